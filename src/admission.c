@@ -0,0 +1,152 @@
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include "admission.h"
+#include "metrics.h"
+
+// 주소 하나의 상태. IPv4 주소는 IPv4-mapped IPv6 형태로 저장해 듀얼 스택 소켓과 같은 키를 씁니다.
+typedef struct {
+    unsigned char key[16];
+    int used;
+    int64_t tat_ns;     // 다음 연결을 받을 수 있는 이론상 시각 (단조 시계)
+} AddressSlot;
+
+static pthread_mutex_t admission_mutex = PTHREAD_MUTEX_INITIALIZER;
+static AddressSlot slots[ADMISSION_SLOTS];
+static size_t slots_used = 0;
+static int64_t global_tat_ns = 0;
+
+// 한도는 락 없이 읽어 제한이 없을 때는 락을 잡지 않습니다.
+static atomic_llong global_rate = 0;
+static atomic_llong address_rate = 0;
+static atomic_int burst = ADMISSION_DEFAULT_BURST;
+static atomic_ullong rejected_global = 0, rejected_address = 0, addresses_forgotten = 0;
+
+void admission_set_rates(long long global_per_second, long long per_address_per_second) {
+    pthread_mutex_lock(&admission_mutex);
+    atomic_store(&global_rate, global_per_second > 0 ? global_per_second : 0);
+    atomic_store(&address_rate, per_address_per_second > 0 ? per_address_per_second : 0);
+    // 한도를 바꾸면 지금부터 새 한도로 계산
+    global_tat_ns = 0;
+    for (size_t i = 0; i < ADMISSION_SLOTS; i++) slots[i].tat_ns = 0;
+    pthread_mutex_unlock(&admission_mutex);
+}
+
+void admission_get_rates(long long *global_per_second, long long *per_address_per_second) {
+    *global_per_second = atomic_load(&global_rate);
+    *per_address_per_second = atomic_load(&address_rate);
+}
+
+void admission_set_burst(int connections) {
+    atomic_store(&burst, connections > 0 ? connections : 1);
+}
+
+// rate에서 연결 하나를 더 받아도 되는지 (GCRA). 받을 수 있으면 다음 시각을 *next에 넣고 1 반환
+static int conforms(int64_t tat, int64_t now, long long rate, int allowance, int64_t *next) {
+    int64_t interval = 1000000000LL / rate;
+    int64_t start = tat > now ? tat : now;
+    if (start - now > interval * (allowance - 1)) return 0;
+    *next = start + interval;
+    return 1;
+}
+
+static int address_key(const struct sockaddr_storage *addr, unsigned char key[16]) {
+    if (addr->ss_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in*)addr;
+        memset(key, 0, 10);
+        key[10] = key[11] = 0xff;
+        memcpy(key + 12, &in->sin_addr, 4);
+        return 0;
+    }
+    if (addr->ss_family == AF_INET6) {
+        memcpy(key, &((const struct sockaddr_in6*)addr)->sin6_addr, 16);
+        return 0;
+    }
+    return -1;
+}
+
+// 주소의 칸을 찾거나 새로 배정 (admission_mutex를 잡은 상태에서 호출)
+// 살펴본 칸이 모두 차 있으면 가장 오래 조용했던(다음 허용 시각이 가장 이른) 주소를 잊습니다.
+static AddressSlot *address_slot(const unsigned char key[16], int64_t now) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (int i = 0; i < 16; i++) {
+        hash ^= key[i];
+        hash *= 1099511628211ULL;
+    }
+
+    AddressSlot *victim = NULL;
+    for (int i = 0; i < ADMISSION_PROBES; i++) {
+        AddressSlot *slot = &slots[(hash + i) & (ADMISSION_SLOTS - 1)];
+        if (slot->used && memcmp(slot->key, key, 16) == 0) return slot;
+        if (!slot->used) {
+            if (!victim || victim->used) victim = slot;
+        } else if (!victim || (victim->used && slot->tat_ns < victim->tat_ns)) {
+            victim = slot;
+        }
+    }
+    if (victim->used) {
+        // 아직 한도를 쓰고 있던 주소를 잊으면 그 주소는 처음부터 다시 계산됨 (STATS에서 칸 부족을 알 수 있도록 셈)
+        if (victim->tat_ns > now) addresses_forgotten++;
+    } else {
+        victim->used = 1;
+        slots_used++;
+    }
+    memcpy(victim->key, key, 16);
+    victim->tat_ns = 0;
+    return victim;
+}
+
+int admission_allow(const struct sockaddr_storage *addr) {
+    long long global = atomic_load_explicit(&global_rate, memory_order_relaxed);
+    long long per_address = atomic_load_explicit(&address_rate, memory_order_relaxed);
+    unsigned char key[16];
+
+    if (global == 0 && per_address == 0) return 1;
+    int allowance = atomic_load_explicit(&burst, memory_order_relaxed);
+    int64_t now = (int64_t)metrics_now_ns();
+    int64_t global_next = 0, address_next = 0;
+    AddressSlot *slot = NULL;
+
+    pthread_mutex_lock(&admission_mutex);
+    if (per_address > 0 && address_key(addr, key) == 0) {
+        slot = address_slot(key, now);
+        if (!conforms(slot->tat_ns, now, per_address, allowance, &address_next)) {
+            pthread_mutex_unlock(&admission_mutex);
+            rejected_address++;
+            return 0;
+        }
+    }
+    if (global > 0 && !conforms(global_tat_ns, now, global, allowance, &global_next)) {
+        pthread_mutex_unlock(&admission_mutex);
+        rejected_global++;
+        return 0;
+    }
+    // 두 한도를 모두 지킬 때만 소비 (거절된 연결이 다른 쪽 한도를 깎지 않도록)
+    if (slot) slot->tat_ns = address_next;
+    if (global > 0) global_tat_ns = global_next;
+    pthread_mutex_unlock(&admission_mutex);
+    return 1;
+}
+
+void admission_reject(int fd) {
+    struct linger abort_close = { .l_onoff = 1, .l_linger = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &abort_close, sizeof(abort_close));
+    close(fd);
+}
+
+void admission_write_stats(FILE *out) {
+    pthread_mutex_lock(&admission_mutex);
+    size_t tracked = slots_used;
+    pthread_mutex_unlock(&admission_mutex);
+
+    fprintf(out, "admission_rate_limit %lld\n", atomic_load(&global_rate));
+    fprintf(out, "admission_rate_limit_per_address %lld\n", atomic_load(&address_rate));
+    fprintf(out, "admission_burst %d\n", atomic_load(&burst));
+    fprintf(out, "admission_rejected_total{reason=\"global\"} %llu\n", atomic_load(&rejected_global));
+    fprintf(out, "admission_rejected_total{reason=\"address\"} %llu\n", atomic_load(&rejected_address));
+    fprintf(out, "admission_addresses_tracked %zu\n", tracked);
+    fprintf(out, "admission_addresses_forgotten_total %llu\n", atomic_load(&addresses_forgotten));
+}
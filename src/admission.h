@@ -0,0 +1,32 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdio.h>
+#include <sys/socket.h>
+
+// --- 접속 허용 제어 (서버) ---
+// 네트워크가 끊겼다 돌아온 뒤 클라이언트가 한꺼번에 다시 접속할 때, accept한 연결을 서버 전체 속도와
+// 주소별 속도로 제한합니다. 한도를 넘은 연결은 핸드셰이크를 시작하기 전에 RST로 바로 끊어
+// (TIME_WAIT와 연결 상태를 남기지 않음) 허용한 연결의 처리가 밀리지 않게 합니다.
+// 속도 제한은 GCRA로 계산하며, ratelimit.c와 달리 거절한 연결은 한도를 소비하지 않습니다.
+// 여러 리액터가 동시에 호출해도 됩니다.
+
+#define ADMISSION_SLOTS 4096            // 주소별 상태를 기억하는 칸 수 (가득 차면 가장 오래 조용했던 주소를 잊음)
+#define ADMISSION_PROBES 8              // 주소 하나를 찾을 때 살펴보는 칸 수
+#define ADMISSION_DEFAULT_BURST 32      // 한도와 상관없이 몰아서 받을 수 있는 연결 수
+
+// 초당 연결 수 (0이면 제한 없음). 실행 중에도 바꿀 수 있습니다.
+void admission_set_rates(long long global_per_second, long long per_address_per_second);
+void admission_get_rates(long long *global_per_second, long long *per_address_per_second);
+void admission_set_burst(int burst);
+
+// accept한 연결을 받아도 되면 1, 한도를 넘었으면 0
+int admission_allow(const struct sockaddr_storage *addr);
+
+// 거절한 연결을 바로 끊음 (SO_LINGER 0으로 RST를 보내고 닫음)
+void admission_reject(int fd);
+
+// STATS용 "이름 값" 형식의 지표
+void admission_write_stats(FILE *out);
+
+#endif
@@ -0,0 +1,578 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "protocol.h"
+
+// --- 헤드리스 부하 생성기 / 브로드캐스트 지연 벤치마크 ---
+// GTK 없이 봇 연결 N개를 열어 방에 나누어 넣고, 정해진 속도로 MSG를 보내면서
+// 같은 방의 모든 멤버가 받기까지 걸린 시간을 잽니다. (봇과 서버가 같은 호스트에 있다고 가정)
+//
+// 시나리오
+//   fanout     : N명을 여러 방에 나누어 메시지 전송 (기본)
+//   large-room : N명 모두 한 방 (브로드캐스트 비용이 방 크기에 비례하는지 확인)
+//   storm      : N개 연결을 한꺼번에 열고 닉네임 핸드셰이크까지의 지연과 초당 연결 수 측정
+
+#define BENCH_NICK_SIZE 30
+#define BENCH_ROOM_SIZE 50
+#define BENCH_READ_SIZE (64 * 1024)
+#define BENCH_PENDING_SIZE (4 * 1024)    // 봇 하나가 아직 못 보낸 바이트 한도 (넘으면 메시지 생략)
+#define BENCH_MAX_EVENTS 256
+#define BENCH_TICK_MS 1
+#define BENCH_SETUP_TIMEOUT_S 30
+#define BENCH_DRAIN_MS 2000              // 전송을 멈춘 뒤 남은 브로드캐스트를 기다리는 시간
+#define BENCH_MAX_THREADS 64
+#define BENCH_MARKER ": B "              // 벤치마크 메시지 표시 ("닉네임: B <보낸 시각 ns> ...")
+
+// 지연 히스토그램: 2의 거듭제곱 구간마다 16칸 (오차 약 6%), 값은 나노초
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB_COUNT)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} Histogram;
+
+typedef enum {
+    SCENARIO_FANOUT,
+    SCENARIO_LARGE_ROOM,
+    SCENARIO_STORM
+} Scenario;
+
+typedef enum {
+    BOT_CONNECTING,
+    BOT_HANDSHAKE,  // 닉네임 전송, 환영 메시지 대기
+    BOT_JOINING,    // JOIN_ROOM 전송, 입장 알림 대기
+    BOT_READY,
+    BOT_FAILED
+} BotState;
+
+typedef struct Worker Worker;
+
+typedef struct {
+    Worker *worker;
+    int fd;
+    int index;
+    int room;
+    BotState state;
+    char nickname[BENCH_NICK_SIZE];
+    char entered[BENCH_NICK_SIZE + BENCH_ROOM_SIZE + 40];  // 자신의 입장 알림 문자열
+    FrameDecoder decoder;
+    char pending[BENCH_PENDING_SIZE];
+    size_t pending_length;
+    uint64_t connect_started;
+} Bot;
+
+struct Worker {
+    int id;
+    pthread_t thread;
+    int epfd;
+    Bot *bots;
+    int count;
+    int ready;
+    int finished_setup;                 // 준비 완료 또는 실패한 봇 수
+    int next_sender;                    // 라운드 로빈 송신 위치
+    uint64_t sent;
+    uint64_t skipped;                   // 송신 버퍼가 가득 차 생략한 메시지
+    uint64_t bytes_received;
+    Histogram handshake;
+    Histogram latency;
+};
+
+// 설정 (명령행 옵션)
+static Scenario scenario = SCENARIO_FANOUT;
+static const char *server_host = "127.0.0.1";
+static int server_port = 8080;
+static int client_count = 100;
+static int room_count = 10;
+static double message_rate = 1000;      // 전체 초당 메시지 수
+static double duration_s = 10;
+static int message_size = 64;
+static int thread_count = 2;
+
+static Bot *all_bots;
+static int *room_sizes;                 // 방별 준비된 멤버 수 (기대 수신 횟수 계산용)
+static char nick_prefix[16];
+static struct sockaddr_in server_addr;
+static pthread_barrier_t phase_barrier;
+static atomic_ullong expected_deliveries;
+static atomic_ullong delivered;
+static uint64_t traffic_started;
+static double setup_seconds;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int hist_index(uint64_t value) {
+    if (value < HIST_SUB_COUNT) return (int)value;
+    int msb = 63 - __builtin_clzll(value);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB_COUNT + (int)((value >> (msb - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1));
+}
+
+static uint64_t hist_value(int index) {
+    if (index < HIST_SUB_COUNT) return index;
+    int msb = index / HIST_SUB_COUNT + HIST_SUB_BITS - 1;
+    return (uint64_t)(HIST_SUB_COUNT + index % HIST_SUB_COUNT) << (msb - HIST_SUB_BITS);
+}
+
+static void hist_record(Histogram *h, uint64_t value) {
+    h->counts[hist_index(value)]++;
+    h->total++;
+    if (value > h->max) h->max = value;
+}
+
+static void hist_merge(Histogram *into, const Histogram *from) {
+    for (int i = 0; i < HIST_BUCKETS; i++) into->counts[i] += from->counts[i];
+    into->total += from->total;
+    if (from->max > into->max) into->max = from->max;
+}
+
+static uint64_t hist_percentile(const Histogram *h, double percentile) {
+    uint64_t rank = (uint64_t)(h->total * percentile / 100.0 + 0.5);
+    uint64_t seen = 0;
+    if (rank == 0) rank = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) return hist_value(i);
+    }
+    return h->max;
+}
+
+// 나노초를 읽기 쉬운 단위로
+static const char *format_ns(char *out, size_t out_size, uint64_t ns) {
+    if (ns < 1000000) snprintf(out, out_size, "%.0f us", ns / 1e3);
+    else if (ns < 1000000000) snprintf(out, out_size, "%.2f ms", ns / 1e6);
+    else snprintf(out, out_size, "%.2f s", ns / 1e9);
+    return out;
+}
+
+static void print_histogram(const char *label, const Histogram *h) {
+    char p50[32], p99[32], p999[32], max[32];
+    if (h->total == 0) {
+        printf("  %s: no samples\n", label);
+        return;
+    }
+    printf("  %s: p50 %s, p99 %s, p999 %s, max %s (%llu samples)\n", label,
+           format_ns(p50, sizeof(p50), hist_percentile(h, 50)),
+           format_ns(p99, sizeof(p99), hist_percentile(h, 99)),
+           format_ns(p999, sizeof(p999), hist_percentile(h, 99.9)),
+           format_ns(max, sizeof(max), h->max), (unsigned long long)h->total);
+}
+
+// --- 봇 송수신 ---
+
+static int bot_flush(Bot *bot) {
+    size_t sent = 0;
+    while (sent < bot->pending_length) {
+        ssize_t n = send(bot->fd, bot->pending + sent, bot->pending_length - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) return -1;
+        sent += n;
+    }
+    memmove(bot->pending, bot->pending + sent, bot->pending_length - sent);
+    bot->pending_length -= sent;
+    return 0;
+}
+
+// 프레임 하나를 송신 버퍼에 넣고 보낼 수 있는 만큼 전송. 버퍼가 가득 차면 1 (생략)
+static int bot_send(Bot *bot, uint8_t opcode, const char *payload, size_t length) {
+    if (bot->pending_length + FRAME_HEADER_SIZE + length > BENCH_PENDING_SIZE) return 1;
+    bot->pending_length += frame_encode(bot->pending + bot->pending_length, BENCH_PENDING_SIZE - bot->pending_length,
+                                        opcode, payload, length);
+    return bot_flush(bot);
+}
+
+static void bot_fail(Bot *bot) {
+    if (bot->state == BOT_FAILED) return;
+    if (bot->state != BOT_READY) bot->worker->finished_setup++;
+    else bot->worker->ready--;
+    bot->state = BOT_FAILED;
+    epoll_ctl(bot->worker->epfd, EPOLL_CTL_DEL, bot->fd, NULL);
+    close(bot->fd);
+    bot->fd = -1;
+}
+
+static void bot_ready(Bot *bot) {
+    bot->state = BOT_READY;
+    bot->worker->ready++;
+    bot->worker->finished_setup++;
+}
+
+static int bot_on_frame(const Frame *frame, void *ctx) {
+    Bot *bot = (Bot*)ctx;
+    char text[FRAME_MAX_PAYLOAD + 1];
+
+    if (frame->opcode != OP_TEXT) return 0;
+    memcpy(text, frame->payload, frame->length);
+    text[frame->length] = '\0';
+
+    if (bot->state == BOT_HANDSHAKE) {
+        if (strncmp(text, "[SERVER] Please create", 22) != 0) return -1; // 닉네임 중복, 정원 초과 등
+        hist_record(&bot->worker->handshake, now_ns() - bot->connect_started);
+        if (scenario == SCENARIO_STORM) {
+            bot_ready(bot);
+            return 0;
+        }
+        char room[BENCH_ROOM_SIZE];
+        snprintf(room, sizeof(room), "bench-%s-%d", nick_prefix, bot->room);
+        snprintf(bot->entered, sizeof(bot->entered), "[SERVER] %s has entered room '%s'.", bot->nickname, room);
+        bot->state = BOT_JOINING;
+        return bot_send(bot, OP_JOIN_ROOM, room, strlen(room)) < 0 ? -1 : 0;
+    }
+    if (bot->state == BOT_JOINING) {
+        if (strcmp(text, bot->entered) == 0) bot_ready(bot);
+        return 0;
+    }
+
+    const char *marker = strstr(text, BENCH_MARKER);
+    if (marker) {
+        uint64_t sent_at = strtoull(marker + strlen(BENCH_MARKER), NULL, 10);
+        uint64_t now = now_ns();
+        if (sent_at > 0 && sent_at <= now) hist_record(&bot->worker->latency, now - sent_at);
+        atomic_fetch_add(&delivered, 1);
+    }
+    return 0;
+}
+
+static void bot_on_readable(Bot *bot) {
+    char buffer[BENCH_READ_SIZE];
+    while (bot->state != BOT_FAILED) {
+        ssize_t n = recv(bot->fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0 || frame_decoder_feed(&bot->decoder, buffer, n, bot_on_frame, bot) < 0) {
+            bot_fail(bot);
+            return;
+        }
+        bot->worker->bytes_received += n;
+    }
+}
+
+static void bot_on_writable(Bot *bot) {
+    if (bot->state == BOT_CONNECTING) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(bot->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+            bot_fail(bot);
+            return;
+        }
+        // 프레임 모드 매직 + 닉네임
+        bot->state = BOT_HANDSHAKE;
+        memcpy(bot->pending, PROTO_MAGIC, PROTO_MAGIC_LEN);
+        bot->pending_length = PROTO_MAGIC_LEN;
+        if (bot_send(bot, OP_NICK, bot->nickname, strlen(bot->nickname)) < 0) bot_fail(bot);
+        return;
+    }
+    if (bot_flush(bot) < 0) bot_fail(bot);
+}
+
+static int bot_connect(Worker *worker, Bot *bot) {
+    bot->connect_started = now_ns();
+    bot->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (bot->fd < 0) return -1;
+
+    int one = 1;
+    setsockopt(bot->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(bot->fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS) {
+        close(bot->fd);
+        bot->fd = -1;
+        return -1;
+    }
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET, .data.ptr = bot };
+    if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, bot->fd, &ev) < 0) {
+        close(bot->fd);
+        bot->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void worker_poll(Worker *worker, int timeout_ms) {
+    struct epoll_event events[BENCH_MAX_EVENTS];
+    int n = epoll_wait(worker->epfd, events, BENCH_MAX_EVENTS, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        Bot *bot = events[i].data.ptr;
+        if (events[i].events & (EPOLLOUT | EPOLLERR)) bot_on_writable(bot);
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) bot_on_readable(bot);
+    }
+}
+
+// 준비된 봇 하나를 골라 벤치마크 메시지 전송
+static void worker_send_one(Worker *worker) {
+    char message[FRAME_MAX_PAYLOAD];
+
+    for (int tries = 0; tries < worker->count; tries++) {
+        Bot *bot = &worker->bots[worker->next_sender];
+        worker->next_sender = (worker->next_sender + 1) % worker->count;
+        if (bot->state != BOT_READY) continue;
+
+        int length = snprintf(message, sizeof(message), "%s" BENCH_MARKER "%llu ", bot->nickname,
+                              (unsigned long long)now_ns());
+        while (length < message_size && length < (int)sizeof(message) - 1) message[length++] = 'x';
+        message[length] = '\0';
+
+        int result = bot_send(bot, OP_MSG, message, length);
+        if (result < 0) {
+            bot_fail(bot);
+        } else if (result > 0) {
+            worker->skipped++;
+        } else {
+            worker->sent++;
+            atomic_fetch_add(&expected_deliveries, room_sizes[bot->room]);
+        }
+        return;
+    }
+}
+
+static void *worker_main(void *arg) {
+    Worker *worker = (Worker*)arg;
+
+    // 1. 연결, 핸드셰이크, 방 입장
+    uint64_t setup_started = now_ns();
+    for (int i = 0; i < worker->count; i++) {
+        Bot *bot = &worker->bots[i];
+        if (bot_connect(worker, bot) < 0) {
+            bot->state = BOT_FAILED;
+            worker->finished_setup++;
+        }
+    }
+    while (worker->finished_setup < worker->count &&
+           now_ns() - setup_started < (uint64_t)BENCH_SETUP_TIMEOUT_S * 1000000000ull) {
+        worker_poll(worker, BENCH_TICK_MS);
+    }
+
+    if (pthread_barrier_wait(&phase_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+        // 입장에 실패한 봇은 브로드캐스트를 받지 않으므로 준비된 봇만 셈
+        for (int i = 0; i < client_count; i++) {
+            if (all_bots[i].state == BOT_READY) room_sizes[all_bots[i].room]++;
+        }
+        traffic_started = now_ns();
+    }
+    pthread_barrier_wait(&phase_barrier);
+
+    // 2. 정해진 속도로 메시지 전송 (스레드마다 전체 속도의 1/T)
+    if (scenario != SCENARIO_STORM && worker->ready > 0) {
+        double rate = message_rate / thread_count;
+        uint64_t end = traffic_started + (uint64_t)(duration_s * 1e9);
+        uint64_t now;
+        while ((now = now_ns()) < end) {
+            uint64_t due = (uint64_t)((now - traffic_started) / 1e9 * rate);
+            while (worker->sent + worker->skipped < due) worker_send_one(worker);
+            worker_poll(worker, BENCH_TICK_MS);
+        }
+    }
+
+    // 3. 남은 브로드캐스트 수신 (모든 스레드가 함께 기다림)
+    uint64_t drain_started = now_ns();
+    while (scenario != SCENARIO_STORM &&
+           atomic_load(&delivered) < atomic_load(&expected_deliveries) &&
+           now_ns() - drain_started < BENCH_DRAIN_MS * 1000000ull) {
+        worker_poll(worker, BENCH_TICK_MS);
+    }
+    pthread_barrier_wait(&phase_barrier);
+
+    for (int i = 0; i < worker->count; i++) {
+        if (worker->bots[i].fd >= 0) close(worker->bots[i].fd);
+        frame_decoder_free(&worker->bots[i].decoder);
+    }
+    close(worker->epfd);
+    return NULL;
+}
+
+static const char *scenario_name(Scenario s) {
+    switch (s) {
+    case SCENARIO_LARGE_ROOM: return "large-room";
+    case SCENARIO_STORM: return "storm";
+    default: return "fanout";
+    }
+}
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--scenario=fanout|large-room|storm] [--host=ADDR] [--port=PORT]\n"
+                    "          [--clients=N] [--rooms=N] [--rate=MSGS_PER_SEC] [--duration=SECONDS]\n"
+                    "          [--size=BYTES] [--threads=N]\n", prog);
+}
+
+// 연결 수만큼 파일 디스크립터 한도를 올림
+static void raise_fd_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"scenario", required_argument, NULL, 'S'},
+        {"host", required_argument, NULL, 'a'},
+        {"port", required_argument, NULL, 'p'},
+        {"clients", required_argument, NULL, 'c'},
+        {"rooms", required_argument, NULL, 'r'},
+        {"rate", required_argument, NULL, 'R'},
+        {"duration", required_argument, NULL, 'd'},
+        {"size", required_argument, NULL, 's'},
+        {"threads", required_argument, NULL, 't'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt_ch;
+    int rooms_given = 0;
+
+    while ((opt_ch = getopt_long(argc, argv, "S:a:p:c:r:R:d:s:t:h", long_options, NULL)) != -1) {
+        switch (opt_ch) {
+        case 'S':
+            if (strcmp(optarg, "fanout") == 0) scenario = SCENARIO_FANOUT;
+            else if (strcmp(optarg, "large-room") == 0) scenario = SCENARIO_LARGE_ROOM;
+            else if (strcmp(optarg, "storm") == 0) scenario = SCENARIO_STORM;
+            else {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'a': server_host = optarg; break;
+        case 'p': server_port = atoi(optarg); break;
+        case 'c': client_count = atoi(optarg); break;
+        case 'r': room_count = atoi(optarg); rooms_given = 1; break;
+        case 'R': message_rate = atof(optarg); break;
+        case 'd': duration_s = atof(optarg); break;
+        case 's': message_size = atoi(optarg); break;
+        case 't': thread_count = atoi(optarg); break;
+        default:
+            print_usage(argv[0]);
+            return opt_ch == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (scenario == SCENARIO_LARGE_ROOM) {
+        if (rooms_given && room_count != 1) fprintf(stderr, "large-room uses a single room; ignoring --rooms\n");
+        room_count = 1;
+    }
+    if (client_count < 1 || room_count < 1 || message_rate <= 0 || duration_s <= 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > BENCH_MAX_THREADS) thread_count = BENCH_MAX_THREADS;
+    if (thread_count > client_count) thread_count = client_count;
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(server_port);
+    if (inet_pton(AF_INET, server_host, &server_addr.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid server address: %s\n", server_host);
+        return EXIT_FAILURE;
+    }
+    raise_fd_limit();
+
+    // 실행마다 닉네임/방 이름이 겹치지 않도록 pid를 붙임
+    snprintf(nick_prefix, sizeof(nick_prefix), "%d", (int)getpid() % 100000);
+    room_sizes = calloc(room_count, sizeof(int));
+    Bot *bots = all_bots = calloc(client_count, sizeof(Bot));
+    Worker *workers = calloc(thread_count, sizeof(Worker));
+    if (!room_sizes || !bots || !workers) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < client_count; i++) {
+        bots[i].index = i;
+        bots[i].fd = -1;
+        bots[i].room = i % room_count;
+        snprintf(bots[i].nickname, BENCH_NICK_SIZE, "b%s_%d", nick_prefix, i);
+        frame_decoder_init(&bots[i].decoder);
+    }
+
+    pthread_barrier_init(&phase_barrier, NULL, thread_count);
+    int offset = 0;
+    for (int t = 0; t < thread_count; t++) {
+        Worker *worker = &workers[t];
+        worker->id = t;
+        worker->bots = bots + offset;
+        worker->count = client_count / thread_count + (t < client_count % thread_count ? 1 : 0);
+        offset += worker->count;
+        for (int i = 0; i < worker->count; i++) worker->bots[i].worker = worker;
+        worker->epfd = epoll_create1(0);
+        if (worker->epfd < 0) {
+            perror("epoll_create1 failed");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (scenario == SCENARIO_STORM) {
+        printf("=== storm: %d clients, %s:%d, %d thread%s ===\n", client_count,
+               server_host, server_port, thread_count, thread_count == 1 ? "" : "s");
+    } else {
+        printf("=== %s: %d clients, %d room%s, %.0f msgs/s for %.0f s, %d-byte messages, %s:%d, %d thread%s ===\n",
+               scenario_name(scenario), client_count, room_count, room_count == 1 ? "" : "s", message_rate, duration_s,
+               message_size, server_host, server_port, thread_count, thread_count == 1 ? "" : "s");
+    }
+    fflush(stdout);
+
+    uint64_t started = now_ns();
+    for (int t = 0; t < thread_count; t++) {
+        if (pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]) != 0) {
+            perror("thread creation failed");
+            return EXIT_FAILURE;
+        }
+    }
+    for (int t = 0; t < thread_count; t++) pthread_join(workers[t].thread, NULL);
+    setup_seconds = (traffic_started - started) / 1e9;
+
+    Histogram *handshake = calloc(1, sizeof(Histogram));
+    Histogram *latency = calloc(1, sizeof(Histogram));
+    uint64_t sent = 0, skipped = 0, bytes = 0;
+    int ready = 0;
+    for (int t = 0; t < thread_count; t++) {
+        hist_merge(handshake, &workers[t].handshake);
+        hist_merge(latency, &workers[t].latency);
+        sent += workers[t].sent;
+        skipped += workers[t].skipped;
+        bytes += workers[t].bytes_received;
+        ready += workers[t].ready;
+    }
+
+    int failed = client_count - ready;
+    printf("  setup: %d of %d clients ready in %.2f s (%.0f handshakes/s, %d failed)\n",
+           ready, client_count, setup_seconds, setup_seconds > 0 ? handshake->total / setup_seconds : 0, failed);
+    print_histogram("handshake latency", handshake);
+
+    if (scenario != SCENARIO_STORM) {
+        unsigned long long expected = atomic_load(&expected_deliveries);
+        unsigned long long got = atomic_load(&delivered);
+        printf("  sent %llu msgs (%.0f/s, %llu skipped on backpressure), delivered %llu of %llu (%.0f/s, %.1f MB/s received)\n",
+               (unsigned long long)sent, sent / duration_s, (unsigned long long)skipped, got, expected,
+               got / duration_s, bytes / duration_s / (1024.0 * 1024.0));
+        print_histogram("broadcast latency", latency);
+    }
+
+    int status = (failed > 0 || (scenario != SCENARIO_STORM && atomic_load(&delivered) < atomic_load(&expected_deliveries)))
+                 ? EXIT_FAILURE : EXIT_SUCCESS;
+    free(handshake);
+    free(latency);
+    free(workers);
+    free(bots);
+    free(room_sizes);
+    pthread_barrier_destroy(&phase_barrier);
+    return status;
+}
@@ -9,15 +9,28 @@
 #include <pthread.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <sys/wait.h> // get_external_ip 함수를 위해 
+#include <netdb.h>
 #include <errno.h>    // 에러 디버깅을 위해
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include "protocol.h"
+#include "filexfer.h"
+#include "transfer.h"
 
 #define SERVER_IP ""
 #define CHAT_PORT 8080
 #define BUFFER_SIZE 1024
 #define NICKNAME_SIZE 30
 #define ROOM_NAME_SIZE 50
-#define FILE_TRANSFER_PORT 8081
+#define FILE_TRANSFER_PORT 8081      // 송신용 포트 범위의 기본값 (포트 포워딩 대상)
+#define FILE_TRANSFER_PORT_MAX 8090
+#define TRANSFER_STATUS_INTERVAL_MS 500
+#define TRANSFER_LIST_MAX 16
+#define READ_CHUNK_SIZE (16 * 1024) // 한 번의 recv로 여러 프레임을 읽어들이는 크기
+#define CHAT_INBOX_FRAME_LINES 2000 // 한 프레임에 채팅창에 넣는 최대 줄 수
+#define CHAT_INBOX_HIDDEN_MS 100     // 채팅창이 보이지 않을 때(프레임 클럭이 멈춤) 수신함을 비우는 간격
+#define CHAT_SCROLLBACK_LINES 5000  // 채팅창에 남기는 기본 줄 수
 
 // --- 전역 변수 및 GTK 위젯 ---
 GtkTextView *chat_output;
@@ -25,212 +38,856 @@ GtkEntry *message_entry;
 GtkWidget *main_window;
 char my_nickname[NICKNAME_SIZE] = "";
 int chat_sock_fd = -1;
-char my_external_ip[16] = ""; // 공인 IP 주소를 저장할 전역 변수
+// 서버가 알려 준 이 클라이언트의 주소 (OP_ADDRESS). 받기 전이거나 쓸 수 없는 주소면 파일을 서버 중계로 보냄
+char my_public_ip[PROTO_IP_SIZE] = "";
+pthread_mutex_t address_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t send_mutex = PTHREAD_MUTEX_INITIALIZER; // 프레임이 섞이지 않도록 채팅 소켓 송신을 직렬화
+GtkLabel *transfer_status;
+GAsyncQueue *chat_inbox;            // 채팅창에 표시할 줄 (post_chat_line)
+gint chat_inbox_scheduled = 0;      // 메인 루프에 비우는 콜백이 예약되어 있음
+// 채팅창 줄 수 상한 (MESSENGER_SCROLLBACK_LINES, 0이면 제한 없음)과 잘라낸 줄을 이어 쓸 파일 (MESSENGER_SCROLLBACK_FILE)
+int scrollback_lines = CHAT_SCROLLBACK_LINES;
+FILE *scrollback_file = NULL;
+// 송신용 리스닝 포트 범위 (MESSENGER_XFER_PORTS="8081-8090", "0"이면 커널이 임시 포트를 고름)
+int xfer_port_min = FILE_TRANSFER_PORT;
+int xfer_port_max = FILE_TRANSFER_PORT_MAX;
+// 서버 중계 포트 (MESSENGER_RELAY_PORT). MESSENGER_XFER_RELAY=1이면 공인 IP가 있어도 항상 중계를 사용
+int xfer_relay_port = RELAY_PORT;
+int xfer_force_relay = 0;
+// 분할 전송을 압축해서 주고받을지 (MESSENGER_XFER_COMPRESS=0이면 압축을 제안하지도 받아들이지도 않음)
+int xfer_compress = 1;
+// 받은 파일을 io_uring으로 비동기 기록할지 (MESSENGER_XFER_URING=0이면 항상 동기 pwrite)
+int xfer_uring = 1;
 
 // --- 네트워크 및 파일 전송 관련 함수 선언 ---
 void on_send_button_clicked(GtkWidget *widget, gpointer data);
 void on_file_button_clicked(GtkWidget *widget, gpointer data);
 void connect_and_start_chat(const char *nickname, GtkWidget *parent_window);
 void* receive_thread(void* arg);
-void* file_receive_client_thread(void *arg);
-void* file_send_server_thread(void *arg);
-int get_external_ip(char *ip_buffer, size_t buffer_size); // 외부 IP 획득 함수 선언
+int run_file_receive(Transfer *t, void *arg);
+int run_file_send(Transfer *t, void *arg);
+int send_frame(uint8_t opcode, const char *payload);
+void post_chat_line(char *message);
 
 // --- GTK GUI 업데이트 (메인 스레드 안전) ---
 
-gboolean add_message_to_textview(gpointer data) {
-    const char *message = (const char *)data;
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(chat_output);
-    GtkTextIter iter;
+// 채팅창에 표시할 줄은 어느 스레드에서든 수신함(inbox)에 넣기만 하고, 메인 루프가 화면을 그리기 전에
+// 프레임마다 한 번 모아서 버퍼에 한 번 삽입하고 한 번만 스크롤합니다. (메시지마다 idle 콜백을 만들지 않음)
+// 창이 보이지 않는 동안에는 프레임이 오지 않으므로 CHAT_INBOX_HIDDEN_MS마다 같은 방식으로 비웁니다.
+
+// 채팅창이 상한을 10% 넘으면 오래된 줄을 한 번에 잘라 상한으로 맞춤 (프레임마다 조금씩 지우지 않도록)
+// 버퍼 크기가 일정하게 유지되므로, 오래 켜 두어도 메모리와 삽입/레이아웃 비용이 늘지 않습니다.
+static void trim_scrollback(GtkTextBuffer *buffer) {
+    gint lines = gtk_text_buffer_get_line_count(buffer) - 1; // 마지막 개행 뒤의 빈 줄 제외
+    if (scrollback_lines <= 0 || lines <= scrollback_lines + scrollback_lines / 10) return;
+
+    GtkTextIter start, cut;
+    gtk_text_buffer_get_start_iter(buffer, &start);
+    gtk_text_buffer_get_iter_at_line(buffer, &cut, lines - scrollback_lines);
+    if (scrollback_file) {
+        char *text = gtk_text_buffer_get_text(buffer, &start, &cut, FALSE);
+        fputs(text, scrollback_file);
+        fflush(scrollback_file);
+        g_free(text);
+    }
+    gtk_text_buffer_delete(buffer, &start, &cut);
+}
+
+// 예약된 tick 콜백 (메인 스레드에서만 사용, 0이면 없음)
+static guint chat_inbox_tick = 0;
+
+// 수신함에서 최대 CHAT_INBOX_FRAME_LINES줄을 꺼내 채팅창에 넣음. 한도를 채웠으면(남은 줄이 있으면) TRUE
+static gboolean drain_chat_batch(void) {
+    GString *batch = g_string_new(NULL);
+    char *line;
+    int count = 0;
+
+    // 플래그를 먼저 내리므로, 이후에 들어온 줄은 다음 콜백을 다시 예약합니다.
+    g_atomic_int_set(&chat_inbox_scheduled, 0);
+    while (count < CHAT_INBOX_FRAME_LINES && (line = g_async_queue_try_pop(chat_inbox))) {
+        g_string_append(batch, line);
+        g_string_append_c(batch, '\n');
+        g_free(line);
+        count++;
+    }
 
-    gtk_text_buffer_get_end_iter(buffer, &iter);
-    gtk_text_buffer_insert(buffer, &iter, message, -1);
-    gtk_text_buffer_insert(buffer, &iter, "\n", -1);
+    if (batch->len > 0) {
+        GtkTextBuffer *buffer = gtk_text_view_get_buffer(chat_output);
+        GtkTextIter iter;
+        gtk_text_buffer_get_end_iter(buffer, &iter);
+        gtk_text_buffer_insert(buffer, &iter, batch->str, (gint)batch->len);
+        trim_scrollback(buffer);
+        gtk_text_view_scroll_mark_onscreen(chat_output, gtk_text_buffer_get_mark(buffer, "end"));
+    }
+    g_string_free(batch, TRUE);
 
-    GtkAdjustment *adj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(gtk_widget_get_parent(GTK_WIDGET(chat_output))));
-    gtk_adjustment_set_value(adj, gtk_adjustment_get_upper(adj));
+    // 한 번의 한도를 채웠으면 남은 줄은 다음 콜백에 (입력과 그리기가 밀리지 않도록)
+    if (count == CHAT_INBOX_FRAME_LINES) {
+        g_atomic_int_set(&chat_inbox_scheduled, 1);
+        return TRUE;
+    }
+    return FALSE;
+}
 
-    g_free(data); 
+static gboolean drain_chat_inbox(GtkWidget *widget, GdkFrameClock *clock, gpointer data) {
+    if (drain_chat_batch()) return G_SOURCE_CONTINUE;
+    chat_inbox_tick = 0;
     return G_SOURCE_REMOVE;
 }
 
-// --- 외부 IP 획득 함수 구현 ---
+// 창이 숨겨지거나 최소화되면 프레임 클럭이 멈춰 tick 콜백이 불리지 않으므로, 그동안은 타이머로 비움
+// (그렇지 않으면 수신함이 끝없이 쌓임)
+static gboolean drain_chat_inbox_hidden(gpointer data) {
+    return drain_chat_batch() ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
 
-int get_external_ip(char *ip_buffer, size_t buffer_size) {
-    // curl을 실행하여 외부 IP를 얻고, 결과를 임시 파일에 저장합니다.
-    const char *command = "curl -s icanhazip.com > external_ip.txt";
-    int status = system(command);
+static gboolean chat_output_ticking(void) {
+    GdkWindow *window = main_window ? gtk_widget_get_window(main_window) : NULL;
+    return gtk_widget_get_mapped(GTK_WIDGET(chat_output)) && window &&
+           !(gdk_window_get_state(window) & GDK_WINDOW_STATE_ICONIFIED);
+}
 
-    if (status == -1 || WEXITSTATUS(status) != 0) {
-        fprintf(stderr, "[ERROR] Failed to execute curl command to get external IP. (Status: %d)\n", status);
-        return -1;
+static gboolean schedule_chat_inbox(gpointer data) {
+    if (chat_output_ticking()) {
+        chat_inbox_tick = gtk_widget_add_tick_callback(GTK_WIDGET(chat_output), drain_chat_inbox, NULL, NULL);
+    } else {
+        g_timeout_add(CHAT_INBOX_HIDDEN_MS, drain_chat_inbox_hidden, NULL);
     }
+    return G_SOURCE_REMOVE;
+}
 
-    FILE *fp = fopen("external_ip.txt", "r");
-    if (fp == NULL) {
-        fprintf(stderr, "[ERROR] Failed to open external_ip.txt.\n");
-        remove("external_ip.txt"); 
-        return -1;
-    }
+// 예약된 tick 콜백이 있는데 창이 숨겨졌으면 타이머로 넘김
+static void chat_output_hidden(void) {
+    if (chat_inbox_tick == 0 || chat_output_ticking()) return;
+    gtk_widget_remove_tick_callback(GTK_WIDGET(chat_output), chat_inbox_tick);
+    chat_inbox_tick = 0;
+    g_timeout_add(CHAT_INBOX_HIDDEN_MS, drain_chat_inbox_hidden, NULL);
+}
 
-    if (fgets(ip_buffer, buffer_size, fp) == NULL) {
-        fclose(fp);
-        fprintf(stderr, "[ERROR] Failed to read IP from file.\n");
-        remove("external_ip.txt");
-        return -1;
+static void on_chat_output_unmap(GtkWidget *widget, gpointer data) {
+    chat_output_hidden();
+}
+
+static gboolean on_window_state_event(GtkWidget *widget, GdkEventWindowState *event, gpointer data) {
+    if (event->new_window_state & GDK_WINDOW_STATE_ICONIFIED) chat_output_hidden();
+    return FALSE;
+}
+
+// 채팅창에 한 줄 표시 (아무 스레드에서나 호출, message는 g_malloc으로 만든 문자열이며 소유권을 넘겨받음)
+// 수신함이 비어 있다가 처음 들어온 줄만 메인 루프에 콜백을 예약합니다.
+void post_chat_line(char *message) {
+    g_async_queue_push(chat_inbox, message);
+    if (g_atomic_int_compare_and_exchange(&chat_inbox_scheduled, 0, 1)) {
+        g_idle_add(schedule_chat_inbox, NULL);
     }
-    
-    fclose(fp);
+}
 
-    // IP 주소 끝의 개행 문자(\n) 제거 (필수)
-    ip_buffer[strcspn(ip_buffer, "\n")] = 0; 
+// --- 채팅 서버 송신 (프레임 프로토콜) ---
 
-    // 임시 파일 삭제
-    remove("external_ip.txt");
+static int send_all(int fd, const char *data, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t n = send(fd, data + sent, length - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        sent += n;
+    }
     return 0;
 }
 
-// --- 파일 전송 로직 (일부 생략) ---
+// 명령 하나를 [길이][opcode][페이로드] 프레임으로 전송
+int send_frame(uint8_t opcode, const char *payload) {
+    char frame[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+    size_t length = frame_encode(frame, sizeof(frame), opcode, payload, strlen(payload));
+    if (length == 0 || chat_sock_fd == -1) return -1;
+
+    // 프레임을 쓰는 동안(락을 기다리는 동안 포함) 파일 스트림이 양보합니다.
+    xfer_chat_begin();
+    pthread_mutex_lock(&send_mutex);
+    int result = send_all(chat_sock_fd, frame, length);
+    pthread_mutex_unlock(&send_mutex);
+    xfer_chat_end();
+    return result;
+}
+
+// --- 공인 주소 (서버가 본 주소) ---
+
+// 서버의 OP_ADDRESS("IP:Port")를 받아 저장. 수신 스레드에서 호출되며, 파일을 보낼 때 읽어 갑니다.
+static void set_public_address(char *payload) {
+    char *cursor = payload;
+    char *ip = proto_next_field(&cursor);
+    char status_msg[PROTO_IP_SIZE + 64];
+
+    if (!ip || strlen(ip) >= PROTO_IP_SIZE) return;
+    pthread_mutex_lock(&address_mutex);
+    snprintf(my_public_ip, sizeof(my_public_ip), "%s", ip);
+    pthread_mutex_unlock(&address_mutex);
+    snprintf(status_msg, sizeof(status_msg), "[SERVER] Public address reported by server: %s", ip);
+    post_chat_line(g_strdup(status_msg));
+}
+
+// 다른 클라이언트가 직접 접속할 수 있는 주소인지 (루프백이면 상대가 접속할 수 없음)
+static int public_address(char *ip, size_t ip_size) {
+    pthread_mutex_lock(&address_mutex);
+    snprintf(ip, ip_size, "%s", my_public_ip);
+    pthread_mutex_unlock(&address_mutex);
+    return ip[0] != '\0' && strncmp(ip, "127.", 4) != 0 && strcmp(ip, "::1") != 0;
+}
+
+// --- 파일 전송 로직 ---
+// 송신/수신은 전송 관리자(src/transfer.c)의 작업 스레드에서 실행되며, 번호로 진행률 조회와 취소가 가능합니다.
+
+// 전송 번호를 붙여 채팅창에 상태 메시지 표시
+static void post_transfer_message(Transfer *t, const char *format, ...) {
+    char text[BUFFER_SIZE + 200];
+    va_list ap;
+
+    va_start(ap, format);
+    vsnprintf(text, sizeof(text), format, ap);
+    va_end(ap);
+    post_chat_line(g_strdup_printf("[SERVER] [#%d] %s", t->id, text));
+}
 
 typedef struct {
-    char target_ip[16];
-    int port;
+    int listen_sock;        // FILE_REQ 전에 미리 열어 둔 송신용 리스닝 소켓 (중계 모드에서는 -1)
+    int port;               // 리스닝 포트 또는 서버 중계 포트
     char filepath[BUFFER_SIZE];
+    char relay_token[RELAY_TOKEN_LEN + 1];  // 비어 있으면 직접 연결
+    int streams;            // 중계 모드에서 미리 열어 둘 데이터 연결 수
 } FileSendArgs;
 
-void* file_send_server_thread(void *arg) {
+static void file_send_args_dispose(void *arg) {
     FileSendArgs *args = (FileSendArgs*)arg;
-    int listen_sock, data_sock;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    int fd = -1;
-    ssize_t read_bytes, sent_bytes;
-    char file_buffer[BUFFER_SIZE];
-    
-    if ((fd = open(args->filepath, O_RDONLY)) < 0) {
-        g_idle_add(add_message_to_textview, g_strdup("[SERVER] Failed to open file for sending."));
-        goto cleanup;
+    if (args->listen_sock >= 0) close(args->listen_sock);
+    free(args);
+}
+
+// 송신 세션: 한 파일을 받으려는 수신자의 여러 데이터 스트림이 공유합니다.
+typedef struct {
+    Transfer *transfer;     // 보낸 바이트 수(progress)와 취소 여부
+    int fd;
+    off_t filesize;
+    pthread_mutex_t lock;
+    pthread_cond_t idle;    // 활성 스트림이 0이 되거나 전송이 끝나면 알림
+    int active;             // 진행 중인 스트림 수
+    int stream_count;       // 지금까지 연결된 스트림 수
+    int finished;           // 수신자가 모든 범위를 받았다고 알림 (또는 기존 단일 스트림 전송 완료)
+    XferMethod method;
+    double started;         // 첫 범위 전송을 시작한 시각
+    double ended;           // 완료 시각
+} SendSession;
+
+typedef struct {
+    SendSession *session;
+    int sock;
+    int relay;              // 서버 중계 연결: 짝지어질 때까지 기다리고, 소켓은 세션이 닫음
+} SendStream;
+
+static void send_session_begin(SendSession *session) {
+    pthread_mutex_lock(&session->lock);
+    if (session->started == 0) session->started = xfer_now();
+    pthread_mutex_unlock(&session->lock);
+}
+
+static void send_session_end(SendSession *session, XferMethod method, int finished) {
+    pthread_mutex_lock(&session->lock);
+    session->method = method;
+    session->ended = xfer_now();
+    if (finished) {
+        session->finished = 1;
+        pthread_cond_broadcast(&session->idle);
     }
+    pthread_mutex_unlock(&session->lock);
+}
 
-    if ((listen_sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        g_idle_add(add_message_to_textview, g_strdup("[SERVER] Failed to create file transfer socket."));
-        goto cleanup;
+// 수신자의 범위 요청마다 해당 범위를 zero-copy(또는 압축, 해시를 요청받으면 읽으면서 해시)로 전송. 길이 0 요청은 수신 완료 통지
+static void serve_range_requests(SendSession *session, int sock) {
+    XferProgress *progress = &session->transfer->progress;
+    XferMethod method;
+    off_t offset, length, sent;
+    uint64_t flags, hash = 0;
+    int result;
+
+    while (xfer_recv_request(sock, &offset, &length, &flags) == 0) {
+        if (length == 0) {
+            send_session_end(session, session->method, 1);
+            break;
+        }
+        if (offset > session->filesize || length > session->filesize - offset) break;
+        uint64_t *want_hash = (flags & XFER_REQUEST_CHECKSUM) ? &hash : NULL;
+        send_session_begin(session);
+        if (flags & XFER_REQUEST_COMPRESSED) {
+            // 수신자가 압축을 요청하면 사용자 공간에서 블록 단위로 압축 (zero-copy 대신 전송량을 줄임)
+            method = XFER_DEFLATE;
+            result = xfer_send_range_compressed(sock, session->fd, offset, length, &sent, progress, want_hash);
+        } else {
+            // 해시를 요청받으면 읽으면서 해시하는 복사 경로로 보냄 (보낸 뒤 다시 읽지 않음)
+            result = xfer_send_range(sock, session->fd, offset, length, &method, &sent, progress, want_hash);
+        }
+        // 수신자가 해시를 요청했으면 범위 뒤에 덧붙임
+        if (result == 0 && want_hash) result = xfer_send_checksum(sock, hash);
+        send_session_end(session, method, 0);
+        if (result < 0) break;
     }
-    
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(args->port);
-    
-    int opt = 1;
-    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+}
 
-    // 이 bind는 클라이언트 A의 임시 파일 서버 소켓이므로, 
-    // 모든 인터페이스(INADDR_ANY)에 바인딩되어야 외부에서 접속 가능합니다.
-    server_addr.sin_addr.s_addr = INADDR_ANY; 
+// 데이터 스트림 하나
+void* file_send_stream_thread(void *arg) {
+    SendStream *stream = (SendStream*)arg;
+    SendSession *session = stream->session;
+    XferProgress *progress = &session->transfer->progress;
+    struct pollfd pfd = { .fd = stream->sock, .events = POLLIN };
+    XferMethod method;
+    off_t sent;
+
+    if (stream->relay) {
+        // 서버가 수신자의 연결과 짝지어 주면 직접 연결과 같은 방식으로 범위 요청을 처리
+        if (xfer_relay_wait(stream->sock, XFER_ACCEPT_TIMEOUT_S, progress) == 0) {
+            pthread_mutex_lock(&session->lock);
+            int first = session->stream_count++ == 0;
+            pthread_mutex_unlock(&session->lock);
+            if (first) post_transfer_message(session->transfer, "Receiver connected through the relay. Starting file transfer...");
+            serve_range_requests(session, stream->sock);
+        }
+    } else if (poll(&pfd, 1, XFER_LEGACY_WAIT_MS) == 0) {
+        // 요청을 보내지 않는 기존 수신자: 파일 전체를 한 스트림으로 전송
+        send_session_begin(session);
+        int result = xfer_send_range(stream->sock, session->fd, 0, session->filesize, &method, &sent, progress, NULL);
+        send_session_end(session, method, result == 0);
+    } else {
+        serve_range_requests(session, stream->sock);
+    }
 
-    if (bind(listen_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 || listen(listen_sock, 1) < 0) {
-        char err_msg[100];
-        snprintf(err_msg, sizeof(err_msg), "[SERVER] Failed to bind/listen for file transfer: %s", strerror(errno));
-        g_idle_add(add_message_to_textview, g_strdup(err_msg));
-        close(listen_sock);
-        goto cleanup;
+    if (!stream->relay) {
+        transfer_untrack_fd(session->transfer, stream->sock);
+        close(stream->sock);
     }
-    
-    g_idle_add(add_message_to_textview, g_strdup("[SERVER] Waiting for receiver to connect..."));
+    pthread_mutex_lock(&session->lock);
+    if (--session->active == 0) pthread_cond_signal(&session->idle);
+    pthread_mutex_unlock(&session->lock);
+    free(stream);
+    return NULL;
+}
+
+// 수신자가 여는 스트림마다 스레드를 붙임. 첫 연결은 XFER_ACCEPT_TIMEOUT_S까지 기다리고,
+// 모든 스트림이 끊긴 채로 XFER_RESUME_WAIT_S가 지나면 수신자가 중단된 것으로 보고 포기합니다.
+// (수신자는 매니페스트로 다음 전송에서 이어받음)
+static void serve_send_session(SendSession *session, int listen_sock) {
+    struct sockaddr_storage client_addr;
+    socklen_t client_len;
+    int connected = 0;
+    double waiting_since = xfer_now(), last_active = 0;
+
+    while (!transfer_cancelled(session->transfer)) {
+        pthread_mutex_lock(&session->lock);
+        int finished = session->finished;
+        int active = session->active;
+        pthread_mutex_unlock(&session->lock);
+        if (finished) break;
+        if (active > 0) last_active = xfer_now();
+        if (connected && active == 0 && xfer_now() - last_active > XFER_RESUME_WAIT_S) break;
+        if (!connected && xfer_now() - waiting_since > XFER_ACCEPT_TIMEOUT_S) break;
+
+        struct pollfd pfd = { .fd = listen_sock, .events = POLLIN };
+        if (poll(&pfd, 1, 500) <= 0) continue;
+
+        client_len = sizeof(client_addr);
+        int data_sock = accept(listen_sock, (struct sockaddr*)&client_addr, &client_len);
+        if (data_sock < 0) continue;
+        xfer_tune_data_socket(data_sock);
+
+        SendStream *stream = malloc(sizeof(SendStream));
+        pthread_t tid;
+        if (!stream || transfer_track_fd(session->transfer, data_sock) < 0) {
+            close(data_sock);
+            free(stream);
+            continue;
+        }
+        stream->session = session;
+        stream->sock = data_sock;
+        stream->relay = 0;
+
+        pthread_mutex_lock(&session->lock);
+        session->active++;
+        session->stream_count++;
+        pthread_mutex_unlock(&session->lock);
+        if (pthread_create(&tid, NULL, file_send_stream_thread, stream) != 0) {
+            transfer_untrack_fd(session->transfer, data_sock);
+            close(data_sock);
+            free(stream);
+            pthread_mutex_lock(&session->lock);
+            session->active--;
+            session->stream_count--;
+            pthread_mutex_unlock(&session->lock);
+            continue;
+        }
+        pthread_detach(tid);
 
-    data_sock = accept(listen_sock, (struct sockaddr*)&client_addr, &client_len);
-    if (data_sock < 0) {
-        g_idle_add(add_message_to_textview, g_strdup("[SERVER] File transfer accept failed."));
-        close(listen_sock);
-        goto cleanup;
+        if (!connected) {
+            connected = 1;
+            last_active = xfer_now();
+            post_transfer_message(session->transfer, "Receiver connected. Starting file transfer...");
+        }
     }
-    
-    g_idle_add(add_message_to_textview, g_strdup("[SERVER] Receiver connected. Starting file transfer..."));
 
-    while ((read_bytes = read(fd, file_buffer, BUFFER_SIZE)) > 0) {
-        if ((sent_bytes = send(data_sock, file_buffer, read_bytes, 0)) != read_bytes) {
-             g_idle_add(add_message_to_textview, g_strdup("[SERVER] File transfer error during send."));
-             break;
+    // 남은 스트림이 끝날 때까지 기다림
+    pthread_mutex_lock(&session->lock);
+    while (session->active > 0) {
+        pthread_cond_wait(&session->idle, &session->lock);
+    }
+    pthread_mutex_unlock(&session->lock);
+}
+
+// 채팅 서버의 중계 포트에 데이터 연결을 열고 토큰/역할을 알림. 취소 대상으로 등록하며 실패 시 -1
+static int connect_to_relay(Transfer *t, int port, const char *token, char role) {
+    struct sockaddr_storage relay_addr;
+    socklen_t addr_len = sizeof(relay_addr);
+
+    // 중계 서버는 채팅 서버와 같은 주소에 있습니다. (IPv4/IPv6 모두)
+    if (getpeername(chat_sock_fd, (struct sockaddr*)&relay_addr, &addr_len) < 0) return -1;
+    if (relay_addr.ss_family == AF_INET6) ((struct sockaddr_in6*)&relay_addr)->sin6_port = htons(port);
+    else ((struct sockaddr_in*)&relay_addr)->sin_port = htons(port);
+
+    int data_sock = socket(relay_addr.ss_family, SOCK_STREAM, 0);
+    if (data_sock < 0) return -1;
+    xfer_tune_data_socket(data_sock);
+    if (transfer_track_fd(t, data_sock) < 0) {
+        close(data_sock);
+        return -1;
+    }
+    if (connect(data_sock, (struct sockaddr*)&relay_addr, addr_len) < 0 ||
+        xfer_relay_hello(data_sock, token, role) < 0) {
+        int saved_errno = errno;
+        transfer_untrack_fd(t, data_sock);
+        close(data_sock);
+        errno = saved_errno;
+        return -1;
+    }
+    return data_sock;
+}
+
+// 중계 모드 송신: 수신자가 열 스트림 수만큼 중계 연결을 미리 열어 두고, 서버가 짝지어 준 연결부터 전송.
+// 전송이 끝나면 짝을 찾지 못한 연결도 끊습니다.
+static void serve_relay_session(SendSession *session, const FileSendArgs *args) {
+    Transfer *t = session->transfer;
+    int socks[XFER_MAX_STREAMS];
+    int count = 0;
+    int streams = args->streams > XFER_MAX_STREAMS ? XFER_MAX_STREAMS : args->streams;
+
+    for (int i = 0; i < streams; i++) {
+        int data_sock = connect_to_relay(t, args->port, args->relay_token, RELAY_ROLE_SENDER);
+        if (data_sock < 0) {
+            if (count == 0) post_transfer_message(t, "Failed to connect to the file relay: %s", strerror(errno));
+            break;
+        }
+
+        SendStream *stream = malloc(sizeof(SendStream));
+        pthread_t tid;
+        if (stream) {
+            stream->session = session;
+            stream->sock = data_sock;
+            stream->relay = 1;
+            pthread_mutex_lock(&session->lock);
+            session->active++;
+            pthread_mutex_unlock(&session->lock);
+        }
+        if (!stream || pthread_create(&tid, NULL, file_send_stream_thread, stream) != 0) {
+            if (stream) {
+                pthread_mutex_lock(&session->lock);
+                session->active--;
+                pthread_mutex_unlock(&session->lock);
+            }
+            free(stream);
+            transfer_untrack_fd(t, data_sock);
+            close(data_sock);
+            break;
         }
+        pthread_detach(tid);
+        socks[count++] = data_sock;
     }
 
-    g_idle_add(add_message_to_textview, g_strdup("[SERVER] File sent successfully."));
+    pthread_mutex_lock(&session->lock);
+    while (session->active > 0 && !session->finished) {
+        pthread_cond_wait(&session->idle, &session->lock);
+    }
+    pthread_mutex_unlock(&session->lock);
 
-    close(data_sock);
-    close(listen_sock);
-cleanup:
-    if (fd >= 0) close(fd);
-    if (args) free(args);
-    return NULL;
+    for (int i = 0; i < count; i++) shutdown(socks[i], SHUT_RDWR);
+    pthread_mutex_lock(&session->lock);
+    while (session->active > 0) {
+        pthread_cond_wait(&session->idle, &session->lock);
+    }
+    pthread_mutex_unlock(&session->lock);
+    for (int i = 0; i < count; i++) {
+        transfer_untrack_fd(t, socks[i]);
+        close(socks[i]);
+    }
+}
+
+int run_file_send(Transfer *t, void *arg) {
+    FileSendArgs *args = (FileSendArgs*)arg;
+    int fd = -1;
+    struct stat st;
+    SendSession session;
+    
+    if ((fd = open(args->filepath, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        post_transfer_message(t, "Failed to open file for sending.");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    if (args->listen_sock >= 0 && transfer_track_fd(t, args->listen_sock) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (args->relay_token[0]) {
+        post_transfer_message(t, "Waiting for %s to connect through the server relay...", t->peer);
+    } else {
+        post_transfer_message(t, "Waiting for %s to connect on port %d...", t->peer, args->port);
+    }
+
+    memset(&session, 0, sizeof(session));
+    session.transfer = t;
+    session.fd = fd;
+    session.filesize = st.st_size;
+    session.method = XFER_SENDFILE;
+    pthread_mutex_init(&session.lock, NULL);
+    pthread_cond_init(&session.idle, NULL);
+
+    if (args->relay_token[0]) {
+        serve_relay_session(&session, args);
+    } else {
+        serve_send_session(&session, args->listen_sock);
+        transfer_untrack_fd(t, args->listen_sock);
+    }
+
+    off_t sent_bytes = (off_t)atomic_load(&t->progress.bytes);
+    double elapsed = session.started > 0 ? session.ended - session.started : 0;
+    char rate[32];
+    xfer_format_rate(rate, sizeof(rate), sent_bytes, elapsed);
+    long long wire_bytes = atomic_load(&t->progress.wire_bytes);
+    if (session.finished && wire_bytes > 0) {
+        post_transfer_message(t, "File sent successfully: %lld bytes (%lld on the wire) in %.2f s (%s, %s, %d stream%s).",
+                              (long long)sent_bytes, wire_bytes, elapsed, rate, xfer_method_name(session.method),
+                              session.stream_count, session.stream_count == 1 ? "" : "s");
+    } else if (session.finished) {
+        post_transfer_message(t, "File sent successfully: %lld bytes in %.2f s (%s, %s, %d stream%s).",
+                              (long long)sent_bytes, elapsed, rate, xfer_method_name(session.method),
+                              session.stream_count, session.stream_count == 1 ? "" : "s");
+    } else if (transfer_cancelled(t)) {
+        post_transfer_message(t, "File transfer cancelled after %lld bytes.", (long long)sent_bytes);
+    } else if (session.stream_count == 0) {
+        post_transfer_message(t, "Receiver did not connect. File transfer abandoned.");
+    } else {
+        post_transfer_message(t, "File transfer interrupted after %lld bytes (%s). Send it again to resume.",
+                              (long long)sent_bytes, rate);
+    }
+
+    pthread_cond_destroy(&session.idle);
+    pthread_mutex_destroy(&session.lock);
+    close(fd);
+    return session.finished ? 0 : -1;
 }
 
 
 typedef struct {
-    char sender_ip[16];
+    char sender_ip[PROTO_IP_SIZE];
     int port;
     char filename[BUFFER_SIZE];
     long filesize;
     char sender_nickname[NICKNAME_SIZE];
+    int streams;            // 0: 기존 단일 스트림, 1 이상: 분할 전송 스트림 수
+    char relay_token[RELAY_TOKEN_LEN + 1];  // 비어 있으면 직접 연결, 아니면 port는 서버 중계 포트
+    int compress;           // 송신자가 압축을 제안했고 이쪽도 사용함: 범위를 압축해서 받음
+    int checksum;           // 송신자가 범위마다 해시를 보내 줌: 받으면서 검사
 } FileRecvArgs;
 
-void* file_receive_client_thread(void *arg) {
+// 송신자에게 데이터 연결을 열고 취소 대상으로 등록. 실패 시 -1
+static int connect_to_sender(Transfer *t, const FileRecvArgs *args) {
+    struct addrinfo hints, *addr;
+    char port_str[16];
+
+    if (args->relay_token[0]) {
+        int relay_sock = connect_to_relay(t, args->port, args->relay_token, RELAY_ROLE_RECEIVER);
+        if (relay_sock >= 0 && xfer_relay_wait(relay_sock, XFER_ACCEPT_TIMEOUT_S, &t->progress) < 0) {
+            transfer_untrack_fd(t, relay_sock);
+            close(relay_sock);
+            errno = ECONNREFUSED;
+            return -1;
+        }
+        return relay_sock;
+    }
+
+    // 송신자 주소는 숫자 IPv4/IPv6 (이름 조회 없음)
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    snprintf(port_str, sizeof(port_str), "%d", args->port);
+    if (getaddrinfo(args->sender_ip, port_str, &hints, &addr) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int data_sock = socket(addr->ai_family, SOCK_STREAM, 0);
+    if (data_sock < 0 || transfer_track_fd(t, data_sock) < 0) {
+        if (data_sock >= 0) close(data_sock);
+        freeaddrinfo(addr);
+        return -1;
+    }
+    xfer_tune_data_socket(data_sock);
+    if (connect(data_sock, addr->ai_addr, addr->ai_addrlen) < 0) {
+        int saved_errno = errno;
+        transfer_untrack_fd(t, data_sock);
+        close(data_sock);
+        freeaddrinfo(addr);
+        errno = saved_errno;
+        return -1;
+    }
+    freeaddrinfo(addr);
+    return data_sock;
+}
+
+static void disconnect_from_sender(Transfer *t, int data_sock) {
+    transfer_untrack_fd(t, data_sock);
+    close(data_sock);
+}
+
+// 분할 수신 세션: 모든 스트림이 같은 .part 파일과 매니페스트를 공유합니다.
+typedef struct {
+    Transfer *transfer;
+    const FileRecvArgs *args;
+    int fd;
+    XferManifest manifest;
+    atomic_int mismatches;  // 해시가 맞지 않아 다시 요청한 청크 수
+    atomic_int async_streams; // io_uring으로 기록한 스트림 수
+} RecvSession;
+
+// 수신 스트림 하나: 남은 청크를 하나씩 가져가 요청하고 제 위치에 기록 (io_uring 쓰기 파이프라인)
+void* file_receive_stream_thread(void *arg) {
+    RecvSession *session = (RecvSession*)arg;
+    int data_sock = connect_to_sender(session->transfer, session->args);
+    size_t chunk;
+    off_t offset, length, received;
+
+    if (data_sock < 0) return NULL;
+    XferWriter *writer = xfer_writer_new(session->fd, xfer_uring);
+    if (!writer) {
+        disconnect_from_sender(session->transfer, data_sock);
+        return NULL;
+    }
+    if (xfer_writer_async(writer)) atomic_fetch_add(&session->async_streams, 1);
+
+    const FileRecvArgs *args = session->args;
+    uint64_t flags = (args->compress ? XFER_REQUEST_COMPRESSED : 0) | (args->checksum ? XFER_REQUEST_CHECKSUM : 0);
+    uint64_t hash = 0, expected;
+    uint64_t *want_hash = args->checksum ? &hash : NULL;
+
+    while (xfer_manifest_claim(&session->manifest, &chunk, &offset, &length)) {
+        XferProgress *progress = &session->transfer->progress;
+        int result = xfer_send_request(data_sock, offset, length, flags);
+        if (result == 0 && args->compress) {
+            result = xfer_recv_range_compressed(data_sock, writer, offset, length, &received, progress, want_hash);
+        } else if (result == 0) {
+            result = xfer_recv_range(data_sock, writer, offset, length, &received, progress, want_hash);
+        }
+        if (result == 0 && want_hash) result = xfer_recv_checksum(data_sock, &expected);
+        if (result < 0) {
+            // 다른 스트림(또는 다음 시도)이 처음부터 다시 받도록 청크를 돌려놓음
+            xfer_manifest_release(&session->manifest, chunk);
+            break;
+        }
+        if (want_hash && hash != expected) {
+            // 손상된 청크는 기록하지 않고 다시 받음 (연결은 해시까지 읽어 동기가 맞으므로 계속 사용)
+            xfer_manifest_release(&session->manifest, chunk);
+            int failures = atomic_fetch_add(&session->mismatches, 1) + 1;
+            post_transfer_message(session->transfer, "Chunk %zu failed verification; requesting it again.", chunk);
+            if (failures > XFER_VERIFY_RETRIES) break;
+            continue;
+        }
+        xfer_manifest_complete(&session->manifest, chunk, want_hash ? hash : 0);
+    }
+
+    // 마지막 청크를 받은 스트림이 송신자에게 완료를 알림
+    if (xfer_manifest_finished(&session->manifest)) {
+        xfer_send_request(data_sock, 0, 0, 0);
+    }
+    xfer_writer_free(writer);
+    disconnect_from_sender(session->transfer, data_sock);
+    return NULL;
+}
+
+// 분할 전송 수신: recv_<name>.part 에 받고, 다 받으면 recv_<name> 으로 이름을 바꿈
+static int receive_chunked(Transfer *t, FileRecvArgs *args) {
+    char final_name[BUFFER_SIZE + 5];
+    char part_name[BUFFER_SIZE + 10];
+    char manifest_name[BUFFER_SIZE + 15];
+    RecvSession session;
+    pthread_t tids[XFER_MAX_STREAMS];
+    int started_streams = 0;
+
+    snprintf(final_name, sizeof(final_name), "recv_%s", args->filename);
+    snprintf(part_name, sizeof(part_name), "%s.part", final_name);
+    snprintf(manifest_name, sizeof(manifest_name), "%s.manifest", final_name);
+
+    memset(&session, 0, sizeof(session));
+    session.transfer = t;
+    session.args = args;
+    atomic_init(&session.mismatches, 0);
+    atomic_init(&session.async_streams, 0);
+    if (xfer_manifest_open(&session.manifest, manifest_name, args->filesize, XFER_RANGE_SIZE) < 0) {
+        post_transfer_message(t, "Failed to create transfer manifest.");
+        return -1;
+    }
+
+    // 이어받는 경우에는 이미 받은 범위를 지우지 않음
+    int flags = O_RDWR | O_CREAT | (session.manifest.resumed_count > 0 ? 0 : O_TRUNC);
+    if ((session.fd = open(part_name, flags, 0644)) < 0) {
+        post_transfer_message(t, "Failed to create file for receiving.");
+        xfer_manifest_close(&session.manifest);
+        return -1;
+    }
+    if (session.manifest.resumed_count > 0) {
+        // 이전 시도에서 받은 청크 중 해시가 기록된 것만 다시 확인 (끊길 때 덜 쓰인 청크 등)
+        size_t damaged = xfer_manifest_verify(&session.manifest, session.fd);
+        post_transfer_message(t, "Resuming '%s': %zu of %zu chunks already received.",
+                              args->filename, session.manifest.resumed_count, session.manifest.chunk_count);
+        if (damaged > 0) {
+            post_transfer_message(t, "%zu previously received chunk%s failed verification and will be received again.",
+                                  damaged, damaged == 1 ? "" : "s");
+        }
+    }
+
+    // 남은 청크 수보다 많은 스트림은 열지 않음 (빈 파일도 완료 통지를 위해 스트림 하나는 엶)
+    size_t remaining = session.manifest.chunk_count - session.manifest.done_count;
+    int streams = args->streams > XFER_MAX_STREAMS ? XFER_MAX_STREAMS : args->streams;
+    if ((size_t)streams > remaining) streams = remaining > 0 ? (int)remaining : 1;
+
+    double started = xfer_now();
+    for (int i = 0; i < streams; i++) {
+        if (pthread_create(&tids[started_streams], NULL, file_receive_stream_thread, &session) == 0) {
+            started_streams++;
+        }
+    }
+    for (int i = 0; i < started_streams; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    double elapsed = xfer_now() - started;
+
+    close(session.fd);
+    int finished = xfer_manifest_finished(&session.manifest);
+    size_t done_count = session.manifest.done_count;
+    size_t chunk_count = session.manifest.chunk_count;
+    // 모든 청크의 해시가 송신자와 맞았을 때만 검증된 것으로 표시 (해시 없이 받은 청크가 있으면 크기만 확인)
+    int verified = args->checksum && session.manifest.hashed_count == chunk_count;
+    xfer_manifest_close(&session.manifest);
+
+    char rate[32];
+    xfer_format_rate(rate, sizeof(rate), (off_t)atomic_load(&t->progress.bytes), elapsed);
+    if (finished && rename(part_name, final_name) == 0) {
+        unlink(manifest_name);
+        long long wire_bytes = atomic_load(&t->progress.wire_bytes);
+        char wire_note[64] = "";
+        if (wire_bytes > 0) snprintf(wire_note, sizeof(wire_note), ", %lld bytes on the wire", wire_bytes);
+        post_transfer_message(t, "File received successfully as %s (%s, %d stream%s%s%s%s).",
+                              final_name, rate, started_streams, started_streams == 1 ? "" : "s", wire_note,
+                              verified ? ", verified " XFER_HASH_NAME : "",
+                              atomic_load(&session.async_streams) > 0 ? ", io_uring" : "");
+        return 0;
+    }
+    if (finished) {
+        post_transfer_message(t, "File received but could not be renamed to %s.", final_name);
+    } else if (transfer_cancelled(t)) {
+        post_transfer_message(t, "File transfer cancelled: %zu of %zu chunks kept for resuming.", done_count, chunk_count);
+    } else {
+        post_transfer_message(t, "File transfer interrupted: %zu of %zu chunks received. It will resume on the next send.",
+                              done_count, chunk_count);
+    }
+    return -1;
+}
+
+int run_file_receive(Transfer *t, void *arg) {
     FileRecvArgs *args = (FileRecvArgs*)arg;
     int data_sock = -1;
-    struct sockaddr_in server_addr;
     int fd = -1;
-    ssize_t recv_bytes;
-    char file_buffer[BUFFER_SIZE];
+    ssize_t recv_bytes = 1;
     long received_size = 0;
+    int write_failed = 0, write_errno = 0;
+
+    if (args->streams > 0) {
+        post_transfer_message(t, "Connecting to sender. Receiving file...");
+        return receive_chunked(t, args);
+    }
     
+    // 기존 단일 스트림 송신자: 해시가 없으므로 크기만 확인. 다 받기 전에는 .part 이름으로 둠
     char recv_filename[BUFFER_SIZE + 5];
+    char part_name[BUFFER_SIZE + 10];
+    char manifest_name[BUFFER_SIZE + 15];
     snprintf(recv_filename, sizeof(recv_filename), "recv_%s", args->filename);
+    snprintf(part_name, sizeof(part_name), "%s.part", recv_filename);
+    snprintf(manifest_name, sizeof(manifest_name), "%s.manifest", recv_filename);
 
-    if ((fd = open(recv_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
-        g_idle_add(add_message_to_textview, g_strdup("[SERVER] Failed to create file for receiving."));
-        goto cleanup;
-    }
-
-    if ((data_sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        g_idle_add(add_message_to_textview, g_strdup("[SERVER] Failed to create file receive socket."));
-        goto cleanup;
-    }
-    
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(args->port);
-    if (inet_pton(AF_INET, args->sender_ip, &server_addr.sin_addr) <= 0) {
-        g_idle_add(add_message_to_textview, g_strdup("[SERVER] Invalid sender IP address."));
-        close(data_sock);
-        goto cleanup;
+    if ((fd = open(part_name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        post_transfer_message(t, "Failed to create file for receiving.");
+        return -1;
     }
+    unlink(manifest_name); // .part를 새로 쓰므로 이전 분할 전송의 기록은 더 이상 맞지 않음
 
-    if (connect(data_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        char err_msg[100];
-        snprintf(err_msg, sizeof(err_msg), "[SERVER] Failed to connect to file sender: %s", strerror(errno));
-        g_idle_add(add_message_to_textview, g_strdup(err_msg));
-        close(data_sock);
-        goto cleanup;
+    XferWriter *writer = xfer_writer_new(fd, xfer_uring);
+    if (!writer || (data_sock = connect_to_sender(t, args)) < 0) {
+        post_transfer_message(t, "Failed to connect to file sender: %s", strerror(errno));
+        xfer_writer_free(writer);
+        close(fd);
+        return -1;
     }
 
-    g_idle_add(add_message_to_textview, g_strdup("[SERVER] Connected to sender. Receiving file..."));
+    post_transfer_message(t, "Connected to sender. Receiving file...");
 
-    while (received_size < args->filesize && (recv_bytes = recv(data_sock, file_buffer, BUFFER_SIZE, 0)) > 0) {
-        write(fd, file_buffer, recv_bytes);
-        received_size += recv_bytes;
+    // 버퍼를 가득 채울 때마다 기록을 맡기고(io_uring이면 비동기), 기록되는 동안 다음 버퍼를 받음
+    while (!write_failed && recv_bytes > 0 && received_size < args->filesize) {
+        size_t capacity, filled = 0;
+        char *buffer = xfer_writer_buffer(writer, &capacity);
+        if (!buffer) {
+            write_failed = 1;
+            write_errno = errno;
+            break;
+        }
+        size_t want = args->filesize - received_size < (long)capacity ? (size_t)(args->filesize - received_size) : capacity;
+        while (filled < want && (recv_bytes = recv(data_sock, buffer + filled, want - filled, 0)) != 0) {
+            if (recv_bytes < 0 && errno == EINTR) continue;
+            if (recv_bytes < 0) break;
+            filled += recv_bytes;
+        }
+        if (xfer_writer_submit(writer, buffer, filled, received_size) < 0) {
+            write_failed = 1;
+            write_errno = errno;
+        }
+        received_size += filled;
+        atomic_fetch_add(&t->progress.bytes, filled);
     }
+    if (xfer_writer_flush(writer) < 0 && !write_failed) {
+        write_failed = 1;
+        write_errno = errno;
+    }
+    xfer_writer_free(writer);
     
-    char success_msg[sizeof(recv_filename) + 50]; 
-    
-    if (received_size == args->filesize) {
-        snprintf(success_msg, sizeof(success_msg), "[SERVER] File received successfully as %s.", recv_filename);
-        g_idle_add(add_message_to_textview, g_strdup(success_msg));
+    int ok = !write_failed && received_size == args->filesize;
+    if (close(fd) < 0) ok = 0;
+    if (ok && rename(part_name, recv_filename) == 0) {
+        post_transfer_message(t, "File received successfully as %s.", recv_filename);
+    } else if (ok) {
+        post_transfer_message(t, "File received but could not be renamed to %s.", recv_filename);
+        ok = 0;
+    } else if (write_failed) {
+        post_transfer_message(t, "Failed to write received file: %s", strerror(write_errno));
+    } else if (transfer_cancelled(t)) {
+        post_transfer_message(t, "File transfer cancelled.");
     } else {
-        g_idle_add(add_message_to_textview, g_strdup("[SERVER] File receive completed but size mismatch or error."));
+        post_transfer_message(t, "File receive completed but size mismatch or error.");
     }
 
-    close(data_sock);
-cleanup:
-    if (fd >= 0) close(fd);
-    if (args) free(args);
-    return NULL;
+    disconnect_from_sender(t, data_sock);
+    return ok ? 0 : -1;
 }
 
 
@@ -273,48 +930,79 @@ void on_file_button_clicked(GtkWidget *widget, gpointer data) {
                 char *filename = strrchr(filepath, '/') ? strrchr(filepath, '/') + 1 : filepath;
                 char request_msg[BUFFER_SIZE];
                 
-                // 전역 변수에 저장된 IP를 사용
-                const char *local_ip = my_external_ip; 
-                int temp_port = FILE_TRANSFER_PORT; 
+                // 서버가 알려 준 주소를 사용 (IPv6이면 FILE_REQ 필드에 대괄호로)
+                char local_ip[PROTO_IP_SIZE];
+                char local_host[PROTO_IP_SIZE + 2];
+                int temp_port = 0;
+                int listen_sock = -1;
                 
-                // IP 주소를 제대로 획득했는지 확인
-                if (strlen(local_ip) == 0 || strcmp(local_ip, "127.0.0.1") == 0) {
-                     g_idle_add(add_message_to_textview, g_strdup("[SERVER] ERROR: External IP not ready. File transfer failed."));
+                // 주소를 아직 받지 못했거나 루프백이면 수신자가 직접 접속할 수 없으므로 서버 중계로 보냄
+                int use_relay = !public_address(local_ip, sizeof(local_ip)) || xfer_force_relay;
+                proto_host_field(local_host, sizeof(local_host), local_ip);
+                FileSendArgs *args = malloc(sizeof(FileSendArgs));
+                char err_msg[100] = "";
+
+                if (!args) {
+                     snprintf(err_msg, sizeof(err_msg), "[SERVER] Memory allocation failed for file send.");
+                } else if (use_relay) {
+                     temp_port = xfer_relay_port;
+                     if (xfer_relay_token(args->relay_token) < 0) {
+                         snprintf(err_msg, sizeof(err_msg), "[SERVER] Failed to create a file relay token.");
+                     }
+                } else {
+                     // 포트 범위에서 빈 포트를 골라 미리 열어 둠 (동시에 여러 파일을 보내도 충돌하지 않음)
+                     args->relay_token[0] = '\0';
+                     listen_sock = xfer_listen(xfer_port_min, xfer_port_max, &temp_port);
+                     if (listen_sock < 0) {
+                         snprintf(err_msg, sizeof(err_msg), "[SERVER] No free file transfer port in %d-%d.", xfer_port_min, xfer_port_max);
+                     }
+                }
+                if (err_msg[0]) {
+                     post_chat_line(g_strdup(err_msg));
+                     free(args);
                      gtk_widget_destroy(target_dialog);
                      gtk_widget_destroy(dialog);
                      g_free(filepath);
                      return;
                 }
-
-                // FILE_REQ:타겟닉네임:파일명:파일크기:송신자IP:송신자Port
-                snprintf(request_msg, BUFFER_SIZE, "FILE_REQ:%s:%s:%ld:%s:%d", 
-                         target_nickname, filename, (long)st.st_size, local_ip, temp_port);
-                
-                send(chat_sock_fd, request_msg, strlen(request_msg), 0);
-                
-                FileSendArgs *args = malloc(sizeof(FileSendArgs));
-                if (!args) {
-                    g_idle_add(add_message_to_textview, g_strdup("[SERVER] Memory allocation failed."));
+                args->listen_sock = listen_sock;
+                args->port = temp_port;
+                args->streams = XFER_DEFAULT_STREAMS;
+                strncpy(args->filepath, filepath, BUFFER_SIZE - 1);
+                args->filepath[BUFFER_SIZE - 1] = '\0';
+
+                // FILE_REQ 프레임: 타겟닉네임:파일명:파일크기:송신자IP:송신자Port:옵션
+                // streams 옵션을 이해하는 수신자는 여러 스트림으로 나누어 받고, 중단되면 이어받습니다.
+                // compress 옵션을 이해하는 수신자는 범위를 압축해서 보내 달라고 요청할 수 있고,
+                // hash 옵션을 이해하는 수신자는 범위마다 해시를 받아 손상된 청크를 다시 받습니다.
+                // 중계 모드에서는 IP/Port 대신 relay 토큰을 보내고, 서버가 중계 포트를 채워 전달합니다.
+                const char *compress_option = xfer_compress ? ",compress=" XFER_CODEC_NAME : "";
+                if (use_relay) {
+                    snprintf(request_msg, BUFFER_SIZE, "%s:%s:%ld:-:0:streams=%d,hash=" XFER_HASH_NAME "%s,relay=%s",
+                             target_nickname, filename, (long)st.st_size, XFER_DEFAULT_STREAMS, compress_option,
+                             args->relay_token);
                 } else {
-                    strncpy(args->filepath, filepath, BUFFER_SIZE - 1);
-                    args->filepath[BUFFER_SIZE - 1] = '\0';
-                    args->port = temp_port;
-                    
-                    pthread_t tid;
-                    if (pthread_create(&tid, NULL, file_send_server_thread, args) != 0) {
-                         g_idle_add(add_message_to_textview, g_strdup("[SERVER] Failed to start file send thread."));
-                         free(args);
-                    } else {
-                        pthread_detach(tid);
-                    }
+                    snprintf(request_msg, BUFFER_SIZE, "%s:%s:%ld:%s:%d:streams=%d,hash=" XFER_HASH_NAME "%s",
+                             target_nickname, filename, (long)st.st_size, local_host, temp_port, XFER_DEFAULT_STREAMS,
+                             compress_option);
                 }
                 
+                // 리스닝 소켓은 이미 열려 있으므로, 전송이 대기열에 있는 동안 수신자가 접속해도 됩니다.
+                send_frame(OP_FILE_REQ, request_msg);
+                
+                int id = transfer_submit(TRANSFER_SEND, filename, target_nickname, st.st_size,
+                                         run_file_send, file_send_args_dispose, args);
                 char status_msg[BUFFER_SIZE];
-                snprintf(status_msg, BUFFER_SIZE, "[SERVER] Request sent to send '%s' (%ld bytes) to %s. Sender IP: %s", filename, (long)st.st_size, target_nickname, local_ip);
-                g_idle_add(add_message_to_textview, g_strdup(status_msg));
+                if (id < 0) {
+                    snprintf(status_msg, BUFFER_SIZE, "[SERVER] Failed to queue file transfer.");
+                } else {
+                    snprintf(status_msg, BUFFER_SIZE, "[SERVER] [#%d] Request sent to send '%s' (%ld bytes) to %s. Sender: %s:%d",
+                             id, filename, (long)st.st_size, target_nickname, use_relay ? "relay" : local_host, temp_port);
+                }
+                post_chat_line(g_strdup(status_msg));
 
             } else {
-                g_idle_add(add_message_to_textview, g_strdup("[SERVER] Failed to get file information."));
+                post_chat_line(g_strdup("[SERVER] Failed to get file information."));
             }
             g_free(filepath);
         }
@@ -323,16 +1011,143 @@ void on_file_button_clicked(GtkWidget *widget, gpointer data) {
     gtk_widget_destroy(dialog);
 }
 
+// 채팅창에 전송 목록 출력 (/transfers)
+static void show_transfer_list(void) {
+    TransferInfo list[TRANSFER_LIST_MAX];
+    size_t count = transfer_list(list, TRANSFER_LIST_MAX);
+
+    if (count == 0) {
+        post_chat_line(g_strdup("[SERVER] No file transfers."));
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        char rate[32], limit[48] = "";
+        xfer_format_rate(rate, sizeof(rate), (off_t)list[i].rate, 1.0);
+        if (list[i].limit > 0) {
+            strcpy(limit, " (limit ");
+            xfer_format_rate(limit + 8, sizeof(limit) - 9, (off_t)list[i].limit, 1.0);
+            strcat(limit, ")");
+        }
+        post_chat_line(g_strdup_printf("[SERVER] #%d %s '%s' %s %s: %lld/%lld bytes, %s%s, %s",
+                   list[i].id, list[i].direction == TRANSFER_SEND ? "send" : "receive", list[i].name,
+                   list[i].direction == TRANSFER_SEND ? "to" : "from", list[i].peer,
+                   (long long)list[i].done, (long long)list[i].total, rate, limit,
+                   transfer_state_name(list[i].state)));
+    }
+}
+
+// 속도 상한(바이트/초)을 "1.2 MB/s" 또는 "unlimited"로 표시
+static void format_limit(char *out, size_t out_size, long long bytes_per_second) {
+    if (bytes_per_second > 0) {
+        xfer_format_rate(out, out_size, (off_t)bytes_per_second, 1.0);
+    } else {
+        snprintf(out, out_size, "unlimited");
+    }
+}
+
+// 파일 전송 속도 상한 (/limit): 인자가 없으면 현재 상한을 보여 주고,
+// "/limit <KB/s>"는 전체 상한, "/limit #N <KB/s>"는 전송 하나의 상한, "/limit default <KB/s>"는 새 전송의 상한. 0은 제한 없음
+static void handle_limit_command(const char *args) {
+    char status_msg[160], global[32], fallback[32], value[32];
+    int id;
+    long long kbps;
+
+    while (*args == ' ') args++;
+    if (*args == '\0') {
+        format_limit(global, sizeof(global), xfer_global_rate());
+        format_limit(fallback, sizeof(fallback), transfer_default_rate());
+        snprintf(status_msg, sizeof(status_msg), "[SERVER] File transfer limit: %s total, %s per new transfer.",
+                 global, fallback);
+    } else if (sscanf(args, "#%d %lld", &id, &kbps) == 2 && kbps >= 0) {
+        format_limit(value, sizeof(value), kbps * 1024);
+        if (transfer_set_rate(id, kbps * 1024) == 0) {
+            snprintf(status_msg, sizeof(status_msg), "[SERVER] [#%d] Transfer limit set to %s.", id, value);
+        } else {
+            snprintf(status_msg, sizeof(status_msg), "[SERVER] No queued or active file transfer #%d.", id);
+        }
+    } else if (sscanf(args, "default %lld", &kbps) == 1 && kbps >= 0) {
+        transfer_set_default_rate(kbps * 1024);
+        format_limit(value, sizeof(value), kbps * 1024);
+        snprintf(status_msg, sizeof(status_msg), "[SERVER] New transfers limited to %s.", value);
+    } else if (sscanf(args, "%lld", &kbps) == 1 && kbps >= 0) {
+        xfer_set_global_rate(kbps * 1024);
+        format_limit(value, sizeof(value), kbps * 1024);
+        snprintf(status_msg, sizeof(status_msg), "[SERVER] File transfers limited to %s in total.", value);
+    } else {
+        snprintf(status_msg, sizeof(status_msg), "[SERVER] Usage: /limit [KB/s | #id KB/s | default KB/s]");
+    }
+    post_chat_line(g_strdup(status_msg));
+}
+
+// 입력창의 로컬 명령 처리 (/transfers, /cancel N, /limit ..., /history 방[:시각]). 명령이면 1
+static int handle_local_command(const char *text) {
+    if (strcmp(text, "/transfers") == 0) {
+        show_transfer_list();
+        return 1;
+    }
+    if (strcmp(text, "/limit") == 0 || strncmp(text, "/limit ", 7) == 0) {
+        handle_limit_command(text + 6);
+        return 1;
+    }
+    if (strncmp(text, "/history ", 9) == 0) {
+        // 서버의 메시지 로그에서 기록을 받아 옴. 더 남았으면 서버가 이어 읽을 HISTORY 요청을 알려 줍니다.
+        if (chat_sock_fd != -1) send_frame(OP_HISTORY, text + 9);
+        return 1;
+    }
+    if (strncmp(text, "/cancel ", 8) == 0) {
+        int id = atoi(text + 8);
+        char status_msg[80];
+        if (transfer_cancel(id) == 0) {
+            snprintf(status_msg, sizeof(status_msg), "[SERVER] [#%d] Cancelling file transfer...", id);
+        } else {
+            snprintf(status_msg, sizeof(status_msg), "[SERVER] No queued or active file transfer #%d.", id);
+        }
+        post_chat_line(g_strdup(status_msg));
+        return 1;
+    }
+    return 0;
+}
+
+// 진행 중/대기 중인 전송을 상태 줄에 표시 (TRANSFER_STATUS_INTERVAL_MS마다)
+gboolean update_transfer_status(gpointer data) {
+    TransferInfo list[TRANSFER_LIST_MAX];
+    size_t count = transfer_list(list, TRANSFER_LIST_MAX);
+    char status[512] = "";
+    size_t used = 0;
+
+    for (size_t i = 0; i < count && used < sizeof(status); i++) {
+        if (list[i].state > TRANSFER_ACTIVE) continue;
+        const char *arrow = list[i].direction == TRANSFER_SEND ? "↑" : "↓";
+        if (list[i].state == TRANSFER_QUEUED) {
+            used += snprintf(status + used, sizeof(status) - used, "%s#%d %s %s queued",
+                             used ? "  " : "", list[i].id, arrow, list[i].name);
+        } else {
+            char rate[32];
+            int percent = list[i].total > 0 ? (int)(list[i].done * 100 / list[i].total) : 100;
+            xfer_format_rate(rate, sizeof(rate), (off_t)list[i].rate, 1.0);
+            used += snprintf(status + used, sizeof(status) - used, "%s#%d %s %s %d%% %s",
+                             used ? "  " : "", list[i].id, arrow, list[i].name, percent, rate);
+        }
+    }
+    gtk_label_set_text(transfer_status, status);
+    return G_SOURCE_CONTINUE;
+}
+
 void on_send_button_clicked(GtkWidget *widget, gpointer data) {
     const gchar *text = gtk_entry_get_text(message_entry);
+
+    if (text[0] == '/' && handle_local_command(text)) {
+        gtk_entry_set_text(message_entry, "");
+        return;
+    }
     
     if (strlen(text) > 0 && chat_sock_fd != -1) {
         
         char full_message[BUFFER_SIZE + NICKNAME_SIZE + 10]; 
         
-        snprintf(full_message, sizeof(full_message), "MSG:%s: %s", my_nickname, text);
+        snprintf(full_message, sizeof(full_message), "%s: %s", my_nickname, text);
 
-        send(chat_sock_fd, full_message, strlen(full_message), 0);
+        send_frame(OP_MSG, full_message);
         
         gtk_entry_set_text(message_entry, ""); 
     }
@@ -340,59 +1155,94 @@ void on_send_button_clicked(GtkWidget *widget, gpointer data) {
 
 // --- 네트워크 스레드 (수신 로직) ---
 
-void* receive_thread(void* arg) {
-    char buffer[BUFFER_SIZE];
-    int bytes_read;
-
-    while (chat_sock_fd != -1 && (bytes_read = recv(chat_sock_fd, buffer, BUFFER_SIZE - 1, 0)) > 0) {
-        buffer[bytes_read] = '\0';
+// FILE_ALERT 페이로드("송신자닉네임:파일명:파일크기:송신자IP:송신자Port[:옵션]")를 받아 수신 스레드 시작
+void start_file_receive(char *alert_token) {
+    char *cursor = alert_token;
+    char *sender_nickname = proto_next_field(&cursor);
+    char *filename = proto_next_field(&cursor);
+    char *filesize_str = proto_next_field(&cursor);
+    char *sender_ip = proto_next_field(&cursor); // IPv6는 대괄호를 벗긴 채로
+    char *port_str = proto_next_field(&cursor);
+    char *options = cursor;
+    
+    if (sender_nickname && filename && filesize_str && sender_ip && port_str) {
         
-        if (strncmp(buffer, "FILE_ALERT:", 11) == 0) {
-            
-            char *alert_token = buffer + 11;
-            char *sender_nickname = strtok(alert_token, ":");
-            char *filename = strtok(NULL, ":");
-            char *filesize_str = strtok(NULL, ":");
-            char *sender_ip = strtok(NULL, ":");
-            char *port_str = strtok(NULL, ":");
-            
-            if (sender_nickname && filename && filesize_str && sender_ip && port_str) {
-                
-                FileRecvArgs *args = malloc(sizeof(FileRecvArgs));
-                if (!args) {
-                    g_idle_add(add_message_to_textview, g_strdup("[SERVER] Memory allocation failed for file receive."));
-                    continue;
-                }
-                
-                strncpy(args->sender_nickname, sender_nickname, NICKNAME_SIZE - 1);
-                args->sender_nickname[NICKNAME_SIZE - 1] = '\0';
-                strncpy(args->filename, filename, BUFFER_SIZE - 1);
-                args->filename[BUFFER_SIZE - 1] = '\0';
-                strncpy(args->sender_ip, sender_ip, 15);
-                args->sender_ip[15] = '\0';
-                args->filesize = atol(filesize_str);
-                args->port = atoi(port_str);
-
-                pthread_t tid;
-                if (pthread_create(&tid, NULL, file_receive_client_thread, args) != 0) {
-                    g_idle_add(add_message_to_textview, g_strdup("[SERVER] Failed to start file receive thread."));
-                    free(args);
-                } else {
-                    pthread_detach(tid);
-                    char alert_msg[BUFFER_SIZE];
-                    snprintf(alert_msg, BUFFER_SIZE, "[SERVER] Receiving file '%s' from %s...", filename, sender_nickname);
-                    g_idle_add(add_message_to_textview, g_strdup(alert_msg));
-                }
-            } else {
-                 g_idle_add(add_message_to_textview, g_strdup("[SERVER] Invalid file alert format received."));
-            }
+        FileRecvArgs *args = malloc(sizeof(FileRecvArgs));
+        if (!args) {
+            post_chat_line(g_strdup("[SERVER] Memory allocation failed for file receive."));
+            return;
+        }
+        
+        strncpy(args->sender_nickname, sender_nickname, NICKNAME_SIZE - 1);
+        args->sender_nickname[NICKNAME_SIZE - 1] = '\0';
+        strncpy(args->filename, filename, BUFFER_SIZE - 1);
+        args->filename[BUFFER_SIZE - 1] = '\0';
+        strncpy(args->sender_ip, sender_ip, PROTO_IP_SIZE - 1);
+        args->sender_ip[PROTO_IP_SIZE - 1] = '\0';
+        args->filesize = atol(filesize_str);
+        args->port = atoi(port_str);
+        args->streams = (int)proto_option_long(options, "streams", 0);
+        if (proto_option_string(options, "relay", args->relay_token, sizeof(args->relay_token)) < 0) {
+            args->relay_token[0] = '\0';
+        } else if (args->streams < 1) {
+            args->streams = 1; // 중계 연결은 항상 범위 요청 방식으로 받음
+        }
+        char codec[16];
+        args->compress = xfer_compress && args->streams > 0 &&
+                         proto_option_string(options, "compress", codec, sizeof(codec)) > 0 &&
+                         strcmp(codec, XFER_CODEC_NAME) == 0;
+        args->checksum = args->streams > 0 &&
+                         proto_option_string(options, "hash", codec, sizeof(codec)) > 0 &&
+                         strcmp(codec, XFER_HASH_NAME) == 0;
+
+        int id = transfer_submit(TRANSFER_RECEIVE, filename, sender_nickname, args->filesize,
+                                 run_file_receive, NULL, args);
+        char alert_msg[BUFFER_SIZE];
+        if (id < 0) {
+            snprintf(alert_msg, BUFFER_SIZE, "[SERVER] Failed to queue file receive.");
         } else {
-            g_idle_add(add_message_to_textview, g_strdup(buffer));
+            snprintf(alert_msg, BUFFER_SIZE, "[SERVER] [#%d] Receiving file '%s' from %s...", id, filename, sender_nickname);
         }
+        post_chat_line(g_strdup(alert_msg));
+    } else {
+         post_chat_line(g_strdup("[SERVER] Invalid file alert format received."));
     }
+}
+
+// 서버에서 온 프레임 하나 처리 (디코더 콜백)
+int handle_server_frame(const Frame *frame, void *ctx) {
+    char payload[FRAME_MAX_PAYLOAD + 1];
+    memcpy(payload, frame->payload, frame->length);
+    payload[frame->length] = '\0';
+
+    if (frame->opcode == OP_FILE_ALERT) {
+        start_file_receive(payload);
+    } else if (frame->opcode == OP_TEXT) {
+        post_chat_line(g_strdup(payload));
+    } else if (frame->opcode == OP_ADDRESS) {
+        set_public_address(payload);
+    }
+    return 0;
+}
+
+void* receive_thread(void* arg) {
+    char buffer[READ_CHUNK_SIZE];
+    int bytes_read;
+    FrameDecoder decoder;
+
+    // TCP가 메시지를 합치거나 나누어도 디코더가 프레임 경계를 복원합니다.
+    frame_decoder_init(&decoder);
+    while (chat_sock_fd != -1 && (bytes_read = recv(chat_sock_fd, buffer, sizeof(buffer), 0)) > 0) {
+        if (frame_decoder_feed(&decoder, buffer, bytes_read, handle_server_frame, NULL) < 0) {
+            post_chat_line(g_strdup("[SERVER] Protocol error from server."));
+            break;
+        }
+    }
+    frame_decoder_free(&decoder);
 
     if (chat_sock_fd != -1) {
-        g_idle_add(add_message_to_textview, g_strdup("[SERVER] Connection lost."));
+        post_chat_line(g_strdup("[SERVER] Connection lost."));
+        xfer_set_chat_socket(-1);
         close(chat_sock_fd);
         chat_sock_fd = -1;
     }
@@ -403,45 +1253,46 @@ void* receive_thread(void* arg) {
 // --- 초기화 및 메인 함수 ---
 
 void connect_and_start_chat(const char *nickname, GtkWidget *parent_window) {
-    struct sockaddr_in server_addr;
-
-    if ((chat_sock_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        fprintf(stderr, "Socket creation error\n");
+    struct addrinfo hints, *addrs, *addr;
+    char port_str[16];
+    int gai_err;
+
+    // SERVER_IP는 IPv4/IPv6 주소나 호스트 이름 (비어 있으면 이 컴퓨터)
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port_str, sizeof(port_str), "%d", CHAT_PORT);
+    if ((gai_err = getaddrinfo(SERVER_IP[0] ? SERVER_IP : NULL, port_str, &hints, &addrs)) != 0) {
+        fprintf(stderr, "Invalid address/ Address not supported: %s\n", gai_strerror(gai_err));
         return;
     }
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(CHAT_PORT);
-
-    if (inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr) <= 0) {
-        fprintf(stderr, "Invalid address/ Address not supported\n");
+    chat_sock_fd = -1;
+    for (addr = addrs; addr; addr = addr->ai_next) {
+        chat_sock_fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (chat_sock_fd < 0) continue;
+        if (connect(chat_sock_fd, addr->ai_addr, addr->ai_addrlen) == 0) break;
         close(chat_sock_fd);
         chat_sock_fd = -1;
+    }
+    freeaddrinfo(addrs);
+    if (chat_sock_fd < 0) {
+        perror("Connection Failed");
         return;
     }
+    // 채팅 연결을 파일 전송보다 우선 (소켓 우선순위, 파일 스트림 양보)
+    xfer_set_chat_socket(chat_sock_fd);
 
-    if (connect(chat_sock_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Connection Failed"); 
+    // 1. 프레임 프로토콜 협상(매직) 후 닉네임 전송
+    // 공인 주소는 기다리지 않습니다: 서버가 등록 직후 OP_ADDRESS로 알려 주며, 그 전의 파일 전송은 중계로 갑니다.
+    if (send_all(chat_sock_fd, PROTO_MAGIC, PROTO_MAGIC_LEN) < 0 || send_frame(OP_NICK, nickname) < 0) {
+        perror("Handshake Failed");
         close(chat_sock_fd);
         chat_sock_fd = -1;
         return;
     }
-
-    // 1. 닉네임 전송
-    send(chat_sock_fd, nickname, strlen(nickname), 0);
     
-    // 2. 공인 IP 획득 및 저장 (연결 성공 후)
-    if (get_external_ip(my_external_ip, sizeof(my_external_ip)) != 0) {
-        g_idle_add(add_message_to_textview, g_strdup("[SERVER] WARNING: Failed to get external IP. File transfers may fail."));
-        // 실패 시 파일 전송을 막기 위해 127.0.0.1이 아닌 빈 문자열 유지
-        my_external_ip[0] = '\0'; 
-    } else {
-        char status_msg[60];
-        snprintf(status_msg, sizeof(status_msg), "[SERVER] External IP registered: %s", my_external_ip);
-        g_idle_add(add_message_to_textview, g_strdup(status_msg));
-    }
-    
-    // 3. 수신 스레드 시작
+    // 2. 수신 스레드 시작
     pthread_t tid;
     if (pthread_create(&tid, NULL, receive_thread, NULL) != 0) {
         fprintf(stderr, "Receive thread creation failed\n");
@@ -451,7 +1302,7 @@ void connect_and_start_chat(const char *nickname, GtkWidget *parent_window) {
     }
     pthread_detach(tid);
 
-    // 4. 방 선택 대화 상자
+    // 3. 방 선택 대화 상자
     GtkWidget *dialog = gtk_dialog_new_with_buttons("Room Selection", GTK_WINDOW(parent_window), GTK_DIALOG_MODAL,
                                                     "Create", 1,
                                                     "Join", 2,
@@ -468,16 +1319,14 @@ void connect_and_start_chat(const char *nickname, GtkWidget *parent_window) {
     const char *room_name = gtk_entry_get_text(GTK_ENTRY(room_entry));
     
     if (strlen(room_name) > 0 && chat_sock_fd != -1) {
-        char cmd[ROOM_NAME_SIZE + 15];
         if (res == 1) {
-            snprintf(cmd, sizeof(cmd), "CREATE_ROOM:%s", room_name);
-            send(chat_sock_fd, cmd, strlen(cmd), 0);
+            send_frame(OP_CREATE_ROOM, room_name);
         } else if (res == 2) {
-            snprintf(cmd, sizeof(cmd), "JOIN_ROOM:%s", room_name);
-            send(chat_sock_fd, cmd, strlen(cmd), 0);
+            send_frame(OP_JOIN_ROOM, room_name);
         }
     } else if (res == GTK_RESPONSE_DELETE_EVENT || res == GTK_RESPONSE_NONE) {
-        g_idle_add(add_message_to_textview, g_strdup("[SERVER] Room selection skipped or cancelled. Disconnecting..."));
+        post_chat_line(g_strdup("[SERVER] Room selection skipped or cancelled. Disconnecting..."));
+        xfer_set_chat_socket(-1);
         close(chat_sock_fd);
         chat_sock_fd = -1;
     }
@@ -501,6 +1350,13 @@ static void activate(GtkApplication *app, gpointer user_data) {
     gtk_text_view_set_editable(chat_output, FALSE);
     gtk_text_view_set_cursor_visible(chat_output, FALSE);
     gtk_container_add(GTK_CONTAINER(scrolled_window), GTK_WIDGET(chat_output));
+    // 새 줄을 넣은 뒤 스크롤할 위치 (오른쪽 gravity라 삽입한 텍스트 뒤로 따라감)
+    GtkTextBuffer *chat_buffer = gtk_text_view_get_buffer(chat_output);
+    GtkTextIter chat_end;
+    gtk_text_buffer_get_end_iter(chat_buffer, &chat_end);
+    gtk_text_buffer_create_mark(chat_buffer, "end", &chat_end, FALSE);
+    g_signal_connect(chat_output, "unmap", G_CALLBACK(on_chat_output_unmap), NULL);
+    g_signal_connect(main_window, "window-state-event", G_CALLBACK(on_window_state_event), NULL);
 
     GtkWidget *hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
     gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, TRUE, 0);
@@ -516,6 +1372,11 @@ static void activate(GtkApplication *app, gpointer user_data) {
     GtkWidget *file_button = gtk_button_new_with_label("File");
     gtk_box_pack_start(GTK_BOX(hbox), file_button, FALSE, FALSE, 0);
     g_signal_connect(file_button, "clicked", G_CALLBACK(on_file_button_clicked), NULL);
+
+    // 파일 전송 상태 줄 (/transfers 로 전체 목록, /cancel N 으로 취소)
+    transfer_status = GTK_LABEL(gtk_label_new(""));
+    gtk_box_pack_start(GTK_BOX(vbox), GTK_WIDGET(transfer_status), FALSE, FALSE, 0);
+    g_timeout_add(TRANSFER_STATUS_INTERVAL_MS, update_transfer_status, NULL);
     
     GtkWidget *dialog = gtk_dialog_new_with_buttons("Enter Your Nickname", GTK_WINDOW(main_window), GTK_DIALOG_MODAL,
                                                     "Cancel", GTK_RESPONSE_CANCEL,
@@ -544,6 +1405,41 @@ int main(int argc, char *argv[]) {
     GtkApplication *app;
     int status;
 
+    // sendfile/splice는 MSG_NOSIGNAL을 쓸 수 없으므로, 수신자가 끊겨도 종료되지 않도록 SIGPIPE를 무시합니다.
+    signal(SIGPIPE, SIG_IGN);
+
+    // 파일 전송 설정: 송신 포트 범위와 동시에 처리할 전송 수
+    const char *ports = getenv("MESSENGER_XFER_PORTS");
+    if (ports && sscanf(ports, "%d-%d", &xfer_port_min, &xfer_port_max) == 1) {
+        xfer_port_max = xfer_port_min;
+    }
+    const char *relay = getenv("MESSENGER_XFER_RELAY");
+    xfer_force_relay = relay && strcmp(relay, "1") == 0;
+    const char *compress = getenv("MESSENGER_XFER_COMPRESS");
+    xfer_compress = !(compress && strcmp(compress, "0") == 0);
+    const char *uring = getenv("MESSENGER_XFER_URING");
+    xfer_uring = !(uring && strcmp(uring, "0") == 0);
+    // 속도 상한 (KB/s): 모든 전송 합계와 전송 하나마다. 실행 중에는 /limit 으로 바꿈
+    const char *rate = getenv("MESSENGER_XFER_RATE");
+    if (rate) xfer_set_global_rate(atoll(rate) * 1024);
+    const char *transfer_rate = getenv("MESSENGER_XFER_TRANSFER_RATE");
+    if (transfer_rate) transfer_set_default_rate(atoll(transfer_rate) * 1024);
+    const char *relay_port = getenv("MESSENGER_RELAY_PORT");
+    if (relay_port) xfer_relay_port = atoi(relay_port);
+    const char *workers = getenv("MESSENGER_XFER_WORKERS");
+    if (transfer_manager_init(workers ? atoi(workers) : TRANSFER_DEFAULT_WORKERS) < 0) {
+        fprintf(stderr, "Failed to start file transfer workers\n");
+        return 1;
+    }
+
+    // 채팅창 스크롤백: 오래된 줄은 잘라내고, 파일을 지정하면 잘라낸 줄을 그 끝에 이어 씀
+    const char *scrollback = getenv("MESSENGER_SCROLLBACK_LINES");
+    if (scrollback) scrollback_lines = atoi(scrollback);
+    const char *scrollback_path = getenv("MESSENGER_SCROLLBACK_FILE");
+    if (scrollback_path && !(scrollback_file = fopen(scrollback_path, "a"))) {
+        perror("Failed to open scrollback file");
+    }
+    chat_inbox = g_async_queue_new_full(g_free);
     app = gtk_application_new("org.gtk.messenger", G_APPLICATION_DEFAULT_FLAGS);
     g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
     status = g_application_run(G_APPLICATION(app), argc, argv);
@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "epoch.h"
+
+// 스레드 하나의 읽기 상태. active이면 epoch는 구간에 들어갈 때 본 전역 에포크입니다.
+// 스레드가 끝나면 기록은 비활성 상태로 남아 다음 스레드가 재사용합니다. (스레드 모드에서 기록이 늘지 않도록)
+typedef struct EpochRecord {
+    atomic_ullong epoch;
+    atomic_int active;
+    int depth;                          // 중첩 깊이 (주인 스레드만 사용)
+    int in_use;                         // records_mutex로 보호
+    struct EpochRecord *next;
+} EpochRecord;
+
+typedef struct Retired {
+    void *object;
+    void (*release)(void *object);
+    unsigned long long epoch;
+    struct Retired *next;
+} Retired;
+
+static atomic_ullong global_epoch = 1;
+static pthread_mutex_t records_mutex = PTHREAD_MUTEX_INITIALIZER;
+static EpochRecord *records = NULL;
+static pthread_key_t record_key;
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+static __thread EpochRecord *local_record = NULL;
+
+// 맡긴 객체 목록 (오래된 것이 뒤). 바꾸는 쪽만 쓰므로 락 하나로 충분합니다.
+static pthread_mutex_t limbo_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Retired *limbo = NULL;
+static size_t since_collect = 0;
+static atomic_ullong retired_total, reclaimed_total;
+
+static void record_release(void *arg) {
+    EpochRecord *record = (EpochRecord*)arg;
+    atomic_store(&record->active, 0);
+    record->depth = 0;
+    pthread_mutex_lock(&records_mutex);
+    record->in_use = 0;
+    pthread_mutex_unlock(&records_mutex);
+    local_record = NULL;
+}
+
+static void record_key_create(void) {
+    pthread_key_create(&record_key, record_release);
+}
+
+static EpochRecord *record_get(void) {
+    if (local_record) return local_record;
+
+    pthread_once(&record_key_once, record_key_create);
+    pthread_mutex_lock(&records_mutex);
+    EpochRecord *record = records;
+    while (record && record->in_use) record = record->next;
+    if (!record) {
+        // 기록을 만들지 못하면 회수가 안전하지 않으므로 중단 (메모리가 바닥난 상황)
+        if (!(record = calloc(1, sizeof(EpochRecord)))) abort();
+        record->next = records;
+        records = record;
+    }
+    record->in_use = 1;
+    pthread_mutex_unlock(&records_mutex);
+
+    pthread_setspecific(record_key, record);
+    local_record = record;
+    return record;
+}
+
+void epoch_enter(void) {
+    EpochRecord *record = record_get();
+    if (record->depth++ > 0) return;
+    atomic_store_explicit(&record->epoch, atomic_load_explicit(&global_epoch, memory_order_relaxed),
+                          memory_order_relaxed);
+    atomic_store_explicit(&record->active, 1, memory_order_relaxed);
+    // 활성 표시가 이후의 읽기(스냅숏 포인터)보다 먼저 보여야 회수하는 쪽이 이 구간을 기다립니다.
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void epoch_exit(void) {
+    EpochRecord *record = local_record;
+    if (!record || --record->depth > 0) return;
+    atomic_store_explicit(&record->active, 0, memory_order_release);
+}
+
+// 활성 읽기 구간이 모두 현재 에포크에 있으면 전역 에포크를 올림. 현재(올린 뒤) 에포크 반환
+static unsigned long long try_advance(void) {
+    unsigned long long epoch = atomic_load(&global_epoch);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    pthread_mutex_lock(&records_mutex);
+    for (EpochRecord *record = records; record; record = record->next) {
+        if (atomic_load_explicit(&record->active, memory_order_acquire) &&
+            atomic_load_explicit(&record->epoch, memory_order_relaxed) != epoch) {
+            pthread_mutex_unlock(&records_mutex);
+            return epoch;
+        }
+    }
+    pthread_mutex_unlock(&records_mutex);
+    atomic_compare_exchange_strong(&global_epoch, &epoch, epoch + 1);
+    return atomic_load(&global_epoch);
+}
+
+void epoch_collect(void) {
+    unsigned long long epoch = try_advance();
+    Retired *ready = NULL;
+
+    // 에포크 epoch - 2 이하에 맡긴 객체는 이제 아무도 보고 있지 않음
+    pthread_mutex_lock(&limbo_mutex);
+    Retired **link = &limbo;
+    while (*link) {
+        Retired *entry = *link;
+        if (entry->epoch + 2 <= epoch) {
+            *link = entry->next;
+            entry->next = ready;
+            ready = entry;
+        } else {
+            link = &entry->next;
+        }
+    }
+    since_collect = 0;
+    pthread_mutex_unlock(&limbo_mutex);
+
+    // 해제 함수는 락 밖에서 호출 (다시 epoch_retire를 불러도 됨)
+    while (ready) {
+        Retired *next = ready->next;
+        ready->release(ready->object);
+        free(ready);
+        atomic_fetch_add_explicit(&reclaimed_total, 1, memory_order_relaxed);
+        ready = next;
+    }
+}
+
+void epoch_retire(void *object, void (*release)(void *object)) {
+    if (!object) return;
+
+    Retired *entry = malloc(sizeof(Retired));
+    if (!entry) {
+        // 목록에 넣을 수 없으면 모든 읽기 구간이 끝나기를 기다렸다가 바로 해제.
+        // 호출한 스레드가 읽기 구간 안이면 기다릴 수 없으므로 남겨 둠 (메모리가 바닥난 경우의 드문 누수)
+        if (local_record && local_record->depth > 0) return;
+        unsigned long long target = atomic_load(&global_epoch) + 2;
+        while (try_advance() < target) sched_yield();
+        release(object);
+        return;
+    }
+    entry->object = object;
+    entry->release = release;
+    entry->epoch = atomic_load(&global_epoch);
+    atomic_fetch_add_explicit(&retired_total, 1, memory_order_relaxed);
+
+    pthread_mutex_lock(&limbo_mutex);
+    entry->next = limbo;
+    limbo = entry;
+    int collect = ++since_collect >= EPOCH_RETIRE_BATCH;
+    pthread_mutex_unlock(&limbo_mutex);
+
+    if (collect) epoch_collect();
+}
+
+void epoch_stats(EpochStats *out) {
+    out->epoch = atomic_load_explicit(&global_epoch, memory_order_relaxed);
+    out->retired = atomic_load_explicit(&retired_total, memory_order_relaxed);
+    out->reclaimed = atomic_load_explicit(&reclaimed_total, memory_order_relaxed);
+}
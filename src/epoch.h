@@ -0,0 +1,34 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+// --- 에포크 기반 메모리 회수 (서버) ---
+// 락 없이 읽는 자료(방 멤버 스냅숏, 방, 연결)를 바꾸는 쪽이 옛 버전을 바로 free하지 않고 맡겨 두면,
+// 그 시점에 읽던 스레드가 모두 읽기 구간을 벗어난 뒤에 해제합니다.
+// 읽는 쪽은 epoch_enter/epoch_exit로 구간을 감싸기만 하며(공유 변수에 쓰지 않음), 구간 안에서 얻은 포인터는
+// 구간이 끝날 때까지 유효합니다. 구간은 짧아야 합니다(블로킹 호출 금지): 그동안 회수가 멈춥니다.
+//
+// 전역 에포크는 모든 읽기 구간이 현재 에포크를 관찰했을 때만 1 증가하며,
+// 에포크 e에 맡긴 객체는 전역 에포크가 e + 2가 되면 해제합니다.
+
+#define EPOCH_RETIRE_BATCH 64   // 맡긴 객체가 이만큼 쌓일 때마다 회수를 시도
+
+// 읽기 구간 (중첩 가능)
+void epoch_enter(void);
+void epoch_exit(void);
+
+// object를 지금 읽는 스레드가 모두 구간을 벗어난 뒤 release(object)로 해제. 어느 스레드에서나 호출 가능
+void epoch_retire(void *object, void (*release)(void *object));
+
+// 맡겨 둔 객체 중 해제해도 되는 것을 해제 (epoch_retire가 주기적으로 호출)
+void epoch_collect(void);
+
+// STATS용
+typedef struct {
+    unsigned long long epoch;
+    unsigned long long retired;     // 맡긴 객체 수 (누적)
+    unsigned long long reclaimed;   // 해제한 객체 수 (누적)
+} EpochStats;
+
+void epoch_stats(EpochStats *out);
+
+#endif
@@ -0,0 +1,944 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/random.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/sockios.h>
+#include <poll.h>
+#include <zlib.h>
+#include "protocol.h"
+#include "filexfer.h"
+#include "xxh64.h"
+#include "uring.h"
+
+void xfer_progress_init(XferProgress *progress) {
+    atomic_init(&progress->bytes, 0);
+    atomic_init(&progress->wire_bytes, 0);
+    atomic_init(&progress->cancelled, 0);
+    ratelimit_init(&progress->limit, 0);
+}
+
+// --- 대역폭 QoS ---
+
+static RateLimit global_limit;          // 모든 전송 공용 상한 (0으로 초기화 = 제한 없음)
+static atomic_int chat_socket = -1;
+static atomic_int chat_writers;         // 채팅 프레임을 쓰는 중인 스레드 수
+
+void xfer_set_global_rate(long long bytes_per_second) {
+    ratelimit_set(&global_limit, bytes_per_second);
+}
+
+long long xfer_global_rate(void) {
+    return ratelimit_rate(&global_limit);
+}
+
+void xfer_set_chat_socket(int sock) {
+    if (sock >= 0) {
+        int priority = XFER_CHAT_PRIORITY, one = 1;
+        setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority));
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    atomic_store(&chat_socket, sock);
+}
+
+void xfer_chat_begin(void) {
+    atomic_fetch_add(&chat_writers, 1);
+}
+
+void xfer_chat_end(void) {
+    atomic_fetch_sub(&chat_writers, 1);
+}
+
+void xfer_tune_data_socket(int sock) {
+    // 실패해도 전송은 되므로 결과는 보지 않음 (오래된 커널, 유닉스 소켓 등)
+    int priority = XFER_DATA_PRIORITY, lowat = XFER_NOTSENT_LOWAT;
+    setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority));
+    setsockopt(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+}
+
+// 채팅이 나가기를 기다리는 중인지: 프레임을 쓰는 중이거나 채팅 소켓에 아직 보내지 않은 바이트가 있음
+static int chat_pending(void) {
+    if (atomic_load_explicit(&chat_writers, memory_order_relaxed) > 0) return 1;
+    int sock = atomic_load_explicit(&chat_socket, memory_order_relaxed);
+    int unsent = 0;
+    return sock >= 0 && ioctl(sock, SIOCOUTQNSD, &unsent) == 0 && unsent > 0;
+}
+
+static void sleep_ns(long long ns) {
+    struct timespec ts = { .tv_sec = ns / 1000000000LL, .tv_nsec = ns % 1000000000LL };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+    }
+}
+
+// 상한이 있으면 한 번에 보낼 크기를 줄여 고르게 보냄
+static size_t step_size(XferProgress *progress, size_t fallback) {
+    fallback = ratelimit_step(&global_limit, fallback);
+    return progress ? ratelimit_step(&progress->limit, fallback) : fallback;
+}
+
+// 소켓을 지난 wire 바이트만큼 상한에 맞춰 쉬고, 채팅이 밀려 있으면 양보. 쉬는 동안 취소되면 1
+static int pace(XferProgress *progress, off_t wire) {
+    long long wait = ratelimit_take(&global_limit, wire);
+    if (progress) {
+        long long own = ratelimit_take(&progress->limit, wire);
+        if (own > wait) wait = own;
+    }
+    for (int i = 0; i < XFER_CHAT_YIELD_MS && chat_pending(); i++) {
+        sleep_ns(1000000LL);
+        wait -= 1000000LL;
+    }
+    // 길게 쉬어야 할 때도 취소에 바로 반응하도록 잘게 나눠 쉼
+    while (wait > 0) {
+        if (progress && atomic_load_explicit(&progress->cancelled, memory_order_relaxed)) return 1;
+        long long slice = wait < 50000000LL ? wait : 50000000LL;
+        sleep_ns(slice);
+        wait -= slice;
+    }
+    return 0;
+}
+
+// 보낸/받은 바이트(파일 기준 bytes, 소켓 기준 wire)를 진행률에 더하고 속도를 맞춘 뒤 취소 여부를 반환
+static int progress_account(XferProgress *progress, off_t bytes, off_t wire) {
+    if (progress) atomic_fetch_add_explicit(&progress->bytes, bytes, memory_order_relaxed);
+    if (pace(progress, wire) || (progress && atomic_load_explicit(&progress->cancelled, memory_order_relaxed))) {
+        errno = ECANCELED;
+        return 1;
+    }
+    return 0;
+}
+
+// 압축하지 않은 전송: 파일 바이트와 소켓 바이트가 같음
+static int progress_add(XferProgress *progress, off_t bytes) {
+    return progress_account(progress, bytes, bytes);
+}
+
+// sendfile/splice가 이 파일에서는 동작하지 않는다는 뜻의 오류 (다음 방식으로 넘어감)
+static int unsupported(int err) {
+    return err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == ESPIPE;
+}
+
+// 반환값: 1 이 방식으로는 처리 불가(아직 아무것도 보내지 않음), 0 완료, -1 오류
+static int send_with_sendfile(int sock, int fd, off_t offset, off_t length, off_t *sent, XferProgress *progress) {
+    off_t position = offset;
+
+    while (*sent < length) {
+        off_t left = length - *sent;
+        size_t step = step_size(progress, XFER_CHUNK_SIZE);
+        size_t chunk = left > (off_t)step ? step : (size_t)left;
+        ssize_t n = sendfile(sock, fd, &position, chunk);
+        if (n > 0) {
+            *sent += n;
+            if (progress_add(progress, n)) return -1;
+        } else if (n == 0) {
+            return -1; // 파일이 광고한 크기보다 짧음
+        } else if (errno == EINTR) {
+            continue;
+        } else {
+            return (*sent == 0 && unsupported(errno)) ? 1 : -1;
+        }
+    }
+    return 0;
+}
+
+static int send_with_splice(int sock, int fd, off_t offset, off_t length, off_t *sent, XferProgress *progress) {
+    int pipe_fds[2];
+    loff_t position = offset;
+    int result = 0;
+
+    if (pipe(pipe_fds) < 0) return 1;
+    // 파이프 용량을 청크 크기까지 늘려 splice 한 번에 옮기는 양을 키움 (실패해도 기본 크기로 동작)
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, XFER_CHUNK_SIZE);
+
+    while (*sent < length) {
+        off_t left = length - *sent;
+        size_t step = step_size(progress, XFER_CHUNK_SIZE);
+        size_t chunk = left > (off_t)step ? step : (size_t)left;
+        ssize_t in_pipe = splice(fd, &position, pipe_fds[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in_pipe < 0) {
+            if (errno == EINTR) continue;
+            result = (*sent == 0 && unsupported(errno)) ? 1 : -1;
+            break;
+        }
+        if (in_pipe == 0) {
+            result = -1;
+            break;
+        }
+
+        // 파이프에 들어간 만큼 모두 소켓으로 비움
+        while (in_pipe > 0) {
+            ssize_t out = splice(pipe_fds[0], NULL, sock, NULL, in_pipe, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out < 0 && errno == EINTR) continue;
+            if (out <= 0) {
+                result = -1;
+                break;
+            }
+            in_pipe -= out;
+            *sent += out;
+            if (progress_add(progress, out)) {
+                result = -1;
+                break;
+            }
+        }
+        if (result < 0) break;
+    }
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return result;
+}
+
+// 기존 방식: 사용자 공간 버퍼를 거치는 복사 루프 (특수 파일용 fallback)
+// state가 있으면 읽은 블록을 캐시에 있을 때 바로 해시함 (보낸 바이트 그대로의 해시)
+static int send_with_copy(int sock, int fd, off_t offset, off_t length, off_t *sent, XferProgress *progress,
+                          Xxh64State *state) {
+    char buffer[XFER_COPY_BUFFER_SIZE];
+
+    while (*sent < length) {
+        off_t left = length - *sent;
+        size_t chunk = left > (off_t)sizeof(buffer) ? sizeof(buffer) : (size_t)left;
+        ssize_t n = pread(fd, buffer, chunk, offset + *sent);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == ESPIPE) n = read(fd, buffer, chunk); // 파이프 등 위치 지정이 안 되는 파일
+        if (n <= 0) return -1;
+        if (state) xxh64_update(state, buffer, (size_t)n);
+
+        ssize_t done = 0;
+        while (done < n) {
+            ssize_t out = send(sock, buffer + done, n - done, MSG_NOSIGNAL);
+            if (out < 0 && errno == EINTR) continue;
+            if (out <= 0) return -1;
+            done += out;
+        }
+        *sent += n;
+        if (progress_add(progress, n)) return -1;
+    }
+    return 0;
+}
+
+int xfer_send_range(int sock, int fd, off_t offset, off_t length, XferMethod *method, off_t *sent,
+                    XferProgress *progress, uint64_t *hash) {
+    int result;
+
+    *sent = 0;
+    if (hash) {
+        // 해시가 필요하면 sendfile 뒤에 범위를 다시 읽는 대신, 한 번 읽은 블록을 해시하고 바로 보냄
+        Xxh64State state;
+        xxh64_init(&state, 0);
+        *method = XFER_COPY;
+        result = send_with_copy(sock, fd, offset, length, sent, progress, &state);
+        *hash = xxh64_digest(&state);
+        return result;
+    }
+    *method = XFER_SENDFILE;
+    result = send_with_sendfile(sock, fd, offset, length, sent, progress);
+    if (result == 1) {
+        *method = XFER_SPLICE;
+        result = send_with_splice(sock, fd, offset, length, sent, progress);
+    }
+    if (result == 1) {
+        *method = XFER_COPY;
+        result = send_with_copy(sock, fd, offset, length, sent, progress, NULL);
+    }
+    return result;
+}
+
+int xfer_listen(int port_min, int port_max, int *port) {
+    // 모든 인터페이스(IPv4/IPv6)에 바인딩되어야 외부에서 접속 가능합니다.
+    if (port_max < port_min) port_max = port_min;
+    for (int candidate = port_min; candidate <= port_max; candidate++) {
+        int sock = proto_listen_any(candidate, 0, 0, XFER_MAX_STREAMS, port);
+        if (sock >= 0) return sock;
+        if (errno != EADDRINUSE && errno != EACCES) break;
+    }
+    return -1;
+}
+
+const char *xfer_method_name(XferMethod method) {
+    switch (method) {
+    case XFER_SENDFILE: return "sendfile";
+    case XFER_SPLICE: return "splice";
+    case XFER_DEFLATE: return XFER_CODEC_NAME;
+    default: return "copy";
+    }
+}
+
+double xfer_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void xfer_format_rate(char *out, size_t out_size, off_t bytes, double seconds) {
+    double rate = seconds > 0 ? bytes / seconds : 0;
+    if (rate >= 1024.0 * 1024 * 1024) {
+        snprintf(out, out_size, "%.2f GB/s", rate / (1024.0 * 1024 * 1024));
+    } else if (rate >= 1024.0 * 1024) {
+        snprintf(out, out_size, "%.1f MB/s", rate / (1024.0 * 1024));
+    } else {
+        snprintf(out, out_size, "%.1f KB/s", rate / 1024.0);
+    }
+}
+
+// --- 분할 전송: 범위 요청 ---
+
+static void put_u64(unsigned char *out, uint64_t value) {
+    for (int i = 7; i >= 0; i--) {
+        out[i] = (unsigned char)(value & 0xff);
+        value >>= 8;
+    }
+}
+
+static uint64_t get_u64(const unsigned char *in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+static int write_full(int sock, const void *data, size_t length) {
+    const char *p = data;
+    while (length > 0) {
+        ssize_t n = send(sock, p, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int read_full(int sock, void *data, size_t length) {
+    char *p = data;
+    while (length > 0) {
+        ssize_t n = recv(sock, p, length, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        length -= n;
+    }
+    return 0;
+}
+
+#define XFER_REQUEST_FLAGS (XFER_REQUEST_COMPRESSED | XFER_REQUEST_CHECKSUM)
+
+int xfer_send_request(int sock, off_t offset, off_t length, uint64_t flags) {
+    unsigned char request[XFER_REQUEST_SIZE];
+    put_u64(request, (uint64_t)offset);
+    put_u64(request + 8, (uint64_t)length | (flags & XFER_REQUEST_FLAGS));
+    return write_full(sock, request, sizeof(request));
+}
+
+int xfer_recv_request(int sock, off_t *offset, off_t *length, uint64_t *flags) {
+    unsigned char request[XFER_REQUEST_SIZE];
+    if (read_full(sock, request, sizeof(request)) < 0) return -1;
+    uint64_t raw_length = get_u64(request + 8);
+    *flags = raw_length & XFER_REQUEST_FLAGS;
+    *offset = (off_t)get_u64(request);
+    *length = (off_t)(raw_length & ~XFER_REQUEST_FLAGS);
+    return (*offset < 0 || *length < 0) ? -1 : 0;
+}
+
+int xfer_send_checksum(int sock, uint64_t hash) {
+    unsigned char trailer[8];
+    put_u64(trailer, hash);
+    return write_full(sock, trailer, sizeof(trailer));
+}
+
+int xfer_recv_checksum(int sock, uint64_t *hash) {
+    unsigned char trailer[8];
+    if (read_full(sock, trailer, sizeof(trailer)) < 0) return -1;
+    *hash = get_u64(trailer);
+    return 0;
+}
+
+int xfer_relay_token(char *token) {
+    unsigned char random_bytes[RELAY_TOKEN_LEN / 2];
+    size_t filled = 0;
+
+    while (filled < sizeof(random_bytes)) {
+        ssize_t n = getrandom(random_bytes + filled, sizeof(random_bytes) - filled, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        filled += n;
+    }
+    for (size_t i = 0; i < sizeof(random_bytes); i++) {
+        sprintf(token + i * 2, "%02x", random_bytes[i]);
+    }
+    return 0;
+}
+
+int xfer_relay_hello(int sock, const char *token, char role) {
+    char hello[RELAY_HELLO_SIZE];
+    memcpy(hello, RELAY_MAGIC, RELAY_MAGIC_LEN);
+    memcpy(hello + RELAY_MAGIC_LEN, token, RELAY_TOKEN_LEN);
+    hello[RELAY_MAGIC_LEN + RELAY_TOKEN_LEN] = role;
+    return write_full(sock, hello, sizeof(hello));
+}
+
+int xfer_relay_wait(int sock, int timeout_s, XferProgress *progress) {
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+    double deadline = xfer_now() + timeout_s;
+    char reply;
+
+    // 취소 여부를 확인할 수 있도록 짧게 나누어 기다림
+    while (xfer_now() < deadline) {
+        if (progress && atomic_load(&progress->cancelled)) return -1;
+        int ready = poll(&pfd, 1, 500);
+        if (ready < 0 && errno != EINTR) return -1;
+        if (ready > 0) {
+            return read_full(sock, &reply, 1) == 0 && reply == RELAY_PAIRED ? 0 : -1;
+        }
+    }
+    return -1;
+}
+
+// --- 수신 파일 쓰기 파이프라인 ---
+
+struct XferWriter {
+    int fd;
+    int async;                              // io_uring 사용 중 (0이면 버퍼 하나로 동기 pwrite)
+    Uring ring;
+    char *buffers[XFER_WRITE_BUFFERS];
+    size_t lengths[XFER_WRITE_BUFFERS];     // 진행 중인 쓰기의 길이와 위치 (짧게 써진 나머지를 마저 쓸 때)
+    off_t offsets[XFER_WRITE_BUFFERS];
+    int in_flight[XFER_WRITE_BUFFERS];
+    int pending;
+    int error;                              // 실패한 쓰기의 errno (0이면 정상)
+};
+
+// 동기 pwrite (짧은 쓰기도 끝까지). 실패 시 errno
+static int pwrite_full(int fd, const char *data, size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t w = pwrite(fd, data, length, offset);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) return errno;
+        if (w == 0) return ENOSPC;
+        data += w;
+        length -= w;
+        offset += w;
+    }
+    return 0;
+}
+
+XferWriter *xfer_writer_new(int fd, int use_uring) {
+    XferWriter *writer = calloc(1, sizeof(XferWriter));
+    if (!writer) return NULL;
+    writer->fd = fd;
+    writer->ring.fd = -1;
+    writer->async = use_uring && uring_init(&writer->ring, XFER_WRITE_BUFFERS) == 0;
+
+    int count = writer->async ? XFER_WRITE_BUFFERS : 1;
+    struct iovec iov[XFER_WRITE_BUFFERS];
+    for (int i = 0; i < count; i++) {
+        // 페이지 단위로 정렬해 등록 버퍼로 고정하기 쉽게 함
+        if (posix_memalign((void**)&writer->buffers[i], 4096, XFER_WRITE_BUFFER_SIZE) != 0) {
+            writer->buffers[i] = NULL;
+            xfer_writer_free(writer);
+            return NULL;
+        }
+        iov[i].iov_base = writer->buffers[i];
+        iov[i].iov_len = XFER_WRITE_BUFFER_SIZE;
+    }
+    if (writer->async) {
+        // 등록은 최적화일 뿐이므로 실패해도(RLIMIT_MEMLOCK 등) 일반 쓰기 요청으로 진행
+        uring_register_buffers(&writer->ring, iov, count);
+        uring_register_file(&writer->ring, fd);
+    }
+    return writer;
+}
+
+int xfer_writer_async(const XferWriter *writer) {
+    return writer->async;
+}
+
+// 완료 하나를 거둠. 짧게 써졌으면 나머지는 동기로 마저 씀
+static int writer_reap(XferWriter *writer) {
+    uint64_t slot;
+    int res;
+
+    if (uring_wait(&writer->ring, &slot, &res) < 0 || slot >= XFER_WRITE_BUFFERS) {
+        writer->error = errno ? errno : EIO;
+        writer->pending = 0; // 링이 망가졌으므로 더 기다리지 않음
+        memset(writer->in_flight, 0, sizeof(writer->in_flight));
+        return -1;
+    }
+    if (res < 0) {
+        if (!writer->error) writer->error = -res;
+    } else if ((size_t)res < writer->lengths[slot]) {
+        int err = pwrite_full(writer->fd, writer->buffers[slot] + res, writer->lengths[slot] - res,
+                              writer->offsets[slot] + res);
+        if (err && !writer->error) writer->error = err;
+    }
+    writer->in_flight[slot] = 0;
+    writer->pending--;
+    return 0;
+}
+
+char *xfer_writer_buffer(XferWriter *writer, size_t *capacity) {
+    *capacity = XFER_WRITE_BUFFER_SIZE;
+    for (;;) {
+        if (writer->error) {
+            errno = writer->error;
+            return NULL;
+        }
+        for (int i = 0; i < XFER_WRITE_BUFFERS; i++) {
+            if (writer->buffers[i] && !writer->in_flight[i]) return writer->buffers[i];
+        }
+        // 모든 버퍼가 디스크에 쓰이는 중: 하나가 끝날 때까지 기다림 (네트워크가 디스크보다 빠른 경우)
+        if (writer_reap(writer) < 0) return NULL;
+    }
+}
+
+int xfer_writer_submit(XferWriter *writer, char *buffer, size_t length, off_t offset) {
+    int slot = 0;
+    while (slot < XFER_WRITE_BUFFERS && writer->buffers[slot] != buffer) slot++;
+    if (slot == XFER_WRITE_BUFFERS || length == 0) return length == 0 ? 0 : -1;
+
+    if (writer->async) {
+        writer->lengths[slot] = length;
+        writer->offsets[slot] = offset;
+        if (uring_write(&writer->ring, writer->fd, buffer, (unsigned)length, offset, slot, (uint64_t)slot) == 0) {
+            writer->in_flight[slot] = 1;
+            writer->pending++;
+            return 0;
+        }
+        // 제출하지 못하면(요청이 링에 남지 않음) 이 버퍼만 동기로 씀
+    }
+    int err = pwrite_full(writer->fd, buffer, length, offset);
+    if (err) {
+        writer->error = err;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int xfer_writer_flush(XferWriter *writer) {
+    while (writer->async && writer->pending > 0) {
+        if (writer_reap(writer) < 0) break;
+    }
+    if (writer->error) {
+        errno = writer->error;
+        return -1;
+    }
+    return 0;
+}
+
+void xfer_writer_free(XferWriter *writer) {
+    if (!writer) return;
+    xfer_writer_flush(writer);
+    if (writer->ring.fd >= 0) uring_exit(&writer->ring);
+    for (int i = 0; i < XFER_WRITE_BUFFERS; i++) free(writer->buffers[i]);
+    free(writer);
+}
+
+int xfer_recv_range(int sock, XferWriter *writer, off_t offset, off_t length, off_t *received, XferProgress *progress,
+                    uint64_t *hash) {
+    Xxh64State state;
+    int result = 0;
+
+    *received = 0;
+    xxh64_init(&state, 0);
+    while (result == 0 && *received < length) {
+        // 버퍼 하나를 가득 채운 뒤 기록을 맡기고, 기록되는 동안 다음 버퍼를 받음
+        size_t capacity, filled = 0;
+        char *buffer = xfer_writer_buffer(writer, &capacity);
+        if (!buffer) {
+            result = -1;
+            break;
+        }
+        off_t left = length - *received;
+        size_t want = left > (off_t)capacity ? capacity : (size_t)left;
+        while (filled < want) {
+            ssize_t n = recv(sock, buffer + filled, want - filled, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                result = -1;
+                break;
+            }
+            filled += n;
+        }
+        if (hash) xxh64_update(&state, buffer, filled); // 버퍼에 있는 동안 해시 (다시 읽지 않음)
+
+        if (xfer_writer_submit(writer, buffer, filled, offset + *received) < 0) result = -1;
+        *received += filled;
+        if (result == 0 && progress_add(progress, filled)) result = -1;
+    }
+    // 범위가 디스크(페이지 캐시)에 다 쓰인 뒤에 돌아가야 매니페스트에 완료로 기록할 수 있음
+    if (xfer_writer_flush(writer) < 0) result = -1;
+    if (hash) *hash = xxh64_digest(&state);
+    return result;
+}
+
+// --- 압축 전송 ---
+
+static void put_u32(unsigned char *out, uint32_t value) {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+static uint32_t get_u32(const unsigned char *in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+// 파일에서 length 바이트를 끝까지 읽음 (파일이 짧으면 -1)
+static int read_block(int fd, char *buffer, size_t length, off_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pread(fd, buffer + done, length - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == ESPIPE) n = read(fd, buffer + done, length - done);
+        if (n <= 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+int xfer_hash_range(int fd, off_t offset, off_t length, uint64_t *hash) {
+    char *buffer = malloc(XFER_RECV_BUFFER_SIZE);
+    Xxh64State state;
+    off_t done = 0;
+
+    if (!buffer) return -1;
+    xxh64_init(&state, 0);
+    while (done < length) {
+        size_t block = length - done > XFER_RECV_BUFFER_SIZE ? XFER_RECV_BUFFER_SIZE : (size_t)(length - done);
+        if (read_block(fd, buffer, block, offset + done) < 0) {
+            free(buffer);
+            return -1;
+        }
+        xxh64_update(&state, buffer, block);
+        done += block;
+    }
+    free(buffer);
+    *hash = xxh64_digest(&state);
+    return 0;
+}
+
+// raw를 out에 압축해 압축 길이를 반환. 원본의 1/32도 줄지 않으면 0 (원본 그대로 보냄)
+// 출력 공간을 그만큼으로 제한하므로, 줄지 않는 블록은 끝까지 압축하지 않고 일찍 포기합니다.
+static size_t deflate_block(z_stream *z, const char *raw, size_t length, char *out) {
+    if (deflateReset(z) != Z_OK) return 0;
+    z->next_in = (Bytef*)raw;
+    z->avail_in = (uInt)length;
+    z->next_out = (Bytef*)out;
+    z->avail_out = (uInt)(length - length / 32);
+    return deflate(z, Z_FINISH) == Z_STREAM_END ? z->total_out : 0;
+}
+
+int xfer_send_range_compressed(int sock, int fd, off_t offset, off_t length, off_t *sent, XferProgress *progress,
+                               uint64_t *hash) {
+    char *raw = malloc(XFER_COMPRESS_BLOCK);
+    char *packed = malloc(XFER_BLOCK_HEADER_SIZE + XFER_COMPRESS_BLOCK);
+    Xxh64State state;
+    z_stream z;
+    int result = 0;
+    int skip = 0, backoff = 1;  // 줄지 않는 블록 뒤에는 몇 블록 동안 압축을 시도하지 않음 (최대 32블록)
+
+    *sent = 0;
+    xxh64_init(&state, 0);
+    memset(&z, 0, sizeof(z));
+    if (!raw || !packed || deflateInit2(&z, Z_BEST_SPEED, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(raw);
+        free(packed);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    while (*sent < length) {
+        off_t left = length - *sent;
+        size_t block = left > XFER_COMPRESS_BLOCK ? XFER_COMPRESS_BLOCK : (size_t)left;
+        size_t wire = 0;
+
+        if (read_block(fd, raw, block, offset + *sent) < 0) {
+            result = -1;
+            break;
+        }
+        if (hash) xxh64_update(&state, raw, block);
+        if (skip > 0) {
+            skip--;
+        } else if ((wire = deflate_block(&z, raw, block, packed + XFER_BLOCK_HEADER_SIZE)) == 0) {
+            skip = backoff;
+            if (backoff < 32) backoff *= 2;
+        } else {
+            backoff = 1;
+        }
+
+        put_u32((unsigned char*)packed, (uint32_t)block);
+        put_u32((unsigned char*)packed + 4, (uint32_t)(wire ? wire : block));
+        if (wire == 0) {
+            // 원본 블록은 헤더와 따로 보내 복사를 피함
+            result = write_full(sock, packed, XFER_BLOCK_HEADER_SIZE);
+            if (result == 0) result = write_full(sock, raw, block);
+        } else {
+            result = write_full(sock, packed, XFER_BLOCK_HEADER_SIZE + wire);
+        }
+        if (result < 0) break;
+
+        *sent += block;
+        size_t on_wire = XFER_BLOCK_HEADER_SIZE + (wire ? wire : block);
+        if (progress) atomic_fetch_add_explicit(&progress->wire_bytes, on_wire, memory_order_relaxed);
+        if (progress_account(progress, block, on_wire)) {
+            result = -1;
+            break;
+        }
+    }
+
+    deflateEnd(&z);
+    free(raw);
+    free(packed);
+    if (hash) *hash = xxh64_digest(&state);
+    return result;
+}
+
+int xfer_recv_range_compressed(int sock, XferWriter *writer, off_t offset, off_t length, off_t *received,
+                               XferProgress *progress, uint64_t *hash) {
+    char *packed = malloc(XFER_COMPRESS_BLOCK);
+    unsigned char header[XFER_BLOCK_HEADER_SIZE];
+    Xxh64State state;
+    z_stream z;
+    int result = 0;
+    char *buffer = NULL;    // 풀어 둔 블록을 모아 한 번에 기록할 쓰기 버퍼
+    size_t capacity = 0, filled = 0;
+
+    *received = 0;
+    xxh64_init(&state, 0);
+    memset(&z, 0, sizeof(z));
+    if (!packed || inflateInit2(&z, -15) != Z_OK) {
+        free(packed);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    while (*received < length) {
+        if (read_full(sock, header, sizeof(header)) < 0) {
+            result = -1;
+            break;
+        }
+        uint32_t block = get_u32(header);
+        uint32_t wire = get_u32(header + 4);
+        if (block == 0 || block > XFER_COMPRESS_BLOCK || wire == 0 || wire > block ||
+            (off_t)block > length - *received) {
+            errno = EPROTO;
+            result = -1;
+            break;
+        }
+
+        // 쓰기 버퍼에 블록이 들어갈 자리가 없으면 지금까지 모은 것을 기록에 맡김
+        if (buffer && capacity - filled < block) {
+            if (xfer_writer_submit(writer, buffer, filled, offset + *received - filled) < 0) {
+                result = -1;
+                break;
+            }
+            buffer = NULL;
+        }
+        if (!buffer) {
+            filled = 0;
+            if (!(buffer = xfer_writer_buffer(writer, &capacity))) {
+                result = -1;
+                break;
+            }
+        }
+
+        char *raw = buffer + filled;
+        if (read_full(sock, wire < block ? packed : raw, wire) < 0) {
+            result = -1;
+            break;
+        }
+        if (wire < block) {
+            inflateReset(&z);
+            z.next_in = (Bytef*)packed;
+            z.avail_in = wire;
+            z.next_out = (Bytef*)raw;
+            z.avail_out = block;
+            if (inflate(&z, Z_FINISH) != Z_STREAM_END || z.total_out != block) {
+                errno = EPROTO;
+                result = -1;
+                break;
+            }
+        }
+        if (hash) xxh64_update(&state, raw, block);
+        filled += block;
+
+        *received += block;
+        if (progress) {
+            atomic_fetch_add_explicit(&progress->wire_bytes, XFER_BLOCK_HEADER_SIZE + wire, memory_order_relaxed);
+        }
+        if (progress_account(progress, block, XFER_BLOCK_HEADER_SIZE + wire)) {
+            result = -1;
+            break;
+        }
+    }
+    if (result == 0 && buffer && xfer_writer_submit(writer, buffer, filled, offset + *received - filled) < 0) {
+        result = -1;
+    }
+    if (xfer_writer_flush(writer) < 0) result = -1;
+
+    inflateEnd(&z);
+    free(packed);
+    if (hash) *hash = xxh64_digest(&state);
+    return result;
+}
+
+// --- 분할 전송: 사이드카 매니페스트 ---
+// 형식: 첫 줄 "CHM1 <filesize> <chunk_size>", 이후 완료된 청크 번호 한 줄씩 (해시를 확인한 청크는 "번호 16진수해시").
+// 중간에 끊겨 개행으로 끝나지 않은 마지막 줄은 무시합니다.
+
+#define MANIFEST_MAGIC "CHM1"
+
+static void manifest_load(XferManifest *m, FILE *fp) {
+    char line[64];
+    while (fgets(line, sizeof(line), fp)) {
+        if (!strchr(line, '\n')) break;
+        char *end;
+        unsigned long long chunk = strtoull(line, &end, 10);
+        if (end == line || chunk >= m->chunk_count) continue;
+        if (m->state[chunk] == CHUNK_DONE) {
+            // 검사에 실패해 다시 받은 청크: 나중 줄의 해시가 맞음
+            if (m->hashes[chunk]) m->hashed_count--;
+        } else {
+            m->state[chunk] = CHUNK_DONE;
+            m->done_count++;
+        }
+        m->hashes[chunk] = *end == ' ' ? strtoull(end + 1, NULL, 16) : 0;
+        if (m->hashes[chunk]) m->hashed_count++;
+    }
+}
+
+int xfer_manifest_open(XferManifest *m, const char *path, off_t filesize, off_t chunk_size) {
+    memset(m, 0, sizeof(*m));
+    m->filesize = filesize;
+    m->chunk_size = chunk_size;
+    m->chunk_count = filesize > 0 ? (size_t)((filesize + chunk_size - 1) / chunk_size) : 0;
+    m->state = calloc(m->chunk_count ? m->chunk_count : 1, 1);
+    m->hashes = calloc(m->chunk_count ? m->chunk_count : 1, sizeof(uint64_t));
+    if (!m->state || !m->hashes) {
+        free(m->state);
+        free(m->hashes);
+        return -1;
+    }
+
+    // 같은 크기의 전송 기록이 있으면 완료된 청크를 이어받음
+    FILE *fp = fopen(path, "r");
+    if (fp) {
+        char magic[8];
+        long long recorded_size, recorded_chunk;
+        if (fscanf(fp, "%7s %lld %lld\n", magic, &recorded_size, &recorded_chunk) == 3 &&
+            strcmp(magic, MANIFEST_MAGIC) == 0 && recorded_size == filesize && recorded_chunk == chunk_size) {
+            manifest_load(m, fp);
+            m->resumed_count = m->done_count;
+        }
+        fclose(fp);
+    }
+
+    int flags = O_WRONLY | O_CREAT | O_APPEND | (m->resumed_count > 0 ? 0 : O_TRUNC);
+    if ((m->fd = open(path, flags, 0644)) < 0) {
+        free(m->state);
+        free(m->hashes);
+        return -1;
+    }
+    if (m->resumed_count == 0) {
+        char header[64];
+        int length = snprintf(header, sizeof(header), MANIFEST_MAGIC " %lld %lld\n",
+                              (long long)filesize, (long long)chunk_size);
+        if (write(m->fd, header, length) != length) {
+            close(m->fd);
+            free(m->state);
+            free(m->hashes);
+            return -1;
+        }
+    }
+    pthread_mutex_init(&m->lock, NULL);
+    return 0;
+}
+
+int xfer_manifest_claim(XferManifest *m, size_t *chunk, off_t *offset, off_t *length) {
+    int found = 0;
+
+    pthread_mutex_lock(&m->lock);
+    for (size_t scanned = 0; scanned < m->chunk_count; scanned++) {
+        size_t i = (m->cursor + scanned) % m->chunk_count;
+        if (m->state[i] == CHUNK_MISSING) {
+            m->state[i] = CHUNK_IN_FLIGHT;
+            m->cursor = (i + 1) % m->chunk_count;
+            *chunk = i;
+            *offset = (off_t)i * m->chunk_size;
+            *length = m->filesize - *offset < m->chunk_size ? m->filesize - *offset : m->chunk_size;
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+    return found;
+}
+
+int xfer_manifest_complete(XferManifest *m, size_t chunk, uint64_t hash) {
+    char line[48];
+    int length = hash ? snprintf(line, sizeof(line), "%zu %016llx\n", chunk, (unsigned long long)hash)
+                      : snprintf(line, sizeof(line), "%zu\n", chunk);
+
+    pthread_mutex_lock(&m->lock);
+    m->state[chunk] = CHUNK_DONE;
+    m->done_count++;
+    m->hashes[chunk] = hash;
+    if (hash) m->hashed_count++;
+    // O_APPEND 한 줄 쓰기: 데이터를 pwrite한 뒤에 기록하므로 기록된 청크는 항상 파일에 있습니다.
+    int result = write(m->fd, line, length) == length ? 0 : -1;
+    pthread_mutex_unlock(&m->lock);
+    return result;
+}
+
+void xfer_manifest_release(XferManifest *m, size_t chunk) {
+    pthread_mutex_lock(&m->lock);
+    if (m->state[chunk] == CHUNK_IN_FLIGHT) m->state[chunk] = CHUNK_MISSING;
+    pthread_mutex_unlock(&m->lock);
+}
+
+size_t xfer_manifest_verify(XferManifest *m, int fd) {
+    size_t failed = 0;
+
+    // 이어받기 전(스트림을 열기 전)에만 호출하므로 잠그지 않음
+    for (size_t i = 0; i < m->chunk_count; i++) {
+        if (m->state[i] != CHUNK_DONE || m->hashes[i] == 0) continue;
+        off_t offset = (off_t)i * m->chunk_size;
+        off_t length = m->filesize - offset < m->chunk_size ? m->filesize - offset : m->chunk_size;
+        uint64_t hash;
+        if (xfer_hash_range(fd, offset, length, &hash) == 0 && hash == m->hashes[i]) continue;
+
+        // 이 청크는 다시 받음. 매니페스트의 기존 줄은 남지만 다시 받으면 새 줄이 덧붙습니다.
+        m->state[i] = CHUNK_MISSING;
+        m->hashes[i] = 0;
+        m->done_count--;
+        m->hashed_count--;
+        if (m->resumed_count > 0) m->resumed_count--;
+        failed++;
+    }
+    return failed;
+}
+
+int xfer_manifest_finished(XferManifest *m) {
+    pthread_mutex_lock(&m->lock);
+    int finished = m->done_count == m->chunk_count;
+    pthread_mutex_unlock(&m->lock);
+    return finished;
+}
+
+void xfer_manifest_close(XferManifest *m) {
+    close(m->fd);
+    free(m->state);
+    free(m->hashes);
+    pthread_mutex_destroy(&m->lock);
+}
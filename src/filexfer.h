@@ -0,0 +1,197 @@
+#ifndef FILEXFER_H
+#define FILEXFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "ratelimit.h"
+
+// --- 파일 전송 데이터 경로 (클라이언트) ---
+// 파일 내용을 사용자 공간 버퍼로 복사하지 않고 커널 안에서 소켓으로 보냅니다.
+// sendfile()을 먼저 쓰고, 지원되지 않으면 splice()(파일 -> 파이프 -> 소켓),
+// 그것도 안 되는 특수 파일은 기존 read()/send() 복사 루프로 보냅니다.
+
+#define XFER_CHUNK_SIZE (8 * 1024 * 1024) // 시스템 콜 한 번에 넘기는 최대 바이트 수
+#define XFER_COPY_BUFFER_SIZE (64 * 1024)
+
+// --- 분할(chunked) 전송 모드 ---
+// 수신자가 여러 TCP 스트림을 열고, 각 스트림에서 [offset 8바이트][length 8바이트](빅엔디언) 요청을
+// 보내면 송신자가 그 범위만 보냅니다. length 0 요청은 "모든 범위를 받았음"을 뜻합니다.
+// 요청 없이 연결만 한 기존 수신자에게는 파일 전체를 한 스트림으로 보냅니다.
+#define XFER_RANGE_SIZE (4 * 1024 * 1024) // 매니페스트의 청크 크기
+#define XFER_DEFAULT_STREAMS 4
+#define XFER_MAX_STREAMS 16
+#define XFER_REQUEST_SIZE 16
+#define XFER_RECV_BUFFER_SIZE (256 * 1024)
+#define XFER_LEGACY_WAIT_MS 2000 // 이 시간 안에 범위 요청이 없으면 기존 수신자로 간주
+#define XFER_RESUME_WAIT_S 30    // 모든 스트림이 끊긴 뒤 수신자의 재접속을 기다리는 시간
+#define XFER_ACCEPT_TIMEOUT_S 600 // 송신자가 첫 연결을 기다리는 최대 시간 (작업 스레드를 붙잡지 않도록)
+
+// --- 압축 전송 ---
+// 송신자가 FILE_REQ 옵션에 "compress=deflate"를 넣으면, 이를 아는 수신자는 범위 요청 길이에
+// XFER_REQUEST_COMPRESSED 비트를 켜서 압축된 응답을 요청합니다. (기존 수신자는 그대로 원본을 받음)
+// 응답은 원본 XFER_COMPRESS_BLOCK 바이트마다 [원본 길이 4바이트][전송 길이 4바이트](빅엔디언)와 본문입니다.
+// 전송 길이가 원본보다 짧으면 raw deflate(레벨 1) 블록, 같으면 압축하지 않은 원본입니다.
+// 블록마다 따로 압축하므로 줄지 않는 블록(이미 압축된 데이터)은 원본 그대로 보냅니다.
+#define XFER_CODEC_NAME "deflate"
+#define XFER_COMPRESS_BLOCK (128 * 1024)
+#define XFER_BLOCK_HEADER_SIZE 8
+#define XFER_REQUEST_COMPRESSED (1ULL << 63)
+
+// --- 무결성 검사 ---
+// 송신자가 FILE_REQ 옵션에 "hash=xxh64"를 넣으면, 수신자는 범위 요청 길이에 XFER_REQUEST_CHECKSUM 비트를 켜고
+// 송신자는 범위를 다 보낸 뒤 그 범위의 XXH64(원본 기준, 8바이트 빅엔디언)를 덧붙입니다.
+// 수신자는 받는 동안 해시를 계산해(다시 읽지 않음) 비교하고, 맞는 청크만 매니페스트에 해시와 함께 기록합니다.
+// 이어받을 때는 매니페스트에 기록된 청크만 .part에서 다시 해시해 손상된 청크를 다시 받습니다.
+#define XFER_HASH_NAME "xxh64"
+#define XFER_REQUEST_CHECKSUM (1ULL << 62)
+#define XFER_VERIFY_RETRIES 8   // 한 번의 수신에서 해시가 맞지 않은 청크를 다시 요청하는 최대 횟수
+
+// 전송 진행률과 취소 요청. 여러 스트림이 같은 값을 함께 갱신합니다.
+typedef struct {
+    atomic_llong bytes;         // 파일 바이트 (압축 전 기준)
+    atomic_llong wire_bytes;    // 압축 전송에서 실제로 소켓을 지난 바이트 (블록 헤더 포함)
+    atomic_int cancelled;
+    RateLimit limit;            // 이 전송의 속도 상한 (0이면 제한 없음, 전송 중에도 바꿀 수 있음)
+} XferProgress;
+
+typedef enum {
+    XFER_SENDFILE,
+    XFER_SPLICE,
+    XFER_COPY,
+    XFER_DEFLATE
+} XferMethod;
+
+void xfer_progress_init(XferProgress *progress);
+
+// --- 대역폭 QoS ---
+// 파일 데이터가 채팅 지연을 밀어내지 않도록 세 가지를 함께 씁니다.
+// 1. 속도 상한: 모든 전송이 나눠 쓰는 전체 상한과 전송마다의 상한(XferProgress.limit). 둘 중 더 엄격한 쪽을 따릅니다.
+//    상한이 있으면 시스템 콜 한 번에 RATELIMIT_QUANTUM씩만 보내고, 보낸 만큼 쉽니다(압축 전송은 실제 전송량 기준).
+// 2. 채팅 우선: 채팅 프레임을 쓰는 중이거나 채팅 소켓에 아직 나가지 않은 바이트가 있으면,
+//    파일 스트림은 다음 조각을 보내기 전에 최대 XFER_CHAT_YIELD_MS 동안 양보합니다.
+// 3. 소켓 설정: 데이터 소켓은 낮은 SO_PRIORITY와 TCP_NOTSENT_LOWAT으로 커널 송신 대기열을 짧게 유지하고,
+//    채팅 소켓은 높은 SO_PRIORITY와 TCP_NODELAY를 씁니다.
+#define XFER_CHAT_YIELD_MS 50
+#define XFER_DATA_PRIORITY 2            // TC_PRIO_BULK
+#define XFER_CHAT_PRIORITY 6            // TC_PRIO_INTERACTIVE
+#define XFER_NOTSENT_LOWAT (256 * 1024)
+
+// 전체 상한 (바이트/초, 0이면 제한 없음). 진행 중인 전송에도 바로 적용됩니다.
+void xfer_set_global_rate(long long bytes_per_second);
+long long xfer_global_rate(void);
+// 채팅 연결 등록 (-1이면 해제). 소켓 설정을 바꾸고, 송신 대기열을 보고 파일 스트림을 양보시킵니다.
+void xfer_set_chat_socket(int sock);
+// 채팅 프레임을 쓰는 동안 감쌈 (파일 스트림이 그동안 다음 조각을 보내지 않음)
+void xfer_chat_begin(void);
+void xfer_chat_end(void);
+// 파일 데이터 소켓 설정 (연결하거나 accept한 직후)
+void xfer_tune_data_socket(int sock);
+
+// fd의 offset부터 length 바이트를 sock으로 전송 (파일 오프셋은 바꾸지 않음)
+// *method에는 실제로 사용한 방식이, *sent에는 보낸 바이트 수가 기록됩니다.
+// progress(NULL 가능)에 보낸 만큼 더하고, 취소되면 청크 사이에서 멈춥니다. 속도 상한과 채팅 우선을 따릅니다.
+// hash(NULL 가능)가 있으면 보낸 바이트의 XXH64를 기록합니다. 이때는 zero-copy 대신 읽은 블록을 해시하고 보내는
+// 복사 경로를 씁니다. sendfile 뒤에 범위를 다시 읽어 해시하면 파일을 두 번 읽고, 보낸 뒤에 바뀐 내용을 해시할 수 있기 때문입니다.
+// 반환값: 0 전부 전송, -1 오류·취소 또는 파일이 예상보다 짧음 (errno 유지)
+int xfer_send_range(int sock, int fd, off_t offset, off_t length, XferMethod *method, off_t *sent,
+                    XferProgress *progress, uint64_t *hash);
+
+// --- 수신 파일 쓰기 파이프라인 ---
+// 받은 데이터를 큰 버퍼 여러 개에 번갈아 채우고, 채운 버퍼는 io_uring으로 디스크에 비동기 기록합니다.
+// (등록 버퍼와 등록 파일 사용) 앞 버퍼가 기록되는 동안 다음 버퍼를 받으므로,
+// 처리량이 네트워크와 디스크 시간의 합이 아니라 느린 쪽에 맞춰집니다.
+// io_uring을 쓸 수 없으면(오래된 커널, seccomp 등) 버퍼 하나로 받은 뒤 pwrite하는 동기 방식으로 동작합니다.
+// 스트림(스레드)마다 하나씩 만들어 씁니다.
+#define XFER_WRITE_BUFFERS 4
+#define XFER_WRITE_BUFFER_SIZE XFER_RECV_BUFFER_SIZE
+
+typedef struct XferWriter XferWriter;
+
+// fd에 기록하는 파이프라인. use_uring이 0이거나 io_uring을 쓸 수 없으면 동기 방식. 실패 시 NULL
+XferWriter *xfer_writer_new(int fd, int use_uring);
+int xfer_writer_async(const XferWriter *writer);
+// 채울 빈 버퍼 (모두 기록 중이면 하나가 끝날 때까지 기다림). 앞선 쓰기가 실패했으면 NULL (errno)
+char *xfer_writer_buffer(XferWriter *writer, size_t *capacity);
+// xfer_writer_buffer로 받은 버퍼의 앞 length 바이트를 fd의 offset에 기록하도록 맡김
+int xfer_writer_submit(XferWriter *writer, char *buffer, size_t length, off_t offset);
+// 맡긴 쓰기가 모두 끝날 때까지 기다림. 하나라도 실패했으면 -1 (errno)
+int xfer_writer_flush(XferWriter *writer);
+void xfer_writer_free(XferWriter *writer);
+
+// 범위 요청 송수신. flags는 XFER_REQUEST_* 비트 조합. xfer_recv_request는 연결이 닫혔거나 오류면 -1
+int xfer_send_request(int sock, off_t offset, off_t length, uint64_t flags);
+int xfer_recv_request(int sock, off_t *offset, off_t *length, uint64_t *flags);
+// sock에서 length 바이트를 받아 writer로 offset 위치에 기록 (돌아오기 전에 모두 기록됨). *received에 받은 바이트 수 기록
+// hash가 NULL이 아니면 받은 데이터의 XXH64를 기록합니다.
+int xfer_recv_range(int sock, XferWriter *writer, off_t offset, off_t length, off_t *received, XferProgress *progress,
+                    uint64_t *hash);
+
+// 압축 응답 송수신 (블록 형식은 위 참고). 길이와 *sent/*received는 원본 바이트 기준이며,
+// progress의 wire_bytes에 실제 전송량을 더합니다. hash(NULL 가능)에는 원본의 XXH64. 블록이 잘못되었거나 오류·취소면 -1
+int xfer_send_range_compressed(int sock, int fd, off_t offset, off_t length, off_t *sent, XferProgress *progress,
+                               uint64_t *hash);
+int xfer_recv_range_compressed(int sock, XferWriter *writer, off_t offset, off_t length, off_t *received,
+                               XferProgress *progress, uint64_t *hash);
+
+// fd의 범위를 읽어 XXH64 계산 (이어받기 전에 .part의 청크를 검사할 때). 파일이 짧으면 -1
+int xfer_hash_range(int fd, off_t offset, off_t length, uint64_t *hash);
+// 범위 뒤에 붙는 해시 송수신
+int xfer_send_checksum(int sock, uint64_t hash);
+int xfer_recv_checksum(int sock, uint64_t *hash);
+
+// 서버 중계(relay) 데이터 연결. 토큰은 RELAY_TOKEN_LEN자의 16진수 난수 (token은 그보다 1바이트 큰 버퍼)
+int xfer_relay_token(char *token);
+// 중계 포트에 연결한 직후 토큰과 역할(RELAY_ROLE_SENDER/RECEIVER)을 알림
+int xfer_relay_hello(int sock, const char *token, char role);
+// 서버가 상대 연결과 짝지어 줄 때까지 대기. 짝지어지면 0, 시간 초과·취소·연결 종료 시 -1
+int xfer_relay_wait(int sock, int timeout_s, XferProgress *progress);
+
+// 송신용 리스닝 소켓을 [port_min, port_max]에서 처음 비어 있는 포트에 엶.
+// port_min이 0이면 커널이 임시 포트를 고릅니다. 실제 포트를 *port에 기록하고, 실패 시 -1
+int xfer_listen(int port_min, int port_max, int *port);
+
+// 수신 쪽 사이드카 매니페스트: 완료된 청크 번호를 한 줄씩 덧붙여 두었다가
+// 중단된 전송을 다시 받을 때 남은 청크만 요청합니다.
+typedef enum {
+    CHUNK_MISSING = 0,
+    CHUNK_IN_FLIGHT,
+    CHUNK_DONE
+} ChunkState;
+
+typedef struct {
+    int fd;                     // 매니페스트 파일 (O_APPEND)
+    off_t filesize;
+    off_t chunk_size;
+    size_t chunk_count;
+    size_t done_count;
+    size_t resumed_count;       // 이전 시도에서 이미 받은 청크 수
+    unsigned char *state;       // ChunkState 배열
+    uint64_t *hashes;           // 완료된 청크의 XXH64 (0이면 해시 없이 받은 청크)
+    size_t hashed_count;        // 해시가 기록된 완료 청크 수
+    size_t cursor;              // 다음에 확인할 청크 (탐색 힌트)
+    pthread_mutex_t lock;
+} XferManifest;
+
+// 매니페스트를 열고, 같은 파일 크기/청크 크기의 기존 기록이 있으면 이어받음. 실패 시 -1
+int xfer_manifest_open(XferManifest *m, const char *path, off_t filesize, off_t chunk_size);
+// 아직 받지 않은 청크 하나를 가져감. 남은 청크가 없으면 0
+int xfer_manifest_claim(XferManifest *m, size_t *chunk, off_t *offset, off_t *length);
+// 청크 수신 완료(해시와 함께 기록, 해시가 없으면 0) 또는 실패(다른 스트림이 다시 가져갈 수 있게 반환)
+int xfer_manifest_complete(XferManifest *m, size_t chunk, uint64_t hash);
+void xfer_manifest_release(XferManifest *m, size_t chunk);
+// 이어받기 전에 해시가 기록된 완료 청크를 fd(.part)에서 다시 해시해, 맞지 않는 청크를 받지 않은 것으로 되돌림.
+// 되돌린 청크 수 반환
+size_t xfer_manifest_verify(XferManifest *m, int fd);
+int xfer_manifest_finished(XferManifest *m);
+void xfer_manifest_close(XferManifest *m);
+
+const char *xfer_method_name(XferMethod method);
+// 단조 시계 기준 현재 시각 (초)
+double xfer_now(void);
+// "12.3 MB/s" 형식의 처리량 문자열
+void xfer_format_rate(char *out, size_t out_size, off_t bytes, double seconds);
+
+#endif
@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "history.h"
+#include "server.h"
+
+#define HISTORY_INITIAL_BUCKETS 64
+
+typedef struct {
+    uint64_t position;      // 바이트 링의 가상 위치 (계속 증가, 실제 위치는 % HISTORY_ROOM_BYTES)
+    uint32_t length;
+    int64_t time_ms;
+} HistoryRecord;
+
+// 방 하나의 기록. 구조체, 레코드 링, 바이트 링이 한 번의 할당(슬랩)에 들어 있습니다.
+typedef struct RoomHistory {
+    char room[ROOM_NAME_SIZE];
+    struct RoomHistory *next;       // 같은 해시 버킷
+    struct RoomHistory *lru_prev;   // 최근에 쓴 방이 앞쪽
+    struct RoomHistory *lru_next;
+    size_t first;                   // 가장 오래된 레코드의 위치
+    size_t count;
+    uint64_t tail;                  // 다음 메시지를 쓸 가상 위치
+    HistoryRecord records[HISTORY_ROOM_MESSAGES];
+    char data[HISTORY_ROOM_BYTES];
+} RoomHistory;
+
+struct HistoryStore {
+    RoomHistory **buckets;
+    size_t bucket_count;
+    RoomHistory *lru_head;
+    RoomHistory *lru_tail;
+    size_t budget;
+    atomic_size_t rooms;            // 이하 STATS 스레드가 읽음 (쓰는 쪽은 하나)
+    atomic_size_t bytes;
+    atomic_ullong evictions;
+};
+
+#define RECORD_AT(h, i) ((h)->records[((h)->first + (i)) % HISTORY_ROOM_MESSAGES])
+
+HistoryStore *history_new(size_t budget) {
+    HistoryStore *store = calloc(1, sizeof(HistoryStore));
+    if (!store) return NULL;
+    store->buckets = calloc(HISTORY_INITIAL_BUCKETS, sizeof(RoomHistory*));
+    if (!store->buckets) {
+        free(store);
+        return NULL;
+    }
+    store->bucket_count = HISTORY_INITIAL_BUCKETS;
+    store->budget = budget;
+    return store;
+}
+
+static RoomHistory *history_find(HistoryStore *store, const char *room) {
+    RoomHistory *h = store->buckets[name_hash(room) & (store->bucket_count - 1)];
+    while (h && strcmp(h->room, room) != 0) {
+        h = h->next;
+    }
+    return h;
+}
+
+static void lru_unlink(HistoryStore *store, RoomHistory *h) {
+    if (h->lru_prev) h->lru_prev->lru_next = h->lru_next;
+    else store->lru_head = h->lru_next;
+    if (h->lru_next) h->lru_next->lru_prev = h->lru_prev;
+    else store->lru_tail = h->lru_prev;
+    h->lru_prev = h->lru_next = NULL;
+}
+
+static void lru_push_front(HistoryStore *store, RoomHistory *h) {
+    h->lru_next = store->lru_head;
+    if (store->lru_head) store->lru_head->lru_prev = h;
+    store->lru_head = h;
+    if (!store->lru_tail) store->lru_tail = h;
+}
+
+static void lru_touch(HistoryStore *store, RoomHistory *h) {
+    if (store->lru_head == h) return;
+    lru_unlink(store, h);
+    lru_push_front(store, h);
+}
+
+static void history_remove(HistoryStore *store, RoomHistory *h) {
+    RoomHistory **link = &store->buckets[name_hash(h->room) & (store->bucket_count - 1)];
+    while (*link && *link != h) {
+        link = &(*link)->next;
+    }
+    if (*link) *link = h->next;
+    lru_unlink(store, h);
+    free(h);
+    atomic_store_explicit(&store->rooms, atomic_load_explicit(&store->rooms, memory_order_relaxed) - 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&store->bytes, atomic_load_explicit(&store->bytes, memory_order_relaxed) - sizeof(RoomHistory),
+                          memory_order_relaxed);
+}
+
+static void history_rehash(HistoryStore *store) {
+    size_t new_count = store->bucket_count * 2;
+    RoomHistory **new_buckets = calloc(new_count, sizeof(RoomHistory*));
+    if (!new_buckets) return; // 체인이 길어질 뿐 동작에는 문제 없음
+
+    for (size_t i = 0; i < store->bucket_count; i++) {
+        RoomHistory *h = store->buckets[i];
+        while (h) {
+            RoomHistory *next = h->next;
+            size_t b = name_hash(h->room) & (new_count - 1);
+            h->next = new_buckets[b];
+            new_buckets[b] = h;
+            h = next;
+        }
+    }
+    free(store->buckets);
+    store->buckets = new_buckets;
+    store->bucket_count = new_count;
+}
+
+// 예산 안에서 방 기록을 새로 만듦. 자리가 없으면 가장 오래 쓰이지 않은 방부터 버림
+static RoomHistory *history_create(HistoryStore *store, const char *room) {
+    if (store->budget < sizeof(RoomHistory)) return NULL;
+    while (store->lru_tail && atomic_load_explicit(&store->bytes, memory_order_relaxed) + sizeof(RoomHistory) > store->budget) {
+        history_remove(store, store->lru_tail);
+        atomic_fetch_add_explicit(&store->evictions, 1, memory_order_relaxed);
+    }
+
+    RoomHistory *h = malloc(sizeof(RoomHistory));
+    if (!h) return NULL;
+    strncpy(h->room, room, ROOM_NAME_SIZE - 1);
+    h->room[ROOM_NAME_SIZE - 1] = '\0';
+    h->first = 0;
+    h->count = 0;
+    h->tail = 0;
+    h->lru_prev = h->lru_next = NULL;
+
+    size_t rooms = atomic_load_explicit(&store->rooms, memory_order_relaxed);
+    if (rooms >= store->bucket_count) history_rehash(store);
+    size_t b = name_hash(h->room) & (store->bucket_count - 1);
+    h->next = store->buckets[b];
+    store->buckets[b] = h;
+    lru_push_front(store, h);
+    atomic_store_explicit(&store->rooms, rooms + 1, memory_order_relaxed);
+    atomic_store_explicit(&store->bytes, atomic_load_explicit(&store->bytes, memory_order_relaxed) + sizeof(RoomHistory),
+                          memory_order_relaxed);
+    return h;
+}
+
+void history_append(HistoryStore *store, const char *room, const char *message, size_t length, int64_t time_ms) {
+    if (!store || length == 0 || length > HISTORY_ROOM_BYTES) return;
+
+    RoomHistory *h = history_find(store, room);
+    if (h) lru_touch(store, h);
+    else if (!(h = history_create(store, room))) return;
+
+    // 메시지는 링 끝에 걸쳐 나뉘지 않도록, 남은 공간이 모자라면 다음 바퀴의 처음부터 씁니다.
+    uint64_t start = h->tail;
+    size_t offset = start % HISTORY_ROOM_BYTES;
+    if (offset + length > HISTORY_ROOM_BYTES) {
+        start += HISTORY_ROOM_BYTES - offset;
+        offset = 0;
+    }
+    uint64_t end = start + length;
+    while (h->count > 0 && (h->count == HISTORY_ROOM_MESSAGES || end - RECORD_AT(h, 0).position > HISTORY_ROOM_BYTES)) {
+        h->first = (h->first + 1) % HISTORY_ROOM_MESSAGES;
+        h->count--;
+    }
+
+    memcpy(h->data + offset, message, length);
+    HistoryRecord *record = &RECORD_AT(h, h->count);
+    record->position = start;
+    record->length = (uint32_t)length;
+    record->time_ms = time_ms;
+    h->count++;
+    h->tail = end;
+}
+
+int history_replay(HistoryStore *store, const char *room, int limit, int64_t since_ms,
+                   void (*visit)(const char *message, size_t length, void *ctx), void *ctx) {
+    if (!store || limit <= 0) return 0;
+    RoomHistory *h = history_find(store, room);
+    if (!h) return 0;
+    lru_touch(store, h);
+
+    size_t skip = h->count > (size_t)limit ? h->count - limit : 0;
+    while (skip < h->count && RECORD_AT(h, skip).time_ms < since_ms) skip++;
+    for (size_t i = skip; i < h->count; i++) {
+        const HistoryRecord *record = &RECORD_AT(h, i);
+        visit(h->data + record->position % HISTORY_ROOM_BYTES, record->length, ctx);
+    }
+    return (int)(h->count - skip);
+}
+
+void history_stats(HistoryStore *store, HistoryStats *out) {
+    out->rooms = atomic_load_explicit(&store->rooms, memory_order_relaxed);
+    out->bytes = atomic_load_explicit(&store->bytes, memory_order_relaxed);
+    out->evictions = atomic_load_explicit(&store->evictions, memory_order_relaxed);
+}
@@ -0,0 +1,39 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// --- 방별 최근 메시지 기록 (메모리) ---
+// 방마다 할당 한 번으로 만든 고정 크기 슬랩 하나를 링으로 씁니다. (메시지마다 malloc 하지 않음)
+// 슬랩은 레코드 색인 링과 바이트 링으로 나뉘고, 가득 차면 가장 오래된 메시지부터 덮어씁니다.
+// 방이 비어도 기록은 남으며(재접속한 사용자에게 재생), 저장소 전체 예산을 넘으면
+// 가장 오랫동안 쓰이지 않은 방의 기록부터 버립니다(LRU).
+// 저장소는 잠그지 않습니다: epoll/스레드 모드는 서버의 기록 조각(HistoryShard) 락, 멀티 리액터 모드는 소유 리액터 스레드에서만 호출합니다.
+
+#define HISTORY_ROOM_MESSAGES 256           // 방 하나가 기억하는 최대 메시지 수
+#define HISTORY_ROOM_BYTES (64 * 1024)      // 방 하나의 메시지 바이트 링 크기
+#define HISTORY_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+typedef struct HistoryStore HistoryStore;
+
+// budget: 모든 방의 슬랩 합계 상한 (바이트)
+HistoryStore *history_new(size_t budget);
+
+// 방의 기록 끝에 메시지 추가 (방 기록이 없으면 만들며, 예산을 넘으면 LRU 방을 버림)
+void history_append(HistoryStore *store, const char *room, const char *message, size_t length, int64_t time_ms);
+
+// 최근 limit개 중 since_ms 이후의 메시지를 오래된 것부터 visit에 넘김. 넘긴 개수 반환
+int history_replay(HistoryStore *store, const char *room, int limit, int64_t since_ms,
+                   void (*visit)(const char *message, size_t length, void *ctx), void *ctx);
+
+// STATS용 (다른 스레드에서 읽어도 됨)
+typedef struct {
+    size_t rooms;
+    size_t bytes;
+    unsigned long long evictions;
+} HistoryStats;
+
+void history_stats(HistoryStore *store, HistoryStats *out);
+
+#endif
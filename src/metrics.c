@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+
+#define METRICS_REQUEST_TIMEOUT_S 2
+#define METRICS_REQUEST_SIZE 64
+
+LogLevel log_level = LOG_INFO;
+unsigned log_sample_every = 1;
+
+// 스레드 하나가 쓰는 지표. 쓰는 쪽은 자기 샤드만 갱신하고(단일 기록자), 읽는 쪽은 relaxed로 합산합니다.
+// 스레드가 끝나면 샤드는 값을 유지한 채 다음 스레드가 이어 씁니다. (스레드 모드에서 샤드가 늘지 않도록)
+typedef struct MetricsShard {
+    atomic_ullong counters[METRIC_COUNTER_COUNT];
+    atomic_ullong buckets[METRIC_HISTOGRAM_COUNT][METRICS_HIST_BUCKETS];
+    atomic_ullong sums[METRIC_HISTOGRAM_COUNT];
+    int in_use;
+    struct MetricsShard *next;
+} MetricsShard;
+
+static pthread_mutex_t shards_mutex = PTHREAD_MUTEX_INITIALIZER;
+static MetricsShard *shards = NULL;
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static __thread MetricsShard *local_shard = NULL;
+static __thread unsigned log_counter = 0;
+
+static const char *counter_names[METRIC_COUNTER_COUNT] = {
+    "connections_accepted_total",
+    "connections_closed_total",
+    "handshakes_rejected_total",
+    "handshake_timeouts_total",
+    "commands_in_total",
+    "messages_in_total",
+    "file_requests_total",
+    "bytes_in_total",
+    "bytes_out_total",
+    "broadcasts_total",
+    "deliveries_total",
+};
+
+static void shard_release(void *arg) {
+    MetricsShard *shard = (MetricsShard*)arg;
+    pthread_mutex_lock(&shards_mutex);
+    shard->in_use = 0;
+    pthread_mutex_unlock(&shards_mutex);
+}
+
+static void shard_key_create(void) {
+    pthread_key_create(&shard_key, shard_release);
+}
+
+// 이 스레드의 샤드 (처음 기록할 때 빈 샤드를 재사용하거나 새로 만듦)
+static MetricsShard *shard_get(void) {
+    if (local_shard) return local_shard;
+
+    pthread_once(&shard_key_once, shard_key_create);
+    pthread_mutex_lock(&shards_mutex);
+    MetricsShard *shard = shards;
+    while (shard && shard->in_use) shard = shard->next;
+    if (!shard && (shard = calloc(1, sizeof(MetricsShard)))) {
+        shard->next = shards;
+        shards = shard;
+    }
+    if (shard) shard->in_use = 1;
+    pthread_mutex_unlock(&shards_mutex);
+
+    if (shard) pthread_setspecific(shard_key, shard);
+    local_shard = shard;
+    return shard;
+}
+
+static inline void shard_increment(atomic_ullong *slot, uint64_t value) {
+    atomic_store_explicit(slot, atomic_load_explicit(slot, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static int hist_index(uint64_t value) {
+    const int sub_count = 1 << METRICS_HIST_SUB_BITS;
+    if (value < (uint64_t)sub_count) return (int)value;
+    int msb = 63 - __builtin_clzll(value);
+    int index = (msb - METRICS_HIST_SUB_BITS + 1) * sub_count +
+                (int)((value >> (msb - METRICS_HIST_SUB_BITS)) & (sub_count - 1));
+    return index < METRICS_HIST_BUCKETS ? index : METRICS_HIST_BUCKETS - 1;
+}
+
+// 구간의 하한값
+static uint64_t hist_value(int index) {
+    const int sub_count = 1 << METRICS_HIST_SUB_BITS;
+    if (index < sub_count) return index;
+    int msb = index / sub_count + METRICS_HIST_SUB_BITS - 1;
+    return (uint64_t)(sub_count + index % sub_count) << (msb - METRICS_HIST_SUB_BITS);
+}
+
+void metrics_add(MetricCounter counter, uint64_t value) {
+    MetricsShard *shard = shard_get();
+    if (shard) shard_increment(&shard->counters[counter], value);
+}
+
+void metrics_observe(MetricHistogram histogram, uint64_t value) {
+    MetricsShard *shard = shard_get();
+    if (!shard) return;
+    shard_increment(&shard->buckets[histogram][hist_index(value)], 1);
+    shard_increment(&shard->sums[histogram], value);
+}
+
+uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void metrics_snapshot(MetricsSnapshot *out) {
+    memset(out, 0, sizeof(*out));
+
+    pthread_mutex_lock(&shards_mutex);
+    for (MetricsShard *shard = shards; shard; shard = shard->next) {
+        for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+            out->counters[c] += atomic_load_explicit(&shard->counters[c], memory_order_relaxed);
+        }
+        for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+            MetricsHistogramData *data = &out->histograms[h];
+            for (int b = 0; b < METRICS_HIST_BUCKETS; b++) {
+                uint64_t count = atomic_load_explicit(&shard->buckets[h][b], memory_order_relaxed);
+                data->counts[b] += count;
+                data->total += count;
+            }
+            data->sum += atomic_load_explicit(&shard->sums[h], memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&shards_mutex);
+}
+
+uint64_t metrics_percentile(const MetricsHistogramData *h, double percentile) {
+    uint64_t rank = (uint64_t)(h->total * percentile / 100.0 + 0.5);
+    uint64_t seen = 0;
+
+    if (h->total == 0) return 0;
+    if (rank == 0) rank = 1;
+    for (int b = 0; b < METRICS_HIST_BUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen >= rank) return hist_value(b);
+    }
+    return hist_value(METRICS_HIST_BUCKETS - 1);
+}
+
+const char *metrics_counter_name(MetricCounter counter) {
+    return counter_names[counter];
+}
+
+int log_sampled(void) {
+    return log_sample_every <= 1 || log_counter++ % log_sample_every == 0;
+}
+
+// --- 관리용 Unix 소켓 ---
+
+static int stats_sock = -1;
+static void (*stats_writer)(FILE *out);
+static int (*command_handler)(const char *command, FILE *out);
+
+static int write_full(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static void serve_request(int fd) {
+    char request[METRICS_REQUEST_SIZE];
+    size_t length = 0;
+    struct timeval timeout = { .tv_sec = METRICS_REQUEST_TIMEOUT_S, .tv_usec = 0 };
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while (length < sizeof(request) - 1) {
+        ssize_t n = recv(fd, request + length, sizeof(request) - 1 - length, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        length += n;
+        if (memchr(request, '\n', length)) break;
+    }
+    request[length] = '\0';
+    request[strcspn(request, "\r\n")] = '\0';
+
+    char *report = NULL;
+    size_t report_length = 0;
+    FILE *out = open_memstream(&report, &report_length);
+    if (!out) return;
+    if (strcmp(request, "STATS") == 0) {
+        stats_writer(out);
+    } else if (!command_handler || command_handler(request, out) < 0) {
+        fputs("ERR unknown command (try STATS)\n", out);
+    }
+    fclose(out);
+    write_full(fd, report, report_length);
+    free(report);
+}
+
+static void *stats_thread(void *arg) {
+    while (1) {
+        int fd = accept(stats_sock, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) perror("stats accept failed");
+            continue;
+        }
+        serve_request(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int metrics_serve(const char *path, void (*write_report)(FILE *out),
+                  int (*handle_command)(const char *command, FILE *out)) {
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path); // 이전 실행이 남긴 소켓 파일
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || chmod(path, 0600) < 0 || listen(sock, 8) < 0) {
+        close(sock);
+        return -1;
+    }
+    stats_sock = sock;
+    stats_writer = write_report;
+    command_handler = handle_command;
+
+    // 운영자 시그널(SIGUSR1)은 메인 스레드가 받도록 막은 상태로 시작
+    sigset_t all_signals, old_mask;
+    pthread_t tid;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &old_mask);
+    int created = pthread_create(&tid, NULL, stats_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (created != 0) {
+        close(sock);
+        stats_sock = -1;
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
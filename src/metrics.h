@@ -0,0 +1,80 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// --- 서버 운영 지표와 로그 ---
+// 카운터와 히스토그램은 스레드별 샤드에 락 없이 기록하고, STATS 요청이 올 때만 모든 샤드를 합칩니다.
+// (이벤트 루프/연결 스레드가 서로의 캐시 라인을 건드리지 않음)
+
+typedef enum {
+    METRIC_CONNECTIONS_ACCEPTED,
+    METRIC_CONNECTIONS_CLOSED,
+    METRIC_HANDSHAKES_REJECTED,     // 닉네임 중복, 정원 초과
+    METRIC_HANDSHAKE_TIMEOUTS,      // 제한 시간 안에 닉네임을 보내지 않아 끊은 연결
+    METRIC_COMMANDS_IN,             // 처리한 명령 수 (모든 opcode)
+    METRIC_MESSAGES_IN,             // 그 중 채팅 메시지(MSG)
+    METRIC_FILE_REQUESTS,
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_BROADCASTS,              // 방 브로드캐스트 횟수
+    METRIC_DELIVERIES,              // 브로드캐스트로 멤버 큐에 넣은 메시지 수 (fan-out 합계)
+    METRIC_COUNTER_COUNT
+} MetricCounter;
+
+typedef enum {
+    METRIC_BROADCAST_NS,            // 브로드캐스트 한 번에 걸린 시간 (인코딩 + 모든 멤버 큐 삽입/전송 시도)
+    METRIC_BROADCAST_MEMBERS,       // 브로드캐스트 한 번의 수신자 수
+    METRIC_HISTOGRAM_COUNT
+} MetricHistogram;
+
+// 2의 거듭제곱 구간마다 8칸 (오차 약 12%), 2^48까지
+#define METRICS_HIST_SUB_BITS 3
+#define METRICS_HIST_BUCKETS (48 << METRICS_HIST_SUB_BITS)
+
+typedef struct {
+    uint64_t counts[METRICS_HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+} MetricsHistogramData;
+
+typedef struct {
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    MetricsHistogramData histograms[METRIC_HISTOGRAM_COUNT];
+} MetricsSnapshot;
+
+void metrics_add(MetricCounter counter, uint64_t value);
+void metrics_observe(MetricHistogram histogram, uint64_t value);
+uint64_t metrics_now_ns(void);
+
+// 모든 스레드의 샤드를 합산
+void metrics_snapshot(MetricsSnapshot *out);
+uint64_t metrics_percentile(const MetricsHistogramData *h, double percentile);
+const char *metrics_counter_name(MetricCounter counter);
+
+// 로컬 Unix 소켓에서 관리 명령("STATS")을 받아 write_report의 출력을 돌려줌. 실패 시 -1
+// 다른 명령은 handle_command(NULL 가능)에 넘기며, 모르는 명령이면 -1을 반환해야 합니다.
+// 두 콜백 모두 별도 스레드에서 호출되며, 출력은 메모리에 모았다가 락 밖에서 전송합니다.
+int metrics_serve(const char *path, void (*write_report)(FILE *out),
+                  int (*handle_command)(const char *command, FILE *out));
+
+// --- 로그 ---
+// info: 접속/입장/퇴장 등 연결 단위 이벤트 (기본값), debug: 채팅 메시지마다 한 줄 (log_sample_every개 중 하나만)
+
+typedef enum {
+    LOG_ERROR,
+    LOG_INFO,
+    LOG_DEBUG
+} LogLevel;
+
+extern LogLevel log_level;
+extern unsigned log_sample_every;
+
+// 메시지 단위 로그를 이번에 남길 차례인지 (스레드별 카운터, 락 없음)
+int log_sampled(void);
+
+#define log_info(...) do { if (log_level >= LOG_INFO) printf(__VA_ARGS__); } while (0)
+#define log_message(...) do { if (log_level >= LOG_DEBUG && log_sampled()) printf(__VA_ARGS__); } while (0)
+
+#endif
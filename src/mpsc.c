@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "mpsc.h"
+
+int mpsc_init(MpscQueue *q) {
+    atomic_init(&q->stub.next, NULL);
+    atomic_init(&q->tail, &q->stub);
+    q->head = &q->stub;
+    atomic_init(&q->wake_pending, 0);
+    q->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return q->wake_fd < 0 ? -1 : 0;
+}
+
+static void enqueue(MpscQueue *q, MpscNode *node) {
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    MpscNode *prev = atomic_exchange_explicit(&q->tail, node, memory_order_acq_rel);
+    // 여기서부터 아래 저장까지 소비자에게는 큐가 끊겨 보입니다. (mpsc_pop이 NULL 반환)
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+void mpsc_wake(MpscQueue *q) {
+    if (atomic_exchange(&q->wake_pending, 1) == 0) {
+        uint64_t one = 1;
+        ssize_t written = write(q->wake_fd, &one, sizeof(one));
+        (void)written; // 카운터가 이미 0이 아니면 실패해도 깨어남
+    }
+}
+
+void mpsc_push(MpscQueue *q, MpscNode *node) {
+    enqueue(q, node);
+    // 연결을 마친 뒤에 확인하므로, 플래그가 이미 올라가 있으면 소비자가 다음 번에 이 작업을 봅니다.
+    mpsc_wake(q);
+}
+
+void mpsc_rearm(MpscQueue *q) {
+    uint64_t value;
+    ssize_t n = read(q->wake_fd, &value, sizeof(value));
+    (void)n;
+    atomic_store(&q->wake_pending, 0);
+}
+
+MpscNode *mpsc_pop(MpscQueue *q) {
+    MpscNode *head = q->head;
+    MpscNode *next = atomic_load_explicit(&head->next, memory_order_acquire);
+
+    if (head == &q->stub) {
+        if (!next) return NULL;
+        q->head = next;
+        head = next;
+        next = atomic_load_explicit(&head->next, memory_order_acquire);
+    }
+    if (next) {
+        q->head = next;
+        return head;
+    }
+    if (head != atomic_load_explicit(&q->tail, memory_order_acquire)) return NULL;
+
+    // 마지막 노드를 꺼내려면 그 뒤에 stub을 다시 붙여야 합니다.
+    enqueue(q, &q->stub);
+    next = atomic_load_explicit(&head->next, memory_order_acquire);
+    if (next) {
+        q->head = next;
+        return head;
+    }
+    return NULL;
+}
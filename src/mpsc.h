@@ -0,0 +1,34 @@
+#ifndef MPSC_H
+#define MPSC_H
+
+#include <stdatomic.h>
+
+// --- 다중 생산자 / 단일 소비자 작업 큐 (락 없음) ---
+// 여러 리액터가 넣은 작업을 큐를 가진 리액터 하나만 꺼냅니다. 노드는 작업 구조체 안에 둡니다(intrusive).
+// 넣기는 원자적 교환 한 번, 꺼내기는 소비자 전용 포인터만 움직입니다. (Vyukov 방식)
+// 소비자가 잠들어 있을 수 있으므로 넣은 쪽이 eventfd로 깨우며, 깨우기는 소비자가 비울 때까지 한 번으로 합쳐집니다.
+
+typedef struct MpscNode {
+    struct MpscNode *_Atomic next;
+} MpscNode;
+
+typedef struct {
+    MpscNode *_Atomic tail;     // 생산자들이 교환하는 끝
+    MpscNode *head;             // 소비자 전용
+    MpscNode stub;
+    atomic_int wake_pending;    // 이미 eventfd에 써 두었음 (소비자가 mpsc_rearm으로 내림)
+    int wake_fd;                // 소비자의 epoll에 등록할 eventfd
+} MpscQueue;
+
+// eventfd 생성 실패 시 -1
+int mpsc_init(MpscQueue *q);
+// 아무 스레드에서나 호출
+void mpsc_push(MpscQueue *q, MpscNode *node);
+// 소비자를 깨움 (소비자가 처리 한도를 넘겨 남은 작업을 다음 바퀴로 미룰 때도 사용)
+void mpsc_wake(MpscQueue *q);
+// 소비자: 꺼내기 전에 wake_fd를 비우고 깨우기 플래그를 내림 (그 뒤에 넣은 작업은 다시 깨움)
+void mpsc_rearm(MpscQueue *q);
+// 소비자: 가장 오래된 작업. 비었거나 생산자가 아직 연결 중이면 NULL (그 생산자가 다시 깨움)
+MpscNode *mpsc_pop(MpscQueue *q);
+
+#endif
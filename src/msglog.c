@@ -0,0 +1,771 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "msglog.h"
+#include "server.h"
+
+// 세그먼트 파일 = [헤더][희소 색인][데이터]
+// 데이터 영역의 레코드 = [길이 4][체크섬 4][시각 8][본문], 8바이트 단위로 맞춤. 길이 0이 끝 표시 (파일을 만들 때 예약한 0으로 찬 공간)
+#define SEGMENT_MAGIC "CHATLOG1"
+#define INDEX_OFFSET 256
+#define DATA_OFFSET (64 * 1024)
+#define RECORD_SIZE(length) ((sizeof(RecordHeader) + (length) + 7) & ~(size_t)7)
+#define MSGLOG_INITIAL_BUCKETS 64
+
+typedef struct {
+    char magic[8];
+    uint64_t base_seq;              // 첫 레코드의 방 안 순번 (파일 이름과 같음)
+    uint64_t committed_end;         // 동기화를 마친 데이터의 끝 (파일 오프셋)
+    uint64_t committed_count;       // committed_end 앞의 레코드 수
+    uint64_t index_count;           // 동기화를 마친 색인 항목 수
+    int64_t committed_last_time;
+    char room[ROOM_NAME_SIZE];      // 참고용 (방 디렉토리 이름이 기준)
+} SegmentHeader;
+
+typedef struct {
+    int64_t time_ms;
+    uint32_t offset;                // 레코드의 파일 오프셋
+    uint32_t seq;                   // 세그먼트 안에서의 순번
+} IndexEntry;
+
+typedef struct {
+    uint32_t length;
+    uint32_t checksum;              // 시각과 본문의 FNV-1a (잘린 레코드 검출용)
+    int64_t time_ms;
+} RecordHeader;
+
+_Static_assert(sizeof(SegmentHeader) <= INDEX_OFFSET, "segment header overlaps the index");
+
+#define INDEX_CAPACITY ((DATA_OFFSET - INDEX_OFFSET) / sizeof(IndexEntry))
+
+typedef struct RoomLog RoomLog;
+
+typedef struct LogSegment {
+    struct LogSegment *prev;        // 같은 방의 이전/다음 세그먼트 (오래된 것이 앞)
+    struct LogSegment *next;
+    RoomLog *log;
+    char *map;
+    uint64_t base_seq;
+    // 쓰는 쪽(저장소를 가진 스레드)만 사용
+    size_t end;
+    uint32_t count;
+    uint32_t index_count;
+    int64_t last_time;
+    int full;                       // 남은 공간의 디스크 블록을 예약하지 못함: 더 쓰지 않고 새 세그먼트로 넘어감
+    unsigned long long spare_id;    // 미리 만든 예비 세그먼트의 임시 파일 번호 (0이면 순번 이름의 파일)
+    atomic_size_t reserved;         // 디스크 블록을 예약한 끝 (파일 오프셋). 쓰는 쪽과 동기화 스레드가 늘림
+    // 동기화 스레드에 공개 (색인 항목과 레코드를 다 쓴 뒤 release로 저장)
+    atomic_uint written_index;
+    atomic_size_t written_end;
+    atomic_int queued;              // 동기화 대기 목록에 들어 있음
+    atomic_int sync_dirs;           // 새로 만든 파일/디렉토리: 1 방 디렉토리, 2 로그 디렉토리도 fsync
+    struct LogSegment *dirty_next;
+    struct LogSegment *retired_next;    // 보존 한도로 떼어 내 지울 세그먼트 목록
+    // 동기화하는 쪽만 사용 (헤더에 확정한 값)
+    size_t synced_end;
+    uint64_t synced_count;
+    int64_t synced_last_time;
+    int spare_made;                 // 이 세그먼트를 보고 예비 세그먼트를 만들었음
+} LogSegment;
+
+struct RoomLog {
+    char room[ROOM_NAME_SIZE];
+    char path[PATH_MAX + ROOM_NAME_SIZE * 2];   // 방 디렉토리 (로그 디렉토리/방 이름 16진수)
+    const char *parent;
+    RoomLog *next;                  // 같은 해시 버킷
+    LogSegment *first;
+    LogSegment *last;
+    size_t segment_count;
+    int64_t last_time;
+    _Atomic(LogSegment*) spare;     // 동기화 스레드가 미리 만들어 둔 다음 세그먼트 (쓰는 쪽이 가져감)
+};
+
+struct MsgLogStore {
+    char dir[PATH_MAX];
+    RoomLog **buckets;
+    size_t bucket_count;
+    atomic_size_t rooms;            // 이하 STATS 스레드가 읽음 (쓰는 쪽은 하나)
+    atomic_size_t segments;
+    atomic_ullong bytes;
+    atomic_ullong appended;
+    atomic_ullong errors;
+    atomic_ullong removed;
+};
+
+// 동기화 대기 목록 (모든 저장소 공용, 동기화 스레드 하나가 비움)
+static pthread_mutex_t dirty_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LogSegment *dirty_head = NULL;
+static LogSegment *retired_head = NULL;
+static unsigned long long retention_bytes = 0;  // 방마다 남길 세그먼트 크기 합 (0이면 지우지 않음)
+static atomic_ullong spare_serial = 0;
+static int sync_interval_ms = MSGLOG_DEFAULT_SYNC_MS;
+static int sync_inline = 0;         // 추가할 때마다 쓰는 쪽이 바로 동기화
+static atomic_ullong sync_count = 0;
+static size_t page_size = 4096;
+
+static uint32_t record_checksum(int64_t time_ms, const char *data, size_t length) {
+    const unsigned char *time_bytes = (const unsigned char*)&time_ms;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(time_ms); i++) {
+        hash = (hash ^ time_bytes[i]) * 16777619u;
+    }
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static const IndexEntry *segment_index(const LogSegment *seg) {
+    return (const IndexEntry*)(seg->map + INDEX_OFFSET);
+}
+
+static const RecordHeader *record_at(const LogSegment *seg, size_t offset) {
+    return (const RecordHeader*)(seg->map + offset);
+}
+
+// offset에 완전한 레코드가 있는지 (복구할 때 확정된 끝 뒤를 검사)
+static int record_valid(const LogSegment *seg, size_t offset) {
+    if (offset + sizeof(RecordHeader) > MSGLOG_SEGMENT_SIZE) return 0;
+    const RecordHeader *record = record_at(seg, offset);
+    if (record->length == 0 || record->length > MSGLOG_SEGMENT_SIZE - offset - sizeof(RecordHeader)) return 0;
+    return record->checksum == record_checksum(record->time_ms, (const char*)(record + 1), record->length);
+}
+
+// 레코드를 쓰기 전에 호출: 첫 레코드이거나 마지막 색인 항목에서 간격 이상 떨어졌으면 색인에 추가
+static void segment_index_record(LogSegment *seg, size_t offset, int64_t time_ms) {
+    IndexEntry *index = (IndexEntry*)(seg->map + INDEX_OFFSET);
+    if (seg->index_count > 0 && offset - index[seg->index_count - 1].offset < MSGLOG_INDEX_INTERVAL) return;
+    if (seg->index_count >= INDEX_CAPACITY) return;
+    index[seg->index_count].time_ms = time_ms;
+    index[seg->index_count].offset = (uint32_t)offset;
+    index[seg->index_count].seq = seg->count;
+    seg->index_count++;
+}
+
+static void segment_path(const RoomLog *log, uint64_t base_seq, char *path, size_t size) {
+    snprintf(path, size, "%s/%020llu.seg", log->path, (unsigned long long)base_seq);
+}
+
+static void spare_path(const RoomLog *log, unsigned long long id, char *path, size_t size) {
+    snprintf(path, size, "%s/spare-%llu.tmp", log->path, id);
+}
+
+// 세그먼트 파일의 디스크 블록을 upto(파일 오프셋)까지 예약. 매핑으로 쓰는 자리는 쓰기 전에 예약해야 합니다.
+// 희소 파일에 쓰다 디스크가 차면 SIGBUS로 서버가 죽기 때문입니다. 실패 시 -1
+static int segment_reserve_fd(LogSegment *seg, int fd, size_t upto) {
+    size_t reserved = atomic_load_explicit(&seg->reserved, memory_order_acquire);
+    if (upto > MSGLOG_SEGMENT_SIZE) upto = MSGLOG_SEGMENT_SIZE;
+    if (upto <= reserved) return 0;
+    if (posix_fallocate(fd, reserved, upto - reserved) != 0) return -1;
+    // 쓰는 쪽과 동기화 스레드가 함께 예약할 수 있으므로 더 큰 값만 남김
+    while (reserved < upto &&
+           !atomic_compare_exchange_weak_explicit(&seg->reserved, &reserved, upto,
+                                                  memory_order_release, memory_order_acquire)) {
+    }
+    return 0;
+}
+
+static int segment_reserve(LogSegment *seg, size_t upto) {
+    char path[sizeof(seg->log->path) + 32];
+    segment_path(seg->log, seg->base_seq, path, sizeof(path));
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return -1;
+    int result = segment_reserve_fd(seg, fd, upto);
+    close(fd);
+    return result;
+}
+
+static void fsync_path(const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+// 쓴 데이터와 색인을 먼저 디스크에 내린 뒤 헤더의 확정 값을 갱신합니다.
+// 헤더가 가리키는 범위는 항상 온전하므로, 재시작할 때 그 뒤만 검사하면 됩니다.
+static void segment_sync(LogSegment *seg) {
+    size_t end = atomic_load_explicit(&seg->written_end, memory_order_acquire);
+    unsigned index_count = atomic_load_explicit(&seg->written_index, memory_order_acquire);
+    int dirs = atomic_exchange(&seg->sync_dirs, 0);
+    SegmentHeader *header = (SegmentHeader*)seg->map;
+    const IndexEntry *index = segment_index(seg);
+
+    if (end == seg->synced_end && !dirs) return;
+
+    // 확정할 값: end 앞의 레코드와 색인 항목만 (쓰는 쪽은 그 사이 더 썼을 수 있음)
+    for (size_t offset = seg->synced_end; offset < end; ) {
+        const RecordHeader *record = record_at(seg, offset);
+        seg->synced_count++;
+        seg->synced_last_time = record->time_ms;
+        offset += RECORD_SIZE(record->length);
+    }
+    while (index_count > 0 && index[index_count - 1].offset >= end) index_count--;
+
+    size_t from = seg->synced_end & ~(page_size - 1);
+    if (end > from) msync(seg->map + from, end - from, MS_SYNC);
+    msync(seg->map, DATA_OFFSET, MS_SYNC);  // 색인 (바뀐 페이지만 쓰임)
+    if (dirs) {
+        fsync_path(seg->log->path);
+        if (dirs & 2) fsync_path(seg->log->parent);
+    }
+
+    header->committed_end = end;
+    header->committed_count = seg->synced_count;
+    header->index_count = index_count;
+    header->committed_last_time = seg->synced_last_time;
+    msync(seg->map, page_size, MS_SYNC);
+    seg->synced_end = end;
+    atomic_fetch_add_explicit(&sync_count, 1, memory_order_relaxed);
+}
+
+// 쓴 만큼을 동기화하는 쪽에 공개하고, 처음 바뀐 세그먼트면 대기 목록에 넣음
+static void segment_written(LogSegment *seg) {
+    atomic_store_explicit(&seg->written_index, seg->index_count, memory_order_release);
+    atomic_store_explicit(&seg->written_end, seg->end, memory_order_release);
+    if (sync_inline) {
+        segment_sync(seg);
+        return;
+    }
+    // 동기화 스레드는 queued를 내린 뒤 끝을 읽으므로, 그 뒤에 쓴 것은 여기서 다시 목록에 들어갑니다.
+    if (atomic_exchange(&seg->queued, 1) == 0) {
+        pthread_mutex_lock(&dirty_mutex);
+        seg->dirty_next = dirty_head;
+        dirty_head = seg;
+        pthread_mutex_unlock(&dirty_mutex);
+    }
+}
+
+static LogSegment *segment_open(RoomLog *log, const char *path, uint64_t base_seq, int create);
+
+// 떼어 낸 세그먼트를 지움 (동기화 대기 목록에서 빠진 뒤에만)
+static void segment_remove(LogSegment *seg) {
+    char path[sizeof(seg->log->path) + 32];
+    segment_path(seg->log, seg->base_seq, path, sizeof(path));
+    unlink(path);
+    munmap(seg->map, MSGLOG_SEGMENT_SIZE);
+    free(seg);
+}
+
+// 동기화 스레드에서: 쓰는 쪽이 방/조각 락 안에서 디스크 블록을 예약하거나 세그먼트 파일을 만들지 않도록
+// 다음 주기에 쓸 만큼을 미리 예약하고, 3/4을 넘게 쓴 세그먼트는 다음 세그먼트를 임시 이름으로 만들어 둡니다.
+static void segment_prepare(LogSegment *seg) {
+    size_t end = atomic_load_explicit(&seg->written_end, memory_order_acquire);
+    RoomLog *log = seg->log;
+
+    if (end + MSGLOG_RESERVE_CHUNK / 2 > atomic_load_explicit(&seg->reserved, memory_order_acquire)) {
+        segment_reserve(seg, end + MSGLOG_RESERVE_CHUNK); // 실패하면 쓰는 쪽이 다시 시도
+    }
+    if (seg->spare_made || end < MSGLOG_SEGMENT_SIZE / 4 * 3 || atomic_load(&log->spare)) return;
+    seg->spare_made = 1;
+
+    char path[sizeof(log->path) + 32];
+    unsigned long long id = atomic_fetch_add(&spare_serial, 1) + 1;
+    spare_path(log, id, path, sizeof(path));
+    LogSegment *spare = segment_open(log, path, 0, 1);
+    if (!spare) return;
+    spare->spare_id = id;
+    atomic_store(&log->spare, spare);
+}
+
+static void *sync_thread(void *arg) {
+    struct timespec interval = {
+        .tv_sec = sync_interval_ms / 1000,
+        .tv_nsec = (long)(sync_interval_ms % 1000) * 1000000
+    };
+
+    while (1) {
+        nanosleep(&interval, NULL);
+        // 떼어 낸 세그먼트는 마지막으로 쓴 뒤에 떼어 냈으므로, 같은 때에 가져온 대기 목록에 있거나 이미 동기화됨
+        pthread_mutex_lock(&dirty_mutex);
+        LogSegment *seg = dirty_head;
+        LogSegment *retired = retired_head;
+        dirty_head = NULL;
+        retired_head = NULL;
+        pthread_mutex_unlock(&dirty_mutex);
+
+        while (seg) {
+            LogSegment *next = seg->dirty_next; // queued를 내리면 쓰는 쪽이 dirty_next를 다시 씀
+            atomic_store(&seg->queued, 0);
+            segment_sync(seg);
+            segment_prepare(seg);
+            seg = next;
+        }
+        while (retired) {
+            LogSegment *next = retired->retired_next;
+            segment_remove(retired);
+            retired = next;
+        }
+    }
+    return NULL;
+}
+
+void msglog_set_retention(unsigned long long bytes) {
+    retention_bytes = bytes;
+}
+
+int msglog_start_sync(int interval_ms) {
+    if (interval_ms <= 0) {
+        sync_inline = 1;
+        return 0;
+    }
+    sync_interval_ms = interval_ms;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, sync_thread, NULL) != 0) return -1;
+    pthread_detach(tid);
+    return 0;
+}
+
+// 재시작: 헤더의 확정 값을 믿고, 그 뒤에 체크섬이 맞는 레코드만 이어 붙임 (색인도 함께 다시 만듦)
+static void segment_recover(LogSegment *seg, int fd) {
+    SegmentHeader *header = (SegmentHeader*)seg->map;
+    const IndexEntry *index = segment_index(seg);
+
+    seg->end = header->committed_end;
+    seg->count = (uint32_t)header->committed_count;
+    seg->index_count = (uint32_t)header->index_count;
+    seg->last_time = header->committed_last_time;
+    if (seg->end < DATA_OFFSET || seg->end > MSGLOG_SEGMENT_SIZE || seg->index_count > INDEX_CAPACITY ||
+        (seg->index_count > 0 && index[seg->index_count - 1].offset >= seg->end)) {
+        // 헤더가 망가졌으면 처음부터 검사
+        seg->end = DATA_OFFSET;
+        seg->count = 0;
+        seg->index_count = 0;
+        seg->last_time = 0;
+    }
+    seg->synced_end = seg->end;
+    seg->synced_count = seg->count;
+    seg->synced_last_time = seg->last_time;
+
+    while (record_valid(seg, seg->end)) {
+        const RecordHeader *record = record_at(seg, seg->end);
+        segment_index_record(seg, seg->end, record->time_ms);
+        seg->count++;
+        seg->last_time = record->time_ms;
+        seg->end += RECORD_SIZE(record->length);
+    }
+
+    // 끝 뒤에 남은 잘린 레코드를 지움. 이어 쓴 레코드 뒤에서 옛 레코드가 되살아나지 않도록 합니다.
+    size_t clear_from = (seg->end + page_size - 1) & ~(page_size - 1);
+    if (clear_from > MSGLOG_SEGMENT_SIZE) clear_from = MSGLOG_SEGMENT_SIZE;
+    for (size_t offset = seg->end; offset < clear_from; offset++) {
+        if (seg->map[offset] != 0) {
+            memset(seg->map + seg->end, 0, clear_from - seg->end);
+            break;
+        }
+    }
+    off_t data = clear_from < MSGLOG_SEGMENT_SIZE ? lseek(fd, clear_from, SEEK_DATA) : -1;
+    if (data >= 0 && data < MSGLOG_SEGMENT_SIZE &&
+        fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, clear_from, MSGLOG_SEGMENT_SIZE - clear_from) < 0) {
+        memset(seg->map + clear_from, 0, MSGLOG_SEGMENT_SIZE - clear_from);
+    }
+}
+
+// 세그먼트 파일을 만들거나(create) 열어서 매핑. 매핑한 뒤에는 파일을 닫아도 됩니다.
+// 새 파일은 희소 파일로 만들고 헤더와 첫 MSGLOG_RESERVE_CHUNK만 예약합니다. 나머지는 쓰는 만큼 조금씩 예약합니다.
+static LogSegment *segment_open(RoomLog *log, const char *path, uint64_t base_seq, int create) {
+    struct stat st;
+
+    int fd = open(path, create ? O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC : O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) return NULL;
+    if (create ? ftruncate(fd, MSGLOG_SEGMENT_SIZE) < 0 ||
+                 posix_fallocate(fd, 0, DATA_OFFSET + MSGLOG_RESERVE_CHUNK) != 0
+               : fstat(fd, &st) < 0 || st.st_size != MSGLOG_SEGMENT_SIZE) {
+        if (create) unlink(path); // 덜 만든 파일이 재시작 때 읽히지 않도록
+        close(fd);
+        return NULL;
+    }
+    char *map = mmap(NULL, MSGLOG_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    LogSegment *seg = map != MAP_FAILED ? calloc(1, sizeof(LogSegment)) : NULL;
+    SegmentHeader *header = (SegmentHeader*)map;
+    if (!seg || (!create && (memcmp(header->magic, SEGMENT_MAGIC, 8) != 0 || header->base_seq != base_seq))) {
+        if (map != MAP_FAILED) munmap(map, MSGLOG_SEGMENT_SIZE);
+        free(seg);
+        close(fd);
+        return NULL;
+    }
+    seg->map = map;
+    seg->log = log;
+    seg->base_seq = base_seq;
+
+    if (create) {
+        memcpy(header->magic, SEGMENT_MAGIC, 8);
+        header->base_seq = base_seq;
+        header->committed_end = DATA_OFFSET;
+        snprintf(header->room, sizeof(header->room), "%s", log->room);
+        seg->end = DATA_OFFSET;
+        seg->synced_end = DATA_OFFSET;
+        atomic_init(&seg->sync_dirs, 1);
+        atomic_init(&seg->reserved, DATA_OFFSET + MSGLOG_RESERVE_CHUNK);
+    } else {
+        segment_recover(seg, fd);
+        // 쓴 끝까지는 블록이 있음. 복구하며 구멍을 낸 꼬리는 이어 쓸 만큼 다시 예약하고, 못 하면 읽기만 하고 이어 쓰지 않음
+        atomic_init(&seg->reserved, seg->end);
+        if (segment_reserve_fd(seg, fd, seg->end + MSGLOG_RESERVE_CHUNK) < 0) seg->full = 1;
+    }
+    close(fd);
+    atomic_init(&seg->written_index, seg->index_count);
+    atomic_init(&seg->written_end, seg->synced_end);
+    atomic_init(&seg->queued, 0);
+    return seg;
+}
+
+static void segment_link(MsgLogStore *store, RoomLog *log, LogSegment *seg) {
+    seg->prev = log->last;
+    if (log->last) log->last->next = seg;
+    else log->first = seg;
+    log->last = seg;
+    log->segment_count++;
+    if (seg->count > 0) log->last_time = seg->last_time;
+    atomic_fetch_add_explicit(&store->segments, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&store->bytes, seg->end - DATA_OFFSET, memory_order_relaxed);
+}
+
+// 보존 한도(방마다 세그먼트 크기 합)를 넘은 가장 오래된 세그먼트를 방에서 떼어 냄. 쓰고 있는 마지막 세그먼트는 남깁니다.
+// 떼어 낸 세그먼트는 동기화 대기 목록에 있을 수 있으므로, 매핑 해제와 파일 삭제는 동기화 스레드가 그 주기를 마친 뒤에 합니다.
+static void log_trim(MsgLogStore *store, RoomLog *log) {
+    while (retention_bytes > 0 && log->first != log->last &&
+           (unsigned long long)log->segment_count * MSGLOG_SEGMENT_SIZE > retention_bytes) {
+        LogSegment *seg = log->first;
+        log->first = seg->next;
+        log->first->prev = NULL;
+        log->segment_count--;
+        atomic_fetch_sub_explicit(&store->segments, 1, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&store->bytes, seg->end - DATA_OFFSET, memory_order_relaxed);
+        atomic_fetch_add_explicit(&store->removed, 1, memory_order_relaxed);
+
+        if (sync_inline) {
+            segment_remove(seg);
+            continue;
+        }
+        pthread_mutex_lock(&dirty_mutex);
+        seg->retired_next = retired_head;
+        retired_head = seg;
+        pthread_mutex_unlock(&dirty_mutex);
+    }
+}
+
+// 방의 다음 세그먼트: 동기화 스레드가 만들어 둔 예비 세그먼트가 있으면 순번 이름으로 바꿔 쓰고, 없으면 여기서 만듦
+static LogSegment *segment_next(RoomLog *log, uint64_t base_seq) {
+    char path[sizeof(log->path) + 32];
+    LogSegment *seg = atomic_exchange(&log->spare, NULL);
+
+    segment_path(log, base_seq, path, sizeof(path));
+    if (seg) {
+        char from[sizeof(log->path) + 32];
+        spare_path(log, seg->spare_id, from, sizeof(from));
+        // 헤더를 먼저 고침. 이름을 바꾸기 전에 멈추면 임시 파일은 재시작할 때 지워집니다.
+        ((SegmentHeader*)seg->map)->base_seq = base_seq;
+        if (rename(from, path) == 0) {
+            seg->base_seq = base_seq;
+            seg->spare_id = 0;
+            return seg;
+        }
+        unlink(from);
+        munmap(seg->map, MSGLOG_SEGMENT_SIZE);
+        free(seg);
+    }
+    return segment_open(log, path, base_seq, 1);
+}
+
+// --- 방 이름 <-> 디렉토리 이름 (16진수로 바꿔 어떤 문자도 경로에 들어가지 않게 함) ---
+
+static void room_to_dirname(const char *room, char *out) {
+    static const char digits[] = "0123456789abcdef";
+    for (; *room; room++) {
+        *out++ = digits[(unsigned char)*room >> 4];
+        *out++ = digits[(unsigned char)*room & 15];
+    }
+    *out = '\0';
+}
+
+static int dirname_to_room(const char *name, char *room) {
+    size_t length = strlen(name);
+    if (length == 0 || length % 2 != 0 || length / 2 >= ROOM_NAME_SIZE) return -1;
+    for (size_t i = 0; i < length; i += 2) {
+        unsigned int byte;
+        if (sscanf(name + i, "%2x", &byte) != 1 || byte == 0) return -1;
+        room[i / 2] = (char)byte;
+    }
+    room[length / 2] = '\0';
+    return 0;
+}
+
+// --- 방 로그 해시 ---
+
+static RoomLog *log_find(MsgLogStore *store, const char *room) {
+    RoomLog *log = store->buckets[name_hash(room) & (store->bucket_count - 1)];
+    while (log && strcmp(log->room, room) != 0) {
+        log = log->next;
+    }
+    return log;
+}
+
+static void log_rehash(MsgLogStore *store) {
+    size_t new_count = store->bucket_count * 2;
+    RoomLog **new_buckets = calloc(new_count, sizeof(RoomLog*));
+    if (!new_buckets) return; // 체인이 길어질 뿐 동작에는 문제 없음
+
+    for (size_t i = 0; i < store->bucket_count; i++) {
+        RoomLog *log = store->buckets[i];
+        while (log) {
+            RoomLog *next = log->next;
+            size_t b = name_hash(log->room) & (new_count - 1);
+            log->next = new_buckets[b];
+            new_buckets[b] = log;
+            log = next;
+        }
+    }
+    free(store->buckets);
+    store->buckets = new_buckets;
+    store->bucket_count = new_count;
+}
+
+static RoomLog *log_new(MsgLogStore *store, const char *room) {
+    char dirname[ROOM_NAME_SIZE * 2];
+    RoomLog *log = calloc(1, sizeof(RoomLog));
+    if (!log) return NULL;
+    snprintf(log->room, sizeof(log->room), "%s", room);
+    room_to_dirname(log->room, dirname);
+    snprintf(log->path, sizeof(log->path), "%s/%s", store->dir, dirname);
+    log->parent = store->dir;
+
+    size_t rooms = atomic_load_explicit(&store->rooms, memory_order_relaxed);
+    if (rooms >= store->bucket_count) log_rehash(store);
+    size_t b = name_hash(log->room) & (store->bucket_count - 1);
+    log->next = store->buckets[b];
+    store->buckets[b] = log;
+    atomic_store_explicit(&store->rooms, rooms + 1, memory_order_relaxed);
+    return log;
+}
+
+static int segment_name_filter(const struct dirent *entry) {
+    size_t length = strlen(entry->d_name);
+    return (length == 24 && strcmp(entry->d_name + 20, ".seg") == 0) ||
+           (strncmp(entry->d_name, "spare-", 6) == 0 && length > 10 && strcmp(entry->d_name + length - 4, ".tmp") == 0);
+}
+
+// 방 디렉토리의 세그먼트를 순번 순서로 매핑 (파일 이름이 0으로 채운 순번이라 이름순이 곧 순번순)
+static void log_load(MsgLogStore *store, RoomLog *log) {
+    struct dirent **entries;
+    int n = scandir(log->path, &entries, segment_name_filter, alphasort);
+    if (n < 0) return;
+
+    for (int i = 0; i < n; i++) {
+        char path[sizeof(log->path) + NAME_MAX + 2];
+        snprintf(path, sizeof(path), "%s/%s", log->path, entries[i]->d_name);
+        if (entries[i]->d_name[0] == 's') {
+            unlink(path); // 쓰기 전에 멈춘 예비 세그먼트
+            free(entries[i]);
+            continue;
+        }
+        uint64_t base_seq = strtoull(entries[i]->d_name, NULL, 10);
+        LogSegment *seg = segment_open(log, path, base_seq, 0);
+        if (seg) {
+            segment_link(store, log, seg);
+            if (seg->end != seg->synced_end) segment_written(seg); // 복구한 꼬리를 헤더에 확정
+        } else {
+            fprintf(stderr, "message log: skipping unreadable segment %s/%s\n", log->path, entries[i]->d_name);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    log_trim(store, log);
+}
+
+MsgLogStore *msglog_open(const char *dir, int shard, int shard_count) {
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (strlen(dir) >= PATH_MAX) return NULL;
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) return NULL;
+
+    MsgLogStore *store = calloc(1, sizeof(MsgLogStore));
+    if (!store) return NULL;
+    snprintf(store->dir, sizeof(store->dir), "%s", dir);
+    store->buckets = calloc(MSGLOG_INITIAL_BUCKETS, sizeof(RoomLog*));
+    DIR *d = store->buckets ? opendir(dir) : NULL;
+    if (!d) {
+        free(store->buckets);
+        free(store);
+        return NULL;
+    }
+    store->bucket_count = MSGLOG_INITIAL_BUCKETS;
+
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        char room[ROOM_NAME_SIZE];
+        if (dirname_to_room(entry->d_name, room) < 0) continue;
+        if (shard_count > 1 && name_hash(room) % shard_count != (size_t)shard) continue;
+        RoomLog *log = log_new(store, room);
+        if (log) log_load(store, log);
+    }
+    closedir(d);
+    return store;
+}
+
+int msglog_append(MsgLogStore *store, const char *room, const char *message, size_t length, int64_t time_ms) {
+    if (!store || length == 0) return -1;
+    if (length > MSGLOG_SEGMENT_SIZE - DATA_OFFSET - sizeof(RecordHeader)) goto fail;
+
+    RoomLog *log = log_find(store, room);
+    int new_dir = 0;
+    if (!log) {
+        if (!(log = log_new(store, room))) goto fail;
+        if (mkdir(log->path, 0755) < 0 && errno != EEXIST) goto fail;
+        new_dir = 1;
+    }
+    // 같은 방의 시각은 겹치지 않게 (HISTORY의 since로 이어 읽을 때 빠지거나 겹치는 메시지가 없도록)
+    if (time_ms <= log->last_time) time_ms = log->last_time + 1;
+
+    size_t size = RECORD_SIZE(length);
+    LogSegment *seg = log->last;
+    if (!seg || seg->full || seg->end + size > MSGLOG_SEGMENT_SIZE) {
+        seg = segment_next(log, seg ? seg->base_seq + seg->count : 0);
+        if (!seg) goto fail;
+        atomic_store(&seg->sync_dirs, new_dir || !log->first ? 3 : 1);
+        segment_link(store, log, seg);
+        log_trim(store, log);
+    }
+    // 보통은 동기화 스레드가 미리 예약해 둠. 쓰는 속도가 앞질렀을 때만 여기서 예약하고, 못 하면 다음 메시지부터 새 세그먼트로
+    if (seg->end + size > atomic_load_explicit(&seg->reserved, memory_order_acquire) &&
+        segment_reserve(seg, seg->end + size + MSGLOG_RESERVE_CHUNK) < 0) {
+        seg->full = 1;
+        goto fail;
+    }
+
+    // 본문을 먼저 쓰고 길이를 마지막에 씀. 확정된 끝 뒤의 레코드는 재시작할 때 체크섬으로 다시 확인합니다.
+    RecordHeader *record = (RecordHeader*)(seg->map + seg->end);
+    memcpy(record + 1, message, length);
+    record->time_ms = time_ms;
+    record->checksum = record_checksum(time_ms, message, length);
+    record->length = (uint32_t)length;
+    segment_index_record(seg, seg->end, time_ms);
+    seg->end += size;
+    seg->count++;
+    seg->last_time = time_ms;
+    log->last_time = time_ms;
+    segment_written(seg);
+
+    atomic_fetch_add_explicit(&store->appended, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&store->bytes, size, memory_order_relaxed);
+    return 0;
+
+fail:
+    atomic_fetch_add_explicit(&store->errors, 1, memory_order_relaxed);
+    return -1;
+}
+
+// 세그먼트에서 since_ms 이상인 첫 레코드를 찾기 시작할 위치: 시각이 since_ms보다 작은 마지막 색인 항목
+static size_t segment_seek_time(const LogSegment *seg, int64_t since_ms) {
+    const IndexEntry *index = segment_index(seg);
+    size_t lo = 0, hi = seg->index_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (index[mid].time_ms < since_ms) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo == 0 ? DATA_OFFSET : index[lo - 1].offset;
+}
+
+int msglog_query(MsgLogStore *store, const char *room, int64_t since_ms, int limit,
+                 MsgLogVisit visit, void *ctx, int64_t *next_ms) {
+    *next_ms = -1;
+    RoomLog *log = store ? log_find(store, room) : NULL;
+    if (!log || !log->last) return 0;
+
+    // 최근 기록을 찾는 경우가 많으므로 끝에서부터 시작 세그먼트를 찾음
+    LogSegment *seg = log->last;
+    while (seg->prev && (seg->index_count == 0 || segment_index(seg)[0].time_ms > since_ms)) {
+        seg = seg->prev;
+    }
+
+    int visited = 0;
+    for (; seg; seg = seg->next) {
+        size_t offset = segment_seek_time(seg, since_ms);
+        while (offset < seg->end) {
+            const RecordHeader *record = record_at(seg, offset);
+            if (record->time_ms >= since_ms) {
+                if (visited == limit) {
+                    *next_ms = record->time_ms;
+                    return visited;
+                }
+                visit((const char*)(record + 1), record->length, record->time_ms, ctx);
+                visited++;
+            }
+            offset += RECORD_SIZE(record->length);
+        }
+    }
+    return visited;
+}
+
+int msglog_tail(MsgLogStore *store, const char *room, int limit, MsgLogVisit visit, void *ctx) {
+    RoomLog *log = store ? log_find(store, room) : NULL;
+    if (!log || !log->last || limit <= 0) return 0;
+
+    // 뒤에서부터 limit개가 시작되는 세그먼트와 그 안에서 건너뛸 개수
+    LogSegment *seg = log->last;
+    uint32_t need = (uint32_t)limit;
+    while (seg->prev && seg->count < need) {
+        need -= seg->count;
+        seg = seg->prev;
+    }
+    uint32_t skip = seg->count > need ? seg->count - need : 0;
+
+    // 색인의 순번으로 건너뛸 레코드 근처까지 바로 이동
+    const IndexEntry *index = segment_index(seg);
+    size_t lo = 0, hi = seg->index_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (index[mid].seq <= skip) lo = mid + 1;
+        else hi = mid;
+    }
+    size_t offset = lo == 0 ? DATA_OFFSET : index[lo - 1].offset;
+    uint32_t seq = lo == 0 ? 0 : index[lo - 1].seq;
+
+    int visited = 0;
+    for (; seg; seg = seg->next, offset = DATA_OFFSET, seq = 0, skip = 0) {
+        for (; offset < seg->end; seq++) {
+            const RecordHeader *record = record_at(seg, offset);
+            if (seq >= skip) {
+                visit((const char*)(record + 1), record->length, record->time_ms, ctx);
+                visited++;
+            }
+            offset += RECORD_SIZE(record->length);
+        }
+    }
+    return visited;
+}
+
+void msglog_foreach_room(MsgLogStore *store, void (*visit)(const char *room, void *ctx), void *ctx) {
+    if (!store) return;
+    for (size_t i = 0; i < store->bucket_count; i++) {
+        for (RoomLog *log = store->buckets[i]; log; log = log->next) {
+            visit(log->room, ctx);
+        }
+    }
+}
+
+void msglog_stats(MsgLogStore *store, MsgLogStats *out) {
+    out->rooms += atomic_load_explicit(&store->rooms, memory_order_relaxed);
+    out->segments += atomic_load_explicit(&store->segments, memory_order_relaxed);
+    out->bytes += atomic_load_explicit(&store->bytes, memory_order_relaxed);
+    out->appended += atomic_load_explicit(&store->appended, memory_order_relaxed);
+    out->errors += atomic_load_explicit(&store->errors, memory_order_relaxed);
+    out->removed += atomic_load_explicit(&store->removed, memory_order_relaxed);
+}
+
+unsigned long long msglog_syncs(void) {
+    return atomic_load_explicit(&sync_count, memory_order_relaxed);
+}
@@ -0,0 +1,66 @@
+#ifndef MSGLOG_H
+#define MSGLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// --- 방별 메시지 로그 (디스크) ---
+// 방마다 디렉토리 하나에 고정 크기 세그먼트 파일을 이어 붙이는 추가 전용 로그입니다.
+// 세그먼트는 mmap(MAP_SHARED)으로 쓰고, 동기화 스레드가 모아 둔 변경을 주기마다 한 번에 msync 합니다(group commit).
+// 디스크 블록 예약과 다음 세그먼트 파일 생성도 동기화 스레드가 미리 해 두어, 추가하는 쪽은 보통 메모리에 쓰기만 합니다.
+// 세그먼트마다 일정 바이트 간격의 희소 색인(시각, 위치)이 있어 시각으로 찾을 때 세그먼트 전체를 읽지 않습니다.
+// 재시작할 때는 세그먼트를 매핑하고 헤더에 확정된 끝 이후(마지막 동기화 뒤에 쓴 부분)만 검사합니다.
+//
+// 저장소는 잠그지 않습니다: epoll/스레드 모드는 서버의 기록 조각(HistoryShard) 락, 멀티 리액터 모드는 소유 리액터 스레드에서만 호출합니다.
+// 리액터마다 자기 소유의 방만 여는 저장소를 하나씩 가지며, 같은 디렉토리를 나눠 씁니다.
+
+#define MSGLOG_SEGMENT_SIZE (4 * 1024 * 1024)   // 세그먼트 파일 크기 (헤더와 색인 영역 포함, 희소 파일)
+#define MSGLOG_RESERVE_CHUNK (256 * 1024)       // 세그먼트의 디스크 블록을 한 번에 예약하는 단위
+#define MSGLOG_INDEX_INTERVAL 4096              // 색인 항목 사이의 데이터 바이트 간격
+#define MSGLOG_QUERY_LIMIT 200                  // HISTORY 요청 한 번에 보내는 최대 메시지 수
+#define MSGLOG_DEFAULT_SYNC_MS 50
+
+typedef struct MsgLogStore MsgLogStore;
+
+// 메시지를 넘겨받는 콜백 (오래된 것부터, time_ms는 로그에 기록된 시각)
+typedef void (*MsgLogVisit)(const char *message, size_t length, int64_t time_ms, void *ctx);
+
+// dir 아래의 방 로그를 매핑해 엶. name_hash(방) % shard_count == shard인 방만 다룹니다. 실패 시 NULL
+MsgLogStore *msglog_open(const char *dir, int shard, int shard_count);
+
+// 방 로그 끝에 메시지 추가. 방의 시각은 단조 증가하도록 보정됩니다 (같은 밀리초면 1ms씩 뒤로). 실패 시 -1
+int msglog_append(MsgLogStore *store, const char *room, const char *message, size_t length, int64_t time_ms);
+
+// since_ms 이후(포함)의 메시지를 최대 limit개 visit에 넘김. 넘긴 개수 반환
+// 더 남아 있으면 *next_ms에 다음 요청의 since 값을, 끝까지 읽었으면 -1을 넣습니다.
+int msglog_query(MsgLogStore *store, const char *room, int64_t since_ms, int limit,
+                 MsgLogVisit visit, void *ctx, int64_t *next_ms);
+
+// 방의 가장 최근 메시지 limit개를 오래된 것부터 visit에 넘김 (재시작 뒤 메모리 기록을 채울 때)
+int msglog_tail(MsgLogStore *store, const char *room, int limit, MsgLogVisit visit, void *ctx);
+
+// 저장소가 연 방마다 visit 호출
+void msglog_foreach_room(MsgLogStore *store, void (*visit)(const char *room, void *ctx), void *ctx);
+
+// 동기화 스레드 시작 (interval_ms마다 group commit, 0이면 추가할 때마다 바로 동기화). 실패 시 -1
+int msglog_start_sync(int interval_ms);
+
+// 방마다 남길 세그먼트 크기 합 (0이면 지우지 않음, 기본값). 넘으면 가장 오래된 세그먼트부터 지우며 쓰는 세그먼트는 남깁니다.
+// msglog_open 전에 호출합니다.
+void msglog_set_retention(unsigned long long bytes);
+
+// STATS용 (다른 스레드에서 읽어도 됨). out에 더하므로 여러 저장소를 합칠 수 있습니다.
+typedef struct {
+    size_t rooms;
+    size_t segments;
+    unsigned long long bytes;           // 레코드 헤더를 포함한 데이터 바이트
+    unsigned long long appended;
+    unsigned long long errors;          // 세그먼트를 만들지 못해(디스크 부족 등) 버린 메시지
+    unsigned long long removed;         // 보존 한도로 지운 세그먼트
+} MsgLogStats;
+
+void msglog_stats(MsgLogStore *store, MsgLogStats *out);
+// 모든 저장소 공용: group commit으로 동기화한 세그먼트 수
+unsigned long long msglog_syncs(void);
+
+#endif
@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include "outqueue.h"
+#include "pool.h"
+
+OutBuffer *outbuf_new(size_t length) {
+    OutBuffer *buf = pool_alloc(sizeof(OutBuffer) + length);
+    if (!buf) return NULL;
+    atomic_init(&buf->refcount, 1);
+    buf->length = length;
+    return buf;
+}
+
+OutBuffer *outbuf_ref(OutBuffer *buf) {
+    atomic_fetch_add_explicit(&buf->refcount, 1, memory_order_relaxed);
+    return buf;
+}
+
+void outbuf_release(OutBuffer *buf) {
+    if (buf && atomic_fetch_sub_explicit(&buf->refcount, 1, memory_order_acq_rel) == 1) {
+        pool_free(buf);
+    }
+}
+
+void outq_init(OutQueue *q) {
+    q->slots = NULL;
+    q->capacity = 0;
+    q->first = 0;
+    q->count = 0;
+    q->bytes = 0;
+    q->head_offset = 0;
+    q->blocked = 0;
+}
+
+#define OUTQ_AT(q, i) ((q)->slots[((q)->first + (i)) & ((q)->capacity - 1)])
+
+void outq_clear(OutQueue *q) {
+    for (size_t i = 0; i < q->count; i++) {
+        outbuf_release(OUTQ_AT(q, i));
+    }
+    free(q->slots);
+    outq_init(q);
+}
+
+// 링이 가득 차면 두 배로 늘리면서 순서대로 다시 배치
+static int outq_grow(OutQueue *q) {
+    size_t new_capacity = q->capacity ? q->capacity * 2 : OUTQ_INITIAL_SLOTS;
+    OutBuffer **slots = malloc(sizeof(OutBuffer*) * new_capacity);
+    if (!slots) return -1;
+    for (size_t i = 0; i < q->count; i++) {
+        slots[i] = OUTQ_AT(q, i);
+    }
+    free(q->slots);
+    q->slots = slots;
+    q->capacity = new_capacity;
+    q->first = 0;
+    return 0;
+}
+
+int outq_push(OutQueue *q, OutBuffer *buf) {
+    if (q->count == q->capacity && outq_grow(q) < 0) return -1;
+    OUTQ_AT(q, q->count) = outbuf_ref(buf);
+    q->count++;
+    q->bytes += buf->length;
+    return 0;
+}
+
+// 가장 오래된 메시지 하나를 큐에서 빼고 참조를 해제
+static void outq_pop(OutQueue *q) {
+    outbuf_release(q->slots[q->first]);
+    q->first = (q->first + 1) & (q->capacity - 1);
+    q->count--;
+    q->head_offset = 0;
+}
+
+size_t outq_drop_oldest(OutQueue *q, size_t bytes_needed) {
+    size_t dropped = 0;
+    size_t freed = 0;
+    // 일부만 전송된 head는 프레임이 깨지지 않도록 끝까지 보내야 하므로 건너뜁니다.
+    size_t skip = (q->count > 0 && q->head_offset > 0) ? 1 : 0;
+
+    while (q->count > skip && freed < bytes_needed) {
+        OutBuffer *victim = OUTQ_AT(q, skip);
+        freed += victim->length;
+        q->bytes -= victim->length;
+        outbuf_release(victim);
+        // 남길 head를 버린 자리로 한 칸 당기면 링의 앞쪽이 하나 줄어듭니다.
+        if (skip) OUTQ_AT(q, 1) = OUTQ_AT(q, 0);
+        q->first = (q->first + 1) & (q->capacity - 1);
+        q->count--;
+        dropped++;
+    }
+    return dropped;
+}
+
+ssize_t outq_flush(OutQueue *q, int fd) {
+    ssize_t total = 0;
+
+    while (q->count > 0) {
+        struct iovec iov[OUTQ_MAX_IOV];
+        int iov_count = 0;
+        size_t offset = q->head_offset;
+
+        for (size_t i = 0; i < q->count && iov_count < OUTQ_MAX_IOV; i++, offset = 0) {
+            OutBuffer *buf = OUTQ_AT(q, i);
+            iov[iov_count].iov_base = buf->data + offset;
+            iov[iov_count].iov_len = buf->length - offset;
+            iov_count++;
+        }
+
+        ssize_t written = writev(fd, iov, iov_count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                q->blocked = 1;
+                return total;
+            }
+            return -1;
+        }
+        total += written;
+        q->bytes -= written;
+
+        // 다 보낸 메시지는 참조를 놓고, 일부만 보낸 메시지는 offset을 기록
+        size_t remaining = written;
+        while (q->count > 0 && remaining >= q->slots[q->first]->length - q->head_offset) {
+            remaining -= q->slots[q->first]->length - q->head_offset;
+            outq_pop(q);
+        }
+        // 부분 전송이어도 EAGAIN을 확인할 때까지 계속 시도합니다. (edge-triggered 이벤트를 받기 위함)
+        if (q->count > 0) q->head_offset += remaining;
+    }
+    q->blocked = 0;
+    return total;
+}
@@ -0,0 +1,56 @@
+#ifndef OUTQUEUE_H
+#define OUTQUEUE_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+// --- 연결별 송신 큐 ---
+// 브로드캐스트하는 쪽은 큐에 넣기만 하고, 실제 전송은 논블로킹 writev로 가능한 만큼만 합니다.
+// 소켓 버퍼가 가득 찬 클라이언트 하나가 다른 클라이언트에게 가는 전송을 막지 않습니다.
+
+#define OUTQ_MAX_IOV 64 // writev 한 번에 묶는 최대 메시지 수
+#define OUTQ_INITIAL_SLOTS 8
+
+// 느린 수신자(큐가 high watermark를 넘는 연결)에 대한 처리 방식
+typedef enum {
+    SLOW_DROP_OLDEST,   // 아직 보내지 않은 오래된 메시지부터 버림
+    SLOW_DROP_NEWEST,   // 새로 들어오는 메시지를 버림
+    SLOW_DISCONNECT     // 연결을 끊음
+} SlowConsumerPolicy;
+
+// 한 번 인코딩한 뒤 바뀌지 않는 송신 버퍼. 방의 모든 멤버 큐가 같은 버퍼를 가리키고,
+// 마지막 참조(전송 완료 또는 드롭)가 해제될 때 크기별 풀(pool_alloc)로 돌아갑니다.
+typedef struct {
+    atomic_int refcount;
+    size_t length;
+    char data[];
+} OutBuffer;
+
+// 버퍼 포인터의 링. 메시지마다 노드를 할당하지 않습니다.
+typedef struct {
+    OutBuffer **slots;
+    size_t capacity;    // 2의 거듭제곱
+    size_t first;       // 가장 오래된 메시지의 위치
+    size_t count;       // 대기 중인 메시지 수
+    size_t bytes;       // 아직 보내지 않은 바이트 수
+    size_t head_offset; // 가장 오래된 메시지 중 이미 보낸 바이트 수
+    int blocked;        // 마지막 전송이 EAGAIN으로 끝남 (쓰기 가능 이벤트 대기 중)
+} OutQueue;
+
+// 참조 카운트 1(만든 쪽의 참조)로 생성. 내용은 호출자가 채웁니다.
+OutBuffer *outbuf_new(size_t length);
+OutBuffer *outbuf_ref(OutBuffer *buf);
+void outbuf_release(OutBuffer *buf);
+
+void outq_init(OutQueue *q);
+void outq_clear(OutQueue *q);
+
+// 큐가 buf에 대한 참조를 하나 더 가짐 (호출자의 참조는 그대로). 메모리 부족 시 -1
+int outq_push(OutQueue *q, OutBuffer *buf);
+// 보내기 시작하지 않은 가장 오래된 메시지부터 bytes_needed 이상 확보될 때까지 버림. 버린 개수 반환
+size_t outq_drop_oldest(OutQueue *q, size_t bytes_needed);
+// 논블로킹 writev로 가능한 만큼 전송. 보낸 바이트 수, 연결 오류 시 -1
+ssize_t outq_flush(OutQueue *q, int fd);
+
+#endif
@@ -0,0 +1,353 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "pool.h"
+
+#define POOL_NAME_SIZE 24
+#define POOL_ALIGN 16
+#define POOL_LARGE 0xff                 // 크기 클래스가 아닌 malloc 버퍼
+
+struct Pool {
+    int id;
+    char name[POOL_NAME_SIZE];
+    size_t object_size;                 // POOL_ALIGN 배수
+    size_t slab_objects;                // 슬랩 하나에 들어가는 객체 수
+    pthread_mutex_t lock;               // 창고와 슬랩 목록 보호
+    void *depot;                        // 남은 객체 목록 (객체 첫 워드가 다음 객체)
+    size_t depot_count;
+    void **slabs;                       // STATS용으로만 세며, 해제하지 않음
+    size_t slab_count;
+    size_t slab_capacity;
+};
+
+// 스레드 하나의 풀별 캐시. 목록과 개수는 주인 스레드만 만지고, 카운터는 STATS 스레드가 relaxed로 읽습니다.
+// 스레드가 끝나면 남은 객체를 창고로 돌려보내고, 카운터를 유지한 채 다음 스레드가 이어 씁니다.
+typedef struct PoolCache {
+    void *head[POOL_MAX];
+    unsigned count[POOL_MAX];
+    atomic_ullong gets[POOL_MAX];
+    atomic_ullong puts[POOL_MAX];
+    atomic_ullong refills[POOL_MAX];    // 창고에서 채움 (캐시가 빔)
+    atomic_ullong spills[POOL_MAX];     // 창고로 덜어냄 (캐시가 넘침)
+    atomic_ullong requested[POOL_MAX];  // 크기 클래스: 요청한 바이트 합계 (꺼낼 때 더함)
+    atomic_ullong returned[POOL_MAX];   // 크기 클래스: 돌려받은 버퍼의 요청 바이트 합계
+    int in_use;
+    struct PoolCache *next;
+} PoolCache;
+
+// 크기별 버퍼 앞에 붙는 헤더 (버퍼가 POOL_ALIGN 정렬을 유지하도록 16바이트)
+typedef struct {
+    uint32_t size;                      // 요청한 바이트 수
+    uint8_t size_class;                 // 0..POOL_CLASS_COUNT-1 또는 POOL_LARGE
+    uint8_t reserved[11];
+} PoolHeader;
+
+static pthread_mutex_t pools_mutex = PTHREAD_MUTEX_INITIALIZER;  // 풀 목록과 캐시 목록 보호
+static Pool *pools[POOL_MAX];
+static atomic_int pool_count;
+static PoolCache *caches = NULL;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static __thread PoolCache *local_cache = NULL;
+
+static Pool *size_classes[POOL_CLASS_COUNT];
+static pthread_once_t size_classes_once = PTHREAD_ONCE_INIT;
+static atomic_ullong large_allocs, large_frees, large_bytes;
+
+static inline void cache_increment(atomic_ullong *slot, uint64_t value) {
+    atomic_store_explicit(slot, atomic_load_explicit(slot, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static inline void *next_of(void *object) {
+    return *(void**)object;
+}
+
+static inline void set_next(void *object, void *next) {
+    *(void**)object = next;
+}
+
+// 객체 count개 목록 [first, last]를 창고에 붙임
+static void depot_push(Pool *pool, void *first, void *last, size_t count) {
+    pthread_mutex_lock(&pool->lock);
+    set_next(last, pool->depot);
+    pool->depot = first;
+    pool->depot_count += count;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void cache_release(void *arg) {
+    PoolCache *cache = (PoolCache*)arg;
+    int count = atomic_load(&pool_count);
+
+    for (int id = 0; id < count; id++) {
+        if (cache->count[id] == 0) continue;
+        void *last = cache->head[id];
+        while (next_of(last)) last = next_of(last);
+        depot_push(pools[id], cache->head[id], last, cache->count[id]);
+        cache->head[id] = NULL;
+        cache->count[id] = 0;
+    }
+    pthread_mutex_lock(&pools_mutex);
+    cache->in_use = 0;
+    pthread_mutex_unlock(&pools_mutex);
+    local_cache = NULL;
+}
+
+static void cache_key_create(void) {
+    pthread_key_create(&cache_key, cache_release);
+}
+
+// 이 스레드의 캐시 (처음 쓸 때 빈 캐시를 재사용하거나 새로 만듦). 만들지 못하면 NULL (창고를 직접 씀)
+static PoolCache *cache_get(void) {
+    if (local_cache) return local_cache;
+
+    pthread_once(&cache_key_once, cache_key_create);
+    pthread_mutex_lock(&pools_mutex);
+    PoolCache *cache = caches;
+    while (cache && cache->in_use) cache = cache->next;
+    if (!cache && (cache = calloc(1, sizeof(PoolCache)))) {
+        cache->next = caches;
+        caches = cache;
+    }
+    if (cache) cache->in_use = 1;
+    pthread_mutex_unlock(&pools_mutex);
+
+    if (cache) pthread_setspecific(cache_key, cache);
+    local_cache = cache;
+    return cache;
+}
+
+Pool *pool_create(const char *name, size_t object_size) {
+    Pool *pool = calloc(1, sizeof(Pool));
+    if (!pool) return NULL;
+
+    if (object_size < sizeof(void*)) object_size = sizeof(void*);
+    pool->object_size = (object_size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    pool->slab_objects = POOL_SLAB_SIZE / pool->object_size;
+    if (pool->slab_objects < POOL_SLAB_MIN_OBJECTS) pool->slab_objects = POOL_SLAB_MIN_OBJECTS;
+    snprintf(pool->name, sizeof(pool->name), "%s", name);
+    pthread_mutex_init(&pool->lock, NULL);
+
+    pthread_mutex_lock(&pools_mutex);
+    int id = atomic_load(&pool_count);
+    if (id >= POOL_MAX) {
+        pthread_mutex_unlock(&pools_mutex);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool);
+        return NULL;
+    }
+    pool->id = id;
+    pools[id] = pool;
+    atomic_store(&pool_count, id + 1);  // 등록을 마친 뒤 공개 (STATS와 캐시 정리가 읽음)
+    pthread_mutex_unlock(&pools_mutex);
+    return pool;
+}
+
+// 창고가 비었으면 슬랩을 하나 더 잘라 넣음 (pool->lock을 잡은 상태). 메모리 부족 시 -1
+static int slab_grow_locked(Pool *pool) {
+    if (pool->slab_count == pool->slab_capacity) {
+        size_t capacity = pool->slab_capacity ? pool->slab_capacity * 2 : 16;
+        void **grown = realloc(pool->slabs, sizeof(void*) * capacity);
+        if (!grown) return -1;
+        pool->slabs = grown;
+        pool->slab_capacity = capacity;
+    }
+    char *slab = aligned_alloc(POOL_ALIGN, pool->object_size * pool->slab_objects);
+    if (!slab) return -1;
+    pool->slabs[pool->slab_count++] = slab;
+
+    // 뒤쪽 객체부터 붙여 앞쪽 주소부터 나가게 함
+    for (size_t i = pool->slab_objects; i-- > 0;) {
+        void *object = slab + i * pool->object_size;
+        set_next(object, pool->depot);
+        pool->depot = object;
+    }
+    pool->depot_count += pool->slab_objects;
+    return 0;
+}
+
+// 창고에서 최대 want개를 떼어 목록으로 반환 (*taken에 개수). 창고가 비면 슬랩을 늘림
+static void *depot_take(Pool *pool, size_t want, unsigned *taken) {
+    void *first = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->depot_count == 0 && slab_grow_locked(pool) < 0) {
+        pthread_mutex_unlock(&pool->lock);
+        *taken = 0;
+        return NULL;
+    }
+    size_t count = pool->depot_count < want ? pool->depot_count : want;
+    void *last = pool->depot;
+    for (size_t i = 1; i < count; i++) last = next_of(last);
+    first = pool->depot;
+    pool->depot = next_of(last);
+    pool->depot_count -= count;
+    set_next(last, NULL);
+    pthread_mutex_unlock(&pool->lock);
+
+    *taken = (unsigned)count;
+    return first;
+}
+
+void *pool_get(Pool *pool) {
+    PoolCache *cache = cache_get();
+    unsigned taken;
+    void *object;
+
+    if (!cache) {
+        object = depot_take(pool, 1, &taken);
+        return object;
+    }
+    int id = pool->id;
+    if (cache->count[id] == 0) {
+        cache->head[id] = depot_take(pool, POOL_BATCH, &taken);
+        if (taken == 0) return NULL;
+        cache->count[id] = taken;
+        cache_increment(&cache->refills[id], 1);
+    }
+    object = cache->head[id];
+    cache->head[id] = next_of(object);
+    cache->count[id]--;
+    cache_increment(&cache->gets[id], 1);
+    return object;
+}
+
+void pool_put(Pool *pool, void *object) {
+    PoolCache *cache = cache_get();
+
+    if (!cache) {
+        depot_push(pool, object, object, 1);
+        return;
+    }
+    int id = pool->id;
+    set_next(object, cache->head[id]);
+    cache->head[id] = object;
+    cache->count[id]++;
+    cache_increment(&cache->puts[id], 1);
+
+    if (cache->count[id] > POOL_CACHE_MAX) {
+        // 앞쪽 POOL_BATCH개(최근에 돌려놓아 캐시에 뜨거운 객체)는 남기고 그 뒤를 창고로 보냄
+        void *keep_last = cache->head[id];
+        for (int i = 1; i < POOL_BATCH; i++) keep_last = next_of(keep_last);
+        void *first = next_of(keep_last);
+        void *last = first;
+        while (next_of(last)) last = next_of(last);
+        set_next(keep_last, NULL);
+        depot_push(pool, first, last, cache->count[id] - POOL_BATCH);
+        cache->count[id] = POOL_BATCH;
+        cache_increment(&cache->spills[id], 1);
+    }
+}
+
+// --- 크기별 버퍼 ---
+
+static void size_classes_create(void) {
+    char name[POOL_NAME_SIZE];
+    for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+        size_t size = (size_t)POOL_CLASS_MIN << i;
+        snprintf(name, sizeof(name), "buffer_%zu", size);
+        size_classes[i] = pool_create(name, size);
+    }
+}
+
+static int size_class_of(size_t total) {
+    for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+        if (total <= (size_t)POOL_CLASS_MIN << i) return size_classes[i] ? i : -1;
+    }
+    return -1;
+}
+
+void *pool_alloc(size_t size) {
+    size_t total = sizeof(PoolHeader) + size;
+    PoolHeader *header;
+
+    pthread_once(&size_classes_once, size_classes_create);
+    int size_class = size > UINT32_MAX ? -1 : size_class_of(total);
+    if (size_class >= 0) {
+        if (!(header = pool_get(size_classes[size_class]))) return NULL;
+        PoolCache *cache = local_cache;
+        if (cache) cache_increment(&cache->requested[size_classes[size_class]->id], size);
+    } else {
+        if (!(header = malloc(total))) return NULL;
+        atomic_fetch_add_explicit(&large_allocs, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&large_bytes, size, memory_order_relaxed);
+        size_class = POOL_LARGE;
+    }
+    header->size = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+    header->size_class = (uint8_t)size_class;
+    return header + 1;
+}
+
+void pool_free(void *buffer) {
+    if (!buffer) return;
+    PoolHeader *header = (PoolHeader*)buffer - 1;
+
+    if (header->size_class == POOL_LARGE) {
+        atomic_fetch_add_explicit(&large_frees, 1, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&large_bytes, header->size, memory_order_relaxed);
+        free(header);
+        return;
+    }
+    Pool *pool = size_classes[header->size_class];
+    uint32_t size = header->size;
+    pool_put(pool, header);
+    PoolCache *cache = local_cache;
+    if (cache) cache_increment(&cache->returned[pool->id], size);
+}
+
+// --- STATS ---
+
+void pool_write_stats(FILE *out) {
+    unsigned long long total_reserved = 0, total_in_use = 0;
+    int count = atomic_load(&pool_count);
+
+    pthread_mutex_lock(&pools_mutex);
+    for (int id = 0; id < count; id++) {
+        Pool *pool = pools[id];
+        unsigned long long gets = 0, puts = 0, refills = 0, spills = 0, requested = 0, returned = 0;
+        for (PoolCache *cache = caches; cache; cache = cache->next) {
+            gets += atomic_load_explicit(&cache->gets[id], memory_order_relaxed);
+            puts += atomic_load_explicit(&cache->puts[id], memory_order_relaxed);
+            refills += atomic_load_explicit(&cache->refills[id], memory_order_relaxed);
+            spills += atomic_load_explicit(&cache->spills[id], memory_order_relaxed);
+            requested += atomic_load_explicit(&cache->requested[id], memory_order_relaxed);
+            returned += atomic_load_explicit(&cache->returned[id], memory_order_relaxed);
+        }
+        pthread_mutex_lock(&pool->lock);
+        size_t slabs = pool->slab_count;
+        size_t depot = pool->depot_count;
+        pthread_mutex_unlock(&pool->lock);
+
+        // 캐시 없이 창고를 직접 쓴 경우는 세지 않으므로, 사용 중인 수는 슬랩 용량으로 제한
+        unsigned long long capacity = (unsigned long long)slabs * pool->slab_objects;
+        unsigned long long in_use = gets > puts ? gets - puts : 0;
+        if (in_use > capacity) in_use = capacity;
+        unsigned long long reserved = capacity * pool->object_size;
+        total_reserved += reserved;
+        total_in_use += in_use * pool->object_size;
+
+        fprintf(out, "pool_objects_in_use{pool=\"%s\"} %llu\n", pool->name, in_use);
+        fprintf(out, "pool_objects_free{pool=\"%s\"} %llu\n", pool->name, capacity - in_use);
+        fprintf(out, "pool_depot_objects{pool=\"%s\"} %zu\n", pool->name, depot);
+        fprintf(out, "pool_slabs{pool=\"%s\"} %zu\n", pool->name, slabs);
+        fprintf(out, "pool_bytes_reserved{pool=\"%s\"} %llu\n", pool->name, reserved);
+        if (requested > 0) {
+            // 사용 중인 버퍼가 실제로 요청한 바이트 (클래스 크기와의 차이가 내부 단편화)
+            fprintf(out, "pool_bytes_requested{pool=\"%s\"} %llu\n", pool->name,
+                    requested > returned ? requested - returned : 0);
+        }
+        fprintf(out, "pool_refills_total{pool=\"%s\"} %llu\n", pool->name, refills);
+        fprintf(out, "pool_spills_total{pool=\"%s\"} %llu\n", pool->name, spills);
+    }
+    pthread_mutex_unlock(&pools_mutex);
+
+    fprintf(out, "pool_bytes_reserved_total %llu\n", total_reserved);
+    fprintf(out, "pool_bytes_in_use_total %llu\n", total_in_use);
+    fprintf(out, "pool_large_allocs_total %llu\n", atomic_load_explicit(&large_allocs, memory_order_relaxed));
+    fprintf(out, "pool_large_in_use %llu\n",
+            atomic_load_explicit(&large_allocs, memory_order_relaxed) -
+            atomic_load_explicit(&large_frees, memory_order_relaxed));
+    fprintf(out, "pool_large_bytes_in_use %llu\n", atomic_load_explicit(&large_bytes, memory_order_relaxed));
+}
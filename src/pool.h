@@ -0,0 +1,43 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// --- 메모리 풀 (서버) ---
+// 연결 상태나 송신 버퍼처럼 자주 만들고 버리는 객체를 malloc/free 없이 재사용합니다.
+// 풀마다 크기가 같은 객체를 슬랩(큰 할당 하나를 잘라 만든 블록) 단위로 마련해 두고,
+// 스레드(리액터)마다 풀별 캐시를 둬서 평소에는 락 없이 캐시에서 꺼내고 돌려놓습니다.
+// 캐시가 비거나 넘치면 POOL_BATCH개씩 공용 창고(depot)와 주고받으므로, 한 스레드가 만들고
+// 다른 스레드가 버리는 객체(리액터 사이를 오가는 작업과 버퍼)도 창고를 거쳐 다시 돌아옵니다.
+// 슬랩은 운영체제에 돌려주지 않습니다. (최대 사용량만큼 남음)
+
+#define POOL_MAX 16                     // 만들 수 있는 풀 수 (크기 클래스 포함)
+#define POOL_SLAB_SIZE (64 * 1024)      // 슬랩 하나의 최소 크기
+#define POOL_SLAB_MIN_OBJECTS 8         // 큰 객체도 슬랩 하나에 이만큼은 들어가게 함
+#define POOL_CACHE_MAX 64               // 스레드 캐시가 풀마다 들고 있는 최대 객체 수
+#define POOL_BATCH 32                   // 캐시와 창고가 한 번에 주고받는 객체 수
+
+// 크기별 버퍼: 64바이트부터 2배씩 POOL_CLASS_COUNT개 클래스 (최대 8 KB, 프레임 하나와 리액터 작업이 들어감)
+// 그보다 큰 요청(방 기록 재생 버퍼 등)은 malloc으로 처리합니다.
+#define POOL_CLASS_MIN 64
+#define POOL_CLASS_COUNT 8
+
+typedef struct Pool Pool;
+
+// object_size 바이트 객체의 풀을 만듦 (name은 STATS에 표시). 풀 수가 POOL_MAX를 넘거나 메모리가 없으면 NULL
+Pool *pool_create(const char *name, size_t object_size);
+// 객체 하나를 꺼냄 (내용은 이전 사용자의 것이 남아 있음). 메모리 부족 시 NULL
+void *pool_get(Pool *pool);
+// 꺼낸 스레드가 아니어도 돌려놓을 수 있음
+void pool_put(Pool *pool, void *object);
+
+// size 바이트 이상의 버퍼 (16바이트 정렬). 메모리 부족 시 NULL
+void *pool_alloc(size_t size);
+// pool_alloc으로 받은 버퍼 반환 (NULL이면 무시)
+void pool_free(void *buffer);
+
+// STATS용 "이름 값" 형식의 풀별 지표: 사용 중/남은 객체, 슬랩 메모리, 요청 바이트(내부 단편화), 창고 왕복 횟수(풀 압박)
+void pool_write_stats(FILE *out);
+
+#endif
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "protocol.h"
+
+void frame_header_encode(char *header, uint8_t opcode, size_t length) {
+    header[0] = (char)((length >> 24) & 0xff);
+    header[1] = (char)((length >> 16) & 0xff);
+    header[2] = (char)((length >> 8) & 0xff);
+    header[3] = (char)(length & 0xff);
+    header[4] = (char)opcode;
+}
+
+size_t frame_encode(char *out, size_t out_size, uint8_t opcode, const void *payload, size_t length) {
+    if (length > FRAME_MAX_PAYLOAD || out_size < FRAME_HEADER_SIZE + length) return 0;
+    frame_header_encode(out, opcode, length);
+    if (length > 0) memcpy(out + FRAME_HEADER_SIZE, payload, length);
+    return FRAME_HEADER_SIZE + length;
+}
+
+void frame_decoder_init(FrameDecoder *dec) {
+    dec->data = NULL;
+    dec->length = 0;
+    dec->capacity = 0;
+}
+
+void frame_decoder_free(FrameDecoder *dec) {
+    free(dec->data);
+    frame_decoder_init(dec);
+}
+
+static uint32_t frame_header_length(const char *header) {
+    const unsigned char *h = (const unsigned char *)header;
+    return ((uint32_t)h[0] << 24) | ((uint32_t)h[1] << 16) | ((uint32_t)h[2] << 8) | h[3];
+}
+
+// data에서 완성된 프레임을 모두 처리하고, 처리한 바이트 수를 *consumed에 기록
+static int decode_frames(const char *data, size_t length, size_t *consumed,
+                         FrameHandler handler, void *ctx) {
+    size_t offset = 0;
+    *consumed = 0;
+
+    while (length - offset >= FRAME_HEADER_SIZE) {
+        uint32_t payload_length = frame_header_length(data + offset);
+        if (payload_length > FRAME_MAX_PAYLOAD) return -1;
+        if (length - offset < FRAME_HEADER_SIZE + payload_length) break;
+
+        Frame frame;
+        frame.opcode = (uint8_t)data[offset + 4];
+        frame.length = payload_length;
+        frame.payload = data + offset + FRAME_HEADER_SIZE;
+        offset += FRAME_HEADER_SIZE + payload_length;
+        *consumed = offset;
+
+        int result = handler(&frame, ctx);
+        if (result < 0) return result;
+    }
+    return 0;
+}
+
+// 남은 조각을 내부 버퍼에 보관 (필요한 만큼만 늘림)
+static int decoder_store(FrameDecoder *dec, const char *data, size_t length) {
+    if (dec->length + length > dec->capacity) {
+        size_t new_capacity = dec->capacity ? dec->capacity : 256;
+        while (new_capacity < dec->length + length) new_capacity *= 2;
+        char *grown = realloc(dec->data, new_capacity);
+        if (!grown) return -1;
+        dec->data = grown;
+        dec->capacity = new_capacity;
+    }
+    memmove(dec->data + dec->length, data, length);
+    dec->length += length;
+    return 0;
+}
+
+int frame_decoder_feed(FrameDecoder *dec, const char *data, size_t length,
+                       FrameHandler handler, void *ctx) {
+    size_t consumed;
+    int result;
+
+    if (dec->length == 0) {
+        // 보관 중인 조각이 없으면 읽은 버퍼에서 바로 디코딩 (복사 없음)
+        result = decode_frames(data, length, &consumed, handler, ctx);
+        if (result < 0) return result;
+        return decoder_store(dec, data + consumed, length - consumed);
+    }
+
+    // 이전 조각 뒤에 이어 붙여서 디코딩
+    if (decoder_store(dec, data, length) < 0) return -1;
+    result = decode_frames(dec->data, dec->length, &consumed, handler, ctx);
+    if (result < 0) return result;
+
+    dec->length -= consumed;
+    if (dec->length == 0) {
+        // 조각을 모두 처리했으면 버퍼를 반납해 유휴 연결의 메모리를 0으로 유지
+        frame_decoder_free(dec);
+    } else if (consumed > 0) {
+        memmove(dec->data, dec->data + consumed, dec->length);
+    }
+    return 0;
+}
+
+// 옵션 필드에서 key의 값 시작 위치를 찾음. 없으면 NULL
+static const char *option_find(const char *options, const char *key) {
+    size_t key_length = strlen(key);
+    const char *p = options;
+
+    while (p && *p) {
+        if (strncmp(p, key, key_length) == 0 && p[key_length] == '=') return p + key_length + 1;
+        p = strchr(p, ',');
+        if (p) p++;
+    }
+    return NULL;
+}
+
+long proto_option_long(const char *options, const char *key, long fallback) {
+    const char *value = option_find(options, key);
+    return value ? strtol(value, NULL, 10) : fallback;
+}
+
+int proto_option_string(const char *options, const char *key, char *out, size_t out_size) {
+    const char *value = option_find(options, key);
+    if (!value || out_size == 0) return -1;
+
+    size_t length = strcspn(value, ",");
+    if (length >= out_size) return -1;
+    memcpy(out, value, length);
+    out[length] = '\0';
+    return (int)length;
+}
+
+char *proto_next_field(char **cursor) {
+    char *field = *cursor;
+    char *end;
+    if (!field || *field == '\0') return NULL;
+
+    if (field[0] == '[' && (end = strchr(field, ']')) && (end[1] == ':' || end[1] == '\0')) {
+        field++;
+        *end++ = '\0';
+    } else {
+        end = field + strcspn(field, ":");
+    }
+    if (*end == ':') {
+        *end = '\0';
+        *cursor = end + 1;
+    } else {
+        *cursor = NULL;
+    }
+    return field;
+}
+
+void proto_host_field(char *out, size_t out_size, const char *ip) {
+    snprintf(out, out_size, strchr(ip, ':') ? "[%s]" : "%s", ip);
+}
+
+int proto_address_text(const struct sockaddr_storage *addr, char *ip, size_t ip_size, int *port) {
+    if (addr->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6*)addr;
+        const void *raw = &in6->sin6_addr;
+        int family = AF_INET6;
+        if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+            raw = &in6->sin6_addr.s6_addr[12];
+            family = AF_INET;
+        }
+        *port = ntohs(in6->sin6_port);
+        return inet_ntop(family, raw, ip, ip_size) ? 0 : -1;
+    }
+    if (addr->ss_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in*)addr;
+        *port = ntohs(in->sin_port);
+        return inet_ntop(AF_INET, &in->sin_addr, ip, ip_size) ? 0 : -1;
+    }
+    return -1;
+}
+
+int proto_listen_any(int port, int type_flags, int reuseport, int backlog, int *bound_port) {
+    static const int families[] = { AF_INET6, AF_INET };
+    int opt = 1, off = 0;
+
+    for (size_t i = 0; i < sizeof(families) / sizeof(families[0]); i++) {
+        struct sockaddr_storage addr;
+        socklen_t addr_len;
+        int sock = socket(families[i], SOCK_STREAM | type_flags, 0);
+        if (sock < 0) continue; // IPv6를 지원하지 않는 커널
+
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        if (reuseport && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+            close(sock);
+            return -1;
+        }
+        memset(&addr, 0, sizeof(addr));
+        if (families[i] == AF_INET6) {
+            struct sockaddr_in6 *in6 = (struct sockaddr_in6*)&addr;
+            setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+            in6->sin6_family = AF_INET6;
+            in6->sin6_addr = in6addr_any;
+            in6->sin6_port = htons(port);
+            addr_len = sizeof(*in6);
+        } else {
+            struct sockaddr_in *in = (struct sockaddr_in*)&addr;
+            in->sin_family = AF_INET;
+            in->sin_addr.s_addr = INADDR_ANY;
+            in->sin_port = htons(port);
+            addr_len = sizeof(*in);
+        }
+
+        if (bind(sock, (struct sockaddr*)&addr, addr_len) == 0 && listen(sock, backlog) == 0) {
+            addr_len = sizeof(addr);
+            if (bound_port && getsockname(sock, (struct sockaddr*)&addr, &addr_len) == 0) {
+                char ip[PROTO_IP_SIZE];
+                proto_address_text(&addr, ip, sizeof(ip), bound_port);
+            }
+            return sock;
+        }
+        int saved_errno = errno;
+        close(sock);
+        errno = saved_errno;
+        // 포트 충돌은 IPv4로 다시 시도해도 같으므로 그대로 실패 (IPv6가 꺼진 호스트만 IPv4로)
+        if (errno == EADDRINUSE || errno == EACCES) return -1;
+    }
+    return -1;
+}
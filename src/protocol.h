@@ -0,0 +1,105 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// --- 길이 헤더 기반 바이너리 프레임 프로토콜 (서버/클라이언트 공용) ---
+//
+// 프레임 = [페이로드 길이 4바이트, 빅엔디언][opcode 1바이트][페이로드]
+//
+// 닉네임 핸드셰이크 때 클라이언트가 PROTO_MAGIC을 먼저 보내면 그 연결은 프레임 모드가 되고,
+// 바로 뒤에 OP_NICK 프레임이 옵니다. 매직 없이 닉네임을 보내면 기존 텍스트 프로토콜
+// ("CMD:param", recv 한 번 = 명령 하나)로 처리됩니다.
+
+#define PROTO_MAGIC "\x01" "CHF"
+#define PROTO_MAGIC_LEN 4
+#define FRAME_HEADER_SIZE 5
+#define FRAME_MAX_PAYLOAD 4096
+
+typedef enum {
+    OP_UNKNOWN = 0,
+    // 클라이언트 -> 서버 (페이로드는 텍스트 프로토콜의 param 부분과 같습니다)
+    OP_NICK = 1,
+    OP_CREATE_ROOM = 2,
+    OP_JOIN_ROOM = 3,
+    OP_MSG = 4,             // "닉네임: 메시지"
+    OP_FILE_REQ = 5,        // "타겟닉네임:파일명:파일크기:송신자IP:송신자Port[:옵션]"
+                            // 옵션은 "key=value,..." (streams=N: 분할 전송, relay=토큰: 서버 중계)
+    OP_HISTORY = 6,         // "방[:시각]" 시각(Unix ms) 이후의 방 기록 요청. 응답은 OP_TEXT 여러 개와
+                            // 마지막 안내 줄 ("[SERVER] More history: HISTORY:방:다음시각" 또는 끝)
+    // 서버 -> 클라이언트
+    OP_TEXT = 16,           // 채팅창에 그대로 표시할 한 줄 (채팅 중계 및 [SERVER] 메시지)
+    OP_FILE_ALERT = 17,     // "송신자닉네임:파일명:파일크기:송신자IP:송신자Port[:옵션]"
+    OP_ADDRESS = 18         // "IP:Port" 서버가 본 클라이언트의 주소 (닉네임 등록 직후 한 번, IPv6는 "[IP]:Port")
+} Opcode;
+
+typedef struct {
+    uint8_t opcode;
+    uint32_t length;
+    const char *payload;    // NULL 종료되지 않음. 콜백 안에서만 유효합니다.
+} Frame;
+
+// 프레임 하나를 처리하는 콜백. 음수를 반환하면 디코딩을 멈추고 그 값을 그대로 돌려줍니다.
+typedef int (*FrameHandler)(const Frame *frame, void *ctx);
+
+// 스트리밍 디코더: 읽은 데이터에서 완성된 프레임은 바로 넘기고,
+// 잘린 마지막 조각만 내부 버퍼에 보관합니다. (유휴 연결은 버퍼를 갖지 않음)
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} FrameDecoder;
+
+// 프레임을 out에 인코딩. 기록한 바이트 수를 반환하며 공간이 부족하거나 너무 크면 0
+size_t frame_encode(char *out, size_t out_size, uint8_t opcode, const void *payload, size_t length);
+void frame_header_encode(char *header, uint8_t opcode, size_t length);
+
+void frame_decoder_init(FrameDecoder *dec);
+void frame_decoder_free(FrameDecoder *dec);
+// 반환값: 0 정상, -1 형식 오류(너무 큰 프레임) 또는 메모리 부족, 그 외 음수는 핸들러의 반환값
+int frame_decoder_feed(FrameDecoder *dec, const char *data, size_t length,
+                       FrameHandler handler, void *ctx);
+
+// FILE_REQ/FILE_ALERT 옵션 필드("key=value,key=value")에서 값을 읽음
+// 정수 값은 없으면 fallback, 문자열 값은 없거나 out에 들어가지 않으면 -1 (성공 시 길이)
+long proto_option_long(const char *options, const char *key, long fallback);
+int proto_option_string(const char *options, const char *key, char *out, size_t out_size);
+
+// --- 주소 (IPv4/IPv6 공용) ---
+// 콜론으로 나눈 필드 안의 IPv6 주소는 "[2001:db8::1]"처럼 대괄호로 감쌉니다. (FILE_REQ/FILE_ALERT/ADDRESS)
+
+#define PROTO_IP_SIZE 46            // INET6_ADDRSTRLEN
+
+struct sockaddr_storage;
+
+// 콜론으로 구분된 다음 필드를 잘라 반환 (대괄호로 감싼 필드는 괄호를 벗겨서). 더 없으면 NULL
+// 필드를 꺼낸 뒤 *cursor는 나머지 문자열(없으면 NULL)을 가리킵니다.
+char *proto_next_field(char **cursor);
+// IP를 필드로 쓸 수 있는 형태로 (IPv6이면 대괄호를 씌움)
+void proto_host_field(char *out, size_t out_size, const char *ip);
+// 소켓 주소를 숫자 IP 문자열과 포트로. IPv4가 매핑된 IPv6 주소는 IPv4로 적습니다. 실패 시 -1
+int proto_address_text(const struct sockaddr_storage *addr, char *ip, size_t ip_size, int *port);
+// 모든 인터페이스에서 받는 리스닝 소켓 (가능하면 IPv4도 받는 IPv6 소켓, 안 되면 IPv4)
+// port가 0이면 커널이 고르며, bound_port(NULL 가능)에 실제 포트를 넣습니다. 실패 시 -1 (errno 유지)
+int proto_listen_any(int port, int type_flags, int reuseport, int backlog, int *bound_port);
+
+// --- 파일 전송 중계 (relay) ---
+//
+// 송신자가 직접 접속받을 수 없을 때(NAT 등) 양쪽 모두 서버의 중계 포트로 접속합니다.
+// 송신자는 FILE_REQ 옵션에 "relay=토큰"을 넣고, 서버는 토큰을 등록한 뒤 FILE_ALERT의
+// 송신자IP/Port 자리에 "relay"와 중계 포트를 넣어 전달합니다.
+// 각 데이터 연결은 [RELAY_MAGIC][토큰 32자][역할 1바이트]로 시작하고, 서버가 송신/수신 연결을
+// 한 쌍으로 묶으면 양쪽에 RELAY_PAIRED 1바이트를 보낸 뒤 그대로 이어 줍니다.
+// 이후의 바이트(범위 요청과 파일 데이터)는 직접 연결과 같습니다.
+
+#define RELAY_PORT 8079
+#define RELAY_MAGIC "\x01" "CHR"
+#define RELAY_MAGIC_LEN 4
+#define RELAY_TOKEN_LEN 32          // 16진수 문자열 (128비트 난수)
+#define RELAY_HELLO_SIZE (RELAY_MAGIC_LEN + RELAY_TOKEN_LEN + 1)
+#define RELAY_ROLE_SENDER 'S'
+#define RELAY_ROLE_RECEIVER 'R'
+#define RELAY_PAIRED 'P'
+
+#endif
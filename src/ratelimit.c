@@ -0,0 +1,47 @@
+#include <time.h>
+#include "ratelimit.h"
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void ratelimit_init(RateLimit *limit, long long bytes_per_second) {
+    atomic_init(&limit->rate, bytes_per_second > 0 ? bytes_per_second : 0);
+    atomic_init(&limit->tat_ns, 0);
+}
+
+void ratelimit_set(RateLimit *limit, long long bytes_per_second) {
+    // 한도를 바꾸면 쌓인 빚을 잊고 지금부터 새 한도로 계산
+    atomic_store(&limit->tat_ns, 0);
+    atomic_store(&limit->rate, bytes_per_second > 0 ? bytes_per_second : 0);
+}
+
+long long ratelimit_rate(RateLimit *limit) {
+    return atomic_load_explicit(&limit->rate, memory_order_relaxed);
+}
+
+long long ratelimit_take(RateLimit *limit, size_t bytes) {
+    long long rate = ratelimit_rate(limit);
+    if (rate <= 0 || bytes == 0) return 0;
+
+    long long now = now_ns();
+    long long cost = (long long)((double)bytes * 1e9 / rate);
+    long long burst = RATELIMIT_BURST_MS * 1000000LL;
+    long long tat = atomic_load_explicit(&limit->tat_ns, memory_order_relaxed);
+    long long next;
+
+    // 쉬는 동안 여유가 쌓이지 않도록 지금보다 과거인 시각은 지금으로 당김
+    do {
+        next = (tat > now ? tat : now) + cost;
+    } while (!atomic_compare_exchange_weak_explicit(&limit->tat_ns, &tat, next,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    long long wait = next - now - burst;
+    return wait > 0 ? wait : 0;
+}
+
+size_t ratelimit_step(RateLimit *limit, size_t fallback) {
+    if (ratelimit_rate(limit) <= 0) return fallback;
+    return fallback < RATELIMIT_QUANTUM ? fallback : RATELIMIT_QUANTUM;
+}
@@ -0,0 +1,28 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+// --- 토큰 버킷 속도 제한 (클라이언트 파일 전송, 서버 중계 공용) ---
+// 락 없이 "다음에 보낼 수 있는 시각" 하나를 CAS로 앞당기는 방식(GCRA)입니다. 여러 스레드가 같은 버킷을 나눠 써도 됩니다.
+// 보낸 뒤에 ratelimit_take로 사용량을 알리면, 한도를 지키기 위해 쉬어야 할 시간을 돌려줍니다.
+// RATELIMIT_BURST_MS만큼은 쉬지 않고 몰아서 보낼 수 있습니다. 한도는 언제든 바꿀 수 있습니다.
+
+#define RATELIMIT_BURST_MS 100
+#define RATELIMIT_QUANTUM (64 * 1024)   // 한도가 있을 때 한 번에 보내는 최대 바이트 (한도를 고르게 지키도록)
+
+typedef struct {
+    atomic_llong rate;      // 바이트/초, 0이면 제한 없음
+    atomic_llong tat_ns;    // 다음 바이트를 보낼 수 있는 이론상 시각 (단조 시계)
+} RateLimit;
+
+void ratelimit_init(RateLimit *limit, long long bytes_per_second);
+void ratelimit_set(RateLimit *limit, long long bytes_per_second);
+long long ratelimit_rate(RateLimit *limit);
+// bytes만큼 사용. 한도를 지키려면 기다려야 하는 시간(ns)을 반환 (제한이 없거나 여유가 있으면 0)
+long long ratelimit_take(RateLimit *limit, size_t bytes);
+// 한도가 있으면 RATELIMIT_QUANTUM, 없으면 fallback (한 번에 보낼 크기)
+size_t ratelimit_step(RateLimit *limit, size_t fallback);
+
+#endif
@@ -0,0 +1,520 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <ctype.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "relay.h"
+#include "metrics.h"
+#include "admission.h"
+
+#define RELAY_NAME_SIZE 30
+#define RELAY_BACKLOG 64
+
+enum { ROLE_SENDER, ROLE_RECEIVER };
+
+// 토큰 하나의 연결 쌍들이 함께 쓰는 속도 상한. 토큰과 중계마다 참조를 하나씩 가집니다. (refs는 relay_mutex로 보호)
+typedef struct RelayShare {
+    RateLimit limit;
+    int refs;
+} RelayShare;
+
+// FILE_REQ로 등록된 토큰. 먼저 접속한 쪽의 연결은 짝이 올 때까지 여기서 기다립니다.
+typedef struct RelayToken {
+    char token[RELAY_TOKEN_LEN + 1];
+    char sender[RELAY_NAME_SIZE];
+    char target[RELAY_NAME_SIZE];
+    int pairs_left;                                 // 아직 맺을 수 있는 연결 쌍 수
+    int waiting[2][RELAY_MAX_STREAMS];              // 역할별 대기 중인 연결
+    int waiting_count[2];
+    double created;
+    struct RelayShare *share;                       // 이 토큰으로 맺은 중계들이 나눠 쓰는 속도 상한
+    struct RelayToken *next;
+} RelayToken;
+
+// 짝지어진 연결 한 쌍. 방향별로 스레드 하나가 splice를 돌립니다.
+typedef struct Relay {
+    char sender[RELAY_NAME_SIZE];
+    char target[RELAY_NAME_SIZE];
+    int fds[2];                                     // [ROLE_SENDER], [ROLE_RECEIVER]
+    atomic_llong bytes[2];                          // [0] 송신자 -> 수신자 (파일), [1] 수신자 -> 송신자 (요청)
+    RelayShare *share;
+    double started;
+    struct Relay *next;
+} Relay;
+
+typedef struct {
+    Relay *relay;
+    int from;                                       // 읽는 쪽 역할
+} RelayDirection;
+
+static pthread_mutex_t relay_mutex = PTHREAD_MUTEX_INITIALIZER;
+static RelayToken *tokens = NULL;
+static Relay *active_relays = NULL;
+static int listen_port = 0;
+static int listen_sock = -1;
+
+// 운영자용 누적 통계 (relay_mutex로 보호)
+static unsigned long long completed_relays = 0;
+static unsigned long long relayed_bytes = 0;
+static double relayed_seconds = 0;
+static unsigned long long expired_tokens = 0;
+
+// 인사 메시지를 기다리는 연결 수 (연결마다 스레드 하나이므로 상한을 둠)
+static atomic_int handshakes_active = 0;
+static atomic_ullong rejected_handshakes = 0;
+
+static atomic_llong relay_rate_limit;               // 중계 하나의 속도 상한 (바이트/초, 0이면 제한 없음)
+
+static double relay_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double mb_per_second(long long bytes, double seconds) {
+    return seconds > 0 ? bytes / seconds / (1024.0 * 1024.0) : 0;
+}
+
+static int valid_token(const char *token) {
+    if (!token || strlen(token) != RELAY_TOKEN_LEN) return 0;
+    for (int i = 0; i < RELAY_TOKEN_LEN; i++) {
+        if (!isxdigit((unsigned char)token[i])) return 0;
+    }
+    return 1;
+}
+
+static RelayToken *find_token_locked(const char *token) {
+    for (RelayToken *t = tokens; t; t = t->next) {
+        if (strcmp(t->token, token) == 0) return t;
+    }
+    return NULL;
+}
+
+static void release_share_locked(RelayShare *share) {
+    if (share && --share->refs == 0) free(share);
+}
+
+static void free_token_locked(RelayToken *target) {
+    RelayToken **link = &tokens;
+    while (*link && *link != target) link = &(*link)->next;
+    if (*link) *link = target->next;
+
+    for (int role = 0; role < 2; role++) {
+        for (int i = 0; i < target->waiting_count[role]; i++) close(target->waiting[role][i]);
+    }
+    release_share_locked(target->share);
+    free(target);
+}
+
+// 짝을 찾지 못한 채 오래된 토큰 정리 (대기 중인 연결도 닫음)
+static void expire_tokens_locked(double now) {
+    RelayToken *t = tokens;
+    while (t) {
+        RelayToken *next = t->next;
+        if (now - t->created > RELAY_PAIR_TIMEOUT_S) {
+            log_info("Relay token from %s to %s expired\n", t->sender, t->target);
+            expired_tokens++;
+            free_token_locked(t);
+        }
+        t = next;
+    }
+}
+
+// 역할별 대기 연결 중 아직 살아 있는 것 하나를 꺼냄. 없으면 -1
+static int pop_waiting_locked(RelayToken *t, int role) {
+    while (t->waiting_count[role] > 0) {
+        int fd = t->waiting[role][0];
+        t->waiting_count[role]--;
+        memmove(t->waiting[role], t->waiting[role] + 1, sizeof(int) * t->waiting_count[role]);
+
+        // 기다리는 동안 끊긴 연결은 버림
+        char probe;
+        ssize_t n = recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            close(fd);
+            continue;
+        }
+        return fd;
+    }
+    return -1;
+}
+
+int relay_enabled(void) {
+    return listen_sock >= 0;
+}
+
+int relay_port(void) {
+    return listen_port;
+}
+
+int relay_register(const char *token, const char *sender, const char *target, int streams) {
+    if (!relay_enabled() || !valid_token(token)) return -1;
+    if (streams < 1) streams = 1;
+    if (streams > RELAY_MAX_STREAMS) streams = RELAY_MAX_STREAMS;
+
+    pthread_mutex_lock(&relay_mutex);
+    expire_tokens_locked(relay_now());
+    if (find_token_locked(token)) {
+        pthread_mutex_unlock(&relay_mutex);
+        return -1;
+    }
+    RelayToken *t = calloc(1, sizeof(RelayToken));
+    RelayShare *share = malloc(sizeof(RelayShare));
+    if (!t || !share) {
+        pthread_mutex_unlock(&relay_mutex);
+        free(t);
+        free(share);
+        return -1;
+    }
+    ratelimit_init(&share->limit, atomic_load(&relay_rate_limit));
+    share->refs = 1;
+    t->share = share;
+    strcpy(t->token, token);
+    strncpy(t->sender, sender, RELAY_NAME_SIZE - 1);
+    strncpy(t->target, target, RELAY_NAME_SIZE - 1);
+    t->pairs_left = streams;
+    t->created = relay_now();
+    t->next = tokens;
+    tokens = t;
+    pthread_mutex_unlock(&relay_mutex);
+    return 0;
+}
+
+void relay_set_rate(long long bytes_per_second) {
+    atomic_store(&relay_rate_limit, bytes_per_second > 0 ? bytes_per_second : 0);
+}
+
+long long relay_rate(void) {
+    return atomic_load(&relay_rate_limit);
+}
+
+// 중계가 쓸 속도 상한. 운영자가 상한을 바꿨으면 진행 중인 중계에도 여기서 반영합니다.
+static RateLimit *relay_limit(Relay *relay) {
+    long long rate = atomic_load_explicit(&relay_rate_limit, memory_order_relaxed);
+    if (ratelimit_rate(&relay->share->limit) != rate) ratelimit_set(&relay->share->limit, rate);
+    return &relay->share->limit;
+}
+
+static void sleep_ns(long long ns) {
+    struct timespec ts = { .tv_sec = ns / 1000000000LL, .tv_nsec = ns % 1000000000LL };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+    }
+}
+
+void relay_unregister(const char *token) {
+    pthread_mutex_lock(&relay_mutex);
+    RelayToken *t = find_token_locked(token);
+    if (t) free_token_locked(t);
+    pthread_mutex_unlock(&relay_mutex);
+}
+
+// 한 방향 중계: 소켓 -> 파이프 -> 소켓. 끝(EOF)은 상대에게 SHUT_WR로 전달하고,
+// 오류가 나면 양쪽을 모두 끊어 반대 방향 스레드도 멈추게 합니다.
+// 파일 방향(송신자 -> 수신자)은 속도 상한이 있으면 RATELIMIT_QUANTUM씩 옮기고 상한에 맞춰 쉽니다.
+static void relay_pump(Relay *relay, int from) {
+    int src = relay->fds[from];
+    int dst = relay->fds[!from];
+    int pipefd[2];
+    int failed = 0;
+
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+        shutdown(src, SHUT_RDWR);
+        shutdown(dst, SHUT_RDWR);
+        return;
+    }
+    fcntl(pipefd[1], F_SETPIPE_SZ, RELAY_PIPE_SIZE); // 실패하면 기본 크기(64 KB)로 동작
+    int capacity = fcntl(pipefd[1], F_GETPIPE_SZ);
+    if (capacity <= 0) capacity = 64 * 1024;
+
+    while (!failed) {
+        RateLimit *limit = from == ROLE_SENDER ? relay_limit(relay) : NULL;
+        size_t step = limit ? ratelimit_step(limit, capacity) : (size_t)capacity;
+        ssize_t n = splice(src, NULL, pipefd[1], NULL, step, SPLICE_F_MOVE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0) break;
+        if (n < 0) {
+            failed = 1;
+            break;
+        }
+        while (n > 0) {
+            ssize_t m = splice(pipefd[0], NULL, dst, NULL, n, SPLICE_F_MOVE);
+            if (m < 0 && errno == EINTR) continue;
+            if (m <= 0) {
+                failed = 1;
+                break;
+            }
+            n -= m;
+            atomic_fetch_add(&relay->bytes[from], m);
+            if (limit) sleep_ns(ratelimit_take(limit, m));
+        }
+    }
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+    if (failed) {
+        shutdown(src, SHUT_RDWR);
+        shutdown(dst, SHUT_RDWR);
+    } else {
+        shutdown(dst, SHUT_WR);
+    }
+}
+
+static void *relay_reverse_thread(void *arg) {
+    RelayDirection *direction = (RelayDirection*)arg;
+    relay_pump(direction->relay, direction->from);
+    return NULL;
+}
+
+// 짝지어진 연결 한 쌍을 끝날 때까지 중계하고 처리량을 기록
+static void run_relay(Relay *relay) {
+    char paired = RELAY_PAIRED;
+    RelayDirection reverse = { .relay = relay, .from = ROLE_RECEIVER };
+    pthread_t tid;
+
+    if (send(relay->fds[ROLE_SENDER], &paired, 1, MSG_NOSIGNAL) == 1 &&
+        send(relay->fds[ROLE_RECEIVER], &paired, 1, MSG_NOSIGNAL) == 1 &&
+        pthread_create(&tid, NULL, relay_reverse_thread, &reverse) == 0) {
+        relay_pump(relay, ROLE_SENDER);
+        pthread_join(tid, NULL);
+    }
+
+    double elapsed = relay_now() - relay->started;
+    long long data_bytes = atomic_load(&relay->bytes[0]);
+    long long request_bytes = atomic_load(&relay->bytes[1]);
+
+    pthread_mutex_lock(&relay_mutex);
+    Relay **link = &active_relays;
+    while (*link && *link != relay) link = &(*link)->next;
+    if (*link) *link = relay->next;
+    completed_relays++;
+    relayed_bytes += data_bytes + request_bytes;
+    relayed_seconds += elapsed;
+    pthread_mutex_unlock(&relay_mutex);
+
+    log_info("Relay %s -> %s finished: %lld bytes in %.2f s (%.1f MB/s, %lld request bytes)\n",
+             relay->sender, relay->target, data_bytes, elapsed, mb_per_second(data_bytes, elapsed), request_bytes);
+    fflush(stdout);
+
+    close(relay->fds[ROLE_SENDER]);
+    close(relay->fds[ROLE_RECEIVER]);
+    pthread_mutex_lock(&relay_mutex);
+    release_share_locked(relay->share);
+    pthread_mutex_unlock(&relay_mutex);
+    free(relay);
+}
+
+static int recv_exact(int fd, char *data, size_t length) {
+    size_t received = 0;
+    while (received < length) {
+        ssize_t n = recv(fd, data + received, length - received, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        received += n;
+    }
+    return 0;
+}
+
+// 인사 메시지를 제한 시간 안에 읽음. 형식이 틀렸거나 시간이 지나면 -1
+static int read_hello(int fd, char hello[RELAY_HELLO_SIZE]) {
+    struct timeval timeout = { .tv_sec = RELAY_HELLO_TIMEOUT_S, .tv_usec = 0 };
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (recv_exact(fd, hello, RELAY_HELLO_SIZE) < 0 || memcmp(hello, RELAY_MAGIC, RELAY_MAGIC_LEN) != 0) return -1;
+    timeout.tv_sec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return 0;
+}
+
+// 새 데이터 연결: 인사 메시지를 읽고, 상대가 기다리고 있으면 바로 중계를 시작하고
+// 아니면 토큰에 맡겨 두고 스레드를 끝냅니다.
+static void *relay_handshake_thread(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    char hello[RELAY_HELLO_SIZE];
+    char token[RELAY_TOKEN_LEN + 1];
+
+    int greeted = read_hello(fd, hello);
+    atomic_fetch_sub(&handshakes_active, 1);
+    if (greeted < 0) {
+        close(fd);
+        return NULL;
+    }
+    // 중계 데이터는 채팅 연결보다 낮은 우선순위로, 커널 송신 대기열은 짧게 (채팅 전달이 뒤에 밀리지 않도록)
+    int priority = RELAY_SOCKET_PRIORITY, lowat = RELAY_NOTSENT_LOWAT;
+    setsockopt(fd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority));
+    setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+
+    memcpy(token, hello + RELAY_MAGIC_LEN, RELAY_TOKEN_LEN);
+    token[RELAY_TOKEN_LEN] = '\0';
+    char role_byte = hello[RELAY_MAGIC_LEN + RELAY_TOKEN_LEN];
+    int role = role_byte == RELAY_ROLE_SENDER ? ROLE_SENDER : ROLE_RECEIVER;
+    if (role_byte != RELAY_ROLE_SENDER && role_byte != RELAY_ROLE_RECEIVER) {
+        close(fd);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&relay_mutex);
+    expire_tokens_locked(relay_now());
+    RelayToken *t = find_token_locked(token);
+    if (!t) {
+        pthread_mutex_unlock(&relay_mutex);
+        close(fd);
+        return NULL;
+    }
+
+    int partner = pop_waiting_locked(t, !role);
+    if (partner < 0) {
+        // 남은 쌍 수보다 많이 기다리게 하지는 않음
+        if (t->waiting_count[role] < t->pairs_left) {
+            t->waiting[role][t->waiting_count[role]++] = fd;
+        } else {
+            close(fd);
+        }
+        pthread_mutex_unlock(&relay_mutex);
+        return NULL;
+    }
+
+    Relay *relay = calloc(1, sizeof(Relay));
+    if (!relay) {
+        // 꺼낸 연결은 다시 기다리게 함
+        t->waiting[!role][t->waiting_count[!role]++] = partner;
+        pthread_mutex_unlock(&relay_mutex);
+        close(fd);
+        return NULL;
+    }
+    strcpy(relay->sender, t->sender);
+    strcpy(relay->target, t->target);
+    relay->fds[role] = fd;
+    relay->fds[!role] = partner;
+    atomic_init(&relay->bytes[0], 0);
+    atomic_init(&relay->bytes[1], 0);
+    relay->share = t->share;
+    relay->share->refs++;
+    relay->started = relay_now();
+    relay->next = active_relays;
+    active_relays = relay;
+    if (--t->pairs_left == 0) free_token_locked(t);
+    pthread_mutex_unlock(&relay_mutex);
+
+    run_relay(relay);
+    return NULL;
+}
+
+// 공개 포트이므로 채팅 포트와 같은 접속 허용 제어를 거치고, 인사를 기다리는 연결 수에도 상한을 둡니다.
+// 파일 디스크립터가 바닥나면 잠시 쉬었다가 다시 받습니다. (대기열의 연결이 남아 있어 바로 다시 실패하므로)
+static void *relay_accept_thread(void *arg) {
+    int backing_off = 0;
+
+    while (1) {
+        struct sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+        int fd = accept4(listen_sock, (struct sockaddr*)&addr, &addr_len, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                if (!backing_off) perror("relay accept failed, backing off");
+                backing_off = 1;
+                usleep(RELAY_ACCEPT_BACKOFF_MS * 1000);
+            } else if (errno != EINTR && errno != ECONNABORTED) {
+                perror("relay accept failed");
+            }
+            continue;
+        }
+        backing_off = 0;
+
+        if (!admission_allow(&addr)) {
+            admission_reject(fd);
+            continue;
+        }
+        if (atomic_fetch_add(&handshakes_active, 1) >= RELAY_MAX_HANDSHAKES) {
+            atomic_fetch_sub(&handshakes_active, 1);
+            rejected_handshakes++;
+            admission_reject(fd);
+            continue;
+        }
+
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, relay_handshake_thread, (void*)(intptr_t)fd) != 0) {
+            atomic_fetch_sub(&handshakes_active, 1);
+            close(fd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    return NULL;
+}
+
+int relay_start(int port) {
+    int sock = proto_listen_any(port, SOCK_CLOEXEC, 0, RELAY_BACKLOG, NULL);
+    if (sock < 0) return -1;
+    listen_sock = sock;
+    listen_port = port;
+
+    // 중계 스레드는 운영자 시그널(SIGUSR1)을 받지 않도록 모두 막은 상태로 시작 (자식 스레드에 상속)
+    sigset_t all_signals, old_mask;
+    pthread_t tid;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &old_mask);
+    int created = pthread_create(&tid, NULL, relay_accept_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (created != 0) {
+        close(sock);
+        listen_sock = -1;
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+void relay_report(FILE *out) {
+    if (!relay_enabled()) return;
+
+    double now = relay_now();
+    int active = 0, pending = 0;
+
+    pthread_mutex_lock(&relay_mutex);
+    fprintf(out, "=== File relays (port %d) ===\n", listen_port);
+    for (Relay *r = active_relays; r; r = r->next) {
+        long long bytes = atomic_load(&r->bytes[0]);
+        double elapsed = now - r->started;
+        fprintf(out, "  %-29s -> %-29s %12lld bytes %8.1f MB/s %7.1f s\n",
+                r->sender, r->target, bytes, mb_per_second(bytes, elapsed), elapsed);
+        active++;
+    }
+    for (RelayToken *t = tokens; t; t = t->next) pending++;
+    fprintf(out, "  active %d, pending tokens %d, completed %llu, relayed %llu bytes (%.1f MB/s per relay), expired %llu\n",
+           active, pending, completed_relays, relayed_bytes,
+           mb_per_second((long long)relayed_bytes, relayed_seconds), expired_tokens);
+    pthread_mutex_unlock(&relay_mutex);
+    fflush(out);
+}
+
+void relay_write_stats(FILE *out) {
+    int active = 0, pending = 0;
+
+    pthread_mutex_lock(&relay_mutex);
+    for (Relay *r = active_relays; r; r = r->next) active++;
+    for (RelayToken *t = tokens; t; t = t->next) pending++;
+    fprintf(out, "relay_enabled %d\n", relay_enabled());
+    fprintf(out, "relay_rate_limit_bytes %lld\n", relay_rate());
+    fprintf(out, "relay_active %d\n", active);
+    fprintf(out, "relay_pending_tokens %d\n", pending);
+    fprintf(out, "relay_completed_total %llu\n", completed_relays);
+    fprintf(out, "relay_bytes_total %llu\n", relayed_bytes);
+    fprintf(out, "relay_seconds_total %.3f\n", relayed_seconds);
+    fprintf(out, "relay_expired_tokens_total %llu\n", expired_tokens);
+    pthread_mutex_unlock(&relay_mutex);
+    fprintf(out, "relay_handshakes_active %d\n", atomic_load(&handshakes_active));
+    fprintf(out, "relay_handshakes_rejected_total %llu\n", atomic_load(&rejected_handshakes));
+}
@@ -0,0 +1,41 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stdio.h>
+#include "protocol.h"
+#include "ratelimit.h"
+
+// --- 파일 전송 중계 (서버) ---
+// 송신자와 수신자의 데이터 연결을 토큰으로 짝지은 뒤, 소켓 -> 파이프 -> 소켓 splice로 이어 줍니다.
+// 파일 데이터는 사용자 공간으로 복사되지 않으며, 채팅 이벤트 루프와는 별도의 스레드에서 동작합니다.
+// 속도 상한을 두면 토큰 하나(전송 하나)의 모든 연결 쌍이 상한 하나를 나눠 쓰므로,
+// 큰 전송 하나가 서버 업링크를 독차지해 채팅 전달이 늦어지지 않습니다.
+
+#define RELAY_MAX_STREAMS 16            // 토큰 하나로 짝지을 수 있는 최대 연결 쌍 수
+#define RELAY_PAIR_TIMEOUT_S 600        // 등록 후 짝이 모두 맺어지지 않으면 토큰을 버리는 시간
+#define RELAY_HELLO_TIMEOUT_S 10        // 접속 후 인사 메시지를 기다리는 시간
+#define RELAY_MAX_HANDSHAKES 256        // 인사 메시지를 기다리는 최대 연결 수 (넘으면 RST로 끊음)
+#define RELAY_ACCEPT_BACKOFF_MS 100     // 파일 디스크립터가 바닥났을 때 다음 accept까지 쉬는 시간
+#define RELAY_PIPE_SIZE (1024 * 1024)   // 방향별 파이프 크기 (splice 한 번에 옮기는 최대 바이트)
+#define RELAY_SOCKET_PRIORITY 2         // 중계 소켓의 SO_PRIORITY (TC_PRIO_BULK)
+#define RELAY_NOTSENT_LOWAT (256 * 1024)
+
+// 중계 포트에서 접속을 받기 시작. 실패 시 -1
+int relay_start(int port);
+int relay_enabled(void);
+int relay_port(void);
+
+// FILE_REQ의 토큰 등록. 중계가 꺼져 있거나 토큰 형식이 틀렸거나 이미 쓰이는 토큰이면 -1
+int relay_register(const char *token, const char *sender, const char *target, int streams);
+void relay_unregister(const char *token);
+
+// 중계 하나(토큰 하나)의 파일 방향 속도 상한 (바이트/초, 0이면 제한 없음). 진행 중인 중계에도 바로 적용됩니다.
+void relay_set_rate(long long bytes_per_second);
+long long relay_rate(void);
+
+// 운영자용: 진행 중인 중계와 누적 처리량 출력 (SIGUSR1)
+void relay_report(FILE *out);
+// STATS용 "이름 값" 형식의 누적 지표
+void relay_write_stats(FILE *out);
+
+#endif
@@ -0,0 +1,299 @@
+#include <stdlib.h>
+#include <string.h>
+#include "server.h"
+#include "epoch.h"
+
+#define ROOM_INITIAL_BUCKETS 64
+#define ROOM_INITIAL_MEMBERS 4
+#define CLIENT_TABLE_INITIAL 64
+#define NICK_INITIAL_BUCKETS 64
+
+pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// --- 연결 테이블 (필요할 때 두 배로 늘어나는 배열) ---
+
+static ClientInfo **clients = NULL;
+static int client_count = 0;
+static int client_capacity = 0;
+static int client_limit = MAX_CLIENTS;
+
+// 등록할 수 있는 최대 연결 수 (서버 시작 시 설정)
+void client_table_set_limit(int limit) {
+    client_limit = limit;
+}
+
+// 테이블 끝에 추가. 각 항목은 자신의 위치(table_index)를 기억합니다.
+int client_table_add(ClientInfo *client) {
+    if (client_count >= client_limit) return -1;
+    if (client_count == client_capacity) {
+        int new_capacity = client_capacity ? client_capacity * 2 : CLIENT_TABLE_INITIAL;
+        ClientInfo **grown = realloc(clients, sizeof(ClientInfo*) * new_capacity);
+        if (!grown) return -1;
+        clients = grown;
+        client_capacity = new_capacity;
+    }
+    client->table_index = client_count;
+    clients[client_count++] = client;
+    return 0;
+}
+
+// 마지막 항목을 빈 자리로 옮겨 O(1)로 제거 (배열 전체를 밀지 않음)
+void client_table_remove(ClientInfo *client) {
+    int index = client->table_index;
+    if (index < 0 || index >= client_count || clients[index] != client) return;
+
+    ClientInfo *last = clients[--client_count];
+    clients[index] = last;
+    last->table_index = index;
+    client->table_index = -1;
+}
+
+int client_table_count(void) {
+    return client_count;
+}
+
+ClientInfo *client_table_at(int index) {
+    return (index >= 0 && index < client_count) ? clients[index] : NULL;
+}
+
+// --- 방 인덱스 (방 이름 -> 멤버 목록 해시 맵) ---
+
+RoomIndex global_rooms = { NULL, 0, 0, 1 };
+
+// FNV-1a 문자열 해시
+size_t name_hash(const char *name) {
+    size_t hash = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// 평균 체인 길이가 1을 넘으면 버킷 수를 두 배로 늘립니다.
+static int room_rehash(RoomIndex *index, size_t new_count) {
+    Room **new_buckets = calloc(new_count, sizeof(Room*));
+    if (!new_buckets) return -1;
+
+    for (size_t i = 0; i < index->bucket_count; i++) {
+        Room *room = index->buckets[i];
+        while (room) {
+            Room *next = room->next;
+            size_t b = name_hash(room->name) & (new_count - 1);
+            room->next = new_buckets[b];
+            new_buckets[b] = room;
+            room = next;
+        }
+    }
+    free(index->buckets);
+    index->buckets = new_buckets;
+    index->bucket_count = new_count;
+    return 0;
+}
+
+Room *room_find(RoomIndex *index, const char *name) {
+    if (index->bucket_count == 0) return NULL;
+    Room *room = index->buckets[name_hash(name) & (index->bucket_count - 1)];
+    while (room && strcmp(room->name, name) != 0) {
+        room = room->next;
+    }
+    return room;
+}
+
+static Room *room_create(RoomIndex *index, const char *name) {
+    if (index->bucket_count == 0 || index->total >= index->bucket_count) {
+        size_t new_count = index->bucket_count ? index->bucket_count * 2 : ROOM_INITIAL_BUCKETS;
+        if (room_rehash(index, new_count) < 0 && index->bucket_count == 0) return NULL;
+    }
+
+    Room *room = calloc(1, sizeof(Room));
+    if (!room) return NULL;
+    if (index->shared) pthread_mutex_init(&room->history_lock, NULL);
+    strncpy(room->name, name, ROOM_NAME_SIZE - 1);
+    room->name[ROOM_NAME_SIZE - 1] = '\0';
+    room->index = index;
+
+    size_t b = name_hash(room->name) & (index->bucket_count - 1);
+    room->next = index->buckets[b];
+    index->buckets[b] = room;
+    index->total++;
+    return room;
+}
+
+static void room_free(void *object) {
+    Room *room = (Room*)object;
+    if (room->index->shared) pthread_mutex_destroy(&room->history_lock);
+    free(atomic_load_explicit(&room->snapshot, memory_order_relaxed));
+    free(room->members);
+    free(room);
+}
+
+// 마지막 멤버가 나간 방은 해시 맵에서 제거합니다.
+// 공유 인덱스에서는 방을 찾아 둔 브로드캐스트가 아직 읽고 있을 수 있으므로 에포크로 회수합니다.
+static void room_destroy(Room *room) {
+    RoomIndex *index = room->index;
+    Room **link = &index->buckets[name_hash(room->name) & (index->bucket_count - 1)];
+    while (*link && *link != room) {
+        link = &(*link)->next;
+    }
+    if (*link) *link = room->next;
+    index->total--;
+    if (index->shared) {
+        epoch_retire(room, room_free);
+    } else {
+        room_free(room);
+    }
+}
+
+// 현재 members로 새 멤버 사본을 만들어 교체하고, 옛 사본은 읽는 쪽이 모두 끝난 뒤 해제되도록 맡김
+static int room_publish(Room *room) {
+    RoomSnapshot *next = malloc(sizeof(RoomSnapshot) + sizeof(ClientInfo*) * room->member_count);
+    if (!next) return -1;
+    next->version = ++room->snapshot_version;
+    next->count = room->member_count;
+    memcpy(next->members, room->members, sizeof(ClientInfo*) * room->member_count);
+    epoch_retire(atomic_exchange_explicit(&room->snapshot, next, memory_order_acq_rel), free);
+    return 0;
+}
+
+RoomSnapshot *room_snapshot(Room *room) {
+    return atomic_load_explicit(&room->snapshot, memory_order_acquire);
+}
+
+Room *room_acquire(RoomIndex *index, const char *name) {
+    Room *room = room_find(index, name);
+    return room ? room : room_create(index, name);
+}
+
+void room_release(Room *room) {
+    if (room->member_count == 0) room_destroy(room);
+}
+
+// 현재 방에서 나와 새 방에 들어감 (방이 없으면 생성). 실패 시 -1
+int room_join(RoomIndex *index, ClientInfo *client, const char *name) {
+    room_leave(client);
+
+    Room *room = room_acquire(index, name);
+    if (!room) return -1;
+
+    if (room->member_count == room->member_capacity) {
+        int new_capacity = room->member_capacity ? room->member_capacity * 2 : ROOM_INITIAL_MEMBERS;
+        ClientInfo **grown = realloc(room->members, sizeof(ClientInfo*) * new_capacity);
+        if (!grown) {
+            room_release(room);
+            return -1;
+        }
+        room->members = grown;
+        room->member_capacity = new_capacity;
+    }
+
+    client->room = room;
+    client->room_index = room->member_count;
+    room->members[room->member_count++] = client;
+    if (room->index->shared && room_publish(room) < 0) {
+        // 사본을 못 만들면 입장하지 않은 것으로 되돌림 (방금 넣은 멤버가 마지막 자리)
+        room->member_count--;
+        client->room = NULL;
+        client->room_index = -1;
+        room_release(room);
+        return -1;
+    }
+    strncpy(client->room_name, room->name, ROOM_NAME_SIZE - 1);
+    client->room_name[ROOM_NAME_SIZE - 1] = '\0';
+    return 0;
+}
+
+// 방 멤버 목록에서 O(1)로 제거 (마지막 멤버를 빈 자리로 이동)
+void room_leave(ClientInfo *client) {
+    Room *room = client->room;
+    if (!room) return;
+
+    ClientInfo *last = room->members[--room->member_count];
+    room->members[client->room_index] = last;
+    last->room_index = client->room_index;
+
+    client->room = NULL;
+    client->room_index = -1;
+    client->room_name[0] = '\0';
+
+    // 사본을 못 만들면 빈 방으로 게시 (나간 연결에는 보내지 않도록). 다음 입장/퇴장 때 다시 만듦
+    if (room->index->shared && room_publish(room) < 0) {
+        epoch_retire(atomic_exchange_explicit(&room->snapshot, NULL, memory_order_acq_rel), free);
+    }
+    room_release(room);
+}
+
+size_t room_count(RoomIndex *index) {
+    return index->total;
+}
+
+void room_foreach(RoomIndex *index, void (*visit)(Room *room, void *ctx), void *ctx) {
+    for (size_t i = 0; i < index->bucket_count; i++) {
+        for (Room *room = index->buckets[i]; room; room = room->next) {
+            visit(room, ctx);
+        }
+    }
+}
+
+// --- 닉네임 디렉토리 (닉네임 -> 연결 해시 맵, 중복 불가) ---
+
+static ClientInfo **nick_buckets = NULL;
+static size_t nick_bucket_count = 0;
+static size_t nick_total = 0;
+
+static int nick_rehash(size_t new_count) {
+    ClientInfo **new_buckets = calloc(new_count, sizeof(ClientInfo*));
+    if (!new_buckets) return -1;
+
+    for (size_t i = 0; i < nick_bucket_count; i++) {
+        ClientInfo *client = nick_buckets[i];
+        while (client) {
+            ClientInfo *next = client->nick_next;
+            size_t b = name_hash(client->nickname) & (new_count - 1);
+            client->nick_next = new_buckets[b];
+            new_buckets[b] = client;
+            client = next;
+        }
+    }
+    free(nick_buckets);
+    nick_buckets = new_buckets;
+    nick_bucket_count = new_count;
+    return 0;
+}
+
+ClientInfo *nick_find(const char *nickname) {
+    if (nick_bucket_count == 0) return NULL;
+    ClientInfo *client = nick_buckets[name_hash(nickname) & (nick_bucket_count - 1)];
+    while (client && strcmp(client->nickname, nickname) != 0) {
+        client = client->nick_next;
+    }
+    return client;
+}
+
+// client->nickname으로 등록. 이미 쓰는 닉네임이면 -2, 메모리 부족이면 -1
+int nick_register(ClientInfo *client) {
+    if (nick_find(client->nickname)) return -2;
+    if (nick_bucket_count == 0 || nick_total >= nick_bucket_count) {
+        size_t new_count = nick_bucket_count ? nick_bucket_count * 2 : NICK_INITIAL_BUCKETS;
+        if (nick_rehash(new_count) < 0 && nick_bucket_count == 0) return -1;
+    }
+
+    size_t b = name_hash(client->nickname) & (nick_bucket_count - 1);
+    client->nick_next = nick_buckets[b];
+    nick_buckets[b] = client;
+    client->nick_registered = 1;
+    nick_total++;
+    return 0;
+}
+
+void nick_unregister(ClientInfo *client) {
+    if (!client->nick_registered) return;
+    ClientInfo **link = &nick_buckets[name_hash(client->nickname) & (nick_bucket_count - 1)];
+    while (*link && *link != client) {
+        link = &(*link)->nick_next;
+    }
+    if (*link) *link = client->nick_next;
+    client->nick_next = NULL;
+    client->nick_registered = 0;
+    nick_total--;
+}
@@ -1,264 +1,2190 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
 
-#define CHAT_PORT 8080
-#define MAX_CLIENTS 10
-#define BUFFER_SIZE 1024
-#define NICKNAME_SIZE 30
-#define ROOM_NAME_SIZE 50
+#include "server.h"
+#include "relay.h"
+#include "metrics.h"
+#include "mpsc.h"
+#include "history.h"
+#include "msglog.h"
+#include "pool.h"
+#include "epoch.h"
+#include "admission.h"
 
-// 클라이언트 정보를 저장하는 구조체
+#define MAX_EVENTS 256
+#define READ_CHUNK_SIZE (16 * 1024) // 프레임 모드에서 한 번의 recv로 여러 프레임을 읽어들이는 크기
+#define THREAD_POLL_MS 100 // 스레드 모드: 다른 스레드가 큐에 넣은 메시지를 확인하는 주기
+#define ACCEPT_BATCH 64 // 리스닝 소켓 이벤트 한 번에 받는 최대 연결 수 (접속 폭주 중에도 기존 연결을 처리하도록)
+#define HANDSHAKE_TIMEOUT_MS 10000 // 접속 후 닉네임을 보내기까지의 기본 제한 시간
+#define CONFIG_LINE_SIZE 1024
+
+// 서버 동작 모드: epoll 이벤트 루프(기본), 연결당 스레드(비교용 fallback),
+// 코어마다 리액터 하나씩 (SO_REUSEPORT로 접속을 나누고, 방마다 소유 리액터가 있음)
+typedef enum {
+    MODE_EPOLL,
+    MODE_THREAD,
+    MODE_REACTORS
+} ServerMode;
+
+// 실행 설정 (명령행 옵션이나 설정 파일로 변경)
+static ServerMode mode = MODE_EPOLL;
+static int chat_port = CHAT_PORT;
+static int relay_listen_port = RELAY_PORT;
+static const char *stats_path = NULL;
+static int reactor_threads = 0;             // 0: 사용 가능한 코어 수
+static int max_clients = MAX_CLIENTS;
+static int listen_backlog = SOMAXCONN;      // 커널의 net.core.somaxconn을 넘으면 그 값으로 잘림
+static int handshake_timeout_ms = HANDSHAKE_TIMEOUT_MS; // 0: 제한 없음
+static int max_message = BUFFER_SIZE;       // 텍스트 모드에서 recv 한 번에 읽는 명령어의 최대 길이 (NULL 포함)
+
+// 핸드셰이크를 기다리는 연결 (epoll 루프/리액터마다 하나). 제한 시간이 모두 같으므로
+// 접속 순서가 곧 마감 순서이고, 앞에서부터 만료시키면 됩니다.
+struct HandshakeQueue {
+    ClientInfo *head;
+    ClientInfo *tail;
+};
+
+// --- 연결별 송신 큐 ---
+// epoll/스레드 모드에서 송신 큐는 연결마다 out_lock으로 보호합니다. (브로드캐스트가 전역 락 없이 멤버별로 넣음)
+// 멀티 리액터 모드의 연결은 자기 리액터 스레드만 건드리므로, 아래의 "out_lock을 잡은 상태"는
+// 그 모드에서 "연결을 소유한 리액터 스레드에서"를 뜻합니다. 락 순서는 clients_mutex -> out_lock, 방의 history_lock -> 기록 조각의 lock -> out_lock입니다.
+// (방의 history_lock은 clients_mutex를 잡은 채로 잡지 않습니다.)
+
+#define OUTQ_HIGH_WATERMARK (256 * 1024)
+#define OUTQ_LOW_WATERMARK (64 * 1024)
+#define OUTQ_REPORT_LIMIT 20 // 큐 깊이 보고에 나열할 최대 연결 수
+#define STATS_ROOM_LIMIT 20 // STATS에 나열할 최대 방 수 (메시지가 많은 순)
+
+// 느린 수신자 설정 (명령행 옵션으로 변경)
+static size_t outq_high_watermark = OUTQ_HIGH_WATERMARK;
+static size_t outq_low_watermark = OUTQ_LOW_WATERMARK;
+static SlowConsumerPolicy slow_policy = SLOW_DROP_OLDEST;
+
+// 운영자용 누적 통계 (멀티 리액터 모드에서는 여러 리액터가 갱신하므로 원자적 변수)
+static atomic_size_t congested_clients = 0;
+static atomic_ullong dropped_messages = 0;
+static atomic_ullong slow_disconnects = 0;
+
+// 방 기록: 입장할 때 최근 history_limit개 중 history_seconds 이내의 메시지를 재생 (0이면 기록하지 않음)
+#define HISTORY_DEFAULT_REPLAY 50
+static int history_limit = HISTORY_DEFAULT_REPLAY;
+static int history_seconds = 0;             // 0: 시간 제한 없음
+static size_t history_budget = HISTORY_DEFAULT_BUDGET;
+
+// 메시지 로그: 채팅 메시지를 디스크에 남기고 HISTORY:방:시각 요청에 답함 (디렉토리가 없으면 끔)
+static const char *message_log_dir = NULL;
+static int message_log_sync_ms = MSGLOG_DEFAULT_SYNC_MS;
+
+// epoll/스레드 모드의 방 기록과 메시지 로그. 멀티 리액터 모드처럼 방 이름 해시로 나눠,
+// 다른 방의 브로드캐스트가 한 락에서 만나지 않게 합니다. lock은 기록을 넣고 읽는 동안만 잡습니다.
+#define HISTORY_SHARDS 16
+
+typedef struct {
+    pthread_mutex_t lock;
+    HistoryStore *history;
+    MsgLogStore *log;
+} HistoryShard;
+
+static HistoryShard history_shards[HISTORY_SHARDS];
+
+static HistoryShard *history_shard(const char *room_name) {
+    return &history_shards[name_hash(room_name) % HISTORY_SHARDS];
+}
+
+// 연결 상태(ClientInfo) 풀. 송신 버퍼와 리액터 작업은 크기별 풀(pool_alloc)에서 꺼냅니다.
+static Pool *connection_pool = NULL;
+
+// 스레드 모드의 연결 스레드 스택 크기. 큰 버퍼는 힙과 풀에 있으므로 기본값(보통 8 MB)보다 작게 잡습니다.
+#define THREAD_STACK_SIZE (256 * 1024)
+
+static volatile sig_atomic_t report_requested = 0;
+static time_t server_started;
+
+static const char *slow_policy_name(SlowConsumerPolicy policy) {
+    switch (policy) {
+    case SLOW_DROP_OLDEST: return "drop-oldest";
+    case SLOW_DROP_NEWEST: return "drop-newest";
+    default: return "disconnect";
+    }
+}
+
+// 연결의 송신 큐 락 (멀티 리액터 모드의 연결은 소유 스레드만 건드리므로 잠그지 않음)
+static void client_lock(ClientInfo *client) {
+    if (!client->reactor) pthread_mutex_lock(&client->out_lock);
+}
+
+static void client_unlock(ClientInfo *client) {
+    if (!client->reactor) pthread_mutex_unlock(&client->out_lock);
+}
+
+// 멀티 리액터 모드: 송신 큐가 바뀐 뒤 리액터의 큐 합계에 반영 (count, bytes는 바꾸기 전 값, 아래 리액터 절에 정의)
+static void reactor_queue_changed(ClientInfo *client, size_t count, size_t bytes);
+
+// 연결을 끊기로 표시. shutdown으로 소유자(리액터/스레드)에게 HUP 이벤트를 보내 정리를 맡깁니다.
+// (out_lock을 잡은 상태에서 호출)
+static void client_kill(ClientInfo *client) {
+    if (client->closing) return;
+    client->closing = 1;
+    if (client->congested) {
+        client->congested = 0;
+        congested_clients--;
+    }
+    size_t count = client->output.count, bytes = client->output.bytes;
+    outq_clear(&client->output);
+    reactor_queue_changed(client, count, bytes);
+    shutdown(client->socket_fd, SHUT_RDWR);
+}
+
+// 연결 소켓의 epoll 등록 (edge-triggered이므로 EPOLLOUT은 소켓 버퍼가 다시 비었을 때만 알려 줌)
+#define CONNECTION_EPOLL_EVENTS (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)
+
+// 혼잡이 풀린 연결의 읽기를 재개. 혼잡은 다른 연결의 브로드캐스트 중에 풀릴 수도 있는데, edge-triggered라
+// 이미 도착해 있던 입력에는 새 이벤트가 오지 않으므로 다시 등록해 읽을 데이터가 있으면 이벤트를 받게 합니다.
+// (스레드 모드는 poll 주기마다 혼잡 여부를 다시 확인)
+static void client_resume_read(ClientInfo *client) {
+    if (client->epfd < 0) return;
+    struct epoll_event ev = { .events = CONNECTION_EPOLL_EVENTS, .data.ptr = client };
+    epoll_ctl(client->epfd, EPOLL_CTL_MOD, client->socket_fd, &ev);
+}
+
+// 송신 큐를 가능한 만큼 전송하고, low watermark 아래로 내려오면 혼잡 상태를 해제
+// (out_lock을 잡은 상태에서 호출)
+static void client_flush(ClientInfo *client) {
+    if (client->closing) return;
+    size_t count = client->output.count, bytes = client->output.bytes;
+    ssize_t sent = outq_flush(&client->output, client->socket_fd);
+    reactor_queue_changed(client, count, bytes);
+    if (sent < 0) {
+        client_kill(client);
+        return;
+    }
+    if (sent > 0) metrics_add(METRIC_BYTES_OUT, sent);
+    if (client->congested && client->output.bytes <= outq_low_watermark) {
+        client->congested = 0;
+        congested_clients--;
+        log_info("Slow consumer recovered: %s (fd %d)\n", client->nickname, client->socket_fd);
+        client_resume_read(client);
+    }
+}
+
+// 메시지를 큐에 넣고 바로 전송을 시도. 블로킹하지 않으며 큐가 buf의 참조를 하나 가집니다.
+// high watermark를 넘는 연결에는 slow_policy를 적용합니다. (out_lock을 잡은 상태에서 호출)
+static void client_enqueue(ClientInfo *client, OutBuffer *buf) {
+    OutQueue *q = &client->output;
+
+    if (client->closing) return;
+    size_t count = q->count, bytes = q->bytes;
+
+    if (!client->congested && q->bytes + buf->length > outq_high_watermark) {
+        client->congested = 1;
+        congested_clients++;
+        log_info("Slow consumer: %s (fd %d) has %zu bytes queued, applying %s\n",
+               client->nickname, client->socket_fd, q->bytes, slow_policy_name(slow_policy));
+    }
+
+    if (client->congested) {
+        if (slow_policy == SLOW_DISCONNECT) {
+            slow_disconnects++;
+            client_kill(client);
+            return;
+        }
+        if (slow_policy == SLOW_DROP_NEWEST) {
+            dropped_messages++;
+            return;
+        }
+        // SLOW_DROP_OLDEST: 새 메시지를 넣고도 low watermark 이하가 되도록 오래된 것부터 버림
+        if (q->bytes + buf->length > outq_low_watermark) {
+            dropped_messages += outq_drop_oldest(q, q->bytes + buf->length - outq_low_watermark);
+        }
+    }
+
+    int pushed = outq_push(q, buf);
+    reactor_queue_changed(client, count, bytes);
+    if (pushed < 0) {
+        dropped_messages++;
+        return;
+    }
+    client_flush(client);
+}
+
+// 프로토콜에 맞춰 송신 버퍼 하나를 인코딩 (참조 카운트 1로 반환)
+// 프레임 모드: [길이][opcode][페이로드], 텍스트 모드: 기존 문자열 형식 (FILE_ALERT는 접두사 포함)
+static OutBuffer *encode_message(int framed, uint8_t opcode, const char *payload, size_t length) {
+    OutBuffer *buf;
+
+    if (framed) {
+        if (length > FRAME_MAX_PAYLOAD) return NULL;
+        buf = outbuf_new(FRAME_HEADER_SIZE + length);
+        if (!buf) return NULL;
+        frame_encode(buf->data, buf->length, opcode, payload, length);
+    } else {
+        const char *prefix = (opcode == OP_FILE_ALERT) ? "FILE_ALERT:" : "";
+        size_t prefix_length = strlen(prefix);
+        if (prefix_length + length > FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD) return NULL;
+        buf = outbuf_new(prefix_length + length);
+        if (!buf) return NULL;
+        memcpy(buf->data, prefix, prefix_length);
+        memcpy(buf->data + prefix_length, payload, length);
+    }
+    return buf;
+}
+
+// 메시지 하나를 송신 큐에 넣음 (out_lock을 잡은 상태에서 호출)
+static int client_send_locked(ClientInfo *client, uint8_t opcode, const char *payload, size_t length) {
+    OutBuffer *buf = encode_message(client->framed, opcode, payload, length);
+    if (!buf) return -1;
+    client_enqueue(client, buf);
+    outbuf_release(buf);
+    return 0;
+}
+
+// 연결 하나에 메시지 전송. 소켓 버퍼가 가득 차 있어도 큐에 넣고 바로 돌아옵니다.
+int client_send(ClientInfo *client, uint8_t opcode, const char *payload, size_t length) {
+    client_lock(client);
+    int result = client_send_locked(client, opcode, payload, length);
+    client_unlock(client);
+    return result;
+}
+
+// 채팅창에 표시할 문자열 메시지 전송 (길이를 직접 세지 않도록 strlen 사용)
+int client_send_text(ClientInfo *client, const char *text) {
+    return client_send(client, OP_TEXT, text, strlen(text));
+}
+
+// 형식 문자열로 만든 문자열 메시지 전송. 스택 버퍼를 거치지 않고 풀에서 꺼낸 송신 버퍼에 바로 씁니다.
+int client_send_textf(ClientInfo *client, const char *format, ...) {
+    va_list args;
+    size_t header = client->framed ? FRAME_HEADER_SIZE : 0;
+
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (length < 0 || length > FRAME_MAX_PAYLOAD) return -1;
+
+    // vsnprintf가 끝에 NUL을 쓰므로 1바이트 크게 꺼낸 뒤 길이를 줄임
+    OutBuffer *buf = outbuf_new(header + length + 1);
+    if (!buf) return -1;
+    va_start(args, format);
+    vsnprintf(buf->data + header, length + 1, format, args);
+    va_end(args);
+    buf->length = header + length;
+    if (client->framed) frame_header_encode(buf->data, OP_TEXT, length);
+
+    client_lock(client);
+    client_enqueue(client, buf);
+    client_unlock(client);
+    outbuf_release(buf);
+    return 0;
+}
+
+// --- 방 기록 재생 ---
+
+static int64_t wall_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+typedef struct {
+    int framed;
+    OutBuffer *buf;     // NULL이면 크기만 계산
+    size_t length;
+} ReplayBuilder;
+
+static void replay_visit(const char *message, size_t length, void *ctx) {
+    ReplayBuilder *builder = (ReplayBuilder*)ctx;
+    size_t encoded = builder->framed ? FRAME_HEADER_SIZE + length : length;
+
+    if (builder->buf) {
+        if (builder->framed) {
+            frame_encode(builder->buf->data + builder->length, encoded, OP_TEXT, message, length);
+        } else {
+            memcpy(builder->buf->data + builder->length, message, length);
+        }
+    }
+    builder->length += encoded;
+}
+
+// 방 기록을 송신 버퍼 하나로 인코딩 (재생할 메시지가 없으면 NULL)
+// 메시지마다 큐에 넣지 않고 버퍼 하나로 묶어 한 번의 쓰기로 보냅니다.
+static OutBuffer *encode_history(HistoryStore *store, const char *room_name, int framed) {
+    ReplayBuilder builder = { .framed = framed, .buf = NULL, .length = 0 };
+    int64_t since = history_seconds > 0 ? wall_clock_ms() - (int64_t)history_seconds * 1000 : 0;
+
+    if (history_replay(store, room_name, history_limit, since, replay_visit, &builder) == 0) return NULL;
+    if (!(builder.buf = outbuf_new(builder.length))) return NULL;
+    builder.length = 0;
+    history_replay(store, room_name, history_limit, since, replay_visit, &builder);
+    return builder.buf;
+}
+
+static void log_visit(const char *message, size_t length, int64_t time_ms, void *ctx) {
+    replay_visit(message, length, ctx);
+}
+
+// HISTORY 요청의 응답: since_ms 이후의 기록과 마지막 안내 줄(이어 읽을 요청 또는 끝)을 송신 버퍼 하나로 인코딩
+// 메시지 로그가 꺼져 있으면 메모리 기록에서 찾습니다.
+static OutBuffer *encode_history_query(MsgLogStore *log, HistoryStore *store, const char *room_name,
+                                       int64_t since_ms, int framed) {
+    ReplayBuilder builder = { .framed = framed, .buf = NULL, .length = 0 };
+    int64_t next_ms = -1;
+    char trailer[160];
+
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1 && !(builder.buf = outbuf_new(builder.length))) return NULL;
+        builder.length = 0;
+        if (log) msglog_query(log, room_name, since_ms, MSGLOG_QUERY_LIMIT, log_visit, &builder, &next_ms);
+        else history_replay(store, room_name, HISTORY_ROOM_MESSAGES, since_ms, replay_visit, &builder);
+        if (pass == 0 && next_ms >= 0) {
+            snprintf(trailer, sizeof(trailer), "[SERVER] More history: HISTORY:%s:%lld", room_name, (long long)next_ms);
+        } else if (pass == 0) {
+            snprintf(trailer, sizeof(trailer), "[SERVER] End of history for '%s'.", room_name);
+        }
+        replay_visit(trailer, strlen(trailer), &builder);
+    }
+    return builder.buf;
+}
+
+// 재시작 뒤: 메시지 로그의 마지막 메시지들로 메모리 기록을 채워, 입장할 때의 재생이 재시작 전과 이어지게 함
+typedef struct {
+    MsgLogStore *log;
+    HistoryStore *history;
+    const char *room;
+} HistoryWarmer;
+
+static void warm_visit(const char *message, size_t length, int64_t time_ms, void *ctx) {
+    HistoryWarmer *warmer = (HistoryWarmer*)ctx;
+    history_append(warmer->history, warmer->room, message, length, time_ms);
+}
+
+static void warm_room(const char *room_name, void *ctx) {
+    HistoryWarmer *warmer = (HistoryWarmer*)ctx;
+    warmer->room = room_name;
+    msglog_tail(warmer->log, room_name, history_limit, warm_visit, warmer);
+}
+
+static void warm_history(MsgLogStore *log, HistoryStore *history) {
+    HistoryWarmer warmer = { .log = log, .history = history, .room = NULL };
+    if (log && history) msglog_foreach_room(log, warm_room, &warmer);
+}
+
+// --- 멀티 리액터 (방 소유권과 리액터 간 작업 전달) ---
+// 연결은 자신을 받은 리액터가 끝까지 처리하고, 방은 이름 해시로 정해진 소유 리액터 하나가 순서를 매깁니다.
+// 브로드캐스트는 소유 리액터로 넘어가 한 번 인코딩된 뒤, 그 방의 멤버가 있는 리액터마다 작업 하나로 전달됩니다.
+// 리액터 사이에는 락 없는 MPSC 큐만 오가며, 같은 리액터 안의 작업은 큐를 거치지 않고 바로 실행합니다.
+
+#define MAX_REACTORS 64             // 방마다 멤버가 있는 리액터를 64비트 마스크로 기록
+#define REACTOR_TASK_BUDGET 1024    // 이벤트 루프 한 바퀴에 처리할 최대 작업 수 (소켓 이벤트가 밀리지 않도록)
+
+typedef enum {
+    TASK_JOIN,          // 소유 리액터: 멤버 하나(target)가 들어옴 (edge: 보낸 리액터의 첫 멤버)
+    TASK_LEAVE,         // 소유 리액터: 멤버 하나가 나감 (edge: 보낸 리액터의 마지막 멤버)
+    TASK_BROADCAST,     // 소유 리액터: 방 전체에 보낼 메시지 (record: 방 기록에 남김)
+    TASK_DELIVER,       // 멤버 리액터: 인코딩된 버퍼를 자기 멤버들의 큐에 넣음
+    TASK_DIRECT,        // 연결의 리액터: 닉네임 하나에게 보낼 메시지 (FILE_ALERT 등)
+    TASK_REPLAY,        // 연결의 리액터: 방 기록 재생이나 HISTORY 응답 버퍼(encoded[0])를 target 연결에 넣음
+    TASK_HISTORY        // 소유 리액터: target 연결의 HISTORY 요청 (since_ms 이후)
+} ReactorTaskKind;
+
+typedef struct {
+    MpscNode node;                  // 반드시 첫 멤버 (큐에서 꺼낸 노드를 작업으로 변환)
+    ReactorTaskKind kind;
+    int from;                       // 보낸 리액터 번호
+    int edge;
+    int record;
+    int framed;                     // JOIN/HISTORY: 요청한 연결의 프로토콜 (방 기록 인코딩용)
+    int64_t since_ms;               // HISTORY: 이 시각 이후의 기록
+    uint8_t opcode;
+    uint64_t started;               // BROADCAST: 요청 시각 (fan-out 지연 측정)
+    uint64_t seq;                   // DELIVER: 방 안 순번, REPLAY(입장): 재생에 든 마지막 순번
+    unsigned generation;            // JOIN/REPLAY: 연결의 입장 번호 (REPLAY에서 0이면 HISTORY 응답)
+    OutBuffer *encoded[2];          // DELIVER: [0] 텍스트 모드, [1] 프레임 모드 (작업이 참조 하나씩 가짐)
+    char room[ROOM_NAME_SIZE];
+    char target[NICKNAME_SIZE];
+    size_t length;
+    char payload[];
+} ReactorTask;
+
+struct Reactor {
+    int id;
+    int cpu;                        // 고정한 코어 (-1: 고정하지 않음)
+    int listen_sock;                // SO_REUSEPORT로 같은 포트를 공유하는 리액터별 리스닝 소켓
+    int epfd;
+    pthread_t thread;
+    MpscQueue inbox;                // 다른 리액터가 넘긴 작업
+    RoomIndex members;              // 이 리액터 연결들의 방 멤버 목록
+    RoomIndex owned;                // 이 리액터가 소유한 방 (멤버 수, 통계, 멤버가 있는 리액터 마스크)
+    HistoryStore *history;          // 소유한 방의 기록
+    MsgLogStore *log;               // 소유한 방의 메시지 로그
+    HandshakeQueue handshakes;      // 이 리액터가 받은 연결 중 핸드셰이크를 기다리는 것
+    atomic_int connections;         // 이하 STATS용
+    atomic_size_t rooms_owned;
+    atomic_ullong handoffs;         // 다른 리액터로 넘긴 작업 수
+    atomic_size_t queued_messages;  // 이 리액터 연결들의 송신 큐 합계 (큐는 리액터 스레드만 읽으므로 대신 공개)
+    atomic_size_t queued_bytes;
+};
+
+static Reactor *reactors = NULL;
+static int reactor_count = 0;
+static atomic_int reactors_published = 0;  // STATS 스레드가 읽어도 되는 리액터 수 (초기화를 마친 뒤 공개)
+static __thread Reactor *current_reactor = NULL;
+
+static void reactor_queue_changed(ClientInfo *client, size_t count, size_t bytes) {
+    Reactor *reactor = client->reactor;
+    if (!reactor) return;
+    // 줄어든 경우도 부호 없는 덧셈의 wrap-around로 그대로 반영됩니다.
+    atomic_fetch_add_explicit(&reactor->queued_messages, client->output.count - count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&reactor->queued_bytes, client->output.bytes - bytes, memory_order_relaxed);
+}
+
+static Reactor *room_owner(const char *room_name) {
+    return &reactors[name_hash(room_name) % reactor_count];
+}
+
+static ReactorTask *task_new(ReactorTaskKind kind, const char *room_name, const char *payload, size_t length) {
+    ReactorTask *task = pool_alloc(sizeof(ReactorTask) + length + 1);
+    if (!task) return NULL;
+    task->kind = kind;
+    task->from = current_reactor ? current_reactor->id : 0;
+    task->edge = 0;
+    task->record = 0;
+    task->framed = 0;
+    task->opcode = OP_TEXT;
+    task->started = 0;
+    task->seq = 0;
+    task->generation = 0;
+    task->since_ms = 0;
+    task->encoded[0] = task->encoded[1] = NULL;
+    snprintf(task->room, sizeof(task->room), "%s", room_name ? room_name : "");
+    task->target[0] = '\0';
+    task->length = length;
+    if (length > 0) memcpy(task->payload, payload, length);
+    task->payload[length] = '\0';
+    return task;
+}
+
+static void task_send(Reactor *target, ReactorTask *task) {
+    if (current_reactor) atomic_fetch_add_explicit(&current_reactor->handoffs, 1, memory_order_relaxed);
+    mpsc_push(&target->inbox, &task->node);
+}
+
+// 멤버 리액터에서: 자기 연결 중 방 멤버들의 큐에 넣음
+// 방금 들어와 재생을 기다리는 연결과 재생에 이미 들어 있는 순번(seq <= live_after)은 건너뜁니다.
+static void member_deliver(Reactor *self, const char *room_name, OutBuffer *encoded[2], uint64_t seq) {
+    Room *room = room_find(&self->members, room_name);
+    if (!room) return; // 작업이 오는 사이에 모두 나감
+
+    for (int i = 0; i < room->member_count; i++) {
+        ClientInfo *member = room->members[i];
+        OutBuffer *buf = encoded[member->framed ? 1 : 0];
+        if (buf && seq > member->live_after) client_enqueue(member, buf);
+    }
+    metrics_add(METRIC_DELIVERIES, room->member_count);
+}
+
+// 소유 리액터에서: 한 번 인코딩해 멤버가 있는 리액터마다 전달 (방 안의 메시지 순서가 여기서 정해짐)
+static void owner_broadcast(Reactor *self, const char *room_name, const char *message, size_t len,
+                            uint64_t started, int record) {
+    Room *room = room_find(&self->owned, room_name);
+    if (!room) return;
+
+    uint64_t seq = ++room->seq;
+    if (record) {
+        int64_t now = wall_clock_ms();
+        history_append(self->history, room_name, message, len, now);
+        msglog_append(self->log, room_name, message, len, now);
+    }
+    OutBuffer *encoded[2] = { encode_message(0, OP_TEXT, message, len), encode_message(1, OP_TEXT, message, len) };
+    for (int i = 0; i < reactor_count; i++) {
+        if (!(room->reactor_mask & (1ULL << i))) continue;
+        if (&reactors[i] == self) {
+            member_deliver(self, room_name, encoded, seq);
+            continue;
+        }
+        ReactorTask *task = task_new(TASK_DELIVER, room_name, NULL, 0);
+        if (!task) continue;
+        task->seq = seq;
+        task->encoded[0] = encoded[0] ? outbuf_ref(encoded[0]) : NULL;
+        task->encoded[1] = encoded[1] ? outbuf_ref(encoded[1]) : NULL;
+        task_send(&reactors[i], task);
+    }
+    atomic_fetch_add_explicit(&room->messages, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&room->bytes, len, memory_order_relaxed);
+    outbuf_release(encoded[0]);
+    outbuf_release(encoded[1]);
+
+    metrics_add(METRIC_BROADCASTS, 1);
+    metrics_observe(METRIC_BROADCAST_MEMBERS, room->member_count);
+    metrics_observe(METRIC_BROADCAST_NS, metrics_now_ns() - started);
+}
+
+// 연결의 리액터에서: 닉네임으로 자기 연결을 다시 찾음 (그 사이 끊겼거나 다른 리액터의 연결이면 NULL)
+// 이 리액터의 연결은 이 스레드만 해제하므로, 찾은 뒤 락 밖에서 써도 됩니다.
+static ClientInfo *reactor_find_client(Reactor *self, const char *nickname) {
+    pthread_mutex_lock(&clients_mutex);
+    ClientInfo *client = nick_find(nickname);
+    if (client && client->reactor != self) client = NULL;
+    pthread_mutex_unlock(&clients_mutex);
+    return client;
+}
+
+// generation이 0이 아니면 입장 재생: 그 입장이 아직 유효할 때만 넣고, seq 이후의 메시지부터 실시간으로 받게 함
+static void reactor_deliver_replay(Reactor *self, const char *target, OutBuffer *buf, uint64_t seq,
+                                   unsigned generation) {
+    ClientInfo *client = reactor_find_client(self, target);
+    if (!client) return;
+    if (generation == 0) {
+        if (buf) client_enqueue(client, buf);
+    } else if (client->join_generation == generation) {
+        if (buf) client_enqueue(client, buf);
+        client->live_after = seq;
+    }
+}
+
+// 소유 리액터에서: 인코딩한 기록 버퍼를 요청한 연결의 리액터(from)로 보냄 (입장 재생은 buf가 NULL이어도 보냄)
+static void owner_reply(Reactor *self, int from, const char *room_name, const char *target, OutBuffer *buf,
+                        uint64_t seq, unsigned generation) {
+    if (from == self->id) {
+        reactor_deliver_replay(self, target, buf, seq, generation);
+        return;
+    }
+    ReactorTask *task = task_new(TASK_REPLAY, room_name, NULL, 0);
+    if (!task) return;
+    task->encoded[0] = buf ? outbuf_ref(buf) : NULL;
+    task->seq = seq;
+    task->generation = generation;
+    snprintf(task->target, sizeof(task->target), "%s", target);
+    task_send(&reactors[from], task);
+}
+
+static void owner_history(Reactor *self, int from, const char *room_name, const char *target, int framed,
+                          int64_t since_ms) {
+    OutBuffer *reply = encode_history_query(self->log, self->history, room_name, since_ms, framed);
+    if (!reply) return;
+    owner_reply(self, from, room_name, target, reply, 0, 0);
+    outbuf_release(reply);
+}
+
+// 소유 리액터에서: 멤버 수와 멤버가 있는 리액터 마스크 갱신 (멤버 목록 자체는 각 리액터가 가짐)
+// 들어온 연결에는 방 기록과 지금까지 매긴 마지막 순번을 보냅니다. 연결의 리액터는 재생이 올 때까지 그 연결에
+// 실시간 메시지를 넣지 않고, 이후로는 그 순번보다 큰 메시지만 넣으므로 빠지거나 겹치는 메시지가 없습니다.
+// (JOIN보다 먼저 보낸 DELIVER는 재생보다 먼저, 뒤에 보낸 DELIVER는 재생 뒤에 같은 큐로 도착합니다.)
+static void owner_membership(Reactor *self, int from, const char *room_name, ReactorTaskKind kind, int edge,
+                             const char *joiner, int framed, unsigned generation) {
+    if (kind == TASK_JOIN) {
+        Room *room = room_acquire(&self->owned, room_name);
+        if (!room) return;
+        room->member_count++;
+        if (edge) room->reactor_mask |= 1ULL << from;
+
+        OutBuffer *replay = encode_history(self->history, room_name, framed);
+        owner_reply(self, from, room_name, joiner, replay, room->seq, generation);
+        outbuf_release(replay);
+    } else {
+        Room *room = room_find(&self->owned, room_name);
+        if (!room) return;
+        room->member_count--;
+        if (edge) room->reactor_mask &= ~(1ULL << from);
+        room_release(room);
+    }
+    atomic_store_explicit(&self->rooms_owned, room_count(&self->owned), memory_order_relaxed);
+}
+
+// 연결의 리액터에서: 닉네임으로 다시 찾아 전송 (그 사이 끊겼으면 버림)
+static void reactor_deliver_direct(Reactor *self, const char *target, uint8_t opcode, const char *payload, size_t length) {
+    ClientInfo *client = reactor_find_client(self, target);
+    if (client) client_send_locked(client, opcode, payload, length);
+}
+
+static void reactor_run_task(Reactor *self, ReactorTask *task) {
+    switch (task->kind) {
+    case TASK_JOIN:
+    case TASK_LEAVE:
+        owner_membership(self, task->from, task->room, task->kind, task->edge, task->target, task->framed,
+                         task->generation);
+        break;
+    case TASK_BROADCAST:
+        owner_broadcast(self, task->room, task->payload, task->length, task->started, task->record);
+        break;
+    case TASK_DELIVER:
+        member_deliver(self, task->room, task->encoded, task->seq);
+        outbuf_release(task->encoded[0]);
+        outbuf_release(task->encoded[1]);
+        break;
+    case TASK_DIRECT:
+        reactor_deliver_direct(self, task->target, task->opcode, task->payload, task->length);
+        break;
+    case TASK_REPLAY:
+        reactor_deliver_replay(self, task->target, task->encoded[0], task->seq, task->generation);
+        outbuf_release(task->encoded[0]);
+        break;
+    case TASK_HISTORY:
+        owner_history(self, task->from, task->room, task->target, task->framed, task->since_ms);
+        break;
+    }
+}
+
+static void reactor_drain_inbox(Reactor *self) {
+    MpscNode *node;
+    int budget = REACTOR_TASK_BUDGET;
+
+    mpsc_rearm(&self->inbox);
+    while (budget-- > 0 && (node = mpsc_pop(&self->inbox))) {
+        ReactorTask *task = (ReactorTask*)node;
+        reactor_run_task(self, task);
+        pool_free(task);
+    }
+    // 남은 작업은 소켓 이벤트를 한 번 처리한 뒤 이어서 처리
+    if (budget < 0) mpsc_wake(&self->inbox);
+}
+
+// 방 전체에 보낼 메시지를 소유 리액터로 넘김
+static void reactor_broadcast(const char *room_name, const char *message, int record) {
+    Reactor *owner = room_owner(room_name);
+    size_t len = strlen(message);
+
+    if (owner == current_reactor) {
+        owner_broadcast(owner, room_name, message, len, metrics_now_ns(), record);
+        return;
+    }
+    ReactorTask *task = task_new(TASK_BROADCAST, room_name, message, len);
+    if (!task) return;
+    task->started = metrics_now_ns();
+    task->record = record;
+    task_send(owner, task);
+}
+
+// joiner: JOIN일 때 들어온 연결 (방 기록 재생 대상)
+static void reactor_membership(Reactor *self, const char *room_name, ReactorTaskKind kind, int edge, ClientInfo *joiner) {
+    Reactor *owner = room_owner(room_name);
+
+    if (owner == self) {
+        owner_membership(owner, self->id, room_name, kind, edge,
+                         joiner ? joiner->nickname : "", joiner ? joiner->framed : 0,
+                         joiner ? joiner->join_generation : 0);
+        return;
+    }
+    ReactorTask *task = task_new(kind, room_name, NULL, 0);
+    if (!task) return;
+    task->edge = edge;
+    if (joiner) {
+        snprintf(task->target, sizeof(task->target), "%s", joiner->nickname);
+        task->framed = joiner->framed;
+        task->generation = joiner->join_generation;
+    }
+    task_send(owner, task);
+}
+
+static void reactor_leave_room(ClientInfo *client) {
+    Room *room = client->room;
+    if (!room) return;
+
+    char room_name[ROOM_NAME_SIZE];
+    int last = room->member_count == 1;
+    snprintf(room_name, sizeof(room_name), "%s", room->name);
+    room_leave(client);
+    reactor_membership(client->reactor, room_name, TASK_LEAVE, last, NULL);
+}
+
+static int reactor_join_room(ClientInfo *client, const char *room_name) {
+    Reactor *self = client->reactor;
+
+    reactor_leave_room(client);
+    // 소유 리액터의 재생이 올 때까지 실시간 메시지를 받지 않음 (이전 입장의 재생은 입장 번호로 버림)
+    if (++client->join_generation == 0) client->join_generation = 1;
+    client->live_after = UINT64_MAX;
+    int first = room_find(&self->members, room_name) == NULL;
+    if (room_join(&self->members, client, room_name) < 0) return -1;
+    reactor_membership(self, client->room_name, TASK_JOIN, first, client);
+    return 0;
+}
+
+// HISTORY 요청을 방의 소유 리액터로 넘김 (응답은 TASK_REPLAY로 돌아옴)
+static void reactor_history(ClientInfo *client, const char *room_name, int64_t since_ms) {
+    Reactor *owner = room_owner(room_name);
+
+    if (owner == client->reactor) {
+        owner_history(owner, owner->id, room_name, client->nickname, client->framed, since_ms);
+        return;
+    }
+    ReactorTask *task = task_new(TASK_HISTORY, room_name, NULL, 0);
+    if (!task) return;
+    task->framed = client->framed;
+    task->since_ms = since_ms;
+    snprintf(task->target, sizeof(task->target), "%s", client->nickname);
+    task_send(owner, task);
+}
+
+static void reactor_send_direct(Reactor *home, const char *target, uint8_t opcode, const char *payload) {
+    size_t length = strlen(payload);
+
+    if (home == current_reactor) {
+        reactor_deliver_direct(home, target, opcode, payload, length);
+        return;
+    }
+    ReactorTask *task = task_new(TASK_DIRECT, NULL, payload, length);
+    if (!task) return;
+    task->opcode = opcode;
+    snprintf(task->target, sizeof(task->target), "%s", target);
+    task_send(home, task);
+}
+
+// 멀티 리액터 모드의 연결 큐는 소유 리액터만 읽으므로, 리액터가 공개한 합계를 더함
+static void reactor_queue_totals(size_t *messages, size_t *bytes) {
+    int published = atomic_load_explicit(&reactors_published, memory_order_acquire);
+    for (int i = 0; i < published; i++) {
+        *messages += atomic_load_explicit(&reactors[i].queued_messages, memory_order_relaxed);
+        *bytes += atomic_load_explicit(&reactors[i].queued_bytes, memory_order_relaxed);
+    }
+}
+
+// 운영자용: 송신 큐 상태 요약과 큐가 쌓인 연결 목록 출력 (SIGUSR1)
+// 연결 목록은 epoll/스레드 모드만 나열하고, 멀티 리액터 모드는 리액터별 합계를 출력합니다.
+void report_queue_depths(void) {
+    size_t total_messages = 0, total_bytes = 0, listed = 0;
+
+    pthread_mutex_lock(&clients_mutex);
+    int count = client_table_count();
+    printf("=== Outbound queues (policy %s, high %zu, low %zu) ===\n",
+           slow_policy_name(slow_policy), outq_high_watermark, outq_low_watermark);
+    for (int i = 0; i < count; i++) {
+        ClientInfo *client = client_table_at(i);
+        if (client->reactor) continue;
+        client_lock(client);
+        total_messages += client->output.count;
+        total_bytes += client->output.bytes;
+        if (client->output.count > 0 && listed < OUTQ_REPORT_LIMIT) {
+            printf("  %-29s fd %-5d %6zu msgs %9zu bytes%s\n", client->nickname, client->socket_fd,
+                   client->output.count, client->output.bytes, client->congested ? " (congested)" : "");
+            listed++;
+        }
+        client_unlock(client);
+    }
+    int published = atomic_load_explicit(&reactors_published, memory_order_acquire);
+    for (int i = 0; i < published; i++) {
+        printf("  reactor %-21d %6zu msgs %9zu bytes\n", i,
+               atomic_load_explicit(&reactors[i].queued_messages, memory_order_relaxed),
+               atomic_load_explicit(&reactors[i].queued_bytes, memory_order_relaxed));
+    }
+    reactor_queue_totals(&total_messages, &total_bytes);
+    printf("  clients %d, queued %zu msgs / %zu bytes, congested %zu, dropped %llu, slow disconnects %llu\n",
+           count, total_messages, total_bytes, atomic_load(&congested_clients),
+           atomic_load(&dropped_messages), atomic_load(&slow_disconnects));
+    pthread_mutex_unlock(&clients_mutex);
+    fflush(stdout);
+}
+
+// STATS용 방 요약 (메시지 수 상위 STATS_ROOM_LIMIT개만 유지)
 typedef struct {
-    int socket_fd;
-    char nickname[NICKNAME_SIZE];
-    char room_name[ROOM_NAME_SIZE]; // 클라이언트가 속한 채팅방 이름
-} ClientInfo;
+    char name[ROOM_NAME_SIZE];
+    unsigned long long messages;
+    unsigned long long bytes;
+    int members;
+} RoomStat;
+
+typedef struct {
+    RoomStat top[STATS_ROOM_LIMIT];
+    int count;
+} RoomStats;
+
+static void collect_room_stat(Room *room, void *ctx) {
+    RoomStats *stats = (RoomStats*)ctx;
+    unsigned long long messages = atomic_load_explicit(&room->messages, memory_order_relaxed);
+    int pos = stats->count;
+
+    if (pos == STATS_ROOM_LIMIT) {
+        if (messages <= stats->top[pos - 1].messages) return;
+        pos--;
+    } else {
+        stats->count++;
+    }
+    while (pos > 0 && stats->top[pos - 1].messages < messages) {
+        stats->top[pos] = stats->top[pos - 1];
+        pos--;
+    }
+    RoomStat *entry = &stats->top[pos];
+    snprintf(entry->name, sizeof(entry->name), "%s", room->name);
+    entry->messages = messages;
+    entry->bytes = atomic_load_explicit(&room->bytes, memory_order_relaxed);
+    entry->members = room->member_count;
+}
+
+static void write_histogram(FILE *out, const char *name, const MetricsHistogramData *h, double scale) {
+    static const double quantiles[] = { 50.0, 99.0, 99.9 };
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        fprintf(out, "%s{quantile=\"%g\"} %g\n", name, quantiles[i] / 100.0,
+                metrics_percentile(h, quantiles[i]) * scale);
+    }
+    fprintf(out, "%s_sum %g\n", name, h->sum * scale);
+    fprintf(out, "%s_count %llu\n", name, (unsigned long long)h->total);
+}
+
+// 관리 소켓의 STATS 응답: "이름 값" 한 줄에 지표 하나 (Prometheus 텍스트 형식과 호환)
+// 메모리 스트림에 쓰므로 clients_mutex는 지표를 모으는 동안만 잡힙니다.
+static void write_stats(FILE *out) {
+    MetricsSnapshot snapshot;
+    RoomStats rooms = { .count = 0 };
+    size_t total_messages = 0, total_bytes = 0, max_bytes = 0, congested = 0, rooms_active;
+    unsigned long long dropped, disconnects;
+    int connections;
+
+    metrics_snapshot(&snapshot);
+
+    pthread_mutex_lock(&clients_mutex);
+    connections = client_table_count();
+    for (int i = 0; i < connections; i++) {
+        ClientInfo *client = client_table_at(i);
+        if (client->reactor) continue; // 아래에서 리액터 합계로 셈 (연결별 최대는 epoll/스레드 모드만)
+        client_lock(client);
+        total_messages += client->output.count;
+        total_bytes += client->output.bytes;
+        if (client->output.bytes > max_bytes) max_bytes = client->output.bytes;
+        client_unlock(client);
+    }
+    congested = atomic_load(&congested_clients);
+    dropped = atomic_load(&dropped_messages);
+    disconnects = atomic_load(&slow_disconnects);
+    rooms_active = room_count(&global_rooms);
+    room_foreach(&global_rooms, collect_room_stat, &rooms);
+    pthread_mutex_unlock(&clients_mutex);
+    reactor_queue_totals(&total_messages, &total_bytes);
+    // 멀티 리액터 모드의 방은 소유 리액터만 건드리므로, 방별 목록 대신 리액터별 합계만 보고합니다.
+    int published = atomic_load_explicit(&reactors_published, memory_order_acquire);
+    for (int i = 0; i < published; i++) {
+        rooms_active += atomic_load_explicit(&reactors[i].rooms_owned, memory_order_relaxed);
+    }
+
+    fprintf(out, "uptime_seconds %ld\n", (long)(time(NULL) - server_started));
+    fprintf(out, "connections_active %d\n", connections);
+    fprintf(out, "rooms_active %zu\n", rooms_active);
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        fprintf(out, "%s %llu\n", metrics_counter_name(c), (unsigned long long)snapshot.counters[c]);
+    }
+    write_histogram(out, "broadcast_fanout_seconds", &snapshot.histograms[METRIC_BROADCAST_NS], 1e-9);
+    write_histogram(out, "broadcast_members", &snapshot.histograms[METRIC_BROADCAST_MEMBERS], 1.0);
+
+    fprintf(out, "outq_queued_messages %zu\n", total_messages);
+    fprintf(out, "outq_queued_bytes %zu\n", total_bytes);
+    fprintf(out, "outq_max_bytes %zu\n", max_bytes);
+    fprintf(out, "outq_congested_connections %zu\n", congested);
+    fprintf(out, "outq_dropped_messages_total %llu\n", dropped);
+    fprintf(out, "outq_slow_disconnects_total %llu\n", disconnects);
+
+    for (int i = 0; i < rooms.count; i++) {
+        const RoomStat *room = &rooms.top[i];
+        fprintf(out, "room_messages_total{room=\"%s\"} %llu\n", room->name, room->messages);
+        fprintf(out, "room_bytes_total{room=\"%s\"} %llu\n", room->name, room->bytes);
+        fprintf(out, "room_members{room=\"%s\"} %d\n", room->name, room->members);
+    }
+
+    HistoryStats history = { 0, 0, 0 };
+    for (int i = 0; i < HISTORY_SHARDS + published; i++) {
+        HistoryStore *store = i < HISTORY_SHARDS ? history_shards[i].history : reactors[i - HISTORY_SHARDS].history;
+        HistoryStats part;
+        if (!store) continue;
+        history_stats(store, &part);
+        history.rooms += part.rooms;
+        history.bytes += part.bytes;
+        history.evictions += part.evictions;
+    }
+    fprintf(out, "history_rooms %zu\n", history.rooms);
+    fprintf(out, "history_bytes %zu\n", history.bytes);
+    fprintf(out, "history_evictions_total %llu\n", history.evictions);
+
+    MsgLogStats log = { 0, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < HISTORY_SHARDS; i++) {
+        if (history_shards[i].log) msglog_stats(history_shards[i].log, &log);
+    }
+    for (int i = 0; i < published; i++) {
+        if (reactors[i].log) msglog_stats(reactors[i].log, &log);
+    }
+    fprintf(out, "msglog_rooms %zu\n", log.rooms);
+    fprintf(out, "msglog_segments %zu\n", log.segments);
+    fprintf(out, "msglog_bytes %llu\n", log.bytes);
+    fprintf(out, "msglog_appended_total %llu\n", log.appended);
+    fprintf(out, "msglog_append_errors_total %llu\n", log.errors);
+    fprintf(out, "msglog_segments_removed_total %llu\n", log.removed);
+    fprintf(out, "msglog_syncs_total %llu\n", msglog_syncs());
+
+    for (int i = 0; i < published; i++) {
+        Reactor *reactor = &reactors[i];
+        fprintf(out, "reactor_connections{reactor=\"%d\",cpu=\"%d\"} %d\n", i, reactor->cpu,
+                atomic_load_explicit(&reactor->connections, memory_order_relaxed));
+        fprintf(out, "reactor_rooms_owned{reactor=\"%d\"} %zu\n", i,
+                atomic_load_explicit(&reactor->rooms_owned, memory_order_relaxed));
+        fprintf(out, "reactor_handoffs_total{reactor=\"%d\"} %llu\n", i,
+                atomic_load_explicit(&reactor->handoffs, memory_order_relaxed));
+        fprintf(out, "reactor_outq_queued_bytes{reactor=\"%d\"} %zu\n", i,
+                atomic_load_explicit(&reactor->queued_bytes, memory_order_relaxed));
+    }
+
+    EpochStats epoch;
+    epoch_stats(&epoch);
+    fprintf(out, "epoch_current %llu\n", epoch.epoch);
+    fprintf(out, "epoch_retired_total %llu\n", epoch.retired);
+    fprintf(out, "epoch_pending %llu\n", epoch.retired - epoch.reclaimed);
+
+    admission_write_stats(out);
+    pool_write_stats(out);
+    relay_write_stats(out);
+}
+
+// 관리 소켓의 STATS 외 명령
+// "RELAY-RATE <KB/s>": 중계 속도 상한 변경 (0이면 제한 없음, 진행 중인 중계에도 적용)
+// "ACCEPT-RATE <연결/초> [주소별 연결/초]": 새 연결 허용 속도 변경 (0이면 제한 없음, 주소별 값을 빼면 그대로 둠)
+static int handle_admin_command(const char *command, FILE *out) {
+    long long kbps, global_rate, address_rate, current_global;
+    char extra;
+
+    if (sscanf(command, "RELAY-RATE %lld %c", &kbps, &extra) == 1 && kbps >= 0) {
+        relay_set_rate(kbps * 1024);
+        fprintf(out, "OK relay_rate_limit_bytes %lld\n", relay_rate());
+        return 0;
+    }
+    admission_get_rates(&current_global, &address_rate);
+    int fields = sscanf(command, "ACCEPT-RATE %lld %lld %c", &global_rate, &address_rate, &extra);
+    if ((fields == 1 || fields == 2) && global_rate >= 0 && address_rate >= 0) {
+        admission_set_rates(global_rate, address_rate);
+        admission_get_rates(&global_rate, &address_rate);
+        fprintf(out, "OK admission_rate_limit %lld admission_rate_limit_per_address %lld\n",
+                global_rate, address_rate);
+        return 0;
+    }
+    return -1;
+}
+
+void on_report_signal(int sig) {
+    report_requested = 1;
+}
+
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// --- 클라이언트 관리 및 브로드캐스트 함수 ---
+
+// 방의 현재 멤버 사본에 있는 연결마다 큐에 넣음 (epoll/스레드 모드, epoch_enter 구간 안에서 호출)
+// 방의 history_lock은 순번을 매기고 기록에 남기는 동안만 잡고, 사본은 락 없이 읽어 멤버별 out_lock만 잠깐씩 잡습니다.
+// 같은 방의 메시지는 앞 순번을 다 넣은 뒤에 넣으므로 모든 멤버에게 같은 순서(기록과도 같은 순서)로 갑니다.
+// 메시지는 프로토콜(텍스트/프레임)별로 한 번만 인코딩되고, 모든 멤버의 큐가 같은 버퍼를 공유합니다.
+static void deliver_to_room(Room *room, const char *message, int record, uint64_t started) {
+    size_t len = strlen(message);
+    OutBuffer *encoded[2] = { NULL, NULL }; // [0] 텍스트 모드, [1] 프레임 모드
+    HistoryShard *shard = history_shard(room->name);
+
+    pthread_mutex_lock(&room->history_lock);
+    uint64_t seq = ++room->seq;
+    if (record && (shard->history || shard->log)) {
+        int64_t now = wall_clock_ms();
+        pthread_mutex_lock(&shard->lock);
+        history_append(shard->history, room->name, message, len, now);
+        msglog_append(shard->log, room->name, message, len, now);
+        pthread_mutex_unlock(&shard->lock);
+    }
+    pthread_mutex_unlock(&room->history_lock);
+
+    // 같은 방에 동시에 보낸 앞 메시지가 다 들어갈 때까지 기다림 (큐에 넣기만 하므로 짧음, 다른 방과는 기다리지 않음)
+    while (atomic_load_explicit(&room->delivered, memory_order_acquire) != seq - 1) sched_yield();
+
+    // 순번을 매긴 뒤에 사본을 읽으므로, 이 순번 이후에 재생을 마친 새 멤버도 사본에 들어 있습니다.
+    RoomSnapshot *members = room_snapshot(room);
+    int count = members ? members->count : 0;
+    for (int i = 0; i < count; i++) {
+        ClientInfo *member = members->members[i];
+        OutBuffer **buf = &encoded[member->framed ? 1 : 0];
+        if (!*buf && !(*buf = encode_message(member->framed, OP_TEXT, message, len))) continue;
+        client_lock(member);
+        // 방금 들어와 재생에 이미 들어 있는 메시지, 다른 방으로 옮긴 연결은 건너뜀
+        if (member->live_room == room && seq > member->live_after) client_enqueue(member, *buf);
+        client_unlock(member);
+    }
+    atomic_store_explicit(&room->delivered, seq, memory_order_release);
+    atomic_fetch_add_explicit(&room->messages, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&room->bytes, len, memory_order_relaxed);
+
+    // 만든 쪽의 참조를 놓음. 이후에는 마지막으로 전송을 마친 큐가 버퍼를 해제합니다.
+    outbuf_release(encoded[0]);
+    outbuf_release(encoded[1]);
+
+    metrics_add(METRIC_BROADCASTS, 1);
+    metrics_add(METRIC_DELIVERIES, count);
+    metrics_observe(METRIC_BROADCAST_MEMBERS, count);
+    metrics_observe(METRIC_BROADCAST_NS, metrics_now_ns() - started);
+}
+
+// 서버 시스템 메시지를 특정 방에 있는 모든 클라이언트에게 전송
+// 이 함수는 [SERVER] prefix를 붙여 전송하거나, 
+// 클라이언트가 이미 [닉네임]을 붙여 보낸 메시지를 그대로 중계할 때 사용됩니다.
+// 방 인덱스로 멤버 목록만 순회하므로 비용은 서버 전체가 아닌 방 크기에 비례합니다.
+// clients_mutex는 방 이름을 찾는 동안만 잡고, 찾은 방은 에포크 구간 안에서 락 없이 읽습니다.
+// record: 방 기록에 남겨 나중에 들어온 사람에게 재생 (채팅 메시지만, 입장/퇴장 알림은 남기지 않음)
+void broadcast_to_room(const char *room_name, const char *message, int record) {
+    uint64_t started = metrics_now_ns();
+
+    if (current_reactor) {
+        reactor_broadcast(room_name, message, record);
+        return;
+    }
+
+    epoch_enter();
+    pthread_mutex_lock(&clients_mutex);
+    Room *room = room_find(&global_rooms, room_name);
+    pthread_mutex_unlock(&clients_mutex);
+    if (room) deliver_to_room(room, message, record, started);
+    epoch_exit();
+}
+
+// 보낸 연결이 들어 있는 방으로 채팅 메시지를 브로드캐스트하고 기록에 남김.
+// 연결의 방(conn->room)은 그 연결을 처리하는 스레드만 바꾸므로, 방 이름을 찾지 않고 락 없이 바로 씁니다.
+static void broadcast_from_client(ClientInfo *sender, const char *message) {
+    if (sender->reactor) {
+        broadcast_to_room(sender->room_name, message, 1);
+        return;
+    }
+    uint64_t started = metrics_now_ns();
+    epoch_enter();
+    if (sender->room) deliver_to_room(sender->room, message, 1, started);
+    epoch_exit();
+}
+
+void send_system_message_to_room(const char *room_name, const char *message) {
+    broadcast_to_room(room_name, message, 0);
+}
+
+// 특정 닉네임을 가진 클라이언트에게 메시지 전송 (파일 전송 중계용, 닉네임 디렉토리로 O(1) 조회)
+int send_to_client(const char *target_nickname, uint8_t opcode, const char *payload) {
+    pthread_mutex_lock(&clients_mutex);
+    ClientInfo *client = nick_find(target_nickname);
+    Reactor *home = client ? client->reactor : NULL;
+    if (client && !home) {
+        client_lock(client);
+        client_send_locked(client, opcode, payload, strlen(payload));
+        client_unlock(client);
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    // 멀티 리액터: 연결의 큐는 그 리액터만 건드리므로 작업으로 넘깁니다.
+    if (home) reactor_send_direct(home, target_nickname, opcode, payload);
+    return client != NULL; // 0: 타겟 클라이언트 없음
+}
+
+// 클라이언트 목록과 방에서 제거 (O(1)) 후 소켓을 닫음
+void remove_client(ClientInfo *client) {
+    char leaving_room[ROOM_NAME_SIZE] = "";
+    
+    pthread_mutex_lock(&clients_mutex);
+    strncpy(leaving_room, client->room_name, ROOM_NAME_SIZE - 1);
+    leaving_room[ROOM_NAME_SIZE - 1] = '\0';
+    if (!client->reactor) room_leave(client);
+    nick_unregister(client);
+    client_table_remove(client);
+    pthread_mutex_unlock(&clients_mutex);
+    if (client->reactor) reactor_leave_room(client);
+    close(client->socket_fd);
+
+    if (strlen(leaving_room) > 0) {
+        log_info("Client disconnected: %s from room %s\n", client->nickname, leaving_room);
+        char leave_msg[120];
+        snprintf(leave_msg, sizeof(leave_msg), "[SERVER] %s has left the chat room.", client->nickname);
+        send_system_message_to_room(leaving_room, leave_msg);
+    }
+}
+
+// 입장 알림보다 먼저, 들어오기 전의 대화를 한 번에 보냄 (clients_mutex 밖에서 호출)
+// 재생에 든 마지막 순번을 live_after로 남겨, 그 순번까지의 실시간 메시지는 건너뛰고 다음 순번부터 받게 합니다.
+// 새 멤버는 메시지를 재생과 실시간 중 한 번만, 방의 순서대로 받습니다.
+static void replay_history(ClientInfo *client, Room *room) {
+    HistoryShard *shard = history_shard(room->name);
+    pthread_mutex_lock(&room->history_lock);
+    pthread_mutex_lock(&shard->lock);
+    OutBuffer *replay = encode_history(shard->history, room->name, client->framed);
+    pthread_mutex_unlock(&shard->lock);
+    client_lock(client);
+    if (replay) client_enqueue(client, replay);
+    client->live_after = room->seq;
+    client_unlock(client);
+    pthread_mutex_unlock(&room->history_lock);
+    outbuf_release(replay);
+}
+
+// 클라이언트의 방을 변경 (이전 방에서 나오고 새 방의 멤버 목록에 추가)
+// 멤버 사본에 들어간 뒤 재생을 마칠 때까지는 실시간 메시지를 받지 않습니다. (live_after = UINT64_MAX)
+int set_client_room(ClientInfo *client, const char *new_room) {
+    if (client->reactor) return reactor_join_room(client, new_room);
+    pthread_mutex_lock(&clients_mutex);
+    int result = room_join(&global_rooms, client, new_room);
+    Room *room = client->room;
+    client_lock(client);
+    client->live_room = room;
+    client->live_after = UINT64_MAX;
+    client_unlock(client);
+    pthread_mutex_unlock(&clients_mutex);
+    // 방은 이 연결이 나가기 전까지 없어지지 않으며, 방을 바꾸는 것은 이 연결을 처리하는 스레드뿐입니다.
+    if (room) replay_history(client, room);
+    return result;
+}
+
+// HISTORY 요청에 답함 (멀티 리액터 모드에서는 방의 소유 리액터가 인코딩해 돌려보냄)
+void send_history(ClientInfo *client, const char *room_name, int64_t since_ms) {
+    if (client->reactor) {
+        reactor_history(client, room_name, since_ms);
+        return;
+    }
+    HistoryShard *shard = history_shard(room_name);
+    pthread_mutex_lock(&shard->lock);
+    OutBuffer *reply = encode_history_query(shard->log, shard->history, room_name, since_ms, client->framed);
+    pthread_mutex_unlock(&shard->lock);
+    if (reply) {
+        client_lock(client);
+        client_enqueue(client, reply);
+        client_unlock(client);
+        outbuf_release(reply);
+    }
+}
+
+// --- 핸드셰이크 제한 시간 ---
+// 접속만 하고 닉네임을 보내지 않는 연결이 연결 상태와 fd를 붙잡고 있지 않도록 제한 시간이 지나면 끊습니다.
+
+static void handshake_track(HandshakeQueue *queue, ClientInfo *conn) {
+    if (conn->handshake_deadline_ns == 0 || conn->registered) return;
+    conn->handshake_queue = queue;
+    conn->handshake_next = NULL;
+    conn->handshake_prev = queue->tail;
+    if (queue->tail) {
+        queue->tail->handshake_next = conn;
+    } else {
+        queue->head = conn;
+    }
+    queue->tail = conn;
+}
+
+static void handshake_untrack(ClientInfo *conn) {
+    HandshakeQueue *queue = conn->handshake_queue;
+    if (!queue) return;
+    if (conn->handshake_prev) {
+        conn->handshake_prev->handshake_next = conn->handshake_next;
+    } else {
+        queue->head = conn->handshake_next;
+    }
+    if (conn->handshake_next) {
+        conn->handshake_next->handshake_prev = conn->handshake_prev;
+    } else {
+        queue->tail = conn->handshake_prev;
+    }
+    conn->handshake_queue = NULL;
+    conn->handshake_prev = conn->handshake_next = NULL;
+}
 
-ClientInfo clients[MAX_CLIENTS];
-int client_count = 0;
-pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+// --- 연결 상태 머신 (epoll / 스레드 모드 공용) ---
 
-// --- 클라이언트 관리 및 브로드캐스트 함수 ---
+// 프레임 모드 클라이언트에게 서버가 본 주소를 알려 줌 (NAT 뒤라면 공인 주소, 파일 전송의 송신자 주소로 쓰임)
+// 클라이언트가 외부 서비스에 묻지 않고도 접속하자마자 자기 주소를 압니다.
+static void send_observed_address(ClientInfo *conn) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    char ip[PROTO_IP_SIZE], host[PROTO_IP_SIZE + 2], payload[PROTO_IP_SIZE + 16];
+    int port;
 
-// 서버 시스템 메시지를 특정 방에 있는 모든 클라이언트에게 전송
-// 이 함수는 [SERVER] prefix를 붙여 전송하거나, 
-// 클라이언트가 이미 [닉네임]을 붙여 보낸 메시지를 그대로 중계할 때 사용됩니다.
-void send_system_message_to_room(const char *room_name, const char *message) {
-    char full_msg[BUFFER_SIZE];
-    // 시스템 메시지가 아닌 경우 (채팅 메시지 중계)는 그대로 사용
-    if (strncmp(message, "[SERVER]", 8) != 0) {
-        snprintf(full_msg, sizeof(full_msg), "%s", message);
-    } else {
-        snprintf(full_msg, sizeof(full_msg), "%s", message);
+    if (!conn->framed || getpeername(conn->socket_fd, (struct sockaddr*)&addr, &addr_len) < 0 ||
+        proto_address_text(&addr, ip, sizeof(ip), &port) < 0) {
+        return;
     }
+    proto_host_field(host, sizeof(host), ip);
+    snprintf(payload, sizeof(payload), "%s:%d", host, port);
+    client_send(conn, OP_ADDRESS, payload, strlen(payload));
+}
+
+// 1. 닉네임 등록 단계. 실패 시 -1을 반환하며 호출자가 소켓을 닫습니다.
+int handle_handshake(ClientInfo *conn, const char *data, int len) {
+    if (len > NICKNAME_SIZE - 1) len = NICKNAME_SIZE - 1;
+    memcpy(conn->nickname, data, len);
+    conn->nickname[len] = '\0';
 
+    // 닉네임은 서버 전체에서 유일해야 합니다. (FILE_REQ 등 닉네임 기반 라우팅이 모호해지지 않도록)
     pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < client_count; i++) {
-        if (strcmp(clients[i].room_name, room_name) == 0) {
-            send(clients[i].socket_fd, full_msg, strlen(full_msg), 0);
-        }
+    int added = nick_register(conn);
+    if (added == 0 && client_table_add(conn) < 0) {
+        nick_unregister(conn);
+        added = -1;
     }
     pthread_mutex_unlock(&clients_mutex);
+    if (added < 0) metrics_add(METRIC_HANDSHAKES_REJECTED, 1);
+    if (added == -2) {
+        client_send_textf(conn, "[SERVER] Nickname '%s' is already in use.", conn->nickname);
+        return -1;
+    }
+    if (added < 0) {
+        client_send_text(conn, "[SERVER] Max clients reached.");
+        return -1;
+    }
+
+    conn->registered = 1;
+    handshake_untrack(conn);
+    log_info("New client connected: %s\n", conn->nickname);
+    send_observed_address(conn);
+    client_send_text(conn, "[SERVER] Please create a room (CREATE_ROOM:name) or join one (JOIN_ROOM:name)");
+    return 0;
 }
 
-// 특정 닉네임을 가진 클라이언트에게 메시지 전송 (파일 전송 중계용)
-int send_to_client(const char *target_nickname, const char *message) {
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < client_count; i++) {
-        if (strcmp(clients[i].nickname, target_nickname) == 0) {
-            send(clients[i].socket_fd, message, strlen(message), 0);
-            pthread_mutex_unlock(&clients_mutex);
-            return 1;
+// 2. 명령어 처리 단계 (param은 NULL 종료된 매개변수, 텍스트 모드에서 콜론이 없으면 NULL)
+void handle_command(ClientInfo *conn, int opcode, char *param) {
+    const char *nickname = conn->nickname;
+    char current_room[ROOM_NAME_SIZE];
+    char success_msg[120];
+
+    strncpy(current_room, conn->room_name, ROOM_NAME_SIZE - 1);
+    current_room[ROOM_NAME_SIZE - 1] = '\0';
+    metrics_add(METRIC_COMMANDS_IN, 1);
+
+    // --- 명령어 처리 ---
+    if (opcode == OP_CREATE_ROOM || opcode == OP_JOIN_ROOM) {
+        if (param && strlen(param) > 0) {
+
+            // 이전 방이 있다면 나가는 메시지 전송
+            if (strlen(current_room) > 0) {
+                 snprintf(success_msg, sizeof(success_msg), "[SERVER] %s has left room '%s'.", nickname, current_room);
+                 send_system_message_to_room(current_room, success_msg);
+            }
+
+            strncpy(current_room, param, ROOM_NAME_SIZE - 1);
+            current_room[ROOM_NAME_SIZE - 1] = '\0';
+            if (set_client_room(conn, current_room) < 0) {
+                client_send_text(conn, "[SERVER] Failed to enter room.");
+                return;
+            }
+
+            snprintf(success_msg, sizeof(success_msg), "[SERVER] %s has entered room '%s'.", nickname, current_room);
+            send_system_message_to_room(current_room, success_msg);
+            log_info("%s has entered room %s\n", nickname, current_room);
+
+        } else {
+            client_send_text(conn, "[SERVER] Invalid room command format.");
         }
     }
-    pthread_mutex_unlock(&clients_mutex);
-    return 0; // 타겟 클라이언트 없음
-}
+    else if (opcode == OP_MSG) {
+         // [수정]: 일반 채팅 메시지 처리. param은 "닉네임: 메시지 내용" 형태입니다.
+        if (strlen(current_room) > 0 && param) {
+            // param의 내용을 그대로 같은 방에 있는 클라이언트에게 중계합니다.
+            metrics_add(METRIC_MESSAGES_IN, 1);
+            broadcast_from_client(conn, param);
+            log_message("Received message in room %s: %s\n", current_room, param);
+        } else {
+            client_send_text(conn, "[SERVER] You must join a room first.");
+        }
+    }
+    else if (opcode == OP_FILE_REQ) {
+         // FILE_REQ:타겟닉네임:파일명:파일크기:송신자IP:송신자Port[:옵션]
+         // 옵션(예: "streams=4")은 FILE_ALERT 끝에 그대로 붙여 전달합니다.
+         // "relay=토큰"이 있으면 토큰을 등록하고, 송신자IP/Port 대신 중계 포트를 알려 줍니다.
+        // 송신자IP가 IPv6이면 "[IP]" 형태이므로 콜론을 필드 단위로 나눕니다.
+        char *cursor = param;
+        char *target = proto_next_field(&cursor);
+        char *filename = proto_next_field(&cursor);
+        char *filesize = proto_next_field(&cursor);
+        char *sender_ip = proto_next_field(&cursor);
+        char *sender_port = proto_next_field(&cursor);
+        char *options = cursor;
+        char sender_host[PROTO_IP_SIZE + 2];
 
-// 클라이언트 목록에서 제거
-void remove_client(int sock_fd) {
-    char leaving_room[ROOM_NAME_SIZE] = "";
-    char leaving_nickname[NICKNAME_SIZE] = "";
-    
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < client_count; i++) {
-        if (clients[i].socket_fd == sock_fd) {
-            strncpy(leaving_room, clients[i].room_name, ROOM_NAME_SIZE - 1);
-            leaving_room[ROOM_NAME_SIZE - 1] = '\0';
-            strncpy(leaving_nickname, clients[i].nickname, NICKNAME_SIZE - 1);
-            leaving_nickname[NICKNAME_SIZE - 1] = '\0';
-            
-            for (int j = i; j < client_count - 1; j++) {
-                clients[j] = clients[j + 1];
+        metrics_add(METRIC_FILE_REQUESTS, 1);
+        char token[RELAY_TOKEN_LEN + 1];
+        int relayed = options && proto_option_string(options, "relay", token, sizeof(token)) >= 0;
+        char relay_port_str[16];
+
+        if (target && filename && filesize && sender_ip && sender_port && relayed &&
+            relay_register(token, nickname, target, (int)proto_option_long(options, "streams", 1)) < 0) {
+            client_send_text(conn, "[SERVER] File relay is not available.");
+        } else if (target && filename && filesize && sender_ip && sender_port) {
+            char alert_msg[FRAME_MAX_PAYLOAD + 1];
+
+            if (relayed) {
+                snprintf(relay_port_str, sizeof(relay_port_str), "%d", relay_port());
+                sender_ip = "relay";
+                sender_port = relay_port_str;
             }
-            client_count--;
-            break;
+            proto_host_field(sender_host, sizeof(sender_host), sender_ip);
+            int alert_len = snprintf(alert_msg, (size_t)max_message, "%s:%s:%s:%s:%s%s%s",
+                                     nickname, filename, filesize, sender_host, sender_port,
+                                     options ? ":" : "", options ? options : "");
+
+            // 잘린 알림은 토큰이나 옵션이 깨진 채 전달되므로 보내지 않음
+            if (alert_len < 0 || alert_len >= max_message) {
+                if (relayed) relay_unregister(token);
+                client_send_textf(conn, "[SERVER] File request too long (max %d bytes).", max_message - 1);
+            } else if (send_to_client(target, OP_FILE_ALERT, alert_msg)) {
+                log_info("File transfer alert sent from %s to %s%s\n", nickname, target, relayed ? " (relayed)" : "");
+                client_send_textf(conn, "[SERVER] File request sent to %s.", target);
+            } else {
+                if (relayed) relay_unregister(token);
+                client_send_textf(conn, "[SERVER] User %s not found.", target);
+            }
+        } else {
+             client_send_text(conn, "[SERVER] File request format error.");
         }
     }
-    pthread_mutex_unlock(&clients_mutex);
-    close(sock_fd);
+    else if (opcode == OP_HISTORY) {
+        // HISTORY:방[:시각] — 시각(Unix ms) 이후의 기록, 생략하면 처음부터. 방 이름에 콜론이 있을 수 있어 마지막 콜론으로 나눔
+        char *since = param ? strrchr(param, ':') : NULL;
+        int64_t since_ms = 0;
+        if (since && since[1] != '\0' && since[strspn(since + 1, "0123456789") + 1] == '\0') {
+            *since++ = '\0';
+            since_ms = strtoll(since, NULL, 10);
+        }
+        if (param && strlen(param) > 0) {
+            send_history(conn, param, since_ms);
+        } else {
+            client_send_text(conn, "[SERVER] Invalid history command format.");
+        }
+    }
+    else {
+        client_send_text(conn, "[SERVER] Unknown command or protocol error.");
+    }
+}
 
-    if (strlen(leaving_room) > 0) {
-        printf("Client disconnected: %s from room %s\n", leaving_nickname, leaving_room);
-        char leave_msg[120];
-        snprintf(leave_msg, sizeof(leave_msg), "[SERVER] %s has left the chat room.", leaving_nickname);
-        send_system_message_to_room(leaving_room, leave_msg);
+// 텍스트 프로토콜: "CMD:param" 을 opcode와 매개변수로 분리
+void handle_text_command(ClientInfo *conn, char *buffer) {
+    char *command = buffer;
+    char *param = strchr(buffer, ':');
+    if (param) *param++ = '\0'; // 명령어와 매개변수 분리 (첫 번째 콜론 기준)
+
+    int opcode = OP_UNKNOWN;
+    if (strcmp(command, "CREATE_ROOM") == 0) opcode = OP_CREATE_ROOM;
+    else if (strcmp(command, "JOIN_ROOM") == 0) opcode = OP_JOIN_ROOM;
+    else if (strcmp(command, "MSG") == 0) opcode = OP_MSG;
+    else if (strcmp(command, "HISTORY") == 0) opcode = OP_HISTORY;
+    else if (strncmp(command, "FILE_REQ", 8) == 0) opcode = OP_FILE_REQ;
+
+    handle_command(conn, opcode, param);
+}
+
+// 프레임 모드: 디코더가 완성된 프레임마다 호출합니다.
+int handle_frame(const Frame *frame, void *ctx) {
+    ClientInfo *conn = (ClientInfo*)ctx;
+    char param[FRAME_MAX_PAYLOAD + 1];
+
+    memcpy(param, frame->payload, frame->length);
+    param[frame->length] = '\0';
+
+    if (!conn->registered) {
+        // 매직 다음의 첫 프레임은 반드시 닉네임이어야 합니다.
+        if (frame->opcode != OP_NICK) return -1;
+        return handle_handshake(conn, param, frame->length);
     }
+    handle_command(conn, frame->opcode, param);
+    return 0;
 }
 
-// 클라이언트의 룸 이름을 설정
-void set_client_room(const char *nickname, const char *new_room) {
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < client_count; i++) {
-        if (strcmp(clients[i].nickname, nickname) == 0) {
-            strncpy(clients[i].room_name, new_room, ROOM_NAME_SIZE - 1);
-            clients[i].room_name[ROOM_NAME_SIZE - 1] = '\0';
-            break;
+// 수신한 데이터 한 덩어리를 연결 상태에 따라 처리. 연결을 끊어야 하면 -1 반환
+// buffer는 bytes_read + 1 바이트 이상이어야 합니다. (텍스트 모드의 NULL 종료용)
+int handle_incoming(ClientInfo *conn, char *buffer, int bytes_read) {
+    if (!conn->registered && !conn->framed) {
+        // 프로토콜 협상: 매직으로 시작하면 프레임 모드, 아니면 기존 텍스트 닉네임
+        if (conn->magic_length > 0 || buffer[0] == PROTO_MAGIC[0]) {
+            int take = PROTO_MAGIC_LEN - conn->magic_length;
+            if (take > bytes_read) take = bytes_read;
+            memcpy(conn->magic + conn->magic_length, buffer, take);
+            conn->magic_length += take;
+            if (memcmp(conn->magic, PROTO_MAGIC, conn->magic_length) != 0) return -1;
+            if (conn->magic_length < PROTO_MAGIC_LEN) return 0;
+
+            conn->framed = 1;
+            buffer += take;
+            bytes_read -= take;
+        } else {
+            buffer[bytes_read] = '\0';
+            return handle_handshake(conn, buffer, bytes_read);
         }
     }
-    pthread_mutex_unlock(&clients_mutex);
+
+    if (conn->framed) {
+        if (bytes_read == 0) return 0;
+        return frame_decoder_feed(&conn->input, buffer, bytes_read, handle_frame, conn) < 0 ? -1 : 0;
+    }
+
+    // 텍스트 모드: 기존과 같이 recv 한 번을 명령어 하나로 취급
+    buffer[bytes_read] = '\0';
+    handle_text_command(conn, buffer);
+    return 0;
 }
 
-// --- 클라이언트 처리 스레드 함수 ---
+// 다음 recv에서 읽을 최대 크기 (텍스트 모드는 기존 동작과 같은 단위로 읽음)
+size_t read_size_for(ClientInfo *conn, size_t buffer_size) {
+    if (conn->framed) return buffer_size - 1;
+    return conn->registered ? (size_t)max_message - 1 : NICKNAME_SIZE - 1;
+}
 
-void* handle_client(void* arg) {
-    int client_sock = *(int*)arg;
-    char buffer[BUFFER_SIZE];
-    char nickname[NICKNAME_SIZE] = "Unknown";
-    char current_room[ROOM_NAME_SIZE] = "";
+static void free_connection(void *object) {
+    ClientInfo *conn = (ClientInfo*)object;
+    if (!conn) return;
+    pthread_mutex_destroy(&conn->out_lock);
+    pool_put(connection_pool, conn);
+}
+
+// 3. 연결 종료 처리
+// epoll/스레드 모드에서는 다른 스레드의 브로드캐스트가 옛 멤버 사본으로 이 연결을 아직 가리킬 수 있으므로,
+// 소켓을 닫기 전에 닫는 중으로 표시해 더 넣지 못하게 하고(닫힌 fd 번호가 재사용될 수 있음), 연결 상태는 에포크로 회수합니다.
+void close_connection(ClientInfo *conn) {
+    metrics_add(METRIC_CONNECTIONS_CLOSED, 1);
+    if (conn->reactor) atomic_fetch_sub_explicit(&conn->reactor->connections, 1, memory_order_relaxed);
+    client_lock(conn);
+    conn->closing = 1;
+    if (conn->congested) {
+        conn->congested = 0;
+        congested_clients--;
+    }
+    size_t count = conn->output.count, bytes = conn->output.bytes;
+    outq_clear(&conn->output);
+    reactor_queue_changed(conn, count, bytes);
+    client_unlock(conn);
+    handshake_untrack(conn);
+
+    if (conn->registered) {
+        remove_client(conn);
+    } else {
+        close(conn->socket_fd);
+    }
+    frame_decoder_free(&conn->input);
+    if (conn->reactor) {
+        free_connection(conn);
+    } else {
+        epoch_retire(conn, free_connection);
+    }
+}
+
+// 연결 상태는 풀에서 꺼내 재사용합니다. (접속/종료마다 malloc/free 하지 않음)
+ClientInfo *create_connection(int sock_fd) {
+    ClientInfo *conn = pool_get(connection_pool);
+    if (!conn) return NULL;
+    memset(conn, 0, sizeof(ClientInfo));
+    metrics_add(METRIC_CONNECTIONS_ACCEPTED, 1);
+    conn->socket_fd = sock_fd;
+    conn->table_index = -1;
+    conn->room_index = -1;
+    conn->epfd = -1;
+    if (handshake_timeout_ms > 0) {
+        conn->handshake_deadline_ns = metrics_now_ns() + (uint64_t)handshake_timeout_ms * 1000000ULL;
+    }
+    pthread_mutex_init(&conn->out_lock, NULL);
+    frame_decoder_init(&conn->input);
+    outq_init(&conn->output);
+    strcpy(conn->nickname, "Unknown");
+    return conn;
+}
+
+static int handshake_expired(ClientInfo *conn, uint64_t now) {
+    return !conn->registered && conn->handshake_deadline_ns != 0 && now >= conn->handshake_deadline_ns;
+}
+
+// 마감이 지난 연결을 끊고, 다음 마감까지 남은 시간(ms)을 반환 (epoll_wait의 제한 시간, -1: 기다리는 연결 없음)
+static int handshake_expire(HandshakeQueue *queue) {
+    uint64_t now = metrics_now_ns();
+    while (queue->head) {
+        ClientInfo *conn = queue->head;
+        if (!handshake_expired(conn, now)) {
+            return (int)((conn->handshake_deadline_ns - now + 999999) / 1000000);
+        }
+        metrics_add(METRIC_HANDSHAKE_TIMEOUTS, 1);
+        close_connection(conn); // 목록에서도 빠짐
+    }
+    return -1;
+}
+
+// --- 스레드 모드 (연결당 스레드, fallback) ---
+
+// 송신 큐가 혼잡한지 (congested는 다른 스레드의 브로드캐스트가 out_lock을 잡고 바꿈)
+static int client_congested(ClientInfo *conn) {
+    client_lock(conn);
+    int congested = conn->congested;
+    client_unlock(conn);
+    return congested;
+}
+
+// 읽을 데이터가 없을 때까지(EAGAIN) 반복 수신. 연결을 끊어야 하면 -1 반환
+// 자기 송신 큐가 혼잡한 동안에는 읽기를 멈춥니다. (high/low watermark 역압)
+int drain_connection(ClientInfo *conn) {
+    char buffer[READ_CHUNK_SIZE];
     int bytes_read;
-    
-    char success_msg[120]; 
-    char fail_msg[120];
-
-    // 1. 닉네임 등록
-    if ((bytes_read = recv(client_sock, nickname, NICKNAME_SIZE - 1, 0)) > 0) {
-        nickname[bytes_read] = '\0';
-        
-        pthread_mutex_lock(&clients_mutex);
-        if (client_count < MAX_CLIENTS) {
-            clients[client_count].socket_fd = client_sock;
-            strncpy(clients[client_count].nickname, nickname, NICKNAME_SIZE - 1);
-            clients[client_count].nickname[NICKNAME_SIZE - 1] = '\0';
-            clients[client_count].room_name[0] = '\0';
-            client_count++;
-            printf("New client connected: %s\n", nickname);
-            send(client_sock, "[SERVER] Please create a room (CREATE_ROOM:name) or join one (JOIN_ROOM:name)", 80, 0);
+
+    while (!client_congested(conn)) {
+        bytes_read = recv(conn->socket_fd, buffer, read_size_for(conn, sizeof(buffer)), 0);
+        if (bytes_read > 0) {
+            metrics_add(METRIC_BYTES_IN, bytes_read);
+            if (handle_incoming(conn, buffer, bytes_read) < 0) return -1;
+        } else if (bytes_read == 0) {
+            return -1;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
         } else {
-            send(client_sock, "[SERVER] Max clients reached.", 28, 0);
-            close(client_sock);
-            pthread_mutex_unlock(&clients_mutex);
-            return NULL;
+            return -1;
         }
-        pthread_mutex_unlock(&clients_mutex);
-    } else {
-        close(client_sock);
-        return NULL;
-    }
-
-    // 2. 메시지 루프
-    while ((bytes_read = recv(client_sock, buffer, BUFFER_SIZE - 1, 0)) > 0) {
-        buffer[bytes_read] = '\0';
-
-        // --- 명령어 처리 ---
-        char *command = buffer;
-        char *param = strchr(buffer, ':');
-        if (param) *param++ = '\0'; // 명령어와 매개변수 분리 (첫 번째 콜론 기준)
-
-        if (strcmp(command, "CREATE_ROOM") == 0 || strcmp(command, "JOIN_ROOM") == 0) {
-            if (param && strlen(param) > 0) {
-                
-                // 이전 방이 있다면 나가는 메시지 전송
-                if (strlen(current_room) > 0) {
-                     snprintf(success_msg, sizeof(success_msg), "[SERVER] %s has left room '%s'.", nickname, current_room);
-                     send_system_message_to_room(current_room, success_msg);
-                }
-                
-                strncpy(current_room, param, ROOM_NAME_SIZE - 1);
-                current_room[ROOM_NAME_SIZE - 1] = '\0';
-                set_client_room(nickname, current_room);
-
-                snprintf(success_msg, sizeof(success_msg), "[SERVER] %s has entered room '%s'.", nickname, current_room);
-                send_system_message_to_room(current_room, success_msg);
-                printf("%s has entered room %s\n", nickname, current_room);
+    }
+    return 0;
+}
 
-            } else {
-                send(client_sock, "[SERVER] Invalid room command format.", 35, 0);
+void* handle_client(void* arg) {
+    ClientInfo *conn = (ClientInfo*)arg;
+
+    // 소켓은 논블로킹이며, 자기 큐가 혼잡하면 읽기를 멈추고 전송만 기다립니다.
+    while (1) {
+        struct pollfd pfd = { .fd = conn->socket_fd, .events = 0 };
+        client_lock(conn);
+        int closing = conn->closing;
+        if (!conn->congested) pfd.events |= POLLIN;
+        if (conn->output.count > 0) pfd.events |= POLLOUT;
+        client_unlock(conn);
+        if (closing) break;
+        if (handshake_expired(conn, metrics_now_ns())) {
+            metrics_add(METRIC_HANDSHAKE_TIMEOUTS, 1);
+            break;
+        }
+
+        int ready = poll(&pfd, 1, THREAD_POLL_MS);
+        if (ready < 0 && errno != EINTR) break;
+        if (ready <= 0) continue;
+
+        if (pfd.revents & POLLOUT) {
+            client_lock(conn);
+            client_flush(conn);
+            client_unlock(conn);
+        }
+        if ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) && drain_connection(conn) < 0) break;
+        if (pfd.revents & (POLLHUP | POLLERR)) break;
+    }
+
+    close_connection(conn);
+    return NULL;
+}
+
+void run_thread_server(int server_sock) {
+    struct sockaddr_storage client_addr;
+    socklen_t client_len;
+    pthread_t tid;
+    int new_sock;
+    sigset_t report_mask, old_mask;
+    pthread_attr_t attr;
+
+    // SIGUSR1(큐 깊이 보고)은 accept 중인 메인 스레드만 받도록 연결 스레드에서는 막아 둡니다.
+    sigemptyset(&report_mask);
+    sigaddset(&report_mask, SIGUSR1);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    while (1) {
+        client_len = sizeof(client_addr);
+        new_sock = accept4(server_sock, (struct sockaddr *)&client_addr, &client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (new_sock < 0) {
+            if (errno != EINTR) perror("accept failed");
+            if (report_requested) {
+                report_requested = 0;
+                report_queue_depths();
+                relay_report(stdout);
             }
+            continue;
         }
-        else if (strcmp(command, "MSG") == 0) {
-             // [수정]: 일반 채팅 메시지 처리. param은 "닉네임: 메시지 내용" 형태입니다.
-            if (strlen(current_room) > 0 && param) {
-                // param의 내용을 그대로 같은 방에 있는 클라이언트에게 중계합니다.
-                send_system_message_to_room(current_room, param); 
-                printf("Received message in room %s: %s\n", current_room, param);
-            } else {
-                send(client_sock, "[SERVER] You must join a room first.", 36, 0);
+
+        if (!admission_allow(&client_addr)) {
+            admission_reject(new_sock);
+            continue;
+        }
+
+        // 스택 변수 주소를 넘기면 다음 accept와 경쟁하므로 연결 상태를 힙에 할당해 넘깁니다.
+        ClientInfo *conn = create_connection(new_sock);
+        if (!conn) {
+            close(new_sock);
+            continue;
+        }
+        pthread_sigmask(SIG_BLOCK, &report_mask, &old_mask);
+        int created = pthread_create(&tid, &attr, handle_client, conn);
+        pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+        if (created != 0) {
+            perror("thread creation failed");
+            close_connection(conn);
+            continue;
+        }
+    }
+}
+
+// --- epoll 모드 (edge-triggered 리액터) ---
+
+static HandshakeQueue epoll_handshakes = { NULL, NULL };
+
+// 리스닝 소켓에서 최대 ACCEPT_BATCH개를 받음. 남은 연결은 리스닝 소켓이 level-triggered라 다음 이벤트에서 받으므로,
+// 접속이 몰려도 이미 연결된 클라이언트의 이벤트가 그 사이에 처리됩니다.
+// reactor: 멀티 리액터 모드에서 연결을 맡을 리액터 (다른 모드는 NULL)
+void accept_connections(int epfd, int server_sock, Reactor *reactor) {
+    struct sockaddr_storage client_addr;
+    socklen_t client_len;
+    int new_sock;
+    HandshakeQueue *handshakes = reactor ? &reactor->handshakes : &epoll_handshakes;
+
+    for (int batch = 0; batch < ACCEPT_BATCH; batch++) {
+        client_len = sizeof(client_addr);
+        new_sock = accept4(server_sock, (struct sockaddr *)&client_addr, &client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (new_sock < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept failed");
+            return;
+        }
+        if (!admission_allow(&client_addr)) {
+            admission_reject(new_sock);
+            continue;
+        }
+
+        ClientInfo *conn = create_connection(new_sock);
+        if (!conn) {
+            close(new_sock);
+            continue;
+        }
+        if (reactor) {
+            conn->reactor = reactor;
+            atomic_fetch_add_explicit(&reactor->connections, 1, memory_order_relaxed);
+        }
+
+        struct epoll_event ev = { .events = CONNECTION_EPOLL_EVENTS, .data.ptr = conn };
+        conn->epfd = epfd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, new_sock, &ev) < 0) {
+            perror("epoll_ctl failed");
+            close_connection(conn);
+            continue;
+        }
+        handshake_track(handshakes, conn);
+    }
+}
+
+// 연결 하나의 epoll 이벤트 처리 (epoll / 멀티 리액터 모드 공용)
+void handle_connection_event(ClientInfo *conn, uint32_t ready) {
+    // 남은 데이터를 먼저 처리한 뒤 끊김(HUP/ERR)을 반영합니다.
+    int closing = (ready & (EPOLLERR | EPOLLHUP)) != 0;
+    // 혼잡이 풀리면 client_flush가 다시 등록해 두므로, 멈춰 두었던 읽기는 다음 이벤트에서 재개됩니다.
+    if (ready & EPOLLOUT) {
+        client_lock(conn);
+        client_flush(conn);
+        client_unlock(conn);
+    }
+    if ((ready & (EPOLLIN | EPOLLRDHUP)) && drain_connection(conn) < 0) {
+        closing = 1;
+    }
+    client_lock(conn);
+    if (conn->closing) closing = 1;
+    client_unlock(conn);
+    if (closing) {
+        // close() 시 epoll 등록도 자동으로 해제됩니다.
+        close_connection(conn);
+    }
+}
+
+void run_epoll_server(int server_sock) {
+    struct epoll_event events[MAX_EVENTS];
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1 failed");
+        exit(EXIT_FAILURE);
+    }
+
+    set_nonblocking(server_sock);
+    // 리스닝 소켓은 data.ptr = NULL 로 구분합니다.
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, server_sock, &ev) < 0) {
+        perror("epoll_ctl failed");
+        exit(EXIT_FAILURE);
+    }
+
+    while (1) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, handshake_expire(&epoll_handshakes));
+        if (report_requested) {
+            report_requested = 0;
+            report_queue_depths();
+            relay_report(stdout);
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            ClientInfo *conn = events[i].data.ptr;
+            if (conn == NULL) {
+                accept_connections(epfd, server_sock, NULL);
+                continue;
             }
+            handle_connection_event(conn, events[i].events);
+        }
+    }
+    close(epfd);
+}
+
+// --- 멀티 리액터 모드 (코어마다 리스닝 소켓과 이벤트 루프 하나) ---
+
+// 같은 포트에 리액터 수만큼 바인드. 커널이 새 연결을 리액터들에 나눠 줍니다.
+static int open_reuseport_listener(int port) {
+    return proto_listen_any(port, SOCK_NONBLOCK | SOCK_CLOEXEC, 1, listen_backlog, NULL);
+}
+
+static void *run_reactor(void *arg) {
+    Reactor *self = (Reactor*)arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    current_reactor = self;
+    while (1) {
+        int n = epoll_wait(self->epfd, events, MAX_EVENTS, handshake_expire(&self->handshakes));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            break;
         }
-        else if (strncmp(command, "FILE_REQ", 8) == 0) {
-             // FILE_REQ:타겟닉네임:파일명:파일크기:송신자IP:송신자Port
-            char *target = strtok(param, ":");
-            char *filename = strtok(NULL, ":");
-            char *filesize = strtok(NULL, ":");
-            char *sender_ip = strtok(NULL, ":");
-            char *sender_port = strtok(NULL, ":");
-
-            if (target && filename && filesize && sender_ip && sender_port) {
-                char alert_msg[BUFFER_SIZE];
-                
-                snprintf(alert_msg, BUFFER_SIZE, "FILE_ALERT:%s:%s:%s:%s:%s", 
-                         nickname, filename, filesize, sender_ip, sender_port);
-                
-                if (send_to_client(target, alert_msg)) {
-                    printf("File transfer alert sent from %s to %s\n", nickname, target);
-                    snprintf(success_msg, sizeof(success_msg), "[SERVER] File request sent to %s.", target);
-                    send(client_sock, success_msg, strlen(success_msg), 0);
-                } else {
-                    snprintf(fail_msg, sizeof(fail_msg), "[SERVER] User %s not found.", target);
-                    send(client_sock, fail_msg, strlen(fail_msg), 0);
-                }
+
+        for (int i = 0; i < n; i++) {
+            void *source = events[i].data.ptr;
+            if (source == NULL) {
+                accept_connections(self->epfd, self->listen_sock, self);
+            } else if (source == &self->inbox) {
+                reactor_drain_inbox(self);
             } else {
-                 send(client_sock, "[SERVER] File request format error.", 34, 0);
+                handle_connection_event((ClientInfo*)source, events[i].events);
             }
         }
-        else {
-            send(client_sock, "[SERVER] Unknown command or protocol error.", 42, 0);
+    }
+    return NULL;
+}
+
+static int reactor_init(Reactor *self, int id, int port, int cpu) {
+    memset(self, 0, sizeof(*self));
+    self->id = id;
+    self->cpu = cpu;
+    if ((self->listen_sock = open_reuseport_listener(port)) < 0) return -1;
+    if ((self->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) return -1;
+    if (mpsc_init(&self->inbox) < 0) return -1;
+    // 방 기록 예산은 리액터들이 나눠 가집니다. (방마다 소유 리액터 하나에만 기록)
+    if (history_limit > 0 && !(self->history = history_new(history_budget / reactor_count))) return -1;
+    // 메시지 로그도 소유한 방의 것만 엶 (모두 같은 디렉토리를 씀)
+    if (message_log_dir && !(self->log = msglog_open(message_log_dir, id, reactor_count))) return -1;
+    warm_history(self->log, self->history);
+
+    // 리스닝 소켓은 data.ptr = NULL, 작업 큐의 eventfd는 &inbox로 구분합니다.
+    struct epoll_event listen_ev = { .events = EPOLLIN, .data.ptr = NULL };
+    struct epoll_event inbox_ev = { .events = EPOLLIN, .data.ptr = &self->inbox };
+    if (epoll_ctl(self->epfd, EPOLL_CTL_ADD, self->listen_sock, &listen_ev) < 0 ||
+        epoll_ctl(self->epfd, EPOLL_CTL_ADD, self->inbox.wake_fd, &inbox_ev) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// 리액터 count개를 띄우고 (가능하면 코어마다 하나씩 고정), 메인 스레드는 운영자 시그널만 처리
+void run_reactors(int port, int count) {
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    int cpu_count = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) cpus[cpu_count++] = cpu;
         }
     }
+    if (count <= 0) count = cpu_count > 0 ? cpu_count : 1;
+    if (count > MAX_REACTORS) count = MAX_REACTORS;
 
-    // 3. 연결 종료 처리
-    remove_client(client_sock);
-    return NULL;
+    reactors = calloc(count, sizeof(Reactor));
+    if (!reactors) {
+        perror("reactor allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    reactor_count = count;
+    for (int i = 0; i < count; i++) {
+        if (reactor_init(&reactors[i], i, port, cpu_count > 0 ? cpus[i % cpu_count] : -1) < 0) {
+            perror("reactor setup failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    atomic_store_explicit(&reactors_published, count, memory_order_release);
+
+    // 운영자 시그널(SIGUSR1)은 메인 스레드가 받도록 리액터는 모든 시그널을 막은 상태로 시작
+    sigset_t all_signals, old_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &old_mask);
+    for (int i = 0; i < count; i++) {
+        Reactor *reactor = &reactors[i];
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (reactor->cpu >= 0) {
+            cpu_set_t pinned;
+            CPU_ZERO(&pinned);
+            CPU_SET(reactor->cpu, &pinned);
+            pthread_attr_setaffinity_np(&attr, sizeof(pinned), &pinned);
+        }
+        int created = pthread_create(&reactor->thread, &attr, run_reactor, reactor);
+        pthread_attr_destroy(&attr);
+        if (created != 0) {
+            fprintf(stderr, "reactor thread creation failed: %s\n", strerror(created));
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    printf("Chat Server running on port %d (%d reactors, %zu bytes of state per connection)...\n",
+           port, count, sizeof(ClientInfo));
+    fflush(stdout);
+    while (1) {
+        pause();
+        if (report_requested) {
+            report_requested = 0;
+            report_queue_depths();
+            relay_report(stdout);
+        }
+    }
 }
 
-int main(void) {
-    int server_sock, new_sock;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len;
-    pthread_t tid;
+void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--config=FILE] [--mode=epoll|thread|reactors] [--reactors=N] [--port=PORT]\n"
+                    "          [--slow-consumer=drop-oldest|drop-newest|disconnect]\n"
+                    "          [--outq-high=BYTES] [--outq-low=BYTES] [--relay-port=PORT]\n"
+                    "          [--stats-socket=PATH] [--log=error|info|debug] [--log-sample=N]\n"
+                    "          [--history=N] [--history-seconds=T] [--history-budget=BYTES]\n"
+                    "          [--message-log=DIR] [--message-log-sync-ms=MS] [--message-log-retention=MB]\n"
+                    "          [--relay-rate=KB/s] [--max-clients=N] [--backlog=N] [--handshake-timeout=MS]\n"
+                    "          [--accept-rate=N] [--accept-rate-per-ip=N] [--accept-burst=N] [--max-message=BYTES]\n"
+                    "Send SIGUSR1 to print outbound queue depths and file relay throughput.\n"
+                    "Send \"STATS\" to the stats socket (default /tmp/chat-server.PORT.sock) for counters and latencies.\n"
+                    "--relay-port=0 disables the file relay, --stats-socket= (empty) disables the stats socket,\n"
+                    "--history=0 disables room history replay on join.\n"
+                    "--message-log keeps chat messages on disk for HISTORY:room:since (off by default),\n"
+                    "--message-log-sync-ms=0 syncs every message instead of group commits,\n"
+                    "--message-log-retention keeps at most MB of log segments per room (0 = keep everything).\n"
+                    "--relay-rate caps each file relay (0 = unlimited), \"RELAY-RATE KB/s\" on the stats socket changes it.\n"
+                    "--accept-rate/--accept-rate-per-ip cap new connections per second (0 = unlimited),\n"
+                    "\"ACCEPT-RATE N [PER-IP]\" on the stats socket changes them; --handshake-timeout=0 waits forever.\n"
+                    "--max-message (%d..%d) caps text-mode commands and FILE_REQ alerts.\n"
+                    "--config reads \"option = value\" lines (long option names); later command-line options override it.\n",
+            prog, MAX_MESSAGE_MIN, FRAME_MAX_PAYLOAD);
+}
+
+static const struct option long_options[] = {
+    {"config", required_argument, NULL, 'c'},
+    {"mode", required_argument, NULL, 'm'},
+    {"port", required_argument, NULL, 'p'},
+    {"slow-consumer", required_argument, NULL, 's'},
+    {"outq-high", required_argument, NULL, 'H'},
+    {"outq-low", required_argument, NULL, 'L'},
+    {"relay-port", required_argument, NULL, 'R'},
+    {"stats-socket", required_argument, NULL, 'S'},
+    {"log", required_argument, NULL, 'l'},
+    {"log-sample", required_argument, NULL, 'n'},
+    {"reactors", required_argument, NULL, 'r'},
+    {"history", required_argument, NULL, 'y'},
+    {"history-seconds", required_argument, NULL, 'Y'},
+    {"history-budget", required_argument, NULL, 'B'},
+    {"message-log", required_argument, NULL, 'd'},
+    {"message-log-sync-ms", required_argument, NULL, 'D'},
+    {"message-log-retention", required_argument, NULL, 'e'},
+    {"relay-rate", required_argument, NULL, 'b'},
+    {"max-clients", required_argument, NULL, 'M'},
+    {"backlog", required_argument, NULL, 'k'},
+    {"handshake-timeout", required_argument, NULL, 't'},
+    {"accept-rate", required_argument, NULL, 'a'},
+    {"accept-rate-per-ip", required_argument, NULL, 'i'},
+    {"accept-burst", required_argument, NULL, 'u'},
+    {"max-message", required_argument, NULL, 'x'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
+// 옵션 하나를 적용 (명령행과 설정 파일 공용). value는 서버가 끝날 때까지 유효해야 합니다. 잘못된 값이면 -1
+static int apply_option(int opt, const char *value) {
+    long long global_rate, address_rate;
+
+    switch (opt) {
+    case 'm':
+        if (strcmp(value, "epoll") == 0) {
+            mode = MODE_EPOLL;
+        } else if (strcmp(value, "thread") == 0) {
+            mode = MODE_THREAD;
+        } else if (strcmp(value, "reactors") == 0) {
+            mode = MODE_REACTORS;
+        } else {
+            return -1;
+        }
+        break;
+    case 'p':
+        chat_port = atoi(value);
+        break;
+    case 's':
+        if (strcmp(value, "drop-oldest") == 0) {
+            slow_policy = SLOW_DROP_OLDEST;
+        } else if (strcmp(value, "drop-newest") == 0) {
+            slow_policy = SLOW_DROP_NEWEST;
+        } else if (strcmp(value, "disconnect") == 0) {
+            slow_policy = SLOW_DISCONNECT;
+        } else {
+            return -1;
+        }
+        break;
+    case 'H':
+        outq_high_watermark = strtoul(value, NULL, 10);
+        break;
+    case 'L':
+        outq_low_watermark = strtoul(value, NULL, 10);
+        break;
+    case 'R':
+        relay_listen_port = atoi(value);
+        break;
+    case 'S':
+        stats_path = value;
+        break;
+    case 'l':
+        if (strcmp(value, "error") == 0) {
+            log_level = LOG_ERROR;
+        } else if (strcmp(value, "info") == 0) {
+            log_level = LOG_INFO;
+        } else if (strcmp(value, "debug") == 0) {
+            log_level = LOG_DEBUG;
+        } else {
+            return -1;
+        }
+        break;
+    case 'n':
+        log_sample_every = strtoul(value, NULL, 10);
+        break;
+    case 'r':
+        reactor_threads = atoi(value);
+        break;
+    case 'y':
+        history_limit = atoi(value);
+        break;
+    case 'Y':
+        history_seconds = atoi(value);
+        break;
+    case 'B':
+        history_budget = strtoul(value, NULL, 10);
+        break;
+    case 'd':
+        message_log_dir = value[0] != '\0' ? value : NULL;
+        break;
+    case 'D':
+        message_log_sync_ms = atoi(value);
+        break;
+    case 'e':
+        if (atoll(value) < 0) return -1;
+        msglog_set_retention((unsigned long long)atoll(value) * 1024 * 1024);
+        break;
+    case 'b':
+        relay_set_rate(atoll(value) * 1024);
+        break;
+    case 'M':
+        if ((max_clients = atoi(value)) <= 0) return -1;
+        break;
+    case 'k':
+        if ((listen_backlog = atoi(value)) <= 0) return -1;
+        break;
+    case 't':
+        if ((handshake_timeout_ms = atoi(value)) < 0) return -1;
+        break;
+    case 'a':
+    case 'i':
+        admission_get_rates(&global_rate, &address_rate);
+        if (opt == 'a') {
+            global_rate = atoll(value);
+        } else {
+            address_rate = atoll(value);
+        }
+        if (global_rate < 0 || address_rate < 0) return -1;
+        admission_set_rates(global_rate, address_rate);
+        break;
+    case 'u':
+        if (atoi(value) <= 0) return -1;
+        admission_set_burst(atoi(value));
+        break;
+    case 'x':
+        max_message = atoi(value);
+        if (max_message < MAX_MESSAGE_MIN || max_message > FRAME_MAX_PAYLOAD) return -1;
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
 
-    if ((server_sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("socket creation failed");
+static char *trim(char *text) {
+    while (*text == ' ' || *text == '\t') text++;
+    char *end = text + strlen(text);
+    while (end > text && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r')) end--;
+    *end = '\0';
+    return text;
+}
+
+// 설정 파일: 한 줄에 "옵션 = 값" 하나 (옵션은 명령행의 긴 이름, '#' 뒤는 주석, 빈 줄 무시)
+// 잘못된 줄이 있으면 어느 줄인지 알리고 종료합니다.
+static void load_config(const char *path) {
+    char line[CONFIG_LINE_SIZE];
+    int number = 0;
+    FILE *file = fopen(path, "r");
+
+    if (!file) {
+        perror(path);
         exit(EXIT_FAILURE);
     }
-    int opt = 1;
-    setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    while (fgets(line, sizeof(line), file)) {
+        number++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char *name = trim(line);
+        if (name[0] == '\0') continue;
+
+        char *separator = strchr(name, '=');
+        if (!separator) separator = name + strcspn(name, " \t");
+        char *value = *separator ? trim(separator + 1) : separator;
+        *separator = '\0';
+        name = trim(name);
+
+        const struct option *option = long_options;
+        while (option->name && strcmp(option->name, name) != 0) option++;
+        if (!option->name || option->has_arg != required_argument || option->val == 'c') {
+            fprintf(stderr, "%s:%d: unknown option '%s'\n", path, number, name);
+            exit(EXIT_FAILURE);
+        }
+        // 경로 같은 값은 포인터로 보관하므로 줄 버퍼를 다시 쓰기 전에 복사
+        char *copy = strdup(value);
+        if (!copy || apply_option(option->val, copy) < 0) {
+            fprintf(stderr, "%s:%d: invalid value for %s: '%s'\n", path, number, name, value);
+            exit(EXIT_FAILURE);
+        }
+    }
+    fclose(file);
+}
+
+int main(int argc, char *argv[]) {
+    int server_sock = -1;
+    char default_stats_path[108];
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(CHAT_PORT);
+    int opt_ch;
+    while ((opt_ch = getopt_long(argc, argv, "c:m:p:s:H:L:R:S:l:n:r:y:Y:B:d:D:e:b:M:k:t:a:i:u:x:h",
+                                 long_options, NULL)) != -1) {
+        if (opt_ch == 'c') {
+            load_config(optarg);
+        } else if (opt_ch == 'h' || opt_ch == '?' || apply_option(opt_ch, optarg) < 0) {
+            print_usage(argv[0]);
+            exit(opt_ch == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
 
-    if (bind(server_sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("bind failed");
+    if (outq_high_watermark == 0 || outq_low_watermark > outq_high_watermark) {
+        fprintf(stderr, "--outq-high must be positive and not below --outq-low\n");
         exit(EXIT_FAILURE);
     }
+    if (history_limit < 0 || history_limit > HISTORY_ROOM_MESSAGES || history_seconds < 0) {
+        fprintf(stderr, "--history must be between 0 and %d, --history-seconds must not be negative\n",
+                HISTORY_ROOM_MESSAGES);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < HISTORY_SHARDS && mode != MODE_REACTORS; i++) {
+        pthread_mutex_init(&history_shards[i].lock, NULL);
+        if (history_limit > 0 && !(history_shards[i].history = history_new(history_budget / HISTORY_SHARDS))) {
+            perror("history allocation failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    // 메시지 로그: 동기화 스레드를 먼저 띄움 (여는 동안 복구한 꼬리도 확정해야 하므로)
+    // 멀티 리액터 모드는 리액터마다 자기 방의 로그를 엽니다. (reactor_init)
+    if (message_log_dir) {
+        if (message_log_sync_ms < 0 || msglog_start_sync(message_log_sync_ms) < 0) {
+            fprintf(stderr, "--message-log-sync-ms must not be negative\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < HISTORY_SHARDS && mode != MODE_REACTORS; i++) {
+            HistoryShard *shard = &history_shards[i];
+            if (!(shard->log = msglog_open(message_log_dir, i, HISTORY_SHARDS))) {
+                perror("message log open failed");
+                exit(EXIT_FAILURE);
+            }
+            warm_history(shard->log, shard->history);
+        }
+        printf("Message log in %s (group commit every %d ms)\n", message_log_dir, message_log_sync_ms);
+    }
 
-    if (listen(server_sock, 3) < 0) {
-        perror("listen failed");
+    client_table_set_limit(max_clients);
+    if (!(connection_pool = pool_create("connection", sizeof(ClientInfo)))) {
+        perror("connection pool allocation failed");
         exit(EXIT_FAILURE);
     }
-    printf("Chat Server running on port %d...\n", CHAT_PORT);
 
-    while (1) {
-        client_len = sizeof(client_addr);
-        if ((new_sock = accept(server_sock, (struct sockaddr *)&client_addr, &client_len)) < 0) {
-            perror("accept failed");
-            continue;
+    // 끊어진 소켓에 쓰더라도 서버 전체가 종료되지 않도록 합니다.
+    signal(SIGPIPE, SIG_IGN);
+
+    // SIGUSR1: 송신 큐 깊이 보고. 대기 중인 accept/epoll_wait를 깨우도록 SA_RESTART 없이 설치합니다.
+    struct sigaction report_action;
+    memset(&report_action, 0, sizeof(report_action));
+    report_action.sa_handler = on_report_signal;
+    sigemptyset(&report_action.sa_mask);
+    sigaction(SIGUSR1, &report_action, NULL);
+
+    // 멀티 리액터 모드는 리액터마다 SO_REUSEPORT 리스닝 소켓을 따로 엽니다. (run_reactors)
+    if (mode != MODE_REACTORS) {
+        // IPv6가 가능하면 IPv4 접속도 함께 받는 듀얼 스택 소켓
+        if ((server_sock = proto_listen_any(chat_port, 0, 0, listen_backlog, NULL)) < 0) {
+            perror("listen failed");
+            exit(EXIT_FAILURE);
         }
-        
-        if (pthread_create(&tid, NULL, handle_client, &new_sock) != 0) {
-            perror("thread creation failed");
-            close(new_sock);
+    }
+
+    // 관리 소켓: 로컬 운영자만 접근할 수 있도록 네트워크 포트 대신 Unix 소켓(0600)을 씁니다.
+    server_started = time(NULL);
+    if (!stats_path) {
+        snprintf(default_stats_path, sizeof(default_stats_path), "/tmp/chat-server.%d.sock", chat_port);
+        stats_path = default_stats_path;
+    }
+    if (stats_path[0] != '\0') {
+        if (metrics_serve(stats_path, write_stats, handle_admin_command) < 0) {
+            perror("stats socket failed");
+        } else {
+            printf("Stats socket listening on %s\n", stats_path);
+        }
+    }
+
+    // 파일 전송 중계: 직접 연결할 수 없는 송신자/수신자를 위한 데이터 포트 (0이면 끔)
+    if (relay_listen_port > 0) {
+        if (relay_start(relay_listen_port) < 0) {
+            perror("relay listen failed");
+        } else {
+            printf("File relay listening on port %d", relay_listen_port);
+            if (relay_rate() > 0) printf(" (%lld KB/s per relay)", relay_rate() / 1024);
+            printf("\n");
         }
-        pthread_detach(tid);
     }
-    close(server_sock);
+
+    if (mode == MODE_EPOLL) {
+        // 연결당 비용 비교용: epoll 모드는 ClientInfo 구조체 하나가 연결당 상태의 전부입니다.
+        printf("Chat Server running on port %d (epoll mode, %zu bytes of state per connection)...\n",
+               chat_port, sizeof(ClientInfo));
+        run_epoll_server(server_sock);
+    } else if (mode == MODE_REACTORS) {
+        run_reactors(chat_port, reactor_threads);
+    } else {
+        printf("Chat Server running on port %d (thread mode, %d bytes of stack per connection)...\n",
+               chat_port, THREAD_STACK_SIZE);
+        run_thread_server(server_sock);
+    }
+
+    if (server_sock >= 0) close(server_sock);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,125 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "protocol.h"
+#include "outqueue.h"
+
+#define CHAT_PORT 8080 // 기본값 (--port)
+#define MAX_CLIENTS 65536 // 연결 테이블은 필요에 따라 늘어나며, 이 값은 기본 상한선입니다. (--max-clients)
+#define BUFFER_SIZE 1024 // 텍스트 모드 메시지 최대 길이 기본값 (--max-message)
+#define MAX_MESSAGE_MIN 128 // --max-message 하한 (명령어와 방 이름이 들어가도록). 상한은 FRAME_MAX_PAYLOAD
+#define NICKNAME_SIZE 30
+#define ROOM_NAME_SIZE 50
+
+typedef struct Room Room;
+typedef struct RoomIndex RoomIndex;
+typedef struct Reactor Reactor;
+typedef struct HandshakeQueue HandshakeQueue;
+
+// 클라이언트(연결) 정보를 저장하는 구조체
+// handle_client의 지역 변수였던 상태까지 포함하여 논블로킹 처리에 사용합니다.
+typedef struct ClientInfo {
+    int socket_fd;
+    int registered;                 // 닉네임 등록(핸드셰이크) 완료 여부
+    int framed;                     // 프레임 프로토콜 사용 여부 (핸드셰이크에서 결정)
+    char magic[PROTO_MAGIC_LEN];    // 나뉘어 도착한 매직 바이트
+    int magic_length;
+    FrameDecoder input;             // 프레임 모드의 미완성 입력 조각
+    char nickname[NICKNAME_SIZE];
+    char room_name[ROOM_NAME_SIZE]; // 클라이언트가 속한 채팅방 이름
+
+    int table_index;                // 연결 테이블에서의 위치 (-1: 미등록)
+    Room *room;                     // 현재 방 (없으면 NULL)
+    int room_index;                 // room->members 에서의 위치
+    struct ClientInfo *nick_next;   // 닉네임 디렉토리의 같은 버킷 다음 항목
+    int nick_registered;            // 닉네임 디렉토리에 등록됨
+
+    pthread_mutex_t out_lock;       // epoll/스레드 모드: output, congested, closing 보호 (멀티 리액터 모드는 쓰지 않음)
+    OutQueue output;                // 아직 보내지 못한 송신 메시지
+    int congested;                  // 송신 큐가 high watermark를 넘어 아직 low 아래로 내려오지 않음
+    int closing;                    // 끊기로 결정됨 (소유자가 다음 이벤트에서 정리)
+    Room *live_room;                // epoll/스레드 모드: 실시간 메시지를 받는 방
+    uint64_t live_after;            // 현재 방에서 재생으로 이미 받은 마지막 순번 (입장 직후 재생 전에는 UINT64_MAX, out_lock으로 보호)
+    unsigned join_generation;       // 멀티 리액터 모드: 입장할 때마다 증가 (이전 입장의 재생을 가려냄)
+    Reactor *reactor;               // 멀티 리액터 모드: 이 연결을 받은 리액터 (다른 모드는 NULL)
+    int epfd;                       // 이 연결을 등록한 epoll (스레드 모드는 -1)
+
+    uint64_t handshake_deadline_ns; // 이 시각(단조 시계)까지 닉네임을 보내지 않으면 끊음 (0: 제한 없음)
+    HandshakeQueue *handshake_queue; // epoll/멀티 리액터 모드: 핸드셰이크를 기다리는 목록 (등록 후 NULL)
+    struct ClientInfo *handshake_prev, *handshake_next;
+} ClientInfo;
+
+// 방 멤버 목록의 읽기 전용 사본. 만든 뒤에는 바뀌지 않으며, 입장/퇴장마다 새 버전으로 교체됩니다.
+typedef struct {
+    uint64_t version;
+    int count;
+    ClientInfo *members[];
+} RoomSnapshot;
+
+// 채팅방: 방 이름 해시 맵의 항목이며 멤버 목록을 직접 가집니다.
+// 멀티 리액터 모드에서는 리액터마다 자기 연결만 멤버로 가진 항목이 따로 있습니다.
+// 공유 인덱스(global_rooms)의 방은 members를 바꿀 때마다 snapshot도 새로 게시하므로,
+// 브로드캐스트는 epoch_enter 구간 안에서 snapshot만 읽습니다. 옛 사본과 없어진 방은 에포크로 회수합니다.
+// 같은 방의 메시지는 history_lock 안에서 받은 순번(seq) 순서로 멤버 큐에 들어갑니다. (멤버 변경은 이 락을 잡지 않음)
+struct Room {
+    char name[ROOM_NAME_SIZE];
+    ClientInfo **members;
+    int member_count;
+    int member_capacity;
+    RoomSnapshot *_Atomic snapshot; // 공유 인덱스만: 현재 멤버 사본 (없으면 NULL)
+    uint64_t snapshot_version;
+    pthread_mutex_t history_lock;   // 공유 인덱스만: 순번 매기기와 기록 추가를 묶음 (전송은 락 밖)
+    uint64_t seq;                   // 마지막으로 매긴 메시지 순번 (history_lock으로 보호, 리액터의 소유 방은 소유 리액터만 사용)
+    atomic_ullong delivered;        // 멤버 큐에 다 넣은 마지막 순번 (다음 순번은 이것을 기다렸다가 넣음)
+    atomic_ullong messages;         // 이 방으로 브로드캐스트한 메시지 수 (STATS)
+    atomic_ullong bytes;
+    uint64_t reactor_mask;          // 멀티 리액터: 방 소유 리액터가 아는, 멤버가 있는 리액터들
+    RoomIndex *index;               // 이 방이 들어 있는 인덱스
+    Room *next;                     // 같은 해시 버킷의 다음 방
+};
+
+// 방 이름 -> 방 해시 맵. epoll/스레드 모드는 global_rooms 하나를 clients_mutex로 보호하고,
+// 멀티 리액터 모드는 리액터마다 자기 스레드만 쓰는 인덱스를 가집니다.
+struct RoomIndex {
+    Room **buckets;
+    size_t bucket_count;
+    size_t total;
+    int shared;                     // 여러 스레드가 락 없이 읽음: 멤버 사본을 게시하고 방을 에포크로 회수
+};
+
+// 연결 테이블, 닉네임 디렉토리와 방 인덱스의 변경을 보호하는 전역 락
+extern pthread_mutex_t clients_mutex;
+
+// --- room.c: 연결 테이블 / 방 인덱스 (모두 clients_mutex를 잡은 상태에서 호출) ---
+// 방 인덱스는 예외: 멀티 리액터 모드의 리액터별 인덱스는 그 리액터 스레드에서만 호출합니다.
+
+void client_table_set_limit(int limit);
+int client_table_add(ClientInfo *client);
+void client_table_remove(ClientInfo *client);
+int client_table_count(void);
+ClientInfo *client_table_at(int index);
+
+extern RoomIndex global_rooms;
+
+size_t name_hash(const char *name);
+Room *room_find(RoomIndex *index, const char *name);
+int room_join(RoomIndex *index, ClientInfo *client, const char *name);
+void room_leave(ClientInfo *client);
+// 공유 인덱스 방의 현재 멤버 사본 (락 불필요, epoch_enter 구간 안에서만 유효). 없으면 NULL
+RoomSnapshot *room_snapshot(Room *room);
+// 멤버 목록 없이 방 항목만 쓰는 경우 (리액터의 소유 방): 찾거나 만들고, 멤버가 0이면 제거
+Room *room_acquire(RoomIndex *index, const char *name);
+void room_release(Room *room);
+size_t room_count(RoomIndex *index);
+// 모든 방을 순회 (통계용)
+void room_foreach(RoomIndex *index, void (*visit)(Room *room, void *ctx), void *ctx);
+
+ClientInfo *nick_find(const char *nickname);
+int nick_register(ClientInfo *client);
+void nick_unregister(ClientInfo *client);
+
+#endif
@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "transfer.h"
+
+static void dispose_args(Transfer *t) {
+    if (t->dispose) {
+        t->dispose(t->args);
+    } else {
+        free(t->args);
+    }
+    t->args = NULL;
+}
+
+static pthread_mutex_t transfer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t transfer_ready = PTHREAD_COND_INITIALIZER;
+static Transfer *transfers = NULL;  // 모든 전송 (최근 것이 앞)
+static int next_transfer_id = 1;
+static atomic_llong default_rate;   // 새 전송의 속도 상한 (바이트/초, 0이면 제한 없음)
+
+// 대기 중인 전송 중 가장 오래된 것 (목록 뒤쪽부터 찾음)
+static Transfer *next_queued(void) {
+    Transfer *found = NULL;
+    for (Transfer *t = transfers; t; t = t->next) {
+        if (t->state == TRANSFER_QUEUED) found = t;
+    }
+    return found;
+}
+
+// 끝난 전송은 TRANSFER_KEEP_FINISHED개까지만 목록에 남김
+static void prune_finished(void) {
+    int kept = 0;
+    Transfer **link = &transfers;
+    while (*link) {
+        Transfer *t = *link;
+        if (t->state >= TRANSFER_DONE && ++kept > TRANSFER_KEEP_FINISHED) {
+            *link = t->next;
+            free(t);
+        } else {
+            link = &t->next;
+        }
+    }
+}
+
+static void *transfer_worker(void *arg) {
+    while (1) {
+        pthread_mutex_lock(&transfer_lock);
+        Transfer *t;
+        while (!(t = next_queued())) {
+            pthread_cond_wait(&transfer_ready, &transfer_lock);
+        }
+        t->state = TRANSFER_ACTIVE;
+        t->started = xfer_now();
+        pthread_mutex_unlock(&transfer_lock);
+
+        int result = t->run(t, t->args);
+        dispose_args(t);
+
+        pthread_mutex_lock(&transfer_lock);
+        t->fd_count = 0;
+        t->ended = xfer_now();
+        if (atomic_load(&t->progress.cancelled)) {
+            t->state = TRANSFER_CANCELLED;
+        } else {
+            t->state = result == 0 ? TRANSFER_DONE : TRANSFER_FAILED;
+        }
+        prune_finished();
+        pthread_mutex_unlock(&transfer_lock);
+    }
+    return NULL;
+}
+
+int transfer_manager_init(int workers) {
+    if (workers < 1) workers = TRANSFER_DEFAULT_WORKERS;
+    for (int i = 0; i < workers; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, transfer_worker, NULL) != 0) return i > 0 ? 0 : -1;
+        pthread_detach(tid);
+    }
+    return 0;
+}
+
+int transfer_submit(TransferDirection direction, const char *name, const char *peer, off_t total,
+                    TransferRun run, TransferDispose dispose, void *args) {
+    Transfer *t = calloc(1, sizeof(Transfer));
+    if (!t) {
+        if (dispose) {
+            dispose(args);
+        } else {
+            free(args);
+        }
+        return -1;
+    }
+    t->direction = direction;
+    t->state = TRANSFER_QUEUED;
+    strncpy(t->name, name, TRANSFER_NAME_SIZE - 1);
+    strncpy(t->peer, peer, TRANSFER_PEER_SIZE - 1);
+    t->total = total;
+    xfer_progress_init(&t->progress);
+    ratelimit_set(&t->progress.limit, atomic_load(&default_rate));
+    t->run = run;
+    t->dispose = dispose;
+    t->args = args;
+
+    pthread_mutex_lock(&transfer_lock);
+    t->id = next_transfer_id++;
+    t->next = transfers;
+    transfers = t;
+    pthread_cond_signal(&transfer_ready);
+    pthread_mutex_unlock(&transfer_lock);
+    return t->id;
+}
+
+int transfer_cancel(int id) {
+    int result = -1;
+
+    pthread_mutex_lock(&transfer_lock);
+    for (Transfer *t = transfers; t; t = t->next) {
+        if (t->id != id) continue;
+        if (t->state == TRANSFER_QUEUED) {
+            // 아직 시작하지 않았으면 작업 스레드가 가져가지 않도록 바로 끝냄
+            atomic_store(&t->progress.cancelled, 1);
+            t->state = TRANSFER_CANCELLED;
+            dispose_args(t);
+            result = 0;
+        } else if (t->state == TRANSFER_ACTIVE) {
+            atomic_store(&t->progress.cancelled, 1);
+            for (int i = 0; i < t->fd_count; i++) {
+                shutdown(t->fds[i], SHUT_RDWR);
+            }
+            result = 0;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&transfer_lock);
+    return result;
+}
+
+int transfer_set_rate(int id, long long bytes_per_second) {
+    int result = -1;
+
+    pthread_mutex_lock(&transfer_lock);
+    for (Transfer *t = transfers; t; t = t->next) {
+        if (t->id != id) continue;
+        if (t->state <= TRANSFER_ACTIVE) {
+            ratelimit_set(&t->progress.limit, bytes_per_second);
+            result = 0;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&transfer_lock);
+    return result;
+}
+
+void transfer_set_default_rate(long long bytes_per_second) {
+    atomic_store(&default_rate, bytes_per_second > 0 ? bytes_per_second : 0);
+}
+
+long long transfer_default_rate(void) {
+    return atomic_load(&default_rate);
+}
+
+size_t transfer_list(TransferInfo *out, size_t max) {
+    size_t count = 0;
+    double now = xfer_now();
+
+    pthread_mutex_lock(&transfer_lock);
+    for (Transfer *t = transfers; t && count < max; t = t->next) {
+        TransferInfo *info = &out[count++];
+        info->id = t->id;
+        info->direction = t->direction;
+        info->state = t->state;
+        memcpy(info->name, t->name, TRANSFER_NAME_SIZE);
+        memcpy(info->peer, t->peer, TRANSFER_PEER_SIZE);
+        info->total = t->total;
+        info->done = (off_t)atomic_load(&t->progress.bytes);
+        double end = t->state >= TRANSFER_DONE ? t->ended : now;
+        info->rate = (t->started > 0 && end > t->started) ? info->done / (end - t->started) : 0;
+        info->limit = ratelimit_rate(&t->progress.limit);
+    }
+    pthread_mutex_unlock(&transfer_lock);
+    return count;
+}
+
+int transfer_track_fd(Transfer *transfer, int fd) {
+    int result = 0;
+    pthread_mutex_lock(&transfer_lock);
+    if (atomic_load(&transfer->progress.cancelled)) {
+        result = -1;
+    } else if (transfer->fd_count < TRANSFER_MAX_FDS) {
+        transfer->fds[transfer->fd_count++] = fd;
+    }
+    pthread_mutex_unlock(&transfer_lock);
+    return result;
+}
+
+void transfer_untrack_fd(Transfer *transfer, int fd) {
+    pthread_mutex_lock(&transfer_lock);
+    for (int i = 0; i < transfer->fd_count; i++) {
+        if (transfer->fds[i] == fd) {
+            transfer->fds[i] = transfer->fds[--transfer->fd_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&transfer_lock);
+}
+
+int transfer_cancelled(Transfer *transfer) {
+    return atomic_load(&transfer->progress.cancelled);
+}
+
+const char *transfer_state_name(TransferState state) {
+    switch (state) {
+    case TRANSFER_QUEUED: return "queued";
+    case TRANSFER_ACTIVE: return "active";
+    case TRANSFER_DONE: return "done";
+    case TRANSFER_FAILED: return "failed";
+    default: return "cancelled";
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "filexfer.h"
+
+// --- 파일 전송 관리자 (클라이언트) ---
+// 전송마다 스레드를 만들지 않고, 고정된 수의 작업 스레드가 대기열의 전송을 하나씩 처리합니다.
+// 각 전송은 번호로 식별되며 진행률 조회와 취소를 지원합니다.
+
+#define TRANSFER_DEFAULT_WORKERS 4
+#define TRANSFER_MAX_FDS (XFER_MAX_STREAMS + 1) // 데이터 스트림 + 송신 리스닝 소켓
+#define TRANSFER_NAME_SIZE 256
+#define TRANSFER_PEER_SIZE 30
+#define TRANSFER_KEEP_FINISHED 32 // 목록에 남겨 두는 끝난 전송 수
+
+typedef enum {
+    TRANSFER_SEND,
+    TRANSFER_RECEIVE
+} TransferDirection;
+
+typedef enum {
+    TRANSFER_QUEUED,
+    TRANSFER_ACTIVE,
+    TRANSFER_DONE,
+    TRANSFER_FAILED,
+    TRANSFER_CANCELLED
+} TransferState;
+
+typedef struct Transfer Transfer;
+typedef int (*TransferRun)(Transfer *transfer, void *args); // 0 성공, -1 실패
+typedef void (*TransferDispose)(void *args);                // args와 그 자원 해제 (NULL이면 free)
+
+struct Transfer {
+    int id;
+    TransferDirection direction;
+    TransferState state;
+    char name[TRANSFER_NAME_SIZE];
+    char peer[TRANSFER_PEER_SIZE];
+    off_t total;
+    XferProgress progress;      // 전송한 바이트 수와 취소 플래그 (데이터 경로가 직접 갱신)
+    double started;
+    double ended;
+
+    TransferRun run;
+    TransferDispose dispose;
+    void *args;                 // run이 끝나거나 대기 중에 취소되면 dispose
+
+    int fds[TRANSFER_MAX_FDS];  // 취소 시 shutdown할 소켓 (블로킹 호출을 깨움)
+    int fd_count;
+    Transfer *next;
+};
+
+// 목록 표시용 사본
+typedef struct {
+    int id;
+    TransferDirection direction;
+    TransferState state;
+    char name[TRANSFER_NAME_SIZE];
+    char peer[TRANSFER_PEER_SIZE];
+    off_t total;
+    off_t done;
+    double rate;                // 바이트/초
+    long long limit;            // 속도 상한 (바이트/초, 0이면 제한 없음)
+} TransferInfo;
+
+// 작업 스레드 workers개 시작. 실패 시 -1
+int transfer_manager_init(int workers);
+// 전송을 대기열에 넣고 번호를 반환 (args의 소유권을 가져감, 실패해도 dispose). 실패 시 -1
+int transfer_submit(TransferDirection direction, const char *name, const char *peer, off_t total,
+                    TransferRun run, TransferDispose dispose, void *args);
+// 대기 중이면 바로 취소하고, 진행 중이면 소켓을 끊어 중단시킴. 해당 전송이 없으면 -1
+int transfer_cancel(int id);
+// 대기 중이거나 진행 중인 전송의 속도 상한을 바꿈 (바이트/초, 0이면 제한 없음). 해당 전송이 없으면 -1
+int transfer_set_rate(int id, long long bytes_per_second);
+// 이후에 넣는 전송의 기본 속도 상한
+void transfer_set_default_rate(long long bytes_per_second);
+long long transfer_default_rate(void);
+// 최근 전송부터 최대 max개를 out에 복사하고 개수를 반환
+size_t transfer_list(TransferInfo *out, size_t max);
+
+// run 안에서 사용: 취소 시 함께 끊을 소켓 등록/해제, 취소 여부 확인
+int transfer_track_fd(Transfer *transfer, int fd);
+void transfer_untrack_fd(Transfer *transfer, int fd);
+int transfer_cancelled(Transfer *transfer);
+
+const char *transfer_state_name(TransferState state);
+
+#endif
@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+
+static int sys_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned opcode, const void *arg, unsigned count) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+int uring_init(Uring *ring, unsigned entries) {
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring->fd = sys_setup(entries, &params);
+    if (ring->fd < 0) return -1;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (ring->single_mmap) {
+        if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) goto fail;
+    ring->cq_ring = ring->single_mmap ? ring->sq_ring
+                                      : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED) goto fail;
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) goto fail;
+
+    char *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+
+fail:
+    {
+        int saved_errno = errno;
+        if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+        if (ring->cq_ring && ring->cq_ring != MAP_FAILED && !ring->single_mmap) munmap(ring->cq_ring, ring->cq_ring_size);
+        if (ring->sq_ring && ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        ring->fd = -1;
+        errno = saved_errno;
+    }
+    return -1;
+}
+
+void uring_exit(Uring *ring) {
+    if (ring->fd < 0) return;
+    munmap(ring->sqes, ring->sqes_size);
+    if (!ring->single_mmap) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd); // 등록한 버퍼와 파일도 함께 해제됨
+    ring->fd = -1;
+}
+
+int uring_register_buffers(Uring *ring, const struct iovec *iov, unsigned count) {
+    if (sys_register(ring->fd, IORING_REGISTER_BUFFERS, iov, count) < 0) return -1;
+    ring->fixed_buffers = 1;
+    return 0;
+}
+
+int uring_register_file(Uring *ring, int fd) {
+    if (sys_register(ring->fd, IORING_REGISTER_FILES, &fd, 1) < 0) return -1;
+    ring->fixed_file = 1;
+    return 0;
+}
+
+int uring_write(Uring *ring, int fd, const void *buffer, unsigned length, off_t offset, int buf_index,
+                uint64_t user_data) {
+    unsigned tail = *ring->sq_tail;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head > *ring->sq_mask) {
+        errno = EBUSY; // 호출자가 진행 중인 요청 수를 entries 이하로 유지
+        return -1;
+    }
+
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = ring->fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = ring->fixed_file ? 0 : fd;
+    sqe->flags = ring->fixed_file ? IOSQE_FIXED_FILE : 0;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = length;
+    sqe->off = (uint64_t)offset;
+    sqe->buf_index = ring->fixed_buffers ? (uint16_t)buf_index : 0;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    // 커널은 io_uring_enter 안에서만 꼬리를 읽으므로(SQPOLL을 쓰지 않음) 먼저 올려 두고,
+    // 제출되지 않았으면 되돌려 요청이 링에 남지 않게 함 (호출자가 같은 버퍼를 pwrite로 다시 쓰므로)
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int submitted;
+    do {
+        submitted = sys_enter(ring->fd, 1, 0, 0);
+    } while (submitted < 0 && errno == EINTR);
+    if (submitted > 0) return 0;
+
+    int saved_errno = submitted < 0 ? errno : EAGAIN;
+    if (__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) != tail) {
+        return 0; // 오류가 났어도 커널이 가져갔으면 진행 중이며 완료가 옴
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+    errno = saved_errno;
+    return -1;
+}
+
+int uring_wait(Uring *ring, uint64_t *user_data, int *result) {
+    for (;;) {
+        unsigned head = *ring->cq_head;
+        if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            *user_data = cqe->user_data;
+            *result = cqe->res;
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            return 0;
+        }
+        if (sys_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) return -1;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// --- io_uring 최소 래퍼 (클라이언트 디스크 쓰기) ---
+// liburing 없이 시스템 콜(io_uring_setup/enter/register)과 mmap한 링으로 쓰기 요청만 다룹니다.
+// 한 스레드에서만 사용합니다. 커널이 io_uring을 지원하지 않거나 막혀 있으면 uring_init이 -1을 반환하므로
+// 호출자는 일반 pwrite로 대신합니다.
+
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    int single_mmap;            // 제출/완료 링을 한 번의 mmap으로 공유 (IORING_FEAT_SINGLE_MMAP)
+    int fixed_buffers;          // uring_register_buffers 성공
+    int fixed_file;             // uring_register_file 성공 (파일 색인 0)
+} Uring;
+
+// entries: 동시에 진행할 최대 요청 수. 실패 시 -1 (errno 유지)
+int uring_init(Uring *ring, unsigned entries);
+void uring_exit(Uring *ring);
+
+// 쓰기 버퍼와 파일을 커널에 미리 등록 (요청마다 페이지 고정과 fd 조회를 생략). 실패해도 등록 없이 동작합니다.
+int uring_register_buffers(Uring *ring, const struct iovec *iov, unsigned count);
+int uring_register_file(Uring *ring, int fd);
+
+// fd의 offset에 쓰기 요청을 넣고 바로 제출. buf_index는 등록한 버퍼 번호(등록하지 않았으면 무시)
+// 등록한 파일이 있으면 fd 대신 그 파일에 씁니다. 실패 시 -1이며, 이때 요청은 링에 남지 않으므로 버퍼를 바로 다시 써도 됩니다.
+// 0을 반환하면 커널이 요청을 가져갔으므로 완료를 반드시 uring_wait로 거둬야 합니다.
+int uring_write(Uring *ring, int fd, const void *buffer, unsigned length, off_t offset, int buf_index,
+                uint64_t user_data);
+// 완료 하나를 기다려 꺼냄. *result는 쓴 바이트 수 또는 -errno. 실패 시 -1
+int uring_wait(Uring *ring, uint64_t *user_data, int *result);
+
+#endif
@@ -0,0 +1,139 @@
+#include <string.h>
+#include "xxh64.h"
+
+#define PRIME1 11400714785074694791ULL
+#define PRIME2 14029467366897019727ULL
+#define PRIME3 1609587929392839161ULL
+#define PRIME4 9650029242287828579ULL
+#define PRIME5 2870177450012600261ULL
+
+static inline uint64_t rotl(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// 입력은 리틀 엔디언으로 읽습니다.
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    return rotl(acc, 31) * PRIME1;
+}
+
+static inline uint64_t merge_round(uint64_t hash, uint64_t acc) {
+    hash ^= round64(0, acc);
+    return hash * PRIME1 + PRIME4;
+}
+
+// 32바이트 묶음들을 네 누산기에 반영하고 처리한 끝을 반환
+static const unsigned char *consume(uint64_t *acc, const unsigned char *p, const unsigned char *limit) {
+    uint64_t v1 = acc[0], v2 = acc[1], v3 = acc[2], v4 = acc[3];
+    while (p + 32 <= limit) {
+        v1 = round64(v1, read64(p));
+        v2 = round64(v2, read64(p + 8));
+        v3 = round64(v3, read64(p + 16));
+        v4 = round64(v4, read64(p + 24));
+        p += 32;
+    }
+    acc[0] = v1;
+    acc[1] = v2;
+    acc[2] = v3;
+    acc[3] = v4;
+    return p;
+}
+
+void xxh64_init(Xxh64State *state, uint64_t seed) {
+    memset(state, 0, sizeof(*state));
+    state->seed = seed;
+    state->acc[0] = seed + PRIME1 + PRIME2;
+    state->acc[1] = seed + PRIME2;
+    state->acc[2] = seed;
+    state->acc[3] = seed - PRIME1;
+}
+
+void xxh64_update(Xxh64State *state, const void *data, size_t length) {
+    const unsigned char *p = data;
+    const unsigned char *end = p + length;
+
+    state->total_len += length;
+    if (state->buffered + length < 32) {
+        memcpy(state->buffer + state->buffered, p, length);
+        state->buffered += length;
+        return;
+    }
+    if (state->buffered > 0) {
+        size_t fill = 32 - state->buffered;
+        memcpy(state->buffer + state->buffered, p, fill);
+        consume(state->acc, state->buffer, state->buffer + 32);
+        p += fill;
+        state->buffered = 0;
+    }
+    p = consume(state->acc, p, end);
+    if (p < end) {
+        memcpy(state->buffer, p, end - p);
+        state->buffered = end - p;
+    }
+}
+
+uint64_t xxh64_digest(const Xxh64State *state) {
+    const unsigned char *p = state->buffer;
+    const unsigned char *end = p + state->buffered;
+    uint64_t hash;
+
+    if (state->total_len >= 32) {
+        const uint64_t *acc = state->acc;
+        hash = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+        hash = merge_round(hash, acc[0]);
+        hash = merge_round(hash, acc[1]);
+        hash = merge_round(hash, acc[2]);
+        hash = merge_round(hash, acc[3]);
+    } else {
+        hash = state->seed + PRIME5;
+    }
+    hash += state->total_len;
+
+    while (p + 8 <= end) {
+        hash ^= round64(0, read64(p));
+        hash = rotl(hash, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        hash ^= (uint64_t)read32(p) * PRIME1;
+        hash = rotl(hash, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        hash ^= *p * PRIME5;
+        hash = rotl(hash, 11) * PRIME1;
+        p++;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t xxh64(const void *data, size_t length, uint64_t seed) {
+    Xxh64State state;
+    xxh64_init(&state, seed);
+    xxh64_update(&state, data, length);
+    return xxh64_digest(&state);
+}
@@ -0,0 +1,25 @@
+#ifndef XXH64_H
+#define XXH64_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// --- XXH64 해시 (파일 전송 무결성 검사) ---
+// 데이터를 받는 대로 조금씩 넣을 수 있는 스트리밍 방식입니다. 결과는 공식 XXH64와 같습니다.
+// 암호학적 해시가 아니므로 손상(비트 오류, 잘린 쓰기) 검출용으로만 씁니다.
+
+typedef struct {
+    uint64_t total_len;
+    uint64_t acc[4];
+    unsigned char buffer[32];   // 아직 32바이트 묶음이 되지 않은 입력
+    size_t buffered;
+    uint64_t seed;
+} Xxh64State;
+
+void xxh64_init(Xxh64State *state, uint64_t seed);
+void xxh64_update(Xxh64State *state, const void *data, size_t length);
+uint64_t xxh64_digest(const Xxh64State *state);
+// 한 번에 계산
+uint64_t xxh64(const void *data, size_t length, uint64_t seed);
+
+#endif
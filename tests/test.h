@@ -0,0 +1,28 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// --- 단위 테스트 공용 (make test) ---
+// 테스트 파일마다 실행 파일 하나이며, 실패한 검사가 있으면 위치를 출력하고 1로 종료합니다.
+
+static int test_failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define TEST_DONE(name) do { \
+        if (test_failures) { \
+            fprintf(stderr, "%s: %d check(s) failed\n", name, test_failures); \
+            return 1; \
+        } \
+        printf("%s: ok\n", name); \
+        return 0; \
+    } while (0)
+
+#endif
@@ -0,0 +1,91 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include "test.h"
+#include "mpsc.h"
+
+// 다중 생산자 큐: 생산자마다 넣은 순서대로 꺼내지고, 빠지거나 겹치는 작업이 없음.
+// 넣으면 eventfd로 소비자를 깨움
+
+#define PRODUCERS 4
+#define ITEMS 200000
+
+typedef struct {
+    MpscNode node;
+    int producer;
+    int seq;
+} Item;
+
+static MpscQueue queue;
+static Item items[PRODUCERS][ITEMS];
+
+static void *produce(void *arg) {
+    int producer = (int)(intptr_t)arg;
+    for (int i = 0; i < ITEMS; i++) {
+        items[producer][i].producer = producer;
+        items[producer][i].seq = i;
+        mpsc_push(&queue, &items[producer][i].node);
+    }
+    return NULL;
+}
+
+static void test_single_thread(void) {
+    Item a, b;
+    struct pollfd pfd;
+
+    CHECK(mpsc_init(&queue) == 0);
+    CHECK(mpsc_pop(&queue) == NULL);
+    mpsc_push(&queue, &a.node);
+    mpsc_push(&queue, &b.node);
+    pfd.fd = queue.wake_fd;
+    pfd.events = POLLIN;
+    CHECK(poll(&pfd, 1, 0) == 1);      // 넣은 쪽이 깨움
+    mpsc_rearm(&queue);
+    CHECK(poll(&pfd, 1, 0) == 0);
+    CHECK(mpsc_pop(&queue) == &a.node);
+    CHECK(mpsc_pop(&queue) == &b.node); // 마지막 노드도 꺼냄 (stub을 다시 붙임)
+    CHECK(mpsc_pop(&queue) == NULL);
+    mpsc_push(&queue, &a.node);
+    CHECK(mpsc_pop(&queue) == &a.node);
+    close(queue.wake_fd);
+}
+
+static void test_producers(void) {
+    pthread_t threads[PRODUCERS];
+    int next[PRODUCERS] = { 0 };
+    long popped = 0;
+
+    CHECK(mpsc_init(&queue) == 0);
+    for (int i = 0; i < PRODUCERS; i++) {
+        pthread_create(&threads[i], NULL, produce, (void*)(intptr_t)i);
+    }
+    while (popped < (long)PRODUCERS * ITEMS) {
+        MpscNode *node = mpsc_pop(&queue);
+        if (!node) {
+            sched_yield(); // 비었거나 생산자가 연결하는 중
+            continue;
+        }
+        Item *item = (Item*)((char*)node - offsetof(Item, node));
+        if (item->seq != next[item->producer]) {
+            CHECK(item->seq == next[item->producer]);
+            break;
+        }
+        next[item->producer]++;
+        popped++;
+    }
+    for (int i = 0; i < PRODUCERS; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK(next[i] == ITEMS);
+    }
+    CHECK(mpsc_pop(&queue) == NULL);
+    close(queue.wake_fd);
+}
+
+int main(void) {
+    test_single_thread();
+    test_producers();
+    TEST_DONE("mpsc");
+}
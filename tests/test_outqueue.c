@@ -0,0 +1,125 @@
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "test.h"
+#include "outqueue.h"
+
+// 송신 큐: 링이 늘어나고 감겨도 순서 유지, outq_drop_oldest의 드롭 개수와 바이트 계산,
+// 일부만 보낸 head는 드롭하지 않아 받는 쪽의 프레임이 깨지지 않음
+
+static OutBuffer *make_buffer(size_t length, char fill) {
+    OutBuffer *buf = outbuf_new(length);
+    memset(buf->data, fill, length);
+    return buf;
+}
+
+// 큐에 넣고 호출자의 참조는 놓음 (브로드캐스트와 같은 사용법)
+static void push(OutQueue *q, size_t length, char fill) {
+    OutBuffer *buf = make_buffer(length, fill);
+    CHECK(outq_push(q, buf) == 0);
+    outbuf_release(buf);
+}
+
+static size_t drain(int fd, char *out, size_t out_size) {
+    size_t total = 0;
+    ssize_t n;
+    while (total < out_size && (n = read(fd, out + total, out_size - total)) > 0) total += (size_t)n;
+    return total;
+}
+
+static void test_drop_oldest(void) {
+    OutQueue q;
+    outq_init(&q);
+    for (int i = 0; i < 4; i++) push(&q, 100, (char)('a' + i));
+
+    CHECK(outq_drop_oldest(&q, 150) == 2);     // 150바이트를 확보하려면 100바이트 메시지 두 개
+    CHECK(q.count == 2 && q.bytes == 200);
+    CHECK(q.slots[q.first]->data[0] == 'c');      // 가장 오래된 것부터 버림
+    CHECK(outq_drop_oldest(&q, 0) == 0);
+    CHECK(outq_drop_oldest(&q, 1000) == 2);    // 있는 만큼만
+    CHECK(q.count == 0 && q.bytes == 0);
+    outq_clear(&q);
+
+    // 큐가 참조를 놓으면 호출자의 참조만 남음
+    OutBuffer *kept = make_buffer(10, 'k');
+    outq_init(&q);
+    CHECK(outq_push(&q, kept) == 0);
+    CHECK(atomic_load(&kept->refcount) == 2);
+    CHECK(outq_drop_oldest(&q, 1) == 1);
+    CHECK(atomic_load(&kept->refcount) == 1);
+    outbuf_release(kept);
+    outq_clear(&q);
+}
+
+static void test_wrap_and_order(void) {
+    int sv[2];
+    char received[4096];
+    OutQueue q;
+
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    outq_init(&q);
+
+    // 처음 링 크기를 넘겨 늘어나게 하고, 앞쪽을 버린 뒤 더 넣어 링이 감기게 함
+    for (int i = 0; i < 12; i++) push(&q, 20, (char)('A' + i));
+    CHECK(outq_drop_oldest(&q, 100) == 5);
+    for (int i = 12; i < 26; i++) push(&q, 20, (char)('A' + i));
+    CHECK(q.count == 21 && q.bytes == 21 * 20);
+
+    CHECK(outq_flush(&q, sv[0]) == 21 * 20);
+    CHECK(q.count == 0 && q.bytes == 0 && !q.blocked);
+    size_t n = drain(sv[1], received, sizeof(received));
+    CHECK(n == 21 * 20);
+    for (size_t i = 0; i < n; i++) {
+        if (received[i] != (char)('A' + 5 + i / 20)) {
+            CHECK(received[i] == (char)('A' + 5 + i / 20));
+            break;
+        }
+    }
+    outq_clear(&q);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+static void test_partial_head(void) {
+    int sv[2], sndbuf = 4096;
+    enum { SIZE = 64 * 1024, COUNT = 8 };
+    static char received[SIZE * COUNT];
+    OutQueue q;
+
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    outq_init(&q);
+    for (int i = 0; i < COUNT; i++) push(&q, SIZE, (char)('a' + i));
+
+    // 소켓 버퍼가 작아 첫 메시지의 일부만 나감
+    ssize_t sent = outq_flush(&q, sv[0]);
+    CHECK(sent > 0 && sent < SIZE && q.blocked && q.head_offset == (size_t)sent);
+
+    // 전부 버리라고 해도 일부 보낸 head는 남김
+    CHECK(outq_drop_oldest(&q, (size_t)-1) == COUNT - 1);
+    CHECK(q.count == 1 && q.bytes == SIZE - (size_t)sent);
+
+    size_t total = 0;
+    while (q.count > 0) {
+        total += drain(sv[1], received + total, sizeof(received) - total);
+        CHECK(outq_flush(&q, sv[0]) >= 0);
+    }
+    total += drain(sv[1], received + total, sizeof(received) - total);
+    CHECK(total == SIZE);  // 받는 쪽에는 첫 메시지가 온전히 하나
+    CHECK(received[0] == 'a' && received[SIZE - 1] == 'a');
+    outq_clear(&q);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+int main(void) {
+    test_drop_oldest();
+    test_wrap_and_order();
+    test_partial_head();
+    TEST_DONE("outqueue");
+}
@@ -0,0 +1,134 @@
+#include <string.h>
+#include "test.h"
+#include "protocol.h"
+
+// 프레임 디코더: 한 번에 여러 프레임(coalesced), 프레임이 여러 번에 나뉘어 온 경우(split),
+// 너무 큰 프레임과 핸들러의 중단, 옵션 필드 파싱
+
+#define MAX_FRAMES 8
+
+typedef struct {
+    int count;
+    uint8_t opcodes[MAX_FRAMES];
+    uint32_t lengths[MAX_FRAMES];
+    char payloads[MAX_FRAMES][FRAME_MAX_PAYLOAD];
+    int stop_after;         // 이만큼 받으면 -2를 반환 (0이면 끝까지)
+} Collector;
+
+static int collect(const Frame *frame, void *ctx) {
+    Collector *c = ctx;
+    if (c->count < MAX_FRAMES) {
+        c->opcodes[c->count] = frame->opcode;
+        c->lengths[c->count] = frame->length;
+        memcpy(c->payloads[c->count], frame->payload, frame->length);
+    }
+    c->count++;
+    return c->stop_after && c->count == c->stop_after ? -2 : 0;
+}
+
+// 테스트 입력: 짧은 프레임, 빈 프레임, 최대 크기 프레임
+static size_t build_stream(char *out, size_t out_size, char *big) {
+    size_t n = 0;
+    memset(big, 'z', FRAME_MAX_PAYLOAD);
+    n += frame_encode(out + n, out_size - n, OP_MSG, "alice: hi", 9);
+    n += frame_encode(out + n, out_size - n, OP_HISTORY, "", 0);
+    n += frame_encode(out + n, out_size - n, OP_TEXT, big, FRAME_MAX_PAYLOAD);
+    return n;
+}
+
+static void check_frames(const Collector *c, const char *big) {
+    CHECK(c->count == 3);
+    CHECK(c->opcodes[0] == OP_MSG && c->lengths[0] == 9 && memcmp(c->payloads[0], "alice: hi", 9) == 0);
+    CHECK(c->opcodes[1] == OP_HISTORY && c->lengths[1] == 0);
+    CHECK(c->opcodes[2] == OP_TEXT && c->lengths[2] == FRAME_MAX_PAYLOAD &&
+          memcmp(c->payloads[2], big, FRAME_MAX_PAYLOAD) == 0);
+}
+
+static void test_coalesced(void) {
+    static char stream[3 * (FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD)], big[FRAME_MAX_PAYLOAD];
+    static Collector c;
+    FrameDecoder dec;
+    size_t n = build_stream(stream, sizeof(stream), big);
+
+    memset(&c, 0, sizeof(c));
+    frame_decoder_init(&dec);
+    CHECK(frame_decoder_feed(&dec, stream, n, collect, &c) == 0);
+    check_frames(&c, big);
+    CHECK(dec.length == 0 && dec.data == NULL);  // 남은 조각이 없으면 버퍼를 갖지 않음
+    frame_decoder_free(&dec);
+}
+
+// 모든 위치에서 두 번으로 나눠 넣기, 그리고 한 바이트씩 넣기
+static void test_split(void) {
+    static char stream[3 * (FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD)], big[FRAME_MAX_PAYLOAD];
+    static Collector c;
+    FrameDecoder dec;
+    size_t n = build_stream(stream, sizeof(stream), big);
+
+    for (size_t cut = 1; cut < n; cut += (cut < 64 || cut > n - 64) ? 1 : 97) {
+        memset(&c, 0, sizeof(c));
+        frame_decoder_init(&dec);
+        CHECK(frame_decoder_feed(&dec, stream, cut, collect, &c) == 0);
+        CHECK(frame_decoder_feed(&dec, stream + cut, n - cut, collect, &c) == 0);
+        check_frames(&c, big);
+        CHECK(dec.length == 0);
+        frame_decoder_free(&dec);
+    }
+
+    memset(&c, 0, sizeof(c));
+    frame_decoder_init(&dec);
+    for (size_t i = 0; i < n; i++) {
+        CHECK(frame_decoder_feed(&dec, stream + i, 1, collect, &c) == 0);
+    }
+    check_frames(&c, big);
+    CHECK(dec.length == 0);
+    frame_decoder_free(&dec);
+}
+
+static void test_errors(void) {
+    static Collector c;
+    FrameDecoder dec;
+    char header[FRAME_HEADER_SIZE];
+    char stream[64];
+
+    // 너무 큰 프레임은 헤더가 나뉘어 와도 형식 오류
+    memset(&c, 0, sizeof(c));
+    frame_decoder_init(&dec);
+    frame_header_encode(header, OP_MSG, FRAME_MAX_PAYLOAD + 1);
+    CHECK(frame_decoder_feed(&dec, header, 2, collect, &c) == 0);
+    CHECK(frame_decoder_feed(&dec, header + 2, sizeof(header) - 2, collect, &c) == -1);
+    CHECK(c.count == 0);
+    frame_decoder_free(&dec);
+
+    // 핸들러가 음수를 반환하면 그 값을 돌려주고 멈춤
+    size_t n = frame_encode(stream, sizeof(stream), OP_MSG, "a", 1);
+    n += frame_encode(stream + n, sizeof(stream) - n, OP_MSG, "b", 1);
+    memset(&c, 0, sizeof(c));
+    c.stop_after = 1;
+    frame_decoder_init(&dec);
+    CHECK(frame_decoder_feed(&dec, stream, n, collect, &c) == -2);
+    CHECK(c.count == 1);
+    frame_decoder_free(&dec);
+
+    CHECK(frame_encode(stream, sizeof(stream), OP_MSG, stream, sizeof(stream)) == 0); // 공간 부족
+}
+
+static void test_options(void) {
+    char token[RELAY_TOKEN_LEN + 1];
+
+    CHECK(proto_option_long("streams=4,compress=deflate", "streams", 1) == 4);
+    CHECK(proto_option_long("compress=deflate", "streams", 1) == 1);
+    CHECK(proto_option_long("xstreams=9,streams=2", "streams", 1) == 2);  // 키 이름 일부는 맞지 않음
+    CHECK(proto_option_string("streams=4,relay=abcd", "relay", token, sizeof(token)) == 4);
+    CHECK(strcmp(token, "abcd") == 0);
+    CHECK(proto_option_string("relay=abcdef", "relay", token, 4) == -1);   // 버퍼보다 긴 값
+    CHECK(proto_option_string("streams=4", "relay", token, sizeof(token)) == -1);
+}
+
+int main(void) {
+    test_coalesced();
+    test_split();
+    test_errors();
+    test_options();
+    TEST_DONE("protocol");
+}